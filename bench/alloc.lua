@@ -0,0 +1,98 @@
+#!/usr/bin/env tarantool
+
+-- Compare parsing of rows with memory allocated by malloc and in
+-- per-batch arena. Xlog and snapshot are made by repeating rows of test
+-- files, every file is read several times with every allocator.
+--
+--     $ tarantool bench/alloc.lua [rows]
+
+local fio = require('fio')
+local clock = require('clock')
+
+local xlog = require('migrate.xlog')
+
+local ROWS = tonumber(arg[1]) or 1000000
+local RUNS = 3
+
+local sources = {
+    'test/insert_test/00000000000000000025.xlog',
+    'test/insert_test/00000000000000000032.snap'
+}
+
+local modes = {
+    {name = 'malloc', alloc = 'malloc'},
+    {name = 'arena', alloc = 'arena'},
+    {name = 'arena, hugepages', alloc = 'arena', hugepages = true}
+}
+
+local function read_file(name)
+    local f = fio.open(name, {'O_RDONLY'})
+    local data = f:read(f:stat().size)
+    f:close()
+    return data
+end
+
+local function read_all(name, cfg)
+    local rows = 0
+    for _, batch in xlog.open(name, cfg) do
+        rows = rows + #batch
+    end
+    return rows
+end
+
+-- file header (11 bytes) is followed by rows and eof marker (4 bytes)
+local function make_file(dir, src)
+    local data = read_file(src)
+    local body = data:sub(12, -5)
+    local count = read_all(src, {batch_count = 1000})
+    local name = fio.pathjoin(dir, fio.basename(src))
+    local f = fio.open(name, {'O_WRONLY', 'O_CREAT', 'O_TRUNC'},
+                       tonumber('644', 8))
+    f:write(data:sub(1, 11))
+    for _ = 1, math.ceil(ROWS / count) do
+        f:write(body)
+    end
+    f:write(data:sub(-4))
+    f:close()
+    return name
+end
+
+local function bench(name, io, prefetch, mode)
+    local best = math.huge
+    local rows
+    for _ = 1, RUNS do
+        collectgarbage('collect')
+        local start = clock.monotonic()
+        rows = read_all(name, {
+            batch_count = 500,
+            io = io,
+            prefetch = prefetch,
+            alloc = mode.alloc,
+            hugepages = mode.hugepages
+        })
+        best = math.min(best, clock.monotonic() - start)
+    end
+    return rows, best
+end
+
+local dir = fio.tempdir()
+for _, src in ipairs(sources) do
+    local name = make_file(dir, src)
+    for _, io in ipairs({'stdio', 'mmap'}) do
+        for _, prefetch in ipairs({false, true}) do
+            for _, mode in ipairs(modes) do
+                local rows, time = bench(name, io, prefetch, mode)
+                print(string.format("%s, %s%s, %-16s %9d rows %8.3f s " ..
+                                    "%8.2f Mrows/s",
+                                    fio.basename(name), io,
+                                    prefetch and ', prefetch' or '',
+                                    mode.name .. ':', rows, time,
+                                    rows / time / 1e6))
+            end
+        end
+    end
+    fio.unlink(name)
+end
+fio.rmdir(dir)
+
+os.exit(0)
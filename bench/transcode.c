@@ -0,0 +1,322 @@
+/*
+ * Compare conversion of 1.5 tuples to msgpack by transcode_size() and
+ * transcode_write() with the per-field path luatu_tuple_fields() used
+ * before them: tnt_iter over fields and mmpstream_encode_*() call for
+ * every field. Tuples are taken from snapshot rows and xlog requests of
+ * test files (fields are converted with schema of insert_test spaces),
+ * both paths must produce the same msgpack.
+ *
+ * Run it from the source directory, default files are test ones:
+ *
+ *     $ make -C build transcode_bench
+ *     $ build/bench/transcode_bench [runs] [file...]
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <msgpuck.h>
+
+#include <tarantool/tnt.h>
+#include <tarantool/tnt_log.h>
+#include <tarantool/tnt_snapshot.h>
+#include <tarantool/tnt_xlog.h>
+
+#include "migrate/xlog/mpstream.h"
+#include "migrate/xlog/transcode.h"
+#include "migrate/xlog/xlog.h"
+
+#define SPACES_MAX 3
+
+static const char *default_files[] = {
+	"test/insert_test/00000000000000000032.snap",
+	"test/insert_test/00000000000000000025.xlog",
+	"test/insert_test/00000000000000000050.xlog",
+	"test/insert_test/00000000000000000075.xlog",
+	"test/insert_test/00000000000000000100.xlog",
+	NULL
+};
+
+/* field types of insert_test spaces, the rest fields are STR */
+static uint8_t tuple_ops[SPACES_MAX][4] = {
+	{F_FLD_STR, F_FLD_NUM, F_FLD_NUM},
+	{F_FLD_NUM, F_FLD_STR, F_FLD_NUM, F_FLD_NUM},
+	{F_FLD_NUM, F_FLD_STR, F_FLD_NUM}
+};
+static uint8_t key_ops[SPACES_MAX][1] = {{F_FLD_STR}, {F_FLD_NUM}, {F_FLD_NUM}};
+static struct field_plan tuple_plans[SPACES_MAX] = {
+	{tuple_ops[0], 3, F_FLD_STR, F_LAYOUT_MIXED},
+	{tuple_ops[1], 4, F_FLD_STR, F_LAYOUT_MIXED},
+	{tuple_ops[2], 3, F_FLD_STR, F_LAYOUT_MIXED}
+};
+static struct field_plan key_plans[SPACES_MAX] = {
+	{key_ops[0], 1, F_FLD_STR, F_LAYOUT_STR},
+	{key_ops[1], 1, F_FLD_STR, F_LAYOUT_NUM},
+	{key_ops[2], 1, F_FLD_STR, F_LAYOUT_NUM}
+};
+
+struct sample {
+	struct tnt_tuple t;
+	const struct field_plan *plan;
+};
+
+static struct sample *samples;
+static size_t sample_count, sample_capacity;
+
+static void
+sample_add(struct tnt_tuple *t, uint32_t space, int is_key)
+{
+	if (sample_count == sample_capacity) {
+		sample_capacity = sample_capacity ? sample_capacity * 2 : 64;
+		samples = realloc(samples, sample_capacity * sizeof(*samples));
+		if (samples == NULL)
+			abort();
+	}
+	struct sample *s = &samples[sample_count++];
+	s->t = *t;
+	s->t.data = malloc(t->size);
+	if (s->t.data == NULL)
+		abort();
+	memcpy(s->t.data, t->data, t->size);
+	s->t.alloc = 0;
+	if (space >= SPACES_MAX)
+		s->plan = &field_plan_str;
+	else
+		s->plan = is_key ? &key_plans[space] : &tuple_plans[space];
+}
+
+static int
+load_snapshot(const char *file)
+{
+	struct tnt_stream s;
+	if (tnt_snapshot(&s) == NULL || tnt_snapshot_open(&s, file) == -1)
+		return -1;
+	struct tnt_iter i;
+	tnt_iter_storage(&i, &s);
+	while (tnt_next(&i)) {
+		struct tnt_log *l = &TNT_SSNAPSHOT_CAST(&s)->log;
+		sample_add(TNT_ISTORAGE_TUPLE(&i), l->current.row_snap.space,
+			   false);
+	}
+	tnt_iter_free(&i);
+	tnt_stream_free(&s);
+	return 0;
+}
+
+static int
+load_xlog(const char *file)
+{
+	struct tnt_stream s;
+	if (tnt_xlog(&s) == NULL || tnt_xlog_open(&s, file) == -1)
+		return -1;
+	struct tnt_iter i;
+	tnt_iter_request(&i, &s);
+	while (tnt_next(&i)) {
+		struct tnt_request *r = TNT_IREQUEST_PTR(&i);
+		switch (r->h.type) {
+		case TNT_OP_INSERT:
+			sample_add(&r->r.insert.t, r->r.insert.h.ns, false);
+			break;
+		case TNT_OP_DELETE:
+			sample_add(&r->r.del.t, r->r.del.h.ns, true);
+			break;
+		case TNT_OP_DELETE_1_3:
+			sample_add(&r->r.del_1_3.t, r->r.del_1_3.h.ns, true);
+			break;
+		case TNT_OP_UPDATE:
+			sample_add(&r->r.update.t, r->r.update.h.ns, true);
+			break;
+		}
+	}
+	tnt_iter_free(&i);
+	tnt_stream_free(&s);
+	return 0;
+}
+
+/* growing buffer, reset before every tuple as xlog_ibuf is */
+struct buf {
+	char *data;
+	size_t used;
+	size_t capacity;
+};
+
+static void *
+buf_reserve(struct buf *b, size_t size)
+{
+	if (b->data == NULL || b->used + size > b->capacity) {
+		size_t capacity = b->capacity ? b->capacity : 1024;
+		while (capacity < b->used + size)
+			capacity *= 2;
+		b->data = realloc(b->data, capacity);
+		if (b->data == NULL)
+			abort();
+		b->capacity = capacity;
+	}
+	return b->data + b->used;
+}
+
+static void *
+buf_reserve_cb(void *ctx, size_t *size)
+{
+	struct buf *b = ctx;
+	void *pos = buf_reserve(b, *size);
+	*size = b->capacity - b->used;
+	return pos;
+}
+
+static void *
+buf_alloc_cb(void *ctx, size_t size)
+{
+	struct buf *b = ctx;
+	void *pos = b->data + b->used;
+	b->used += size;
+	return pos;
+}
+
+static void
+error_cb(void *error_ctx, const char *err, size_t errlen)
+{
+	(void)error_ctx;
+	fprintf(stderr, "%.*s\n", (int)errlen, err);
+	abort();
+}
+
+/* the former luatu_tuple_fields() loop */
+static size_t
+convert_per_field(struct buf *b, struct tnt_tuple *t,
+		  const struct field_plan *plan)
+{
+	b->used = 0;
+	struct mpstream stream;
+	mmpstream_init(&stream, b, buf_reserve_cb, buf_alloc_cb, error_cb,
+		       NULL);
+	mmpstream_encode_array(&stream, t->cardinality);
+	struct tnt_iter ifl;
+	tnt_iter(&ifl, t);
+	while (tnt_next(&ifl)) {
+		int idx = TNT_IFIELD_IDX(&ifl);
+		char *data = TNT_IFIELD_DATA(&ifl);
+		uint32_t size = TNT_IFIELD_SIZE(&ifl);
+		enum field_t tp = plan->layout == F_LAYOUT_STR ? F_FLD_STR :
+				  field_plan_op(plan, idx);
+		if (tp == F_FLD_NUM && size == 4) {
+			uint32_t num;
+			memcpy(&num, data, sizeof(num));
+			mmpstream_encode_uint(&stream, num);
+		} else if (tp == F_FLD_NUM && size == 8) {
+			uint64_t num;
+			memcpy(&num, data, sizeof(num));
+			mmpstream_encode_uint(&stream, num);
+		} else {
+			if (tp == F_FLD_NUM)
+				error_cb(NULL, "bad NUM field", 13);
+			mmpstream_encode_str(&stream, data, size);
+		}
+	}
+	if (ifl.status == TNT_ITER_FAIL)
+		error_cb(NULL, "failed to parse tuple", 21);
+	tnt_iter_free(&ifl);
+	mmpstream_flush(&stream);
+	return b->used;
+}
+
+static size_t
+convert_transcode(struct buf *b, struct tnt_tuple *t,
+		  const struct field_plan *plan)
+{
+	b->used = 0;
+	const char *data = t->data + sizeof(uint32_t);
+	size_t size = t->size - sizeof(uint32_t);
+	struct transcode_error err;
+	ssize_t len = transcode_size(data, size, t->cardinality, plan, false,
+				     &err);
+	if (len < 0)
+		error_cb(NULL, "failed to convert tuple", 23);
+	char *pos = buf_reserve(b, len);
+	char *end = transcode_write(pos, data, size, t->cardinality, plan,
+				    false);
+	b->used = end - pos;
+	return b->used;
+}
+
+typedef size_t (*convert_f)(struct buf *, struct tnt_tuple *,
+			    const struct field_plan *);
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+run(convert_f convert, int runs, size_t *bytes)
+{
+	struct buf b = {NULL, 0, 0};
+	size_t total = 0;
+	double start = now();
+	for (int r = 0; r < runs; ++r) {
+		for (size_t i = 0; i < sample_count; ++i)
+			total += convert(&b, &samples[i].t, samples[i].plan);
+	}
+	double elapsed = now() - start;
+	free(b.data);
+	*bytes = total;
+	return elapsed;
+}
+
+int
+main(int argc, char **argv)
+{
+	int runs = argc > 1 ? atoi(argv[1]) : 20000;
+	const char **files = argc > 2 ? (const char **)argv + 2 :
+					default_files;
+	for (; *files != NULL; ++files) {
+		size_t len = strlen(*files);
+		bool snap = len > 5 && strcmp(*files + len - 5, ".snap") == 0;
+		if ((snap ? load_snapshot(*files) : load_xlog(*files)) != 0) {
+			fprintf(stderr, "can't read '%s'\n", *files);
+			return 1;
+		}
+	}
+	if (sample_count == 0 || runs <= 0) {
+		fprintf(stderr, "nothing to convert\n");
+		return 1;
+	}
+
+	struct buf a = {NULL, 0, 0}, b = {NULL, 0, 0};
+	for (size_t i = 0; i < sample_count; ++i) {
+		size_t len = convert_per_field(&a, &samples[i].t,
+					       samples[i].plan);
+		if (convert_transcode(&b, &samples[i].t,
+				      samples[i].plan) != len ||
+		    memcmp(a.data, b.data, len) != 0) {
+			fprintf(stderr, "msgpack of tuple %zu differs\n", i);
+			return 1;
+		}
+	}
+	free(a.data);
+	free(b.data);
+
+	printf("%zu tuples, %d runs\n", sample_count, runs);
+	struct {
+		const char *name;
+		convert_f convert;
+	} paths[] = {
+		{"tnt_iter + mpstream", convert_per_field},
+		{"transcode", convert_transcode}
+	};
+	for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); ++p) {
+		size_t bytes;
+		double elapsed = run(paths[p].convert, runs, &bytes);
+		double count = (double)sample_count * runs;
+		printf("%-20s %7.1f ns/tuple %8.1f MB/s\n", paths[p].name,
+		       elapsed * 1e9 / count, bytes / elapsed / 1e6);
+	}
+	return 0;
+}
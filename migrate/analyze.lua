@@ -0,0 +1,98 @@
+local log = require('log')
+local clock = require('clock')
+
+local xlog = require('migrate.xlog')
+local xdir = require('migrate.xdir')
+local utils = require('migrate.utils')
+local helper = require('migrate.utils.checktype')
+
+local error = utils.error
+local checkt_xc = helper.checkt_xc
+
+--[[
+Workload profile of 1.5 snapshot and xlogs, made before migration to
+choose batch sizes, spot hot keys and find fields declared as NUM that
+aren't 4 or 8 bytes long. Files are read in C by worker threads, rows
+are walked by headers and BER sizes without decoding (see
+migrate/xlog/analyze.h), box isn't needed.
+]]--
+
+-- spaces as for migrate.reader() to schema/ischema of xlog.open()
+local function spaces_convert(spaces)
+    if spaces == nil then
+        return nil
+    end
+    local rv = {}
+    for no, cfg in pairs(spaces) do
+        checkt_xc(cfg, 'table', 'space description')
+        checkt_xc(cfg.fields, 'table', 'fields')
+        local parts = cfg.index and cfg.index.parts or {1}
+        local ischema = {}
+        for _, part in ipairs(parts) do
+            table.insert(ischema, cfg.fields[part] or cfg.default)
+        end
+        rv[no] = {
+            schema = cfg.fields,
+            ischema = ischema,
+            default = cfg.default
+        }
+    end
+    return rv
+end
+
+--[[
+local result = migrate.analyze('xlog_snap_dir' or
+                               {xlog = 'xlog_dir', snap = 'snap_dir'}, {
+    spaces = {...}, -- as for migrate.reader() (fields, index.parts,
+                    -- default), optional
+    threads = (number), -- reading threads, 4 by default
+    top = (number), -- hot keys reported per space, 10 by default
+    verify = 'full'/'header'/'none' -- as for migrate.reader()
+})
+]]--
+local function analyze(dir, cfg)
+    cfg = cfg or {}
+    checkt_xc(cfg, 'table', 'config')
+    cfg.threads = cfg.threads or 4
+    checkt_xc(cfg.threads, 'number', 'threads')
+    cfg.top = cfg.top or 10
+    checkt_xc(cfg.top, 'number', 'top')
+    checkt_xc(cfg.spaces, {'table', 'nil'}, 'spaces')
+    local xlog_dir, snap_dir
+    if type(dir) == 'table' then
+        xlog_dir, snap_dir = dir.xlog, dir.snap
+        if not xlog_dir or not snap_dir then
+            error('"dir" must have "snap" and "xlog"')
+        end
+    elseif type(dir) == 'string' then
+        xlog_dir, snap_dir = dir, dir
+    else
+        error('"dir" must be table or string')
+    end
+
+    local _, files = xdir.xdir(snap_dir, xlog_dir)
+    local start = clock.monotonic()
+    local res = xlog.analyze(files, {
+        spaces = spaces_convert(cfg.spaces),
+        threads = cfg.threads,
+        top = cfg.top,
+        verify = cfg.verify
+    })
+    res.time = clock.monotonic() - start
+    local bytes = 0
+    for _, f in ipairs(res.files) do
+        bytes = bytes + f.bytes
+        if f.error ~= nil then
+            log.warn("%s", f.error)
+        end
+    end
+    res.bytes = bytes
+    res.throughput = res.time > 0 and bytes / res.time or 0
+    log.info("analyzed %d files, %d bytes in %.3f sec", #res.files, bytes,
+             res.time)
+    return res
+end
+
+return {
+    analyze = analyze
+}
@@ -0,0 +1,248 @@
+local msgpack = require('msgpack')
+
+--[[
+Coalescing of xlog rows before they are applied.
+
+Rows are pushed into a window and folded per (space, primary key):
+insert followed by updates becomes one insert, consecutive updates are
+merged into one (assignments of the same field collapse, arithmetic of
+the same field is summed), delete or insert override everything before
+them and updates after delete are dropped. drain() returns the folded
+rows in order of the last row of every key, so rows of different keys
+may be reordered, but every key sees its operations in order.
+
+Rows are folded only if the result is the same as of sequential apply:
+updates that touch primary key fields or fail on the inserted tuple are
+left as they are.
+]]--
+
+-- max number of update operations in 1.10 request
+local UPDATE_OPS_MAX = 4000
+-- numbers that are summed in Lua exactly
+local NUM_MAX = 2 ^ 53
+local BIT_MAX = 2 ^ 31
+
+local function totable(obj)
+    return type(obj) == 'table' and obj or obj:totable()
+end
+
+local function row_key(def, v)
+    if v.op == 'insert' then
+        local key = {}
+        for i, part in ipairs(def.parts) do
+            key[i] = v.tuple[part]
+        end
+        return msgpack.encode(key)
+    end
+    return msgpack.encode(totable(v.key))
+end
+
+-- operations that insert or delete fields move the fields after them
+local function op_shifts(op)
+    return op[1] == '!' or op[1] == '#'
+end
+
+-- Returns false if operations modify or move primary key fields
+local function ops_foldable(def, ops)
+    for _, op in ipairs(ops) do
+        local field = op[2]
+        if type(field) ~= 'number' or field < 1 or
+           (op_shifts(op) and field <= def.parts_max) or
+           def.part_fields[field] then
+            return false
+        end
+    end
+    return true
+end
+
+local function small_num(v, max)
+    return type(v) == 'number' and v >= 0 and v < max and v % 1 == 0
+end
+
+-- Fold operation 'b' into operation 'a' of the same field, returns nil
+-- if they can't be expressed by one operation
+local function op_fold(a, b)
+    if b[1] == '=' then
+        return b
+    end
+    local x, y = a[3], b[3]
+    if a[1] == '=' and b[1] == '+' and small_num(x, NUM_MAX) and
+       small_num(y, NUM_MAX) and x + y < NUM_MAX then
+        return {'=', a[2], x + y}
+    elseif a[1] == '+' and b[1] == '+' and small_num(x, NUM_MAX) and
+           small_num(y, NUM_MAX) and x + y < NUM_MAX then
+        return {'+', a[2], x + y}
+    elseif not small_num(x, BIT_MAX) or not small_num(y, BIT_MAX) then
+        return nil
+    elseif (a[1] == '&' or a[1] == '=') and b[1] == '&' then
+        return {a[1], a[2], bit.band(x, y)}
+    elseif (a[1] == '|' or a[1] == '=') and b[1] == '|' then
+        return {a[1], a[2], bit.bor(x, y)}
+    elseif (a[1] == '^' or a[1] == '=') and b[1] == '^' then
+        return {a[1], a[2], bit.bxor(x, y)}
+    end
+    return nil
+end
+
+-- Merge update operations 'b' after 'a', returns nil if too many
+local function ops_merge(a, b)
+    local ops, last = {}, {}
+    -- fields are addressed by number until some operation moves them
+    local shifted = false
+    local function add(op)
+        if shifted or op_shifts(op) then
+            shifted = true
+            table.insert(ops, op)
+            return
+        end
+        local pos = last[op[2]]
+        local folded = pos and op_fold(ops[pos], op)
+        if folded ~= nil then
+            ops[pos] = folded
+        else
+            table.insert(ops, op)
+            last[op[2]] = #ops
+        end
+    end
+    for _, op in ipairs(a) do add(op) end
+    for _, op in ipairs(b) do add(op) end
+    if #ops > UPDATE_OPS_MAX then
+        return nil
+    end
+    return ops
+end
+
+-- Fold row 'v' into row 'prev' of the same key, returns nil if they
+-- must be applied one by one
+local function row_fold(def, prev, v)
+    if v.op == 'insert' or v.op == 'delete' then
+        return v
+    end
+    -- update
+    if prev.op == 'delete' then
+        -- update of missing tuple does nothing
+        return prev
+    end
+    local ops = totable(v.ops)
+    if not ops_foldable(def, ops) then
+        return nil
+    end
+    if prev.op == 'insert' then
+        local is_table = type(prev.tuple) == 'table'
+        local tuple = is_table and box.tuple.new(prev.tuple) or prev.tuple
+        local ok, new = pcall(tuple.update, tuple, ops)
+        if not ok then
+            return nil
+        end
+        return {
+            op = 'insert',
+            space = v.space,
+            tuple = is_table and new:totable() or new,
+            flags = prev.flags,
+            lsn = v.lsn,
+            time = v.time
+        }
+    end
+    local prev_ops = totable(prev.ops)
+    if not ops_foldable(def, prev_ops) then
+        return nil
+    end
+    local merged = ops_merge(prev_ops, ops)
+    if merged == nil then
+        return nil
+    end
+    return {
+        op = 'update',
+        space = v.space,
+        key = prev.key,
+        ops = merged,
+        flags = v.flags,
+        lsn = v.lsn,
+        time = v.time
+    }
+end
+
+local window_mt = {
+    -- Add row to window
+    push = function (self, v)
+        self.count = self.count + 1
+        self.pushed = self.pushed + 1
+        local def = self.spaces[v.space]
+        local entry = nil
+        if def ~= nil then
+            local key = row_key(def, v)
+            entry = self.keys[key]
+            if entry == nil then
+                entry = {rows = {v}}
+                self.keys[key] = entry
+                table.insert(self.entries, entry)
+            else
+                local rows = entry.rows
+                local folded = row_fold(def, rows[#rows], v)
+                if folded ~= nil then
+                    rows[#rows] = folded
+                else
+                    table.insert(rows, v)
+                end
+            end
+        else
+            -- rows of spaces that aren't coalesced pass through
+            entry = {rows = {v}}
+            table.insert(self.entries, entry)
+        end
+        entry.pos = self.count
+    end,
+
+    -- Returns folded rows and empties the window
+    drain = function (self)
+        local entries = self.entries
+        table.sort(entries, function (a, b) return a.pos < b.pos end)
+        local rows = {}
+        for _, entry in ipairs(entries) do
+            for _, v in ipairs(entry.rows) do
+                table.insert(rows, v)
+            end
+        end
+        self.emitted = self.emitted + #rows
+        self.keys, self.entries, self.count = {}, {}, 0
+        return rows
+    end
+}
+
+--[[
+local window = coalesce.new({[space_no] = {parts = {1, ...}}, ...})
+window:push(row) -- row as returned by xlog reader, 'tuple' or 'table'
+window.count     -- number of rows pushed since last drain
+window:drain()   -- array of folded rows
+window.pushed, window.emitted -- totals
+Rows of spaces that are not in the table are not folded.
+]]--
+local function new(spaces)
+    local defs = {}
+    for no, def in pairs(spaces) do
+        local part_fields, parts_max = {}, 0
+        for _, part in ipairs(def.parts) do
+            part_fields[part] = true
+            parts_max = math.max(parts_max, part)
+        end
+        defs[no] = {
+            parts = def.parts,
+            part_fields = part_fields,
+            parts_max = parts_max
+        }
+    end
+    return setmetatable({
+        spaces = defs,
+        keys = {},
+        entries = {},
+        count = 0,
+        pushed = 0,
+        emitted = 0
+    }, {
+        __index = window_mt
+    })
+end
+
+return {
+    new = new
+}
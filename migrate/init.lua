@@ -1,5 +1,6 @@
 local fun = require('fun')
 local log = require('log')
+local clock = require('clock')
 local json = require('json')
 local yaml = require('yaml')
 local pickle = require('pickle')
@@ -21,6 +22,8 @@ local iter, enumerate = fun.iter, fun.enumerate
 
 local xlog = require('migrate.xlog')
 local xdir = require('migrate.xdir')
+local coalesce = require('migrate.coalesce')
+local throttle = require('migrate.throttle')
 local helper = require('migrate.utils.checktype')
 local lazy_func = require('migrate.utils').lazy_func
 local checkt_xc = helper.checkt_xc
@@ -82,6 +85,11 @@ local function convert_cfg(cfg)
         schema = cfg.fields,
         ischema = iter(cfg.index.parts):map(get_type):totable(),
 
+        space_id = sid.id,
+        index_id = iid.id,
+        parts = cfg.index.parts,
+        native = cfg.insert == nil and cfg.delete == nil and cfg.update == nil,
+
         insert = insert_cb,
         delete = delete_cb,
         update = update_cb
@@ -104,76 +112,584 @@ local function verify_space_definition(space_id, cfg)
     return cfg
 end
 
+local function reader_open(self, file, lsn, offset, follow)
+    local cfg = {
+        spaces = self.spaces,
+        convert = true,
+        throw = self.throw,
+        batch_count = self.throttle and self.throttle.batch_count or
+                      self.batch_count,
+        return_type = self.return_type,
+        io = self.io,
+        verify = self.verify,
+        verify_skipped = self.verify_skipped,
+        prefetch = self.prefetch,
+        alloc = self.alloc,
+        hugepages = self.hugepages,
+        offset = offset,
+        salvage = self.salvage
+    }
+    if xdir.file_ext(file) == 'snap' then
+        cfg.threads = self.threads
+    else
+        cfg.lsn_from = lsn + 1
+        cfg.lsn_index = self.lsn_index
+        if self.xlog_threads > 0 then
+            cfg.prefetch = true
+            cfg.budget = self.budget
+        end
+    end
+    if follow then
+        -- xlog that is being written is read in tx thread as it grows,
+        -- compressed one is already complete
+        cfg.follow = file:sub(-5) == '.xlog'
+        cfg.prefetch = false
+        return xlog.open(file, cfg)
+    end
+    if self.apply == 'native' then
+        return xlog.batches_open(file, cfg)
+    end
+    return xlog.open(file, cfg)
+end
+
+local function log_progress(processed, floor, what)
+    if math.floor(processed / 100000) > floor then
+        floor = math.floor(processed / 100000)
+        log.info("Processed %.1fM %s", floor/10, what)
+    end
+    return floor
+end
+
+local function basename(file)
+    return file:match('[^/]*$')
+end
+
+--[[
+Progress is kept in one tuple of cfg.progress space:
+{1, file, offset, lsn, rows, deferred}
+'file' (basename, '' between files) is applied up to 'offset' (see
+xlog.offset()), all rows up to 'lsn' are applied, 'rows' is the number
+of rows taken from files, 'deferred' are indexes dropped by
+defer_secondary while snapshot is loaded.
+]]--
+local function progress_save(self, file, offset, lsn, processed)
+    self.progress:replace({1, file and basename(file) or '', offset or 0, lsn,
+                           self.rows + (processed or 0), self.deferred})
+end
+
+-- Whether progress must be saved in transaction of the batch. Rows of
+-- snapshot are replaced, so applying them again after restart is
+-- harmless. Xlog rows aren't, and xlog batch that is committed without
+-- progress would be applied twice, so it's saved with every batch.
+local function progress_due(self, is_snap, batches)
+    return self.progress ~= nil and
+           (not is_snap or batches % self.progress_every == 0)
+end
+
+-- Let other fibers run after batch, transaction of which took
+-- 'tx_time' seconds, and adapt size of the next one. Returns offset
+-- of file after the batch.
+local function throttle_batch(self, iter, rows, offset, tx_time)
+    local new_offset = xlog.offset(iter)
+    self.throttle:batch(rows, math.max(new_offset - offset, 0), tx_time)
+    xlog.set_batch_count(iter, self.throttle.batch_count)
+    return new_offset
+end
+
+-- apply rows of file from C, without creating Lua objects
+local function resume_native(self, file, param, lsn)
+    local processed, floor, batches = 0, 0, 0
+    local is_snap = xdir.file_ext(file) == 'snap'
+    local before_commit = nil
+    if self.progress ~= nil then
+        before_commit = function (count, last)
+            batches = batches + 1
+            if progress_due(self, is_snap, batches) then
+                progress_save(self, file, xlog.offset(param),
+                              is_snap and lsn or math.max(lsn, last),
+                              processed + count)
+            end
+        end
+    end
+    local offset = xlog.offset(param)
+    while true do
+        local started = clock.monotonic()
+        local count, last = xlog.apply(param, self.plan, is_snap and 0 or lsn,
+                                       self.commit, self.throw, before_commit)
+        if count == nil then
+            break
+        end
+        if self.throttle ~= nil then
+            offset = throttle_batch(self, param, count, offset,
+                                    clock.monotonic() - started)
+        end
+        if not is_snap and last > lsn then
+            lsn = last
+        end
+        processed = processed + count
+        floor = log_progress(processed, floor, is_snap and 'tuples' or 'row')
+    end
+    if is_snap then
+        lsn = xdir.lsn_from_filename(file)
+    end
+    return processed, lsn
+end
+
+local function resume_snap(self, file, iter, lsn)
+    local processed, floor, batches = 0, 0, 0
+    local offset = xlog.offset(iter)
+    for _, rv in iter do
+        local started = clock.monotonic()
+        if self.commit then box.begin() end
+        for k, v in pairs(rv) do
+            self.spaces[v.space].insert(v.tuple, 0)
+        end
+        processed = processed + #rv
+        batches = batches + 1
+        if progress_due(self, true, batches) then
+            progress_save(self, file, xlog.offset(iter), lsn, processed)
+        end
+        if self.commit then box.commit() end
+        if self.throttle ~= nil then
+            offset = throttle_batch(self, iter, #rv, offset,
+                                    clock.monotonic() - started)
+        end
+        floor = log_progress(processed, floor, 'tuples')
+    end
+    return processed, xdir.lsn_from_filename(file)
+end
+
+local function apply_row(self, v)
+    if v.op == 'insert' then
+        self.spaces[v.space].insert(v.tuple, v.flags)
+    elseif v.op == 'delete' then
+        self.spaces[v.space].delete(v.key, v.flags)
+    elseif v.op == 'update' then
+        self.spaces[v.space].update(v.key, v.ops, v.flags)
+    end
+end
+
+local function resume_xlog(self, file, iter, lsn)
+    local processed, floor = 0, 0
+    local window = nil
+    if self.coalesce > 0 then
+        window = coalesce.new(self.coalesce_spaces)
+    end
+    local offset = xlog.offset(iter)
+    for _, rv in iter do
+        local started = clock.monotonic()
+        if self.commit then box.begin() end
+        for k, v in pairs(rv) do
+            -- prefetched file is opened before lsn is known
+            if v.lsn > lsn then
+                if window ~= nil then
+                    window:push(v)
+                else
+                    apply_row(self, v)
+                end
+                lsn = v.lsn
+                self.row_time = v.time
+            end
+        end
+        if window ~= nil and window.count >= self.coalesce then
+            for _, v in ipairs(window:drain()) do
+                apply_row(self, v)
+            end
+        end
+        processed = processed + #rv
+        -- rows in window aren't applied yet, they are read again
+        -- after restart from the position of the last drain
+        if progress_due(self, false) and
+           (window == nil or window.count == 0) then
+            progress_save(self, file, xlog.offset(iter), lsn, processed)
+        end
+        if self.commit then box.commit() end
+        if self.throttle ~= nil then
+            offset = throttle_batch(self, iter, #rv, offset,
+                                    clock.monotonic() - started)
+        end
+        floor = log_progress(processed, floor, 'row')
+    end
+    if window ~= nil then
+        if self.commit then box.begin() end
+        for _, v in ipairs(window:drain()) do
+            apply_row(self, v)
+        end
+        if progress_due(self, false) then
+            progress_save(self, file, xlog.offset(iter), lsn, processed)
+        end
+        if self.commit then box.commit() end
+        -- followed xlog is applied by many calls, as it grows
+        local say = self.following and log.verbose or log.info
+        say("Coalesced %d rows into %d operations", window.pushed,
+            window.emitted)
+    end
+    return processed, lsn
+end
+
+-- Options of _index that are accepted by create_index()
+local index_options = {
+    'unique', 'dimension', 'distance', 'bloom_fpr', 'page_size',
+    'range_size', 'run_count_per_level', 'run_size_ratio'
+}
+
+-- Definitions of secondary indexes of target spaces as
+-- {space_id, name, create_index() options}
+local function secondary_list(self)
+    local saved, seen = {}, {}
+    for _, def in pairs(self.spaces) do
+        if not seen[def.space_id] then
+            seen[def.space_id] = true
+            local space = box.space[def.space_id]
+            for _, t in box.space._index:pairs({def.space_id}) do
+                if t[2] ~= 0 then
+                    local index = space.index[t[3]]
+                    local opts = {id = t[2], type = index.type, parts = {}}
+                    for _, k in ipairs(index_options) do
+                        opts[k] = t[5][k]
+                    end
+                    for _, part in ipairs(index.parts) do
+                        table.insert(opts.parts, {
+                            part.fieldno, part.type,
+                            is_nullable = part.is_nullable,
+                            collation = part.collation
+                        })
+                    end
+                    table.insert(saved, {def.space_id, t[3], opts})
+                end
+            end
+        end
+    end
+    return saved
+end
+
+-- Drop indexes listed by secondary_list() that exist, to recreate them
+-- with secondary_restore()
+local function secondary_drop(saved)
+    for i = #saved, 1, -1 do
+        local space, name = box.space[saved[i][1]], saved[i][2]
+        if space.index[name] ~= nil then
+            log.info("dropping index '%s' of space '%s'", name, space.name)
+            space.index[name]:drop()
+        end
+    end
+end
+
+-- Recreate indexes dropped by secondary_drop(), all of them are tried
+-- even if some fail
+local function secondary_restore(saved)
+    local failed = nil
+    for _, def in ipairs(saved) do
+        local space, name, opts = box.space[def[1]], def[2], def[3]
+        log.info("building index '%s' of space '%s'", name, space.name)
+        local start = clock.monotonic()
+        local stat, err = pcall(space.create_index, space, name, opts)
+        if stat then
+            log.info("index '%s' of space '%s' is built in %.1f sec", name,
+                     space.name, clock.monotonic() - start)
+        else
+            log.error("Failed to build index '%s' of space '%s': %s", name,
+                      space.name, tostring(err))
+            log.error("Index definition was: %s", yaml.encode(opts))
+            failed = failed or err
+        end
+    end
+    if failed ~= nil then
+        error(2, "Failed to restore secondary indexes: %s", tostring(failed))
+    end
+end
+
+-- Remember regions of 'file' skipped by salvage
+local function damaged_collect(self, file, iter)
+    for _, d in ipairs(xlog.damaged(iter)) do
+        log.warn("'%s': damaged region [%d, %d) between lsn %d and %d " ..
+                 "is skipped", file, d.from, d.to, d.lsn_before,
+                 d.lsn_after)
+        table.insert(self.damaged, {file = file, from = d.from, to = d.to,
+                                    lsn_before = d.lsn_before,
+                                    lsn_after = d.lsn_after})
+    end
+end
+
+-- Report problems of lsn ranges of files found by catalog before any of
+-- them is applied
+local function lsn_check(self, issues)
+    if self.lsn_check == 'none' then
+        return
+    end
+    local fatal = nil
+    for _, v in ipairs(issues) do
+        local msg
+        if v.kind == 'gap' then
+            msg = string.format("rows with lsn [%d, %d] are missing in " ..
+                                "xlogs", v.from, v.to)
+        elseif v.kind == 'overlap' then
+            msg = string.format("'%s' repeats rows with lsn [%d, %d], " ..
+                                "they are skipped", v.file, v.from, v.to)
+        elseif v.kind == 'broken' then
+            msg = string.format("'%s' has no readable rows", v.file)
+        else
+            msg = string.format("'%s' has no end of file marker", v.file)
+        end
+        log.warn("%s", msg)
+        if v.kind ~= 'overlap' then
+            fatal = fatal or msg
+        end
+    end
+    if fatal ~= nil and self.lsn_check == 'error' then
+        error(0, "%s", fatal)
+    end
+end
+
+-- Xlog to follow after 'done' (the one that has row lsn + 1 if it's
+-- nil), nil if it isn't created yet, and problems of lsn ranges of
+-- files found by catalog
+local function follow_next(self, done)
+    local files, issues = self.catalog:after(self.lsn)
+    local done_lsn = done and xdir.lsn_from_filename(done) or -1
+    for _, file in ipairs(files) do
+        if xdir.lsn_from_filename(file) > done_lsn then
+            return file, issues
+        end
+    end
+    return nil, issues
+end
+
+-- Apply rows written to 'file' since the last call, returns number of
+-- rows read
+local function follow_apply(self, file, iter)
+    local stat, processed, lsn = xpcall_tb(resume_xlog, self, file, iter,
+                                           self.lsn)
+    if not stat then
+        error(0, "%s", tostring(processed))
+    end
+    self.lsn = lsn
+    self.rows = self.rows + processed
+    return processed
+end
+
 local reader_mt = {
     resume = function (self)
-        local files = nil
+        local files, issues = nil, nil
         if self.lsn == 0 then
-            _, files = xdir.xdir(self.snap_dir, self.xlog_dir)
+            _, files, issues = xdir.xdir(self.snap_dir, self.xlog_dir,
+                                         self.catalog)
         else
-            files = xdir.xdir_xlogs_after_lsn(self.xlog_dir, self.lsn)
+            files, issues = self.catalog:after(self.lsn)
         end
+        lsn_check(self, issues)
         local lsn = self.lsn
         local overall = 0
-        for _, file in pairs(files) do
-            local processed, floor = 0, 0
+        -- number of files decoded ahead of the one being applied
+        local ahead = self.prefetch and 1 or 0
+        if self.xlog_threads > 0 then
+            ahead = math.max(ahead, self.xlog_threads - 1)
+        end
+        local opened = {}
+        -- file that was being applied by the reader that saved progress
+        local restart = self.restart
+        self.restart = nil
+        if restart ~= nil and (#files == 0 or
+                               basename(files[1]) ~= restart.file) then
+            log.warn("file '%s' to restart isn't found, files are " ..
+                     "applied from the beginning", restart.file)
+            restart = nil
+        end
+        for i, file in ipairs(files) do
+            local is_snap = xdir.file_ext(file) == 'snap'
+            local offset = nil
+            if i == 1 and restart ~= nil then
+                offset = restart.offset
+                log.info("restarting '%s' from offset %d", file, offset)
+            end
+            local iter = opened[i] or reader_open(self, file, lsn, offset)
+            opened[i] = nil
+            -- start decoding of the next files while this one is
+            -- applied: they are opened before lsn is known, so rows that
+            -- are already applied are skipped by lsn when they are
+            -- applied, exactly as rows of overlapping files are
+            local lsn_ahead = is_snap and xdir.lsn_from_filename(file) or lsn
+            for j = i + 1, math.min(i + ahead, #files) do
+                opened[j] = opened[j] or reader_open(self, files[j],
+                                                     lsn_ahead)
+            end
             log.info("opening '%s'", file)
-            if file:sub(-4) == 'snap' then
-                for _, rv in xlog.open(file, {
-                        spaces = self.spaces,
-                        convert = true,
-                        throw = self.throw,
-                        batch_count = self.batch_count,
-                        return_type = self.return_type
-                }) do
-                    if self.commit then box.begin() end
-                    for k, v in pairs(rv) do
-                        self.spaces[v.space].insert(v.tuple, 0)
+            if not is_snap then
+                log.info("Starting from lsn " .. tostring(lsn + 1))
+            end
+            local resume_file = is_snap and resume_snap or resume_xlog
+            if self.apply == 'native' then
+                resume_file = resume_native
+            end
+            local deferred = nil
+            if is_snap and self.defer_secondary then
+                -- indexes dropped by reader that was interrupted
+                deferred = restart ~= nil and restart.deferred or
+                           secondary_list(self)
+                if self.progress ~= nil then
+                    -- definitions are saved before indexes are dropped
+                    self.deferred = deferred
+                    progress_save(self, file, offset, lsn)
+                end
+                secondary_drop(deferred)
+            end
+            local stat, processed, new_lsn = xpcall_tb(resume_file, self,
+                                                       file, iter, lsn)
+            if deferred ~= nil then
+                -- indexes are restored even if loading failed, error of
+                -- loading is raised then and restore failure is attached
+                if not stat then box.rollback() end
+                local restored, err = pcall(secondary_restore, deferred)
+                self.deferred = nil
+                if not restored and stat then
+                    error(0, "%s", tostring(err))
+                elseif not restored then
+                    processed = string.format("%s (%s)", tostring(processed),
+                                              tostring(err))
+                end
+            end
+            if not stat then
+                error(0, "%s", tostring(processed))
+            end
+            damaged_collect(self, file, iter)
+            lsn = new_lsn
+            overall = overall + processed
+            self.lsn = lsn
+            self.rows = self.rows + processed
+            if self.progress ~= nil then
+                progress_save(self, nil, 0, lsn)
+            end
+        end
+    return overall
+    end,
+
+    -- Catch up with resume() and apply rows appended to xlogs as they are
+    -- written, until stop() is called
+    follow = function (self, cfg)
+        cfg = cfg or {}
+        checkt_xc(cfg, 'table', 'config')
+        checkt_xc(cfg.poll_interval, {'number', 'nil'}, 'poll_interval')
+        local poll_interval = cfg.poll_interval or 1
+        self.following = true
+        local stat, rv = pcall(function ()
+            local overall = self:resume()
+            local watch = xlog.watch(self.xlog_dir)
+            -- xlog being followed and the last one that was finished
+            local file, iter, done = nil, nil, nil
+            -- directory is listed for the next xlog at most once in
+            -- poll_interval, while the current one doesn't grow
+            local idle, listed = false, 0
+            while self.following do
+                if iter == nil then
+                    local issues
+                    file, issues = follow_next(self, done)
+                    if file ~= nil and done ~= nil then
+                        -- xlog left without end of file marker is
+                        -- reported when it's left
+                        local found = {}
+                        for _, v in ipairs(issues) do
+                            if v.kind ~= 'incomplete' then
+                                table.insert(found, v)
+                            end
+                        end
+                        lsn_check(self, found)
                     end
-                    if self.commit then box.commit() end
-                    processed = processed + #rv
-                    if math.floor(processed / 100000) > floor then
-                        floor = math.floor(processed / 100000)
-                        log.info("Processed %.1fM tuples", floor/10)
+                    if file ~= nil then
+                        log.info("following '%s' from lsn %d", file,
+                                 tonumber(self.lsn) + 1)
+                        iter = reader_open(self, file, self.lsn, nil, true)
                     end
                 end
-                lsn = xdir.lsn_from_filename(file)
-            else
-                local floor = 0
-                log.info("Starting from lsn " .. tostring(lsn + 1))
-                for _, rv in xlog.open(file, {
-                        spaces = self.spaces,
-                        convert = true,
-                        throw = self.throw,
-                        batch_count = self.batch_count,
-                        return_type = self.return_type,
-                        lsn_from = lsn + 1
-                }) do
-                    if self.commit then box.begin() end
-                    for k, v in pairs(rv) do
-                        if v.op == 'insert' then
-                            self.spaces[v.space].insert(v.tuple, v.flags)
-                        elseif v.op == 'delete' then
-                            self.spaces[v.space].delete(v.key, v.flags)
-                        elseif v.op == 'update' then
-                            self.spaces[v.space].update(v.key, v.ops, v.flags)
-                        end
-                        lsn = v.lsn
+                local processed, finished = 0, false
+                if iter ~= nil then
+                    -- rows written to file before the next one was
+                    -- created are read by this call
+                    local newer = false
+                    if idle and clock.monotonic() - listed >= poll_interval then
+                        newer = follow_next(self, file) ~= nil
+                        listed = clock.monotonic()
                     end
-                    if self.commit then box.commit() end
-                    processed = processed + #rv
-                    if math.floor(processed / 100000) > floor then
-                        floor = math.floor(processed / 100000)
-                        log.info("Processed %.1fM row", floor/10)
+                    processed = follow_apply(self, file, iter)
+                    overall = overall + processed
+                    local complete = xlog.complete(iter)
+                    if complete or (newer and processed == 0) then
+                        if not complete then
+                            log.warn("'%s' has no end of file marker, " ..
+                                     "it's followed by the next xlog", file)
+                        end
+                        damaged_collect(self, file, iter)
+                        done, iter, finished = file, nil, true
+                        if self.progress ~= nil then
+                            progress_save(self, nil, 0, self.lsn)
+                        end
                     end
                 end
+                -- the next xlog may be there already
+                idle = processed == 0 and not finished
+                if idle and self.following then
+                    xlog.watch_wait(watch, poll_interval)
+                end
             end
-            overall = overall + processed
-            self.lsn = lsn
+            return overall
+        end)
+        self.following = false
+        if not stat then
+            error(0, "%s", tostring(rv))
         end
-    return overall
+        return rv
+    end,
+
+    -- Make follow() return, after the batch being applied
+    stop = function (self)
+        self.following = false
+    end,
+
+    -- How far applied rows are behind rows written to xlogs: 'lsn' - number
+    -- of lsns, 'seconds' - age of the last applied row (0 if all rows are
+    -- applied, nil if no xlog row was applied yet)
+    lag = function (self)
+        -- xlogs are scanned by resume() and follow(), only a reader that
+        -- didn't load anything scans them here
+        if self.catalog.lsn_last == nil then
+            self.catalog:after(self.lsn)
+        end
+        local lsn = tonumber(self.lsn)
+        local last = math.max(lsn, self.catalog.lsn_last)
+        local lag = {lsn = last - lsn, seconds = 0}
+        if lag.lsn > 0 then
+            lag.seconds = self.row_time and
+                          math.max(clock.time() - self.row_time, 0)
+        end
+        return lag
+    end,
+
+    -- Effective rate of loading, nil if it isn't throttled
+    rate = function (self)
+        return self.throttle and self.throttle:rate()
     end
 }
 
+-- Spaces, rows of which can be coalesced: reordering of rows of
+-- different keys mustn't break unique secondary indexes and custom
+-- callbacks must see every row
+local function coalesce_plan(space_def)
+    local spaces = {}
+    for k, v in pairs(space_def) do
+        local unique = false
+        for id, index in pairs(box.space[v.space_id].index) do
+            if type(id) == 'number' and id ~= v.index_id and index.unique then
+                unique = true
+            end
+        end
+        if v.native and not unique then
+            spaces[k] = {parts = v.parts}
+        else
+            log.info("rows of space %d are not coalesced", k)
+        end
+    end
+    return spaces
+end
+
 local function reader(cfg)
     checkt_xc(cfg, 'table', 'config')
     -- verify error flag
@@ -191,6 +707,106 @@ local function reader(cfg)
     -- check type of batch_count
     cfg.batch_count = cfg.batch_count or 500
     checkt_xc(cfg.batch_count, 'number', 'batch_count')
+    -- check io backend
+    cfg.io = cfg.io or 'stdio'
+    if cfg.io ~= 'stdio' and cfg.io ~= 'mmap' then
+        error(2, "Bad value of cfg.io. Expected 'stdio'/'mmap', got %s",
+              tostring(cfg.io))
+    end
+    -- check checksum verification level
+    cfg.verify = cfg.verify or 'full'
+    if cfg.verify ~= 'full' and cfg.verify ~= 'header' and
+       cfg.verify ~= 'none' then
+        error(2, "Bad value of cfg.verify. Expected 'full'/'header'/'none', " ..
+                 "got %s", tostring(cfg.verify))
+    end
+    -- check verification of skipped rows
+    if cfg.verify_skipped == nil then
+        cfg.verify_skipped = true
+    end
+    checkt_xc(cfg.verify_skipped, 'boolean', 'verify_skipped')
+    -- check salvage flag
+    cfg.salvage = cfg.salvage or false
+    checkt_xc(cfg.salvage, 'boolean', 'salvage')
+    -- check allocator of rows being parsed
+    cfg.alloc = cfg.alloc or 'malloc'
+    if cfg.alloc ~= 'malloc' and cfg.alloc ~= 'arena' then
+        error(2, "Bad value of cfg.alloc. Expected 'malloc'/'arena', got %s",
+              tostring(cfg.alloc))
+    end
+    cfg.hugepages = cfg.hugepages or false
+    checkt_xc(cfg.hugepages, 'boolean', 'hugepages')
+    -- check background decoding flag
+    cfg.prefetch = cfg.prefetch or false
+    checkt_xc(cfg.prefetch, 'boolean', 'prefetch')
+    -- check number of snapshot decoding threads
+    cfg.threads = cfg.threads or 0
+    checkt_xc(cfg.threads, 'number', 'threads')
+    if cfg.threads < 0 then
+        error(2, "Bad value of cfg.threads. Expected non-negative number, " ..
+                 "got %s", tostring(cfg.threads))
+    end
+    -- check number of xlogs decoded at once and their memory budget
+    cfg.xlog_threads = cfg.xlog_threads or 0
+    checkt_xc(cfg.xlog_threads, 'number', 'xlog_threads')
+    if cfg.xlog_threads < 0 then
+        error(2, "Bad value of cfg.xlog_threads. Expected non-negative " ..
+                 "number, got %s", tostring(cfg.xlog_threads))
+    end
+    cfg.xlog_memory = cfg.xlog_memory or 64 * 1024 * 1024
+    checkt_xc(cfg.xlog_memory, 'number', 'xlog_memory')
+    if cfg.xlog_memory < 0 then
+        error(2, "Bad value of cfg.xlog_memory. Expected non-negative " ..
+                 "number, got %s", tostring(cfg.xlog_memory))
+    end
+    -- check how applied xlog rows are skipped
+    cfg.lsn_index = cfg.lsn_index or 'scan'
+    if cfg.lsn_index ~= 'none' and cfg.lsn_index ~= 'scan' and
+       cfg.lsn_index ~= 'file' then
+        error(2, "Bad value of cfg.lsn_index. Expected 'none'/'scan'/'file', " ..
+                 "got %s", tostring(cfg.lsn_index))
+    end
+    -- check coalescing window
+    cfg.coalesce = cfg.coalesce or 0
+    checkt_xc(cfg.coalesce, 'number', 'coalesce')
+    if cfg.coalesce < 0 then
+        error(2, "Bad value of cfg.coalesce. Expected non-negative number, " ..
+                 "got %s", tostring(cfg.coalesce))
+    end
+    -- check progress space and how often snapshot progress is saved
+    checkt_xc(cfg.progress, {'string', 'nil'}, 'progress')
+    cfg.progress_every = cfg.progress_every or 1
+    checkt_xc(cfg.progress_every, 'number', 'progress_every')
+    if cfg.progress_every < 1 then
+        error(2, "Bad value of cfg.progress_every. Expected positive " ..
+                 "number, got %s", tostring(cfg.progress_every))
+    end
+    -- check scheduling of batches beside live traffic
+    for _, name in ipairs({'max_tx_time_ms', 'max_rows_per_sec',
+                           'max_mb_per_sec'}) do
+        checkt_xc(cfg[name], {'number', 'nil'}, name)
+        if cfg[name] ~= nil and cfg[name] <= 0 then
+            error(2, "Bad value of cfg.%s. Expected positive number, " ..
+                     "got %s", name, tostring(cfg[name]))
+        end
+    end
+    -- check deferred secondary index build flag
+    cfg.defer_secondary = cfg.defer_secondary or false
+    checkt_xc(cfg.defer_secondary, 'boolean', 'defer_secondary')
+    -- check catalog file and what is done on lsn gaps between files
+    checkt_xc(cfg.catalog, {'string', 'nil'}, 'catalog')
+    cfg.lsn_check = cfg.lsn_check or 'warn'
+    if cfg.lsn_check ~= 'warn' and cfg.lsn_check ~= 'error' and
+       cfg.lsn_check ~= 'none' then
+        error(2, "Bad value of cfg.lsn_check. Expected 'warn'/'error'/" ..
+                 "'none', got %s", tostring(cfg.lsn_check))
+    end
+    -- check apply mode
+    cfg.apply = cfg.apply or 'lua'
+    if cfg.apply ~= 'lua' and cfg.apply ~= 'native' then
+        error(2, "Bad value of cfg.apply. Expected 'lua'/'native', got %s",
+              tostring(cfg.apply))
+    end
     -- verifying directory configuration
     local xlog_dir, snap_dir = nil, nil
     if type(cfg.dir) == 'table' then
@@ -209,6 +825,43 @@ local function reader(cfg)
     for k, v in pairs(cfg.spaces) do
         space_def[k] = verify_space_definition(k, v)
     end
+    local plan = nil
+    if cfg.apply == 'native' then
+        local targets = {}
+        for k, v in pairs(space_def) do
+            if not v.native then
+                error(2, "Space %d has custom insert/delete/update callback, " ..
+                         "it can't be used with cfg.apply = 'native'", k)
+            end
+            targets[k] = {v.space_id, v.index_id}
+        end
+        plan = xlog.apply_plan(targets)
+    end
+    local coalesce_spaces = nil
+    if cfg.coalesce > 0 then
+        if cfg.apply == 'native' then
+            error(2, "cfg.coalesce can't be used with cfg.apply = 'native'")
+        end
+        coalesce_spaces = coalesce_plan(space_def)
+    end
+    local throttled = nil
+    if cfg.max_tx_time_ms ~= nil or cfg.max_rows_per_sec ~= nil or
+       cfg.max_mb_per_sec ~= nil then
+        throttled = throttle.new({
+            batch_count = cfg.batch_count,
+            max_tx_time = cfg.max_tx_time_ms and cfg.max_tx_time_ms / 1000,
+            max_rows_per_sec = cfg.max_rows_per_sec,
+            max_bytes_per_sec = cfg.max_mb_per_sec and
+                                cfg.max_mb_per_sec * 1024 * 1024
+        })
+    end
+    local progress = nil
+    if cfg.progress ~= nil then
+        progress = box.schema.create_space(cfg.progress,
+                                           {if_not_exists = true})
+        progress:create_index('primary', {parts = {1, 'unsigned'},
+                                          if_not_exists = true})
+    end
 
     -- start work
     local self = setmetatable({
@@ -218,14 +871,55 @@ local function reader(cfg)
         commit = cfg.commit,
         return_type = cfg.return_type,
         batch_count = cfg.batch_count,
+        io = cfg.io,
+        verify = cfg.verify,
+        verify_skipped = cfg.verify_skipped,
+        salvage = cfg.salvage,
+        damaged = {},
+        alloc = cfg.alloc,
+        hugepages = cfg.hugepages,
+        threads = cfg.threads,
+        prefetch = cfg.prefetch,
+        xlog_threads = cfg.xlog_threads,
+        budget = cfg.xlog_threads > 0 and
+                 xlog.decoder_budget(cfg.xlog_memory) or nil,
+        apply = cfg.apply,
+        defer_secondary = cfg.defer_secondary,
+        coalesce = cfg.coalesce,
+        coalesce_spaces = coalesce_spaces,
+        lsn_index = cfg.lsn_index,
+        progress = progress,
+        progress_every = cfg.progress_every,
+        throttle = throttled,
+        rows = 0,
+        following = false,
+        plan = plan,
         xlog_dir = xlog_dir,
-        snap_dir = snap_dir
+        snap_dir = snap_dir,
+        catalog = xdir.catalog(xlog_dir, cfg.catalog),
+        lsn_check = cfg.lsn_check
     }, {
         __index = reader_mt
     })
+    -- continue after reader that saved progress
+    local saved = progress and progress:get(1)
+    if saved ~= nil then
+        self.lsn, self.rows = saved[4], saved[5]
+        if saved[2] ~= '' then
+            self.restart = {
+                file = saved[2],
+                offset = saved[3],
+                deferred = saved[6]
+            }
+        end
+        log.info("restarting after lsn %d, %d rows were applied",
+                 self.lsn, self.rows)
+    end
     return self
 end
 
 return {
-    reader = reader
+    reader = reader,
+    verify = require('migrate.verify').verify,
+    analyze = require('migrate.analyze').analyze
 }
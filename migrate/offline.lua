@@ -0,0 +1,765 @@
+local fio = require('fio')
+local log = require('log')
+local ffi = require('ffi')
+local errno = require('errno')
+local digest = require('digest')
+local pickle = require('pickle')
+local msgpack = require('msgpack')
+-- reader of 1.10 xlogs/snapshots that is built into tarantool
+local xlog110 = require('xlog')
+
+local xlog = require('migrate.xlog')
+local xdir = require('migrate.xdir')
+local utils = require('migrate.utils')
+local helper = require('migrate.utils.checktype')
+
+local error = utils.error
+local checkt_xc = helper.checkt_xc
+local checkt_table_xc = helper.checkt_table_xc
+
+--[[
+Offline conversion of 1.5 snapshot and xlogs into 1.10 snapshot.
+
+Rows are applied to state that is kept per target space by primary key
+instead of box spaces. When the state grows over 'memory' bytes it's
+sorted and spilled to disk as a run, runs are merged at the end (newer
+records of the same key override or update older ones). Resulting
+snapshot has all rows of 'base' snapshot (schema made by 1.10 instance
+with empty target spaces) followed by the converted tuples.
+]]--
+
+-- state entries: tuple (msgpack string), tombstone and list of update
+-- operation lists for tuple that was spilled before
+local REC_TUPLE = 'T'
+local REC_DELETE = 'D'
+local REC_UPDATE = 'U'
+
+-- estimated memory overhead of one entry of state
+local ENTRY_OVERHEAD = 64
+
+local RUN_BUFFER = 1024 * 1024
+
+-- 1.10 xlog format, see src/box/xlog.c and src/box/iproto_constants.h
+local ROW_MARKER = '\xd5\xba\x0b\xab'
+local EOF_MARKER = '\xd5\x10\xad\xed'
+local FIXHEADER_SIZE = 19
+local TX_AUTOCOMMIT = 128 * 1024
+local IPROTO_INSERT = 2
+-- ids of _space and _index
+local SPACE_SPACE_ID = 280
+local INDEX_SPACE_ID = 288
+
+local UINT32_MOD = 4294967296
+
+pcall(ffi.cdef, 'int getpid(void);')
+
+local function key_encode(def, tuple)
+    local key = {}
+    for i, part in ipairs(def.parts) do
+        key[i] = tuple[part]
+    end
+    return def.prefix .. msgpack.encode(key)
+end
+
+local function update_error(op, fmt, ...)
+    error(0, "Failed to apply update operation '%s' to field %s: " .. fmt,
+          tostring(op[1]), tostring(op[2]), ...)
+end
+
+local function op_arith(op, a, b)
+    if type(a) ~= 'number' and type(a) ~= 'cdata' then
+        update_error(op, "field is not a number")
+    end
+    -- 8 byte arguments are cdata, arithmetic wraps as in 1.5
+    if type(a) == 'cdata' or type(b) == 'cdata' then
+        a, b = ffi.cast('uint64_t', a), ffi.cast('uint64_t', b)
+        if op[1] == '+' then return a + b end
+        if op[1] == '&' then return bit.band(a, b) end
+        if op[1] == '^' then return bit.bxor(a, b) end
+        return bit.bor(a, b)
+    end
+    local r
+    if op[1] == '+' then
+        r = a + b
+    elseif op[1] == '&' then
+        r = bit.band(a, b)
+    elseif op[1] == '^' then
+        r = bit.bxor(a, b)
+    else
+        r = bit.bor(a, b)
+    end
+    return r % UINT32_MOD
+end
+
+-- 1.10 splice rules: 1-based offset, negative offset and length count
+-- from the end
+local function op_splice(op, str)
+    if type(str) ~= 'string' then
+        update_error(op, "field is not a string")
+    end
+    local offset, cut, paste = op[3], op[4], op[5]
+    local len = #str
+    if offset < 0 then
+        if -offset > len + 1 then
+            update_error(op, "offset is out of bound")
+        end
+        offset = offset + len + 1
+    elseif offset > 0 then
+        offset = math.min(offset - 1, len)
+    else
+        update_error(op, "offset is out of bound")
+    end
+    if cut < 0 then
+        cut = -cut > len - offset and 0 or cut + len - offset
+    elseif cut > len - offset then
+        cut = len - offset
+    end
+    return str:sub(1, offset) .. paste .. str:sub(offset + cut + 1)
+end
+
+-- Apply 1.10 update operations (as returned by reader) to tuple table
+local function tuple_update(tuple, ops)
+    for _, op in ipairs(ops) do
+        local field = op[2]
+        if field < 1 or field > #tuple + 1 or
+           (field > #tuple and op[1] ~= '=' and op[1] ~= '!') then
+            update_error(op, "field is out of range (tuple has %d fields)",
+                         #tuple)
+        end
+        if op[1] == '=' then
+            tuple[field] = op[3]
+        elseif op[1] == '!' then
+            table.insert(tuple, field, op[3])
+        elseif op[1] == '#' then
+            for _ = 1, math.min(op[3], #tuple - field + 1) do
+                table.remove(tuple, field)
+            end
+        elseif op[1] == ':' then
+            tuple[field] = op_splice(op, tuple[field])
+        else
+            tuple[field] = op_arith(op, tuple[field], op[3])
+        end
+    end
+end
+
+--
+-- Runs of spilled state
+--
+
+local function file_error(what, path)
+    error(0, "Failed to %s '%s': %s", what, path, errno.strerror())
+end
+
+local function file_open_write(path)
+    local f = fio.open(path, {'O_WRONLY', 'O_CREAT', 'O_TRUNC'},
+                       tonumber('644', 8))
+    if f == nil then
+        file_error('create', path)
+    end
+    return {f = f, path = path, buf = {}, size = 0}
+end
+
+local function file_write(w, data)
+    table.insert(w.buf, data)
+    w.size = w.size + #data
+    if w.size >= RUN_BUFFER then
+        if not w.f:write(table.concat(w.buf)) then
+            file_error('write', w.path)
+        end
+        w.buf, w.size = {}, 0
+    end
+end
+
+local function file_close(w, sync)
+    if w.size > 0 and not w.f:write(table.concat(w.buf)) then
+        file_error('write', w.path)
+    end
+    w.buf, w.size = {}, 0
+    if sync and not w.f:fsync() then
+        file_error('sync', w.path)
+    end
+    w.f:close()
+end
+
+-- every record of run is [key, kind, payload], prefixed with its length
+local function run_write(path, state)
+    local keys = {}
+    for k in pairs(state) do
+        table.insert(keys, k)
+    end
+    table.sort(keys)
+    local w = file_open_write(path)
+    for _, k in ipairs(keys) do
+        local e = state[k]
+        local rec
+        if type(e) == 'string' then
+            rec = msgpack.encode({k, REC_TUPLE, e})
+        elseif e == false then
+            rec = msgpack.encode({k, REC_DELETE})
+        else
+            rec = msgpack.encode({k, REC_UPDATE, e})
+        end
+        file_write(w, pickle.pack('N', #rec) .. rec)
+    end
+    file_close(w, false)
+    return #keys
+end
+
+local function run_open(path)
+    local f = fio.open(path, {'O_RDONLY'})
+    if f == nil then
+        file_error('open', path)
+    end
+    return {f = f, path = path, buf = '', pos = 1}
+end
+
+-- make sure that 'size' bytes are buffered, returns false at eof
+local function run_fill(r, size)
+    while #r.buf - r.pos + 1 < size do
+        local data = r.f:read(math.max(RUN_BUFFER, size))
+        if data == nil then
+            file_error('read', r.path)
+        end
+        if #data == 0 then
+            return false
+        end
+        r.buf = r.buf:sub(r.pos) .. data
+        r.pos = 1
+    end
+    return true
+end
+
+local function run_next(r)
+    if not run_fill(r, 4) then
+        return nil
+    end
+    local len = pickle.unpack('N', r.buf:sub(r.pos, r.pos + 3))
+    if not run_fill(r, 4 + len) then
+        error(0, "Run '%s' is truncated", r.path)
+    end
+    local rec = msgpack.decode(r.buf, r.pos + 4)
+    r.pos = r.pos + 4 + len
+    return rec
+end
+
+local function run_close(r)
+    r.f:close()
+end
+
+-- binary heap of run heads ordered by key and run number
+local function heap_less(a, b)
+    if a.rec[1] ~= b.rec[1] then
+        return a.rec[1] < b.rec[1]
+    end
+    return a.no < b.no
+end
+
+local function heap_push(heap, item)
+    table.insert(heap, item)
+    local i = #heap
+    while i > 1 do
+        local p = math.floor(i / 2)
+        if not heap_less(heap[i], heap[p]) then
+            break
+        end
+        heap[i], heap[p] = heap[p], heap[i]
+        i = p
+    end
+end
+
+local function heap_pop(heap)
+    local top = heap[1]
+    heap[1] = heap[#heap]
+    heap[#heap] = nil
+    local i, n = 1, #heap
+    while true do
+        local l, r, m = 2 * i, 2 * i + 1, i
+        if l <= n and heap_less(heap[l], heap[m]) then m = l end
+        if r <= n and heap_less(heap[r], heap[m]) then m = r end
+        if m == i then
+            break
+        end
+        heap[i], heap[m] = heap[m], heap[i]
+        i = m
+    end
+    return top
+end
+
+--
+-- 1.10 snapshot writer
+--
+
+local function snap_writer_open(path, meta)
+    local w = file_open_write(path)
+    file_write(w, meta)
+    return {file = w, rows = {}, size = 0, lsn = 0}
+end
+
+local function snap_writer_flush(s)
+    if #s.rows == 0 then
+        return
+    end
+    local data = table.concat(s.rows)
+    local fix = ROW_MARKER .. msgpack.encode(#data) .. msgpack.encode(0) ..
+                msgpack.encode(digest.crc32_update(0, data))
+    local padding = FIXHEADER_SIZE - #fix
+    -- padding is msgpack string, so that header can be decoded as is
+    fix = fix .. string.char(0xa0 + padding - 1) ..
+          string.rep('\0', padding - 1)
+    file_write(s.file, fix)
+    file_write(s.file, data)
+    s.rows, s.size = {}, 0
+end
+
+-- rows of snapshot are numbered from 1, as 1.10 does
+local function snap_writer_insert(s, space_id, tuple)
+    s.lsn = s.lsn + 1
+    local row = '\x82\x00' .. msgpack.encode(IPROTO_INSERT) ..
+                '\x03' .. msgpack.encode(s.lsn) ..
+                '\x82\x10' .. msgpack.encode(space_id) .. '\x21' .. tuple
+    table.insert(s.rows, row)
+    s.size = s.size + #row
+    if s.size >= TX_AUTOCOMMIT then
+        snap_writer_flush(s)
+    end
+end
+
+local function snap_writer_close(s)
+    snap_writer_flush(s)
+    file_write(s.file, EOF_MARKER)
+    file_close(s.file, true)
+end
+
+--
+-- Base snapshot
+--
+
+-- Returns text header of 1.10 snapshot and its vclock
+local function base_meta(path)
+    local f = fio.open(path, {'O_RDONLY'})
+    if f == nil then
+        file_error('open', path)
+    end
+    local data = f:read(64 * 1024)
+    f:close()
+    local stop = data and data:find('\n\n', 1, true)
+    if stop == nil or data:sub(1, 5) ~= 'SNAP\n' then
+        error(0, "'%s' is not a 1.10 snapshot", path)
+    end
+    local meta = data:sub(1, stop + 1)
+    local vclock = {}
+    local text = meta:match('\nVClock: ({[^\n]*})\n')
+    if text == nil then
+        error(0, "Snapshot '%s' has no vclock", path)
+    end
+    for id, lsn in text:gmatch('(%d+):%s*(%d+)') do
+        vclock[tonumber(id)] = tonumber64(lsn)
+    end
+    return meta, vclock
+end
+
+local function vclock_format(vclock)
+    local ids = {}
+    for id in pairs(vclock) do
+        table.insert(ids, id)
+    end
+    table.sort(ids)
+    local parts, sum = {}, 0
+    for _, id in ipairs(ids) do
+        local lsn = tostring(vclock[id]):gsub('[UL]+$', '')
+        table.insert(parts, string.format('%d: %s', id, lsn))
+        sum = sum + vclock[id]
+    end
+    return '{' .. table.concat(parts, ', ') .. '}', sum
+end
+
+-- Reads rows of base snapshot and resolves names of target spaces and
+-- their primary indexes
+local function base_load(path)
+    local rows, spaces, indexes = {}, {}, {}
+    for _, row in xlog110.pairs(path) do
+        local hdr, body = row.HEADER, row.BODY
+        if hdr.type ~= 'INSERT' then
+            error(0, "Unexpected row of type '%s' in snapshot '%s'",
+                  tostring(hdr.type), path)
+        end
+        local t = body.tuple
+        table.insert(rows, {body.space_id, msgpack.encode(t)})
+        if body.space_id == SPACE_SPACE_ID then
+            spaces[t[1]] = t[3]
+            spaces[t[3]] = t[1]
+        elseif body.space_id == INDEX_SPACE_ID then
+            indexes[t[1]] = indexes[t[1]] or {}
+            indexes[t[1]][t[2]] = t[3]
+            indexes[t[1]][t[3]] = t[2]
+        end
+    end
+    return rows, spaces, indexes
+end
+
+--
+-- Conversion
+--
+
+-- 'spaces' and 'indexes' map names to ids and back, as base_load()
+-- returns them, 'where' names their source in errors
+local function space_resolve(space_no, cfg, spaces, indexes, where)
+    where = where or 'base snapshot'
+    checkt_xc(cfg, 'table', 'config')
+    checkt_xc(cfg.new_id, {'number', 'string'}, 'config.new_id')
+    checkt_table_xc(cfg.fields, 'string', 'config.fields')
+    checkt_xc(cfg.default, 'string', 'config.default')
+    checkt_xc(cfg.index, 'table', 'config.index')
+    checkt_xc(cfg.index.new_id, {'number', 'string'}, 'config.index.new_id')
+    checkt_table_xc(cfg.index.parts, 'number', 'config.index.parts')
+    if cfg.insert ~= nil or cfg.delete ~= nil or cfg.update ~= nil then
+        error(0, "Space %d has custom insert/delete/update callback, it " ..
+                 "can't be converted offline", space_no)
+    end
+    local space_id = type(cfg.new_id) == 'number' and cfg.new_id or
+                     spaces[cfg.new_id]
+    if space_id == nil or spaces[space_id] == nil then
+        error(0, "Space '%s' is not found in %s", tostring(cfg.new_id),
+              where)
+    end
+    local index = indexes[space_id] or {}
+    local index_id = type(cfg.index.new_id) == 'number' and
+                     cfg.index.new_id or index[cfg.index.new_id]
+    if index_id ~= 0 or index[0] == nil then
+        error(0, "Index '%s' of space '%s' is not primary or not found " ..
+                 "in %s", tostring(cfg.index.new_id), tostring(cfg.new_id),
+              where)
+    end
+    local fields, default = cfg.fields, cfg.default
+    local ischema = {}
+    for _, part in ipairs(cfg.index.parts) do
+        table.insert(ischema, fields[part] or default)
+    end
+    return {
+        space_id = space_id,
+        parts = cfg.index.parts,
+        prefix = pickle.pack('N', space_id),
+        schema = fields,
+        ischema = ischema,
+        default = default
+    }
+end
+
+local converter_mt = {
+    entry_size = function (self, key, e)
+        return #key + ENTRY_OVERHEAD + (type(e) == 'string' and #e or 0)
+    end,
+
+    set = function (self, key, e)
+        local old = self.state[key]
+        if old ~= nil then
+            self.used = self.used - self:entry_size(key, old)
+        end
+        -- without runs state has no tombstones
+        if e == false and #self.runs == 0 then
+            e = nil
+        end
+        self.state[key] = e
+        if e ~= nil then
+            self.used = self.used + self:entry_size(key, e)
+        end
+    end,
+
+    spill = function (self)
+        local path = fio.pathjoin(self.tmpdir, string.format(
+            'migrate.%d.%d.run', self.pid, #self.runs + 1))
+        table.insert(self.runs, path)
+        local count = run_write(path, self.state)
+        log.info("spilled %d keys (%.1f MB) to '%s'", count,
+                 self.used / 1024 / 1024, path)
+        self.state, self.used = {}, 0
+        collectgarbage('collect')
+    end,
+
+    insert = function (self, def, tuple)
+        self:set(key_encode(def, tuple), msgpack.encode(tuple))
+    end,
+
+    delete = function (self, def, key)
+        self:set(def.prefix .. msgpack.encode(key), false)
+    end,
+
+    update = function (self, def, key, ops)
+        local k = def.prefix .. msgpack.encode(key)
+        local e = self.state[k]
+        if type(e) == 'string' then
+            local tuple = msgpack.decode(e)
+            tuple_update(tuple, ops)
+            local nk = key_encode(def, tuple)
+            if nk ~= k then
+                -- tuple is moved to another key, as 1.5 does
+                self:set(k, false)
+            end
+            self:set(nk, msgpack.encode(tuple))
+        elseif e == nil and #self.runs > 0 then
+            -- tuple may be in runs, apply operations when they're merged
+            self:set(k, {ops})
+        elseif type(e) == 'table' then
+            self.used = self.used - self:entry_size(k, e)
+            table.insert(e, ops)
+            self.used = self.used + self:entry_size(k, e)
+        end
+        -- update of missing tuple does nothing
+    end,
+
+    apply = function (self, v)
+        local def = self.spaces[v.space]
+        if v.op == 'insert' then
+            self:insert(def, v.tuple)
+        elseif v.op == 'delete' then
+            self:delete(def, v.key)
+        elseif v.op == 'update' then
+            self:update(def, v.key, v.ops)
+        end
+        if self.used > self.memory then
+            self:spill()
+        end
+    end,
+
+    load = function (self, file)
+        local is_snap = xdir.file_ext(file) == 'snap'
+        local cfg = {
+            spaces = self.spaces,
+            convert = true,
+            throw = true,
+            return_type = 'table',
+            batch_count = self.batch_count,
+            io = self.io,
+            verify = self.verify,
+            prefetch = self.prefetch
+        }
+        if not is_snap then
+            cfg.lsn_from = self.lsn + 1
+        end
+        log.info("opening '%s'", file)
+        local processed = 0
+        for _, rv in xlog.open(file, cfg) do
+            for _, v in ipairs(rv) do
+                if is_snap then
+                    self:insert(self.spaces[v.space], v.tuple)
+                    if self.used > self.memory then
+                        self:spill()
+                    end
+                elseif v.lsn > self.lsn then
+                    self:apply(v)
+                    self.lsn = v.lsn
+                end
+            end
+            processed = processed + #rv
+        end
+        if is_snap then
+            self.lsn = xdir.lsn_from_filename(file)
+        end
+        return processed
+    end,
+
+    -- Calls func(key, tuple) for every key of state in key order
+    merge = function (self, func)
+        if #self.runs == 0 then
+            local keys = {}
+            for k, e in pairs(self.state) do
+                if type(e) == 'string' then
+                    table.insert(keys, k)
+                end
+            end
+            table.sort(keys)
+            for _, k in ipairs(keys) do
+                func(k, self.state[k])
+            end
+            return
+        end
+        self:spill()
+        local heap, readers = {}, {}
+        for no, path in ipairs(self.runs) do
+            readers[no] = run_open(path)
+            local rec = run_next(readers[no])
+            if rec ~= nil then
+                heap_push(heap, {no = no, rec = rec})
+            end
+        end
+        while #heap > 0 do
+            -- records of the same key come from older runs first
+            local key, tuple = heap[1].rec[1], nil
+            while #heap > 0 and heap[1].rec[1] == key do
+                local item = heap_pop(heap)
+                local rec = item.rec
+                if rec[2] == REC_TUPLE then
+                    tuple = rec[3]
+                elseif rec[2] == REC_DELETE then
+                    tuple = nil
+                elseif tuple ~= nil then
+                    local t = msgpack.decode(tuple)
+                    for _, ops in ipairs(rec[3]) do
+                        tuple_update(t, ops)
+                    end
+                    local def = self.targets[pickle.unpack('N', key:sub(1, 4))]
+                    if key_encode(def, t) ~= key then
+                        error(0, "Update of spilled tuple changes its " ..
+                                 "primary key, increase 'memory'")
+                    end
+                    tuple = msgpack.encode(t)
+                end
+                item.rec = run_next(readers[item.no])
+                if item.rec ~= nil then
+                    heap_push(heap, item)
+                end
+            end
+            if tuple ~= nil then
+                func(key, tuple)
+            end
+        end
+        for _, r in ipairs(readers) do
+            run_close(r)
+        end
+    end,
+
+    cleanup = function (self)
+        for _, path in ipairs(self.runs) do
+            fio.unlink(path)
+        end
+        self.runs = {}
+    end
+}
+
+--[[
+State of target spaces after all rows of 1.5 snapshot and xlogs of
+'cfg.dir' are applied, 'defs' are spaces resolved by space_resolve()
+indexed by 1.5 space number, 'targets' - by target space id. Options
+of cfg: memory, tmpdir, batch_count, io, verify, prefetch. Tuples are
+iterated with state:merge(), state:cleanup() removes spilled runs.
+]]--
+local function replay(cfg, defs, targets)
+    cfg.memory = cfg.memory or 128 * 1024 * 1024
+    checkt_xc(cfg.memory, 'number', 'memory')
+    checkt_xc(cfg.tmpdir, 'string', 'tmpdir')
+    cfg.batch_count = cfg.batch_count or 500
+    checkt_xc(cfg.batch_count, 'number', 'batch_count')
+    checkt_xc(cfg.prefetch, {'boolean', 'nil'}, 'prefetch')
+    local xlog_dir, snap_dir = nil, nil
+    if type(cfg.dir) == 'table' then
+        xlog_dir, snap_dir = cfg.dir.xlog, cfg.dir.snap
+        if not xlog_dir or not snap_dir then
+            error('"config" must have "snap_dir" and "xlog_dir"')
+        end
+    elseif type(cfg.dir) == 'string' then
+        xlog_dir, snap_dir = cfg.dir, cfg.dir
+    else
+        error('"dir" must be present and must be table or string')
+    end
+
+    local self = setmetatable({
+        spaces = defs,
+        state = {},
+        used = 0,
+        runs = {},
+        lsn = 0,
+        memory = cfg.memory,
+        tmpdir = cfg.tmpdir,
+        targets = targets,
+        pid = ffi.C.getpid(),
+        batch_count = cfg.batch_count,
+        io = cfg.io,
+        verify = cfg.verify,
+        prefetch = cfg.prefetch
+    }, {
+        __index = converter_mt
+    })
+
+    local stat, res = pcall(function ()
+        local processed = 0
+        local _, files = xdir.xdir(snap_dir, xlog_dir)
+        for _, file in ipairs(files) do
+            processed = processed + self:load(file)
+        end
+        log.info("read %d rows, last lsn is %s", processed, tostring(self.lsn))
+    end)
+    if not stat then
+        self:cleanup()
+        error(0, "%s", tostring(res))
+    end
+    return self
+end
+
+--[[
+local offline = require('migrate.offline')
+local result = offline.convert({
+    dir = {xlog = 'xlog_dir', snap = 'snap_dir'} or 'xlog_snap_dir',
+    spaces = {...}, -- same as for migrate.reader(), without callbacks
+    base = '<path to 1.10 snapshot with schema>',
+    output = '<dir to write snapshot to>',
+    memory = (number), -- bytes of state kept in memory, 128M by default
+    tmpdir = '<dir for spilled state>', -- 'output' by default
+    batch_count, io, verify, prefetch -- same as for migrate.reader()
+})
+result is {path = <snapshot>, rows = <tuples written>, lsn = <last lsn>}
+]]--
+local function convert(cfg)
+    checkt_xc(cfg, 'table', 'config')
+    checkt_xc(cfg.base, 'string', 'base')
+    checkt_xc(cfg.output, 'string', 'output')
+    cfg.tmpdir = cfg.tmpdir or cfg.output
+    checkt_xc(cfg.spaces, 'table', 'spaces')
+
+    local meta, vclock = base_meta(cfg.base)
+    local base_rows, spaces, indexes = base_load(cfg.base)
+    local defs, targets = {}, {}
+    for k, v in pairs(cfg.spaces) do
+        checkt_xc(k, 'number', 'space_id')
+        defs[k] = space_resolve(k, v, spaces, indexes)
+        targets[defs[k].space_id] = defs[k]
+    end
+    for _, row in ipairs(base_rows) do
+        if targets[row[1]] then
+            error(0, "Space '%s' isn't empty in base snapshot",
+                  tostring(spaces[row[1]]))
+        end
+    end
+
+    local self = replay(cfg, defs, targets)
+    local stat, res = pcall(function ()
+        -- snapshot of state made by 1.10 instance has one more change
+        -- than base
+        vclock[1] = (vclock[1] or 0) + 1
+        local vclock_text, signature = vclock_format(vclock)
+        meta = meta:gsub('\nVClock: [^\n]*\n',
+                         '\nVClock: ' .. vclock_text .. '\n')
+        local path = fio.pathjoin(cfg.output,
+            xdir.filename_from_lsn(tonumber(signature), 'snap'))
+        if fio.stat(path) ~= nil then
+            error(0, "Snapshot '%s' already exists", path)
+        end
+        local s = snap_writer_open(path .. '.inprogress', meta)
+        for _, row in ipairs(base_rows) do
+            snap_writer_insert(s, row[1], row[2])
+        end
+        base_rows = nil
+        local count = 0
+        self:merge(function (key, tuple)
+            snap_writer_insert(s, pickle.unpack('N', key:sub(1, 4)), tuple)
+            count = count + 1
+        end)
+        snap_writer_close(s)
+        if not fio.rename(path .. '.inprogress', path) then
+            file_error('rename', path .. '.inprogress')
+        end
+        log.info("written %d tuples to '%s'", count, path)
+        return {path = path, rows = count, lsn = self.lsn}
+    end)
+    self:cleanup()
+    if not stat then
+        error(0, "%s", tostring(res))
+    end
+    return res
+end
+
+return {
+    convert = convert,
+    -- used by migrate.verify
+    replay = replay,
+    space_resolve = space_resolve
+}
\ No newline at end of file
@@ -0,0 +1,119 @@
+local clock = require('clock')
+local fiber = require('fiber')
+
+--[[
+Scheduling of batches for loading beside live traffic.
+
+After every batch the loader reports how many rows and bytes it has
+applied and how long its transaction took. Size of the next batch is
+adapted so that its transaction fits 'max_tx_time', and the fiber
+sleeps long enough to keep rows and bytes under their rates (or just
+yields, so that other fibers run between batches).
+]]--
+
+-- rate is measured over windows of this many seconds
+local RATE_WINDOW = 1
+
+local throttle_mt = {
+    --[[
+    Account batch of 'rows' rows and 'bytes' bytes, transaction of
+    which took 'tx_time' seconds, then sleep or yield. Must be called
+    out of transaction.
+    ]]--
+    batch = function (self, rows, bytes, tx_time)
+        local now = self.clock()
+        if self.max_tx_time ~= nil and rows > 0 then
+            -- time per row is smoothed, so that one slow commit
+            -- doesn't collapse the batch
+            local per_row = tx_time / rows
+            if self.per_row ~= nil then
+                per_row = (self.per_row + per_row) / 2
+            end
+            self.per_row = per_row
+            local count = math.floor(self.max_tx_time / math.max(per_row,
+                                                                 1e-9))
+            -- batch grows slowly and shrinks at once
+            count = math.min(count, self.batch_count * 2, self.batch_max)
+            self.batch_count = math.max(count, 1)
+        end
+        -- next batch may start when rows and bytes of this one are paid
+        local cost = 0
+        if self.max_rows_per_sec ~= nil then
+            cost = math.max(cost, rows / self.max_rows_per_sec)
+        end
+        if self.max_bytes_per_sec ~= nil then
+            cost = math.max(cost, bytes / self.max_bytes_per_sec)
+        end
+        self.ready = math.max(self.ready, now) + cost
+
+        self.window_rows = self.window_rows + rows
+        self.window_bytes = self.window_bytes + bytes
+        self.window_tx_time = self.window_tx_time + tx_time
+        local elapsed = now - self.window_start
+        if elapsed >= RATE_WINDOW then
+            self.rows_per_sec = self.window_rows / elapsed
+            self.bytes_per_sec = self.window_bytes / elapsed
+            self.busy = self.window_tx_time / elapsed
+            self.window_start = now
+            self.window_rows, self.window_bytes = 0, 0
+            self.window_tx_time = 0
+        end
+
+        if self.ready > now then
+            self.sleep(self.ready - now)
+        else
+            self.sleep(0)
+        end
+    end,
+
+    -- Effective rate, measured over the last window
+    rate = function (self)
+        return {
+            rows_per_sec = self.rows_per_sec,
+            bytes_per_sec = self.bytes_per_sec,
+            -- share of time spent in transactions of batches
+            busy = self.busy,
+            batch_count = self.batch_count
+        }
+    end
+}
+
+--[[
+local t = throttle.new({
+    batch_count = 500,      -- batch size to start from, upper bound of it
+    max_tx_time = 0.005,    -- seconds, nil - batch size isn't adapted
+    max_rows_per_sec = nil, -- nil - not limited
+    max_bytes_per_sec = nil -- nil - not limited
+})
+t.batch_count            -- size of the next batch
+t:batch(rows, bytes, tx_time)
+t:rate()                 -- {rows_per_sec, bytes_per_sec, busy, batch_count}
+]]--
+local function new(cfg)
+    local now = clock.monotonic()
+    return setmetatable({
+        max_tx_time = cfg.max_tx_time,
+        max_rows_per_sec = cfg.max_rows_per_sec,
+        max_bytes_per_sec = cfg.max_bytes_per_sec,
+        batch_max = cfg.batch_count,
+        batch_count = cfg.batch_count,
+        per_row = nil,
+        ready = now,
+        window_start = now,
+        window_rows = 0,
+        window_bytes = 0,
+        window_tx_time = 0,
+        rows_per_sec = 0,
+        bytes_per_sec = 0,
+        busy = 0,
+        -- replaced in tests
+        clock = clock.monotonic,
+        sleep = fiber.sleep
+    }, {
+        __index = throttle_mt
+    })
+end
+
+return {
+    new = new
+}
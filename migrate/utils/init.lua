@@ -76,6 +76,7 @@ local function xpcall_tb_cb(err)
             log.error("[%-4s]%s at <%s:%d>", f.what, name, f.file, f.line)
         end
     )
+    return err
 end
 
 local xpcall_tb = function(func, ...)
@@ -0,0 +1,394 @@
+local fio = require('fio')
+local log = require('log')
+local fiber = require('fiber')
+local pickle = require('pickle')
+local msgpack = require('msgpack')
+
+local xlog = require('migrate.xlog')
+local offline = require('migrate.offline')
+local utils = require('migrate.utils')
+local helper = require('migrate.utils.checktype')
+
+local error = utils.error
+local checkt_xc = helper.checkt_xc
+
+--[[
+Verification of migrated spaces.
+
+Digest of every target space (sum of 128-bit hashes of tuples and their
+count, see migrate/xlog/digest.h) is computed twice: from the state 1.5
+snapshot and xlogs are replayed to (as offline.convert does it, with the
+same type conversion) and by scanning primary index of the space in C.
+The scan runs in a fiber while files are read, tuples of both sides are
+hashed by worker threads.
+
+If digests of a space differ and 'bisect' is set, the mismatched key
+range is split at a median of keys sampled from the source and digests
+of halves are compared again, up to 'bisect' times.
+]]--
+
+-- tuples of target index accounted per call of xlog.digest_scan()
+local SCAN_CHUNK = 4096
+-- split key of a range is the median of that many sampled source keys
+local SAMPLE_SIZE = 64
+-- source tuples accounted between yields
+local YIELD_EVERY = 4096
+
+local EMPTY_KEY = msgpack.encode({})
+
+-- Key parts are compared as memtx does it for unsigned and string
+-- parts: numbers (64-bit ones are cdata) before strings, strings
+-- bytewise
+local function part_less(a, b)
+    local ta = type(a) == 'cdata' and 'number' or type(a)
+    local tb = type(b) == 'cdata' and 'number' or type(b)
+    if ta ~= tb then
+        return ta < tb
+    end
+    return a < b
+end
+
+local function key_less(a, b)
+    for i = 1, math.max(#a, #b) do
+        if a[i] == nil or b[i] == nil then
+            return a[i] == nil and b[i] ~= nil
+        end
+        if a[i] ~= b[i] then
+            return part_less(a[i], b[i])
+        end
+    end
+    return false
+end
+
+-- nil 'from' is the start of index, nil 'to' is the end of it
+local function range_has(r, key)
+    return (r.from == nil or not key_less(key, r.from)) and
+           (r.to == nil or key_less(key, r.to))
+end
+
+local function range_less(a, b)
+    if a.from == nil or b.from == nil then
+        return a.from == nil and b.from ~= nil
+    end
+    return key_less(a.from, b.from)
+end
+
+-- 'list' is sorted by 'from' and ranges don't overlap
+local function range_find(list, key)
+    local lo, hi = 1, #list
+    while lo < hi do
+        local mid = math.floor((lo + hi + 1) / 2)
+        local from = list[mid].from
+        if from == nil or not key_less(key, from) then
+            lo = mid
+        else
+            hi = mid - 1
+        end
+    end
+    local r = list[lo]
+    return r ~= nil and range_has(r, key) and r or nil
+end
+
+local function range_new(d, def, from, to)
+    d.slots = d.slots + 1
+    local r = {
+        space_id = def.space_id,
+        from = from,
+        to = to,
+        source = d.slots,
+        target = d.slots + 1,
+        samples = {},
+        seen = 0
+    }
+    d.slots = d.slots + 1
+    return r
+end
+
+-- reservoir sampling of msgpack keys
+local function range_sample(r, key)
+    r.seen = r.seen + 1
+    if #r.samples < SAMPLE_SIZE then
+        table.insert(r.samples, key)
+        return
+    end
+    local i = math.random(r.seen)
+    if i <= SAMPLE_SIZE then
+        r.samples[i] = key
+    end
+end
+
+-- Key to split range at, nil if all sampled keys are the same
+local function range_split_key(r)
+    local keys = {}
+    for _, k in ipairs(r.samples) do
+        table.insert(keys, (msgpack.decode(k)))
+    end
+    table.sort(keys, key_less)
+    -- both halves must have sampled keys
+    for i = math.floor(#keys / 2) + 1, #keys do
+        if key_less(keys[1], keys[i]) then
+            return keys[i]
+        end
+    end
+    return nil
+end
+
+-- Account source tuples of 'ranges' ({[space_id] = sorted list}) to
+-- their slots
+local function source_pass(state, d, ranges, sample)
+    local count = 0
+    state:merge(function (key, tuple)
+        local list = ranges[pickle.unpack('N', key:sub(1, 4))]
+        if list == nil then
+            return
+        end
+        local r = list[1]
+        if #list > 1 or r.from ~= nil or r.to ~= nil then
+            r = range_find(list, msgpack.decode(key, 5))
+            if r == nil then
+                return
+            end
+        end
+        xlog.digest_add(d.digest, r.source, tuple)
+        if sample then
+            range_sample(r, key:sub(5))
+        end
+        count = count + 1
+        if count % YIELD_EVERY == 0 then
+            fiber.yield()
+        end
+    end)
+end
+
+local function target_scan(d, r, parts)
+    local key = r.from and msgpack.encode(r.from) or EMPTY_KEY
+    local stop = r.to and msgpack.encode(r.to)
+    local after = false
+    while true do
+        local _, last = xlog.digest_scan(d.digest, r.target, r.space_id, 0,
+                                         key, after, stop, parts,
+                                         SCAN_CHUNK)
+        if last == nil then
+            break
+        end
+        key, after = last, true
+        xlog.digest_wait(d.digest)
+        fiber.yield()
+    end
+end
+
+-- Scan target ranges in a fiber, returns function that waits for it
+local function target_pass(d, ranges)
+    local done = fiber.channel(1)
+    fiber.create(function ()
+        done:put({pcall(function ()
+            for space_id, list in pairs(ranges) do
+                local parts = {}
+                for i, part in ipairs(box.space[space_id].index[0].parts) do
+                    parts[i] = part.fieldno
+                end
+                for _, r in ipairs(list) do
+                    target_scan(d, r, parts)
+                end
+            end
+        end)})
+    end)
+    return function ()
+        local res = done:get()
+        if not res[1] then
+            error(0, "%s", tostring(res[2]))
+        end
+    end
+end
+
+local function range_result(d, r)
+    local source_count, source_hash = xlog.digest_result(d.digest, r.source)
+    local target_count, target_hash = xlog.digest_result(d.digest, r.target)
+    return source_hash == target_hash and source_count == target_count, {
+        source = {count = source_count, hash = source_hash},
+        target = {count = target_count, hash = target_hash}
+    }
+end
+
+local function range_report(d, r, res)
+    table.insert(d.report.spaces[d.names[r.space_id]].ranges, {
+        from = r.from,
+        to = r.to,
+        source_count = res.source.count,
+        target_count = res.target.count
+    })
+end
+
+-- Split mismatched ranges level by level, the narrowest ones are
+-- reported
+local function bisect(d, state, pending, depth)
+    for level = 1, depth do
+        if #pending == 0 then
+            return
+        end
+        local ranges, halves = {}, {}
+        for _, p in ipairs(pending) do
+            local mid = range_split_key(p.range)
+            if mid == nil then
+                range_report(d, p.range, p.res)
+            else
+                local def = d.targets[p.range.space_id]
+                local a = range_new(d, def, p.range.from, mid)
+                local b = range_new(d, def, mid, p.range.to)
+                local list = ranges[def.space_id] or {}
+                ranges[def.space_id] = list
+                table.insert(list, a)
+                table.insert(list, b)
+                table.insert(halves, {parent = p, a, b})
+            end
+        end
+        for _, list in pairs(ranges) do
+            table.sort(list, range_less)
+        end
+        local wait = target_pass(d, ranges)
+        local stat, err = pcall(source_pass, state, d, ranges, level < depth)
+        wait()
+        if not stat then
+            error(0, "%s", tostring(err))
+        end
+        pending = {}
+        for _, h in ipairs(halves) do
+            local found = false
+            for _, r in ipairs(h) do
+                local ok, res = range_result(d, r)
+                if not ok then
+                    found = true
+                    if level == depth then
+                        range_report(d, r, res)
+                    else
+                        table.insert(pending, {range = r, res = res})
+                    end
+                end
+            end
+            -- tuples were changed between passes
+            if not found then
+                range_report(d, h.parent.range, h.parent.res)
+            end
+        end
+    end
+end
+
+local function schema_load()
+    local spaces, indexes = {}, {}
+    for _, t in box.space._space:pairs() do
+        spaces[t[1]] = t[3]
+        spaces[t[3]] = t[1]
+    end
+    for _, t in box.space._index:pairs() do
+        indexes[t[1]] = indexes[t[1]] or {}
+        indexes[t[1]][t[2]] = t[3]
+        indexes[t[1]][t[3]] = t[2]
+    end
+    return spaces, indexes
+end
+
+--[[
+local result = migrate.verify({
+    dir = {xlog = 'xlog_dir', snap = 'snap_dir'} or 'xlog_snap_dir',
+    spaces = {...}, -- same as for migrate.reader(), without callbacks
+    threads = (number), -- hashing threads, 4 by default (0 - in tx thread)
+    bisect = (number), -- how many times mismatched range is split, 0 by
+                       -- default
+    memory, tmpdir, -- same as for offline.convert(), tmpdir is the
+                    -- current directory by default
+    batch_count, io, verify, prefetch -- same as for migrate.reader()
+})
+result is {
+    ok = true/false,
+    spaces = {
+        [target space name] = {
+            ok = true/false,
+            source = {count = (number), hash = (hex string)},
+            target = {count = (number), hash = (hex string)},
+            -- mismatched key ranges, from <= key < to (nil - no bound)
+            ranges = {{from = key, to = key, source_count = (number),
+                       target_count = (number)}, ...}
+        }
+    }
+}
+Target spaces mustn't change while they're verified.
+]]--
+local function verify(cfg)
+    checkt_xc(cfg, 'table', 'config')
+    checkt_xc(cfg.spaces, 'table', 'spaces')
+    cfg.threads = cfg.threads or 4
+    checkt_xc(cfg.threads, 'number', 'threads')
+    cfg.bisect = cfg.bisect or 0
+    checkt_xc(cfg.bisect, 'number', 'bisect')
+    cfg.tmpdir = cfg.tmpdir or fio.cwd()
+
+    local spaces, indexes = schema_load()
+    local defs, targets, names = {}, {}, {}
+    for k, v in pairs(cfg.spaces) do
+        checkt_xc(k, 'number', 'space_id')
+        defs[k] = offline.space_resolve(k, v, spaces, indexes, 'schema')
+        targets[defs[k].space_id] = defs[k]
+        names[defs[k].space_id] = spaces[defs[k].space_id]
+    end
+
+    local d = {
+        digest = xlog.digest(cfg.threads),
+        slots = 0,
+        targets = targets,
+        names = names,
+        report = {ok = true, spaces = {}}
+    }
+    local ranges = {}
+    for space_id, def in pairs(targets) do
+        ranges[space_id] = {range_new(d, def, nil, nil)}
+    end
+
+    local wait = target_pass(d, ranges)
+    local stat, state = pcall(offline.replay, cfg, defs, targets)
+    if not stat then
+        pcall(wait)
+        error(0, "%s", tostring(state))
+    end
+    local res
+    stat, res = pcall(function ()
+        wait()
+        source_pass(state, d, ranges, cfg.bisect > 0)
+        local pending = {}
+        for space_id, list in pairs(ranges) do
+            local ok, r = range_result(d, list[1])
+            local name = names[space_id]
+            d.report.spaces[name] = {
+                ok = ok,
+                source = r.source,
+                target = r.target,
+                ranges = {}
+            }
+            if ok then
+                log.info("space '%s': %d tuples, digest %s", name,
+                         r.source.count, r.source.hash)
+            else
+                d.report.ok = false
+                log.warn("space '%s' differs: %d tuples, digest %s in " ..
+                         "files, %d tuples, digest %s in space", name,
+                         r.source.count, r.source.hash, r.target.count,
+                         r.target.hash)
+                if cfg.bisect > 0 then
+                    table.insert(pending, {range = list[1], res = r})
+                else
+                    range_report(d, list[1], r)
+                end
+            end
+        end
+        bisect(d, state, pending, cfg.bisect)
+        return d.report
+    end)
+    state:cleanup()
+    if not stat then
+        error(0, "%s", tostring(res))
+    end
+    return res
+end
+
+return {
+    verify = verify
+}
@@ -1,5 +1,9 @@
 local fio = require('fio')
 local fun = require('fun')
+local log = require('log')
+local fiber = require('fiber')
+
+local xlog = require('migrate.xlog')
 
 local chain, iter = fun.chain, fun.iter
 local glob, pathjoin, basename = fio.glob, fio.pathjoin, fio.basename
@@ -9,24 +13,66 @@ local function filename_from_lsn(lsn, ext)
     return string.format('%020d.%s', lsn, ext)
 end
 
+-- suffixes of compressed files, that are read by xlog.open() as is (see
+-- migrate/xlog/zstream.h)
+local compressed = {'.gz', '.zst', '.lz4'}
+
+-- file name without suffix of compression
+local function uncompressed(filename)
+    for _, suffix in ipairs(compressed) do
+        if filename:sub(-#suffix):lower() == suffix then
+            return filename:sub(1, -#suffix - 1)
+        end
+    end
+    return filename
+end
+
+-- 'snap'/'xlog' for plain and compressed files
+local function file_ext(filename)
+    return uncompressed(filename):sub(-4)
+end
+
 local function lsn_from_filename(filename)
-    return tonumber64(basename(filename):sub(1, -6))
+    return tonumber64(uncompressed(basename(filename)):sub(1, -6))
 end
 
--- load all files with given extension (or xlog/snap), 
+-- load all files with given extension (or xlog/snap), compressed ones
+-- too, unless the same file isn't compressed
 local function xdir_load(path, ext)
     ext = (type(ext) == 'table' and ext) or (ext and {ext}) or {'*.xlog', '*.snap'}
+    local patterns = {}
+    for _, x in ipairs(ext) do
+        table.insert(patterns, x)
+        for _, suffix in ipairs(compressed) do
+            table.insert(patterns, x .. suffix)
+        end
+    end
     local files = chain(
         unpack(
-            iter(ext):map(
+            iter(patterns):map(
                 function (x) return glob(pathjoin(path, x)) end
             ):totable()
         )
     ):filter(
-        function(i) return basename(i):sub(1, -6):match('^%d+$') end
+        function(i)
+            return uncompressed(basename(i)):sub(1, -6):match('^%d+$')
+        end
     ):totable()
-    table.sort(files)
-    return files
+    -- plain file goes before its compressed copy
+    table.sort(files, function (a, b)
+        local plain_a, plain_b = uncompressed(a), uncompressed(b)
+        if plain_a ~= plain_b then
+            return plain_a < plain_b
+        end
+        return #a < #b
+    end)
+    local rv = {}
+    for _, file in ipairs(files) do
+        if #rv == 0 or uncompressed(rv[#rv]) ~= uncompressed(file) then
+            table.insert(rv, file)
+        end
+    end
+    return rv
 end
 
 local function find_xlogs_after_lsn(path, lsn)
@@ -40,7 +86,114 @@ local function find_xlogs_after_lsn(path, lsn)
     return idx == 0 and {} or iter(xlogs):drop_n(idx - 1):totable()
 end
 
-local function xdir(snap_path, xlog_path)
+--[[
+Catalog of xlogs of directory (see migrate/xlog/catalog.h), that keeps
+lsn ranges of files between calls:
+
+    local catalog = xdir.catalog(xlog_path, file) -- 'file' is optional,
+                                                  -- catalog is saved there
+    local files, issues = catalog:after(lsn)
+
+after() rescans new and changed files, returns paths of files from the
+one that has row 'lsn' + 1 (by names, as xdir_xlogs_after_lsn() does)
+and problems of their lsn ranges: {kind = 'gap', from = lsn, to = lsn},
+{kind = 'overlap', file = name, from = lsn, to = lsn} and
+{kind = 'broken'/'incomplete', file = name}. Only the last file may be
+incomplete (without end of file marker). catalog.lsn_last is the last
+lsn of these files found by the last after().
+
+Files are scanned in a coio thread, so fibers that use the same catalog
+(e.g. follow() and lag() of reader) take turns.
+]]--
+
+local function catalog_issues(entries, lsn)
+    local issues = {}
+    local expected = lsn + 1
+    local prev = nil
+    for i, e in ipairs(entries) do
+        if e.state == 'broken' then
+            table.insert(issues, {kind = 'broken', file = e.name})
+        elseif e.state == 'open' and i < #entries then
+            table.insert(issues, {kind = 'incomplete', file = e.name})
+        end
+        if e.lsn_first > 0 then
+            if e.lsn_first > expected then
+                table.insert(issues, {kind = 'gap', from = expected,
+                                      to = e.lsn_first - 1})
+            elseif prev ~= nil and e.lsn_first <= prev.lsn_last then
+                table.insert(issues, {kind = 'overlap', file = e.name,
+                                      from = e.lsn_first,
+                                      to = prev.lsn_last})
+            end
+            expected = math.max(expected, e.lsn_last + 1)
+            prev = e
+        end
+    end
+    return issues
+end
+
+-- Call fn(self, ...) holding the latch of catalog
+local function catalog_locked(self, fn, ...)
+    self.latch:put(true)
+    local rv = {pcall(fn, self, ...)}
+    self.latch:get()
+    if not rv[1] then
+        error(rv[2], 0)
+    end
+    return unpack(rv, 2, table.maxn(rv))
+end
+
+local function catalog_after(self, lsn)
+    xlog.catalog_scan(self.catalog)
+    if self.file ~= nil and
+       not xlog.catalog_save(self.catalog, self.file) then
+        -- catalog is a cache, reading goes on without it
+        log.warn("Cannot save catalog '%s'", self.file)
+    end
+    lsn = tonumber(lsn)
+    local from = math.max(xlog.catalog_find(self.catalog, lsn), 1)
+    local entries = xlog.catalog_files(self.catalog, from)
+    local files = {}
+    local lsn_last = lsn
+    for _, e in ipairs(entries) do
+        table.insert(files, pathjoin(self.path, e.name))
+        lsn_last = math.max(lsn_last, e.lsn_last)
+    end
+    self.lsn_last = lsn_last
+    return files, catalog_issues(entries, lsn)
+end
+
+local catalog_mt = {
+    after = function (self, lsn)
+        return catalog_locked(self, catalog_after, lsn)
+    end,
+
+    files = function (self)
+        return catalog_locked(self, function (self)
+            return xlog.catalog_files(self.catalog)
+        end)
+    end
+}
+
+local function catalog(path, file)
+    if type(path) ~= 'string' then
+        error("Expected 'path' to be string", 2)
+    end
+    local self = setmetatable({
+        path = path,
+        file = file,
+        catalog = xlog.catalog(path),
+        latch = fiber.channel(1)
+    }, {
+        __index = catalog_mt
+    })
+    if file ~= nil then
+        xlog.catalog_load(self.catalog, file)
+    end
+    return self
+end
+
+local function xdir(snap_path, xlog_path, catalog)
     if type(snap_path) ~= 'string' then
         error("Expected 'snap_path' to be string", 2)
     end
@@ -50,15 +203,25 @@ local function xdir(snap_path, xlog_path)
     local snap_last = xdir_load(snap_path, '*.snap')
     snap_last = #snap_last > 0 and snap_last[#snap_last] or nil
     local snap_lsn = snap_last and lsn_from_filename(snap_last) or 1
-    local result = find_xlogs_after_lsn(xlog_path, snap_lsn)
-    table.insert(result, 1, snap_last)
-    return snap_lsn, result
+    local result, issues
+    if catalog ~= nil then
+        result, issues = catalog:after(snap_lsn)
+    else
+        result = find_xlogs_after_lsn(xlog_path, snap_lsn)
+    end
+    -- xlogs may be read without snapshot
+    if snap_last ~= nil then
+        table.insert(result, 1, snap_last)
+    end
+    return snap_lsn, result, issues
 end
 
 return {
     xdir = xdir,
     xdir_load = xdir_load,
     xdir_xlogs_after_lsn = find_xlogs_after_lsn,
+    catalog = catalog,
     filename_from_lsn = filename_from_lsn,
-    lsn_from_filename = lsn_from_filename
+    lsn_from_filename = lsn_from_filename,
+    file_ext = file_ext
 }
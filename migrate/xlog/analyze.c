@@ -0,0 +1,727 @@
+#include "analyze.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "transcode.h"
+#include "xlog.h"
+
+/* 1.5 has at most 256 spaces, rows of greater numbers are malformed */
+#define ANALYZE_SPACE_MAX 256
+/* counters per reported hot key, more of them make counts exact for
+ * more skewed workloads */
+#define ANALYZE_TOPK_FACTOR 8
+#define ANALYZE_TOPK_MIN 64
+#define ANALYZE_SLOT_EMPTY UINT32_MAX
+
+/* row marker and header before row data */
+static const uint32_t analyze_row_overhead =
+	sizeof(tnt_log_marker_v11) + sizeof(struct tnt_log_header_v11);
+
+static inline int
+analyze_hist_bucket(uint64_t v)
+{
+	return v == 0 ? 0 : 64 - __builtin_clzll(v);
+}
+
+/* FNV-1a */
+static inline uint64_t
+analyze_hash(const char *data, size_t size)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; ++i) {
+		h ^= (uint8_t)data[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/* bounded version of tnt_enc_read(), returns bytes read or -1 */
+static inline int
+analyze_read_ber(const char *data, const char *end, uint32_t *value)
+{
+	uint32_t v = 0;
+	for (int i = 0; i < 5 && data + i < end; ++i) {
+		v = v << 7 | (data[i] & 0x7f);
+		if (!(data[i] & 0x80)) {
+			*value = v;
+			return i + 1;
+		}
+	}
+	return -1;
+}
+
+static inline int
+analyze_read_u32(const char **pos, const char *end, uint32_t *value)
+{
+	if (end - *pos < (ptrdiff_t)sizeof(uint32_t))
+		return -1;
+	memcpy(value, *pos, sizeof(uint32_t));
+	*pos += sizeof(uint32_t);
+	return 0;
+}
+
+/*
+ * Topk
+ */
+
+static int
+analyze_topk_create(struct analyze_topk *t, uint32_t top)
+{
+	uint32_t capacity = top * ANALYZE_TOPK_FACTOR;
+	if (capacity < ANALYZE_TOPK_MIN)
+		capacity = ANALYZE_TOPK_MIN;
+	uint32_t size = 1;
+	while (size < 2 * capacity)
+		size *= 2;
+	t->heap = calloc(capacity, sizeof(*t->heap));
+	t->table = malloc(size * sizeof(*t->table));
+	if (t->heap == NULL || t->table == NULL) {
+		free(t->heap);
+		free(t->table);
+		t->heap = NULL;
+		t->table = NULL;
+		return -1;
+	}
+	memset(t->table, 0xff, size * sizeof(*t->table));
+	t->capacity = capacity;
+	t->mask = size - 1;
+	t->count = 0;
+	return 0;
+}
+
+static void
+analyze_topk_destroy(struct analyze_topk *t)
+{
+	for (uint32_t i = 0; t->heap != NULL && i < t->count; ++i)
+		free(t->heap[i].key);
+	free(t->heap);
+	free(t->table);
+	memset(t, 0, sizeof(*t));
+}
+
+static inline void
+analyze_topk_swap(struct analyze_topk *t, uint32_t a, uint32_t b)
+{
+	struct analyze_counter tmp = t->heap[a];
+	t->heap[a] = t->heap[b];
+	t->heap[b] = tmp;
+	t->table[t->heap[a].slot] = a;
+	t->table[t->heap[b].slot] = b;
+}
+
+static void
+analyze_topk_sift_down(struct analyze_topk *t, uint32_t i)
+{
+	for (;;) {
+		uint32_t l = 2 * i + 1, r = l + 1, m = i;
+		if (l < t->count && t->heap[l].count < t->heap[m].count)
+			m = l;
+		if (r < t->count && t->heap[r].count < t->heap[m].count)
+			m = r;
+		if (m == i)
+			return;
+		analyze_topk_swap(t, i, m);
+		i = m;
+	}
+}
+
+static void
+analyze_topk_sift_up(struct analyze_topk *t, uint32_t i)
+{
+	while (i > 0) {
+		uint32_t p = (i - 1) / 2;
+		if (t->heap[p].count <= t->heap[i].count)
+			return;
+		analyze_topk_swap(t, i, p);
+		i = p;
+	}
+}
+
+/* backward shift deletion of linear probing */
+static void
+analyze_topk_table_remove(struct analyze_topk *t, uint32_t i)
+{
+	for (;;) {
+		t->table[i] = ANALYZE_SLOT_EMPTY;
+		uint32_t j = i;
+		for (;;) {
+			j = (j + 1) & t->mask;
+			if (t->table[j] == ANALYZE_SLOT_EMPTY)
+				return;
+			uint32_t k = t->heap[t->table[j]].hash & t->mask;
+			/* entry at j may move to i if i is between its home
+			 * slot k and j (cyclically) */
+			if ((j > i && (k <= i || k > j)) ||
+			    (j < i && (k <= i && k > j)))
+				break;
+		}
+		t->table[i] = t->table[j];
+		t->heap[t->table[i]].slot = i;
+		i = j;
+	}
+}
+
+/*
+ * Count key, 'data' is its 1.5 tuple (cardinality and fields) that is
+ * converted with 'plan' when key is counted for the first time.
+ * Returns -1 if memory can't be allocated.
+ */
+static int
+analyze_topk_hit(struct analyze_topk *t, const char *data, size_t size,
+		 const struct field_plan *plan)
+{
+	uint64_t hash = analyze_hash(data, size);
+	uint32_t i = hash & t->mask;
+	for (; t->table[i] != ANALYZE_SLOT_EMPTY; i = (i + 1) & t->mask) {
+		uint32_t pos = t->table[i];
+		if (t->heap[pos].hash == hash) {
+			t->heap[pos].count++;
+			analyze_topk_sift_down(t, pos);
+			return 0;
+		}
+	}
+
+	uint32_t cardinality;
+	memcpy(&cardinality, data, sizeof(cardinality));
+	const char *fields = data + sizeof(cardinality);
+	size_t fields_size = size - sizeof(cardinality);
+	struct transcode_error err;
+	ssize_t len = transcode_size(fields, fields_size, cardinality, plan,
+				     false, &err);
+	if (len < 0) {
+		/* NUM field of wrong width is reported as string */
+		plan = &field_plan_str;
+		len = transcode_size(fields, fields_size, cardinality, plan,
+				     false, &err);
+		if (len < 0)
+			return 0;
+	}
+	char *key = malloc(len);
+	if (key == NULL)
+		return -1;
+	transcode_write(key, fields, fields_size, cardinality, plan, false);
+
+	uint32_t pos;
+	uint64_t count = 0;
+	if (t->count < t->capacity) {
+		pos = t->count++;
+	} else {
+		/* the least counted key is replaced */
+		pos = 0;
+		count = t->heap[0].count;
+		free(t->heap[0].key);
+		analyze_topk_table_remove(t, t->heap[0].slot);
+		/* deletion could shift the free slot found above */
+		for (i = hash & t->mask; t->table[i] != ANALYZE_SLOT_EMPTY;
+		     i = (i + 1) & t->mask)
+			;
+	}
+	struct analyze_counter *c = &t->heap[pos];
+	c->hash = hash;
+	c->count = count + 1;
+	c->error = count;
+	c->key = key;
+	c->key_size = len;
+	c->slot = i;
+	t->table[i] = pos;
+	if (pos == 0)
+		analyze_topk_sift_down(t, 0);
+	else
+		analyze_topk_sift_up(t, pos);
+	return 0;
+}
+
+/*
+ * Rows
+ */
+
+static struct analyze_space *
+analyze_worker_space(struct analyze_worker *w, uint32_t space_no)
+{
+	if (space_no >= ANALYZE_SPACE_MAX)
+		return NULL;
+	if (space_no >= w->space_count) {
+		uint32_t count = w->space_count ? w->space_count : 16;
+		while (count <= space_no)
+			count *= 2;
+		struct analyze_space *spaces = realloc(w->spaces,
+						       count * sizeof(*spaces));
+		if (spaces == NULL)
+			return NULL;
+		memset(spaces + w->space_count, 0,
+		       (count - w->space_count) * sizeof(*spaces));
+		w->spaces = spaces;
+		w->space_count = count;
+	}
+	struct analyze_space *s = &w->spaces[space_no];
+	if (!s->used) {
+		if (w->a->top > 0 && analyze_topk_create(&s->hot, w->a->top) != 0)
+			return NULL;
+		s->used = true;
+	}
+	return s;
+}
+
+/*
+ * Walk 'cardinality' fields at *pos, counts NUM fields of wrong width
+ * by 'plan'. Returns -1 if they're malformed.
+ */
+static int
+analyze_fields(struct analyze_space *s, const char **pos, const char *end,
+	       uint32_t cardinality, const struct field_plan *plan)
+{
+	const char *data = *pos;
+	for (uint32_t idx = 0; idx < cardinality; ++idx) {
+		uint32_t size;
+		int esize = analyze_read_ber(data, end, &size);
+		if (esize < 0 || (size_t)(end - data) - esize < size)
+			return -1;
+		data += esize + size;
+		if (plan->layout != F_LAYOUT_STR &&
+		    field_plan_op(plan, idx) == F_FLD_NUM &&
+		    size != 4 && size != 8)
+			s->num_violations++;
+	}
+	*pos = data;
+	return 0;
+}
+
+static void
+analyze_tuple_size(struct analyze_space *s, uint32_t cardinality,
+		   uint32_t size)
+{
+	s->tuples++;
+	s->cardinality_hist[analyze_hist_bucket(cardinality)]++;
+	s->size_hist[analyze_hist_bucket(size)]++;
+	if (cardinality > s->max_cardinality)
+		s->max_cardinality = cardinality;
+	if (size > s->max_size)
+		s->max_size = size;
+}
+
+static const struct space_def *
+analyze_space_def(struct analyze *a, uint32_t space_no)
+{
+	/* spaces without definition aren't skipped */
+	const struct space_map *map = a->spaces;
+	if (map == NULL || space_no >= map->size)
+		return NULL;
+	return map->defs[space_no];
+}
+
+/* Returns 1 if row is malformed, -1 if memory can't be allocated */
+static int
+analyze_snap_row(struct analyze_worker *w, const char *buf, uint32_t size)
+{
+	struct tnt_log_row_snap_v11 row;
+	if (size < sizeof(row))
+		return 1;
+	memcpy(&row, buf, sizeof(row));
+	struct analyze_space *s = analyze_worker_space(w, row.space);
+	if (s == NULL)
+		return row.space >= ANALYZE_SPACE_MAX ? 1 : -1;
+	s->rows++;
+	s->bytes += size + analyze_row_overhead;
+	s->ops[ANALYZE_OP_INSERT]++;
+	/* snapshot rows have no cardinality before fields */
+	const char *pos = buf + sizeof(row), *end = buf + size;
+	if (row.data_size > size - sizeof(row))
+		return 1;
+	const struct field_plan *plan =
+		space_def_plan(analyze_space_def(w->a, row.space), 0);
+	if (analyze_fields(s, &pos, end, row.tuple_size, plan) != 0)
+		return 1;
+	analyze_tuple_size(s, row.tuple_size, row.data_size);
+	return 0;
+}
+
+static int
+analyze_update_ops(struct analyze_space *s, const char *pos, const char *end,
+		   const struct space_def *def)
+{
+	uint32_t count;
+	if (analyze_read_u32(&pos, end, &count) != 0)
+		return 1;
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t field, size;
+		if (analyze_read_u32(&pos, end, &field) != 0 || pos == end)
+			return 1;
+		uint8_t op = *pos++;
+		int esize = analyze_read_ber(pos, end, &size);
+		if (esize < 0 || (size_t)(end - pos) - esize < size)
+			return 1;
+		pos += esize + size;
+		if (op >= TNT_UPDATE_MAX)
+			return 1;
+		s->update_ops[op]++;
+		bool num;
+		switch (op) {
+		case TNT_UPDATE_ADD:
+		case TNT_UPDATE_AND:
+		case TNT_UPDATE_XOR:
+		case TNT_UPDATE_OR:
+			num = true;
+			break;
+		case TNT_UPDATE_ASSIGN:
+		case TNT_UPDATE_INSERT:
+			num = space_def_field(def, field, 0) == F_FLD_NUM;
+			break;
+		default:
+			num = false;
+		}
+		if (num && size != 4 && size != 8)
+			s->num_violations++;
+	}
+	return 0;
+}
+
+static int
+analyze_xlog_row(struct analyze_worker *w, const char *buf, uint32_t size)
+{
+	struct tnt_log_row_v11 row;
+	if (size < sizeof(row))
+		return 1;
+	memcpy(&row, buf, sizeof(row));
+	const char *pos = buf + sizeof(row), *end = buf + size;
+	uint32_t space_no, flags;
+	if (analyze_read_u32(&pos, end, &space_no) != 0)
+		return 1;
+	enum analyze_op op;
+	switch (row.op) {
+	case TNT_OP_INSERT:
+		op = ANALYZE_OP_INSERT;
+		break;
+	case TNT_OP_DELETE:
+	case TNT_OP_DELETE_1_3:
+		op = ANALYZE_OP_DELETE;
+		break;
+	case TNT_OP_UPDATE:
+		op = ANALYZE_OP_UPDATE;
+		break;
+	default:
+		return 1;
+	}
+	if (row.op != TNT_OP_DELETE_1_3 &&
+	    analyze_read_u32(&pos, end, &flags) != 0)
+		return 1;
+	struct analyze_space *s = analyze_worker_space(w, space_no);
+	if (s == NULL)
+		return space_no >= ANALYZE_SPACE_MAX ? 1 : -1;
+	s->rows++;
+	s->bytes += size + analyze_row_overhead;
+	s->ops[op]++;
+	const struct space_def *def = analyze_space_def(w->a, space_no);
+	const char *tuple = pos;
+	uint32_t cardinality;
+	if (analyze_read_u32(&pos, end, &cardinality) != 0)
+		return 1;
+	const char *fields = pos;
+	if (analyze_fields(s, &pos, end, cardinality,
+			   space_def_plan(def, op != ANALYZE_OP_INSERT)) != 0)
+		return 1;
+	if (op == ANALYZE_OP_INSERT)
+		analyze_tuple_size(s, cardinality, pos - fields);
+	if (op != ANALYZE_OP_UPDATE)
+		return 0;
+	if (w->a->top > 0 &&
+	    analyze_topk_hit(&s->hot, tuple, pos - tuple,
+			     space_def_plan(def, 1)) != 0)
+		return -1;
+	return analyze_update_ops(s, pos, end, def);
+}
+
+static int
+analyze_file_error(struct analyze_file *f, const char *fmt, const char *arg)
+{
+	size_t len = strlen(fmt) + strlen(f->path) + strlen(arg);
+	f->error = malloc(len);
+	if (f->error != NULL)
+		snprintf(f->error, len, fmt, f->path, arg);
+	return -1;
+}
+
+/* Returns -1 if memory can't be allocated */
+static int
+analyze_file(struct analyze_worker *w, struct analyze_file *f)
+{
+	struct tnt_log l;
+	enum tnt_log_type type = tnt_log_guess(f->path);
+	if (tnt_log_open_io(&l, f->path, type, TNT_LOG_IO_MMAP) != 0) {
+		analyze_file_error(f, "Cannot open '%s': %s",
+				   tnt_log_strerror(&l));
+		tnt_log_close(&l);
+		return 0;
+	}
+	tnt_log_set_verify(&l, w->a->verify);
+	int rc = 0;
+	for (;;) {
+		char *buf = NULL;
+		uint32_t size = 0;
+		rc = l.read(&l, &buf, &size);
+		if (rc == 1) {
+			rc = 0;
+			break;
+		}
+		if (rc != 0) {
+			if (tnt_log_error(&l) == TNT_LOG_EMEMORY)
+				break;
+			analyze_file_error(f, "Failed to read '%s': %s",
+					   tnt_log_strerror(&l));
+			rc = 0;
+			break;
+		}
+		f->rows++;
+		f->bytes += size + analyze_row_overhead;
+		if (f->lsn_first == 0)
+			f->lsn_first = l.current.hdr.lsn;
+		f->lsn_last = l.current.hdr.lsn;
+		rc = type == TNT_LOG_SNAPSHOT ? analyze_snap_row(w, buf, size) :
+						analyze_xlog_row(w, buf, size);
+		/* compressed files are read with stdio (see zstream.h) */
+		if (l.io != TNT_LOG_IO_MMAP)
+			tnt_mem_free(buf);
+		if (rc < 0)
+			break;
+		if (rc > 0)
+			f->malformed++;
+		rc = 0;
+	}
+	tnt_log_close(&l);
+	return rc;
+}
+
+static void *
+analyze_worker_f(void *arg)
+{
+	struct analyze_worker *w = arg;
+	struct analyze *a = w->a;
+	for (;;) {
+		uint32_t i = __atomic_fetch_add(&a->next_file, 1,
+						__ATOMIC_RELAXED);
+		if (i >= a->file_count || __atomic_load_n(&a->failed,
+							  __ATOMIC_RELAXED))
+			break;
+		if (analyze_file(w, &a->files[i]) != 0) {
+			__atomic_store_n(&a->failed, true, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	return NULL;
+}
+
+struct analyze *
+analyze_new(const char **paths, uint32_t count, const struct space_map *spaces,
+	    enum tnt_log_verify verify, uint32_t top, int threads,
+	    char *errbuf, size_t errlen)
+{
+	if (threads < 1)
+		threads = 1;
+	if ((uint32_t)threads > count)
+		threads = count > 0 ? count : 1;
+	struct analyze *a = calloc(1, sizeof(struct analyze));
+	if (a == NULL)
+		goto error_mem;
+	a->spaces = spaces;
+	a->verify = verify;
+	a->top = top;
+	a->files = calloc(count, sizeof(struct analyze_file));
+	a->workers = calloc(threads, sizeof(struct analyze_worker));
+	if ((a->files == NULL && count > 0) || a->workers == NULL)
+		goto error_mem;
+	for (uint32_t i = 0; i < count; ++i) {
+		a->files[i].path = strdup(paths[i]);
+		if (a->files[i].path == NULL)
+			goto error_mem;
+		a->file_count++;
+	}
+	a->worker_count = threads;
+	for (int i = 0; i < threads; ++i) {
+		struct analyze_worker *w = &a->workers[i];
+		w->a = a;
+		int rc = pthread_create(&w->thread, NULL, analyze_worker_f, w);
+		if (rc != 0) {
+			snprintf(errbuf, errlen, "Failed to start worker "
+				 "thread: %s", strerror(rc));
+			goto error;
+		}
+		w->started = true;
+	}
+	return a;
+error_mem:
+	snprintf(errbuf, errlen, "Failed to allocate memory for analysis");
+error:
+	if (a != NULL)
+		a->failed = true;
+	analyze_delete(a);
+	return NULL;
+}
+
+void
+analyze_wait(struct analyze *a)
+{
+	for (int i = 0; i < a->worker_count; ++i) {
+		struct analyze_worker *w = &a->workers[i];
+		if (w->started)
+			pthread_join(w->thread, NULL);
+		w->started = false;
+	}
+}
+
+void
+analyze_space_destroy(struct analyze_space *s)
+{
+	analyze_topk_destroy(&s->hot);
+}
+
+void
+analyze_delete(struct analyze *a)
+{
+	if (a == NULL)
+		return;
+	analyze_wait(a);
+	for (int i = 0; a->workers != NULL && i < a->worker_count; ++i) {
+		struct analyze_worker *w = &a->workers[i];
+		for (uint32_t j = 0; j < w->space_count; ++j)
+			analyze_space_destroy(&w->spaces[j]);
+		free(w->spaces);
+	}
+	for (uint32_t i = 0; i < a->file_count; ++i) {
+		free(a->files[i].path);
+		free(a->files[i].error);
+	}
+	free(a->workers);
+	free(a->files);
+	free(a);
+}
+
+static int
+analyze_counter_hash_cmp(const void *a, const void *b)
+{
+	const struct analyze_counter *x = *(struct analyze_counter **)a;
+	const struct analyze_counter *y = *(struct analyze_counter **)b;
+	return x->hash < y->hash ? -1 : x->hash > y->hash;
+}
+
+static int
+analyze_counter_count_cmp(const void *a, const void *b)
+{
+	const struct analyze_counter *x = *(struct analyze_counter **)a;
+	const struct analyze_counter *y = *(struct analyze_counter **)b;
+	return x->count > y->count ? -1 : x->count < y->count;
+}
+
+/* Sum counters of the same keys of all workers, keep 'top' of them */
+static int
+analyze_merge_hot(struct analyze *a, uint32_t space_no,
+		  struct analyze_topk *result)
+{
+	uint32_t total = 0;
+	for (int i = 0; i < a->worker_count; ++i) {
+		struct analyze_worker *w = &a->workers[i];
+		if (space_no < w->space_count)
+			total += w->spaces[space_no].hot.count;
+	}
+	if (total == 0)
+		return 0;
+	struct analyze_counter **all = malloc(total * sizeof(*all));
+	struct analyze_counter *sums = malloc(total * sizeof(*sums));
+	if (all == NULL || sums == NULL)
+		goto error;
+	uint32_t n = 0;
+	for (int i = 0; i < a->worker_count; ++i) {
+		struct analyze_worker *w = &a->workers[i];
+		if (space_no >= w->space_count)
+			continue;
+		struct analyze_topk *t = &w->spaces[space_no].hot;
+		for (uint32_t j = 0; j < t->count; ++j)
+			all[n++] = &t->heap[j];
+	}
+	qsort(all, n, sizeof(*all), analyze_counter_hash_cmp);
+	uint32_t m = 0;
+	for (uint32_t i = 0; i < n; ++i) {
+		if (m > 0 && sums[m - 1].hash == all[i]->hash) {
+			sums[m - 1].count += all[i]->count;
+			sums[m - 1].error += all[i]->error;
+			continue;
+		}
+		sums[m++] = *all[i];
+	}
+	for (uint32_t i = 0; i < m; ++i)
+		all[i] = &sums[i];
+	qsort(all, m, sizeof(*all), analyze_counter_count_cmp);
+	uint32_t count = m < a->top ? m : a->top;
+	result->heap = calloc(count, sizeof(*result->heap));
+	if (result->heap == NULL)
+		goto error;
+	for (uint32_t i = 0; i < count; ++i) {
+		struct analyze_counter *c = &result->heap[i];
+		*c = *all[i];
+		c->key = malloc(c->key_size);
+		if (c->key == NULL)
+			goto error;
+		memcpy(c->key, all[i]->key, c->key_size);
+		result->count = i + 1;
+	}
+	free(all);
+	free(sums);
+	return 0;
+error:
+	free(all);
+	free(sums);
+	return -1;
+}
+
+int
+analyze_merge(struct analyze *a, struct analyze_space **result,
+	      uint32_t *space_count)
+{
+	uint32_t count = 0;
+	for (int i = 0; i < a->worker_count; ++i) {
+		if (a->workers[i].space_count > count)
+			count = a->workers[i].space_count;
+	}
+	*result = NULL;
+	*space_count = 0;
+	if (a->failed)
+		return -1;
+	struct analyze_space *spaces = calloc(count ? count : 1,
+					      sizeof(*spaces));
+	if (spaces == NULL)
+		return -1;
+	*result = spaces;
+	*space_count = count;
+	for (int i = 0; i < a->worker_count; ++i) {
+		struct analyze_worker *w = &a->workers[i];
+		for (uint32_t no = 0; no < w->space_count; ++no) {
+			struct analyze_space *src = &w->spaces[no];
+			struct analyze_space *dst = &spaces[no];
+			if (!src->used)
+				continue;
+			dst->used = true;
+			dst->rows += src->rows;
+			dst->bytes += src->bytes;
+			for (int k = 0; k < ANALYZE_OP_MAX; ++k)
+				dst->ops[k] += src->ops[k];
+			for (int k = 0; k < TNT_UPDATE_MAX; ++k)
+				dst->update_ops[k] += src->update_ops[k];
+			dst->tuples += src->tuples;
+			for (int k = 0; k < ANALYZE_HIST_SIZE; ++k) {
+				dst->cardinality_hist[k] +=
+					src->cardinality_hist[k];
+				dst->size_hist[k] += src->size_hist[k];
+			}
+			if (src->max_cardinality > dst->max_cardinality)
+				dst->max_cardinality = src->max_cardinality;
+			if (src->max_size > dst->max_size)
+				dst->max_size = src->max_size;
+			dst->num_violations += src->num_violations;
+		}
+	}
+	for (uint32_t no = 0; no < count; ++no) {
+		if (spaces[no].used &&
+		    analyze_merge_hot(a, no, &spaces[no].hot) != 0)
+			return -1;
+	}
+	return 0;
+}
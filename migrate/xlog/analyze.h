@@ -0,0 +1,146 @@
+#ifndef   _XLOG_ANALYZE_H_
+#define   _XLOG_ANALYZE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include <tarantool/tnt.h>
+#include <tarantool/tnt_log.h>
+
+struct space_map;
+
+/*
+ * Workload profile of 1.5 snapshots and xlogs (see migrate.analyze).
+ *
+ * Rows are read from file mapping and their data is walked in place,
+ * without building requests or converting tuples. Files are taken by
+ * worker threads one by one, every worker collects statistics of its
+ * own, they are merged when all files are read.
+ */
+
+/* log2 buckets: 0, 1, [2, 3], [4, 7], ... */
+#define ANALYZE_HIST_SIZE 34
+
+enum analyze_op {
+	ANALYZE_OP_INSERT,
+	ANALYZE_OP_DELETE,
+	ANALYZE_OP_UPDATE,
+	ANALYZE_OP_MAX
+};
+
+struct analyze_counter {
+	uint64_t hash;
+	uint64_t count;
+	/* count of the key this one evicted, count is overestimated by
+	 * at most that much */
+	uint64_t error;
+	/* key converted to msgpack */
+	char *key;
+	uint32_t key_size;
+	/* position in analyze_topk::table */
+	uint32_t slot;
+};
+
+/*
+ * Most updated keys (Space-Saving algorithm): counters of 'capacity'
+ * keys, a key that isn't counted replaces the one with the least
+ * count.
+ */
+struct analyze_topk {
+	/* min-heap by count */
+	struct analyze_counter *heap;
+	uint32_t count;
+	uint32_t capacity;
+	/* positions in heap by hash, open addressing */
+	uint32_t *table;
+	uint32_t mask;
+};
+
+struct analyze_space {
+	bool used;
+	uint64_t rows;
+	/* bytes of rows, with headers */
+	uint64_t bytes;
+	uint64_t ops[ANALYZE_OP_MAX];
+	uint64_t update_ops[TNT_UPDATE_MAX];
+	/* snapshot tuples and inserted ones */
+	uint64_t tuples;
+	uint64_t cardinality_hist[ANALYZE_HIST_SIZE];
+	uint64_t size_hist[ANALYZE_HIST_SIZE];
+	uint32_t max_cardinality;
+	uint32_t max_size;
+	/* NUM fields (by space definition) that are not 4 or 8 bytes long,
+	 * in tuples, keys and update operations */
+	uint64_t num_violations;
+	struct analyze_topk hot;
+};
+
+struct analyze_file {
+	char *path;
+	uint64_t rows;
+	uint64_t bytes;
+	uint64_t lsn_first;
+	uint64_t lsn_last;
+	/* rows with valid checksums and unparsable data */
+	uint64_t malformed;
+	/* reading stopped at error */
+	char *error;
+};
+
+struct analyze_worker {
+	struct analyze *a;
+	/* indexed by space number */
+	struct analyze_space *spaces;
+	uint32_t space_count;
+	pthread_t thread;
+	bool started;
+};
+
+struct analyze {
+	const struct space_map *spaces;
+	enum tnt_log_verify verify;
+	/* number of hot keys reported per space */
+	uint32_t top;
+	struct analyze_file *files;
+	uint32_t file_count;
+	/* next file to be taken by a worker */
+	uint32_t next_file;
+	int worker_count;
+	struct analyze_worker *workers;
+	/* memory allocation failed in a worker */
+	bool failed;
+};
+
+/*
+ * Start analysis of files in 'threads' threads, 'spaces' are used to
+ * find NUM fields and to convert hot keys.
+ */
+struct analyze *
+analyze_new(const char **paths, uint32_t count, const struct space_map *spaces,
+	    enum tnt_log_verify verify, uint32_t top, int threads,
+	    char *errbuf, size_t errlen);
+
+/* Block until all files are read */
+void
+analyze_wait(struct analyze *a);
+
+/*
+ * Merge statistics of workers into 'result' (array of space_count
+ * entries indexed by space number), hot keys of result are sorted by
+ * count and there are at most 'top' of them. Returns -1 if memory
+ * can't be allocated.
+ */
+int
+analyze_merge(struct analyze *a, struct analyze_space **result,
+	      uint32_t *space_count);
+
+void
+analyze_space_destroy(struct analyze_space *s);
+
+void
+analyze_delete(struct analyze *a);
+
+#endif /* _XLOG_ANALYZE_H_ */
@@ -0,0 +1,359 @@
+#include "batch.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <msgpuck.h>
+
+#include <tarantool/tnt.h>
+#include <tarantool/tnt_log.h>
+
+#include "transcode.h"
+#include "xlog.h"
+
+#define BATCH_ROWS_MIN 256
+#define BATCH_DATA_MIN (64 * 1024)
+
+struct batch *
+batch_new(void)
+{
+	struct batch *b = calloc(1, sizeof(struct batch));
+	return b;
+}
+
+void
+batch_delete(struct batch *b)
+{
+	if (b == NULL)
+		return;
+	free(b->rows);
+	free(b->data);
+	damage_list_destroy(&b->damaged);
+	free(b);
+}
+
+void
+batch_reset(struct batch *b)
+{
+	b->count = 0;
+	b->size = 0;
+	b->offset = 0;
+	b->damaged.count = 0;
+	b->error = 0;
+	b->errmsg[0] = '\0';
+}
+
+/* salvage callback of decoders, region is added to batch being filled */
+void
+batch_add_damage(void *arg, const struct tnt_log_damage *damage)
+{
+	struct batch **b = arg;
+	if (damage_list_add(&(*b)->damaged, damage) != 0)
+		batch_error(*b, "failed to allocate memory for damaged region");
+}
+
+int
+batch_error(struct batch *b, const char *fmt, ...)
+{
+	if (b->error)
+		return -1;
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(b->errmsg, sizeof(b->errmsg), fmt, ap);
+	va_end(ap);
+	b->error = 1;
+	return -1;
+}
+
+static char *
+batch_reserve(struct batch *b, size_t size)
+{
+	if (b->size + size <= b->data_capacity)
+		return b->data + b->size;
+	size_t capacity = b->data_capacity ? b->data_capacity : BATCH_DATA_MIN;
+	while (capacity < b->size + size)
+		capacity *= 2;
+	/* row offsets are 32 bit */
+	if (capacity > UINT32_MAX) {
+		batch_error(b, "batch is too large (%zu bytes)", b->size + size);
+		return NULL;
+	}
+	char *data = realloc(b->data, capacity);
+	if (data == NULL) {
+		batch_error(b, "failed to allocate %zu bytes for batch",
+			    capacity);
+		return NULL;
+	}
+	b->data = data;
+	b->data_capacity = capacity;
+	return b->data + b->size;
+}
+
+struct batch_row *
+batch_add_row(struct batch *b, uint32_t op, uint32_t space)
+{
+	if (b->count == b->capacity) {
+		uint32_t capacity = b->capacity ? b->capacity * 2 :
+				    BATCH_ROWS_MIN;
+		struct batch_row *rows = realloc(b->rows, capacity *
+						 sizeof(struct batch_row));
+		if (rows == NULL) {
+			batch_error(b, "failed to allocate %u batch rows",
+				    capacity);
+			return NULL;
+		}
+		b->rows = rows;
+		b->capacity = capacity;
+	}
+	struct batch_row *row = &b->rows[b->count];
+	memset(row, 0, sizeof(struct batch_row));
+	row->op = op;
+	row->space = space;
+	row->data = row->ops = row->end = b->size;
+	return row;
+}
+
+void
+batch_finish_row(struct batch *b)
+{
+	struct batch_row *row = &b->rows[b->count++];
+	if (row->ops == row->data)
+		row->ops = b->size;
+	row->end = b->size;
+}
+
+/*
+ * Encode NUM field to pos, there must be at least 9 bytes reserved.
+ * Returns NULL if field can't be converted.
+ */
+static inline char *
+batch_store_num(struct batch *b, char *pos, const char *data, uint32_t size)
+{
+	uint64_t num;
+	if (size == 4) {
+		uint32_t num32;
+		memcpy(&num32, data, sizeof(num32));
+		return mp_encode_uint(pos, num32);
+	}
+	if (size != 8) {
+		batch_error(b, "Cannot convert field '%.*s' to type NUM,"
+			       " exptected len 4 or 8, got '%u'",
+			    (int)size, data, size);
+		return NULL;
+	}
+	memcpy(&num, data, sizeof(num));
+	if (b->wide_num) {
+		pos = mp_store_u8(pos, 0xcf);
+		return mp_store_u64(pos, num);
+	}
+	return mp_encode_uint(pos, num);
+}
+
+/* same conversion rules as lua_field_encode() in tuple.c */
+static int
+batch_encode_field(struct batch *b, const char *data, uint32_t size,
+		   enum field_t tp)
+{
+	char *pos = batch_reserve(b, tp == F_FLD_NUM ? 9 :
+					  mp_sizeof_str(size));
+	if (pos == NULL)
+		return -1;
+	if (tp == F_FLD_NUM)
+		pos = batch_store_num(b, pos, data, size);
+	else
+		pos = mp_encode_str(pos, data, size);
+	if (pos == NULL)
+		return -1;
+	b->size = pos - b->data;
+	return 0;
+}
+
+int
+batch_encode_fields(struct batch *b, const char *data, size_t size,
+		    uint32_t cardinality, const struct field_plan *plan)
+{
+	struct transcode_error err;
+	ssize_t len = transcode_size(data, size, cardinality, plan,
+				     b->wide_num, &err);
+	if (len < 0 && err.field == NULL)
+		return batch_error(b, "failed to parse tuple");
+	if (len < 0)
+		return batch_error(b, "Cannot convert field '%.*s' to type NUM,"
+				      " exptected len 4 or 8, got '%u'",
+				   (int)err.size, err.field, err.size);
+	char *pos = batch_reserve(b, len);
+	if (pos == NULL)
+		return -1;
+	pos = transcode_write(pos, data, size, cardinality, plan, b->wide_num);
+	b->size = pos - b->data;
+	return 0;
+}
+
+static inline int
+batch_encode_tuple(struct batch *b, struct tnt_tuple *t,
+		   struct space_def *def, int is_key)
+{
+	/* tuple data starts with cardinality */
+	if (t->size < sizeof(uint32_t))
+		return batch_error(b, "failed to parse tuple");
+	return batch_encode_fields(b, t->data + sizeof(uint32_t),
+				   t->size - sizeof(uint32_t),
+				   t->cardinality, space_def_plan(def, is_key));
+}
+
+static int
+batch_encode_int(struct batch *b, int64_t num)
+{
+	size_t size = num < 0 ? mp_sizeof_int(num) : mp_sizeof_uint(num);
+	char *pos = batch_reserve(b, size);
+	if (pos == NULL)
+		return -1;
+	pos = num < 0 ? mp_encode_int(pos, num) : mp_encode_uint(pos, num);
+	b->size = pos - b->data;
+	return 0;
+}
+
+/* same layout as luatu_ops_fields() in tuple.c */
+static int
+batch_encode_ops(struct batch *b, struct tnt_request_update *req,
+		 struct space_def *def)
+{
+	char *pos = batch_reserve(b, mp_sizeof_array(req->opc));
+	if (pos == NULL)
+		return -1;
+	b->size = mp_encode_array(pos, req->opc) - b->data;
+	for (uint32_t i = 0; i < req->opc; ++i) {
+		struct tnt_request_update_op *op = &req->opv[i];
+		if (op->op >= TNT_UPDATE_MAX)
+			return batch_error(b, "Undefined update operation: "
+					      "0x%02x", op->op);
+		const struct update_op_record *rec =
+			&update_op_records[op->op];
+		pos = batch_reserve(b, mp_sizeof_array(rec->args_count) +
+				       mp_sizeof_str(1));
+		if (pos == NULL)
+			return -1;
+		pos = mp_encode_array(pos, rec->args_count);
+		b->size = mp_encode_str(pos, rec->operation, 1) - b->data;
+		if (batch_encode_int(b, op->field + 1) != 0)
+			return -1;
+		const char *data = op->data;
+		uint32_t size = op->size;
+		int rc = 0;
+		switch (op->op) {
+		case TNT_UPDATE_ADD:
+		case TNT_UPDATE_AND:
+		case TNT_UPDATE_XOR:
+		case TNT_UPDATE_OR:
+			rc = batch_encode_field(b, data, size, F_FLD_NUM);
+			break;
+		case TNT_UPDATE_INSERT:
+		case TNT_UPDATE_ASSIGN:
+			rc = batch_encode_field(b, data, size,
+					space_def_field(def, op->field, 0));
+			break;
+		case TNT_UPDATE_SPLICE: {
+			struct splice_args args;
+			if (splice_args_parse(data, size, &args) != 0)
+				return batch_error(b, "failed to parse splice "
+						      "operation");
+			if (batch_encode_int(b, args.offset) != 0 ||
+			    batch_encode_int(b, args.length) != 0)
+				return -1;
+			pos = batch_reserve(b, mp_sizeof_str(args.str_len));
+			if (pos == NULL)
+				return -1;
+			b->size = mp_encode_str(pos, args.str, args.str_len) -
+				  b->data;
+			break;
+		}
+		case TNT_UPDATE_DELETE:
+			rc = batch_encode_int(b, 1);
+			break;
+		}
+		if (rc != 0)
+			return -1;
+	}
+	return 0;
+}
+
+int
+batch_add_snap_row(struct batch *b, const struct space_map *spaces,
+		   uint64_t lsn, double tm, const char *buf, uint32_t size)
+{
+	struct tnt_log_row_snap_v11 row_snap;
+	if (size < sizeof(row_snap))
+		goto error;
+	memcpy(&row_snap, buf, sizeof(row_snap));
+	if (row_snap.data_size > size - sizeof(row_snap))
+		goto error;
+	struct space_def *def = NULL;
+	if (space_map_find(spaces, row_snap.space, &def) != 0)
+		return 0;
+	struct batch_row *row = batch_add_row(b, BATCH_OP_INSERT,
+					      row_snap.space);
+	if (row == NULL)
+		return -1;
+	row->lsn = lsn;
+	row->tm = tm;
+	if (batch_encode_fields(b, buf + sizeof(row_snap),
+				row_snap.data_size, row_snap.tuple_size,
+				space_def_plan(def, 0)) != 0)
+		return -1;
+	batch_finish_row(b);
+	return 0;
+error:
+	return batch_error(b, "parsing failed: bad snapshot row");
+}
+
+int
+batch_add_request(struct batch *b, const struct space_map *spaces,
+		  uint64_t lsn, double tm, struct tnt_request *r)
+{
+	uint32_t op, space, flags = 0;
+	struct tnt_tuple *t;
+	switch (r->h.type) {
+	case TNT_OP_INSERT:
+		op = BATCH_OP_INSERT;
+		space = r->r.insert.h.ns;
+		flags = r->r.insert.h.flags;
+		t = &r->r.insert.t;
+		break;
+	case TNT_OP_DELETE:
+	case TNT_OP_DELETE_1_3:
+		/* both have ns first and tuple last */
+		op = BATCH_OP_DELETE;
+		space = r->r.del.h.ns;
+		t = r->h.type == TNT_OP_DELETE ? &r->r.del.t :
+						 &r->r.del_1_3.t;
+		break;
+	case TNT_OP_UPDATE:
+		op = BATCH_OP_UPDATE;
+		space = r->r.update.h.ns;
+		t = &r->r.update.t;
+		break;
+	default:
+		return batch_error(b, "Unknown operation");
+	}
+	struct space_def *def = NULL;
+	if (space_map_find(spaces, space, &def) != 0)
+		return 0;
+	struct batch_row *row = batch_add_row(b, op, space);
+	if (row == NULL)
+		return -1;
+	row->lsn = lsn;
+	row->tm = tm;
+	row->flags = flags;
+	if (batch_encode_tuple(b, t, def, op != BATCH_OP_INSERT) != 0)
+		return -1;
+	if (op == BATCH_OP_UPDATE) {
+		row->ops = b->size;
+		if (batch_encode_ops(b, &r->r.update, def) != 0)
+			return -1;
+	}
+	batch_finish_row(b);
+	return 0;
+}
@@ -0,0 +1,137 @@
+#ifndef   _XLOG_BATCH_H_
+#define   _XLOG_BATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "damage_list.h"
+
+struct space_def;
+struct space_map;
+struct field_plan;
+struct tnt_tuple;
+struct tnt_request;
+
+/*
+ * Batch of rows, converted to msgpack without touching Lua or box,
+ * so it may be filled in any thread. Row bodies are stored in one
+ * contiguous buffer and are referenced by offsets.
+ */
+
+enum batch_op {
+	BATCH_OP_INSERT = 0,
+	BATCH_OP_DELETE,
+	BATCH_OP_UPDATE,
+	BATCH_OP_MAX
+};
+
+struct batch_row {
+	uint64_t lsn;
+	double tm;
+	uint32_t space;
+	uint32_t op;
+	uint32_t flags;
+	/* tuple (insert) or key (delete/update) is [data, ops) */
+	uint32_t data;
+	/* update operations are [ops, end), empty for other ops */
+	uint32_t ops;
+	uint32_t end;
+};
+
+struct batch {
+	struct batch_row *rows;
+	uint32_t count;
+	uint32_t capacity;
+	char *data;
+	size_t size;
+	size_t data_capacity;
+	/*
+	 * encode 8 byte numbers as MP_UINT64 even if they are small,
+	 * so that they can be told apart from 4 byte ones on decoding
+	 */
+	int wide_num;
+	/* sequence number of batch in pipeline */
+	uint64_t seq;
+	/* bytes accounted in decoder budget (see decoder_budget) */
+	size_t charged;
+	/*
+	 * file offset right after the last row read into batch, reading
+	 * may be restarted there (see tnt_log_seek_row), 0 if unknown
+	 */
+	uint64_t offset;
+	/*
+	 * offsets of the first row of pipeline chunk and of the row
+	 * following the chunk, they are equal if chunk has no rows
+	 */
+	uint64_t first_row;
+	uint64_t next_row;
+	/* regions skipped by salvage while batch was filled */
+	struct damage_list damaged;
+	/* set if batch can't be filled, rows before error are valid */
+	int error;
+	char errmsg[256];
+};
+
+struct batch *
+batch_new(void);
+
+void
+batch_delete(struct batch *b);
+
+void
+batch_reset(struct batch *b);
+
+/* memory held by batch buffers */
+static inline size_t
+batch_mem_size(const struct batch *b)
+{
+	return b->data_capacity + b->capacity * sizeof(struct batch_row);
+}
+
+int
+batch_error(struct batch *b, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/*
+ * Salvage callback (see tnt_log_set_salvage), 'arg' is 'struct batch **'
+ * pointing to batch that is being filled.
+ */
+void
+batch_add_damage(void *arg, const struct tnt_log_damage *damage);
+
+/*
+ * Append row to the batch, body must be appended by batch_encode_*
+ * functions right after that.
+ */
+struct batch_row *
+batch_add_row(struct batch *b, uint32_t op, uint32_t space);
+
+/* Finish last row, must be called after its body is encoded */
+void
+batch_finish_row(struct batch *b);
+
+/*
+ * Encode 1.5 tuple fields (BER-encoded field sizes, followed by
+ * data) as msgpack array, converting fields using plan of space.
+ */
+int
+batch_encode_fields(struct batch *b, const char *data, size_t size,
+		    uint32_t cardinality, const struct field_plan *plan);
+
+/*
+ * Append snapshot row (row_snap header followed by tuple data). Rows
+ * of spaces that are not in 'spaces' are skipped (if it's filtered).
+ */
+int
+batch_add_snap_row(struct batch *b, const struct space_map *spaces,
+		   uint64_t lsn, double tm, const char *buf, uint32_t size);
+
+/*
+ * Append parsed xlog request (insert, delete or update). Rows of spaces
+ * that are not in 'spaces' are skipped (if it's filtered).
+ */
+int
+batch_add_request(struct batch *b, const struct space_map *spaces,
+		  uint64_t lsn, double tm, struct tnt_request *r);
+
+#endif /* _XLOG_BATCH_H_ */
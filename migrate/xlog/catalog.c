@@ -0,0 +1,387 @@
+#include "catalog.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include <third_party/crc32.h>
+
+#include <tarantool/tnt.h>
+#include <tarantool/tnt_log.h>
+#include <tarantool/tnt_dir.h>
+
+#include "lsn_index.h"
+
+#define CATALOG_MAGIC "XLOGCAT1"
+
+struct catalog_header {
+	char magic[8];
+	uint32_t count;
+	/* crc32c of entries */
+	uint32_t crc32;
+} __attribute__((packed));
+
+/* saved catalog_file, without name */
+struct catalog_entry {
+	uint64_t name_lsn;
+	uint64_t lsn_first;
+	uint64_t lsn_last;
+	uint64_t size;
+	int64_t mtime;
+	uint64_t end;
+	uint32_t state;
+	uint32_t reserved;
+} __attribute__((packed));
+
+static const uint64_t catalog_row_overhead =
+	sizeof(tnt_log_marker_v11) + sizeof(struct tnt_log_header_v11);
+
+struct catalog *
+catalog_new(const char *dir)
+{
+	struct catalog *c = calloc(1, sizeof(struct catalog));
+	if (c == NULL)
+		return NULL;
+	c->dir = strdup(dir);
+	if (c->dir == NULL) {
+		free(c);
+		return NULL;
+	}
+	return c;
+}
+
+static void
+catalog_files_free(struct catalog_file *files, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; ++i)
+		free(files[i].name);
+	free(files);
+}
+
+void
+catalog_delete(struct catalog *c)
+{
+	if (c == NULL)
+		return;
+	catalog_files_free(c->files, c->count);
+	free(c->dir);
+	free(c);
+}
+
+void
+catalog_load(struct catalog *c, const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (f == NULL)
+		return;
+	struct catalog_header h;
+	struct catalog_entry *entries = NULL;
+	struct catalog_file *files = NULL;
+	struct stat st;
+	if (fread(&h, sizeof(h), 1, f) != 1 ||
+	    memcmp(h.magic, CATALOG_MAGIC, sizeof(h.magic)) != 0 ||
+	    h.count == 0 || fstat(fileno(f), &st) == -1 ||
+	    (uint64_t)st.st_size != sizeof(h) +
+				    (uint64_t)h.count * sizeof(*entries))
+		goto out;
+	entries = malloc(h.count * sizeof(*entries));
+	files = calloc(h.count, sizeof(*files));
+	if (entries == NULL || files == NULL)
+		goto out;
+	if (fread(entries, sizeof(*entries), h.count, f) != h.count ||
+	    crc32c(0, (unsigned char *)entries,
+		   h.count * sizeof(*entries)) != h.crc32)
+		goto out;
+	for (uint32_t i = 0; i < h.count; ++i) {
+		struct catalog_entry *e = &entries[i];
+		struct catalog_file *file = &files[i];
+		/* entries must be sorted for merge with directory */
+		if (i > 0 && e->name_lsn < entries[i - 1].name_lsn)
+			goto out;
+		file->name_lsn = e->name_lsn;
+		file->lsn_first = e->lsn_first;
+		file->lsn_last = e->lsn_last;
+		file->size = e->size;
+		file->mtime = e->mtime;
+		file->end = e->end;
+		file->state = e->state;
+	}
+	catalog_files_free(c->files, c->count);
+	c->files = files;
+	c->count = h.count;
+	c->dirty = 0;
+	files = NULL;
+out:
+	free(entries);
+	free(files);
+	fclose(f);
+}
+
+/* catalog is written to temporary file and renamed */
+int
+catalog_save(struct catalog *c, const char *path)
+{
+	char tmp[PATH_MAX];
+	snprintf(tmp, sizeof(tmp), "%s.inprogress", path);
+	struct catalog_entry *entries = calloc(c->count ? c->count : 1,
+					       sizeof(*entries));
+	if (entries == NULL)
+		return -1;
+	for (uint32_t i = 0; i < c->count; ++i) {
+		struct catalog_file *file = &c->files[i];
+		struct catalog_entry *e = &entries[i];
+		e->name_lsn = file->name_lsn;
+		e->lsn_first = file->lsn_first;
+		e->lsn_last = file->lsn_last;
+		e->size = file->size;
+		e->mtime = file->mtime;
+		e->end = file->end;
+		e->state = file->state;
+	}
+	struct catalog_header h;
+	memcpy(h.magic, CATALOG_MAGIC, sizeof(h.magic));
+	h.count = c->count;
+	h.crc32 = crc32c(0, (unsigned char *)entries,
+			 c->count * sizeof(*entries));
+	int rc = -1;
+	FILE *f = fopen(tmp, "w");
+	if (f != NULL) {
+		rc = (fwrite(&h, sizeof(h), 1, f) == 1 &&
+		      fwrite(entries, sizeof(*entries), c->count,
+			     f) == c->count) ? 0 : -1;
+		if (fclose(f) != 0 || rc != 0 || rename(tmp, path) != 0) {
+			remove(tmp);
+			rc = -1;
+		}
+	}
+	free(entries);
+	if (rc == 0)
+		c->dirty = 0;
+	return rc;
+}
+
+/*
+ * Find the last row backwards from end of file marker at 'eof': it's
+ * the row with a valid header, that ends right at the marker.
+ */
+static int
+catalog_find_last(struct tnt_log *l, uint64_t eof,
+		  struct tnt_log_header_v11 *hdr)
+{
+	if (eof < l->begin_offset + catalog_row_overhead)
+		return -1;
+	const char *p = l->map + eof - catalog_row_overhead;
+	const char *begin = l->map + l->begin_offset;
+	for (; p >= begin; --p) {
+		uint32_t marker;
+		memcpy(&marker, p, sizeof(marker));
+		if (marker != tnt_log_marker_v11)
+			continue;
+		uint64_t offset = p - l->map;
+		if (lsn_index_read_hdr(l, eof, offset, hdr) == 0 &&
+		    offset + catalog_row_overhead + hdr->len == eof)
+			return 0;
+	}
+	return -1;
+}
+
+/*
+ * Read compressed file by headers from 'file->end': it's a stream that
+ * can't be mapped (see zstream.h) and size of which isn't known.
+ */
+static void
+catalog_read_stream(struct tnt_log *l, struct catalog_file *file)
+{
+	struct tnt_log_header_v11 hdr;
+	uint64_t offset = file->end;
+	while (lsn_index_read_hdr(l, UINT64_MAX, offset, &hdr) == 0) {
+		if (file->lsn_first == 0)
+			file->lsn_first = hdr.lsn;
+		file->lsn_last = hdr.lsn;
+		offset += catalog_row_overhead + hdr.len;
+	}
+	file->end = offset;
+	uint32_t marker = 0;
+	if (ferror(l->fd))
+		file->state = CATALOG_BROKEN;
+	else if (fseeko(l->fd, offset, SEEK_SET) == 0 &&
+		 fread(&marker, sizeof(marker), 1, l->fd) == 1 &&
+		 marker == tnt_log_marker_eof_v11)
+		file->state = CATALOG_COMPLETE;
+	else
+		file->state = CATALOG_OPEN;
+}
+
+/*
+ * Read rows of file 'path' by headers from 'file->end' (or from the
+ * beginning if 'resume' isn't set), updates 'file'.
+ */
+static void
+catalog_read(struct catalog_file *file, const char *path, int resume)
+{
+	struct tnt_log l;
+	if (tnt_log_open_io(&l, path, TNT_LOG_XLOG, TNT_LOG_IO_MMAP) != 0) {
+		tnt_log_close(&l);
+		file->state = CATALOG_BROKEN;
+		file->lsn_first = file->lsn_last = 0;
+		file->end = 0;
+		return;
+	}
+	if (l.io != TNT_LOG_IO_MMAP) {
+		if (!resume || file->end < (uint64_t)l.begin_offset) {
+			file->lsn_first = file->lsn_last = 0;
+			file->end = l.begin_offset;
+		}
+		catalog_read_stream(&l, file);
+		tnt_log_close(&l);
+		return;
+	}
+	uint64_t size = l.map_size;
+	if (!resume || file->end < (uint64_t)l.begin_offset ||
+	    file->end > size) {
+		file->lsn_first = file->lsn_last = 0;
+		file->end = l.begin_offset;
+	}
+	struct tnt_log_header_v11 hdr;
+	uint32_t marker = 0;
+	if (size >= file->end + sizeof(marker))
+		memcpy(&marker, l.map + size - sizeof(marker), sizeof(marker));
+	if (marker == tnt_log_marker_eof_v11) {
+		/* complete file is read by the first and the last row */
+		uint64_t eof = size - sizeof(marker);
+		file->state = CATALOG_COMPLETE;
+		struct tnt_log_header_v11 first;
+		if (file->end == eof) {
+			/* no rows or they were read up to the marker */
+		} else if ((file->lsn_first == 0 &&
+			    lsn_index_read_hdr(&l, eof, file->end,
+					       &first) != 0) ||
+			   catalog_find_last(&l, eof, &hdr) != 0) {
+			file->state = CATALOG_BROKEN;
+		} else {
+			if (file->lsn_first == 0)
+				file->lsn_first = first.lsn;
+			file->lsn_last = hdr.lsn;
+			file->end = eof;
+		}
+	} else {
+		file->state = CATALOG_OPEN;
+		uint64_t offset = file->end;
+		while (lsn_index_read_hdr(&l, size, offset, &hdr) == 0) {
+			if (file->lsn_first == 0)
+				file->lsn_first = hdr.lsn;
+			file->lsn_last = hdr.lsn;
+			offset += catalog_row_overhead + hdr.len;
+		}
+		file->end = offset;
+	}
+	tnt_log_close(&l);
+}
+
+static struct catalog_file *
+catalog_lookup(struct catalog_file *files, uint32_t count, uint64_t lsn)
+{
+	uint32_t lo = 0, hi = count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (files[mid].name_lsn < lsn)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < count && files[lo].name_lsn == lsn ? &files[lo] : NULL;
+}
+
+int
+catalog_scan(struct catalog *c, uint32_t *scanned, char *errbuf,
+	     size_t errlen)
+{
+	*scanned = 0;
+	struct tnt_dir d;
+	tnt_dir_init(&d, TNT_DIR_XLOG);
+	if (tnt_dir_scan(&d, c->dir) != 0) {
+		snprintf(errbuf, errlen, "Cannot list '%s': %s", c->dir,
+			 strerror(errno));
+		return -1;
+	}
+	struct catalog_file *files = calloc(d.count ? d.count : 1,
+					    sizeof(*files));
+	if (files == NULL) {
+		tnt_dir_free(&d);
+		snprintf(errbuf, errlen, "Failed to allocate memory for "
+			 "catalog");
+		return -1;
+	}
+	uint32_t count = 0;
+	for (int i = 0; i < d.count; ++i) {
+		/* compressed copy of file is listed after it */
+		if (count > 0 && files[count - 1].name_lsn == d.files[i].lsn)
+			continue;
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s/%s", c->dir, d.files[i].name);
+		struct stat st;
+		/* file is removed while directory is scanned */
+		if (stat(path, &st) == -1)
+			continue;
+		struct catalog_file *file = &files[count];
+		file->name = strdup(d.files[i].name);
+		if (file->name == NULL) {
+			catalog_files_free(files, count);
+			tnt_dir_free(&d);
+			snprintf(errbuf, errlen, "Failed to allocate memory "
+				 "for catalog");
+			return -1;
+		}
+		count++;
+		file->name_lsn = d.files[i].lsn;
+		struct catalog_file *old = catalog_lookup(c->files, c->count,
+							  file->name_lsn);
+		if (old != NULL && old->size == (uint64_t)st.st_size &&
+		    old->mtime == (int64_t)st.st_mtime) {
+			file->lsn_first = old->lsn_first;
+			file->lsn_last = old->lsn_last;
+			file->end = old->end;
+			file->state = old->state;
+			file->size = old->size;
+			file->mtime = old->mtime;
+			continue;
+		}
+		/* rows appended to file that is written are read from the
+		 * last one read before */
+		int resume = old != NULL && old->state == CATALOG_OPEN &&
+			     old->size <= (uint64_t)st.st_size;
+		if (resume) {
+			file->lsn_first = old->lsn_first;
+			file->lsn_last = old->lsn_last;
+			file->end = old->end;
+		}
+		file->size = st.st_size;
+		file->mtime = st.st_mtime;
+		catalog_read(file, path, resume);
+		(*scanned)++;
+	}
+	tnt_dir_free(&d);
+	if (*scanned > 0 || count != c->count)
+		c->dirty = 1;
+	catalog_files_free(c->files, c->count);
+	c->files = files;
+	c->count = count;
+	return 0;
+}
+
+uint32_t
+catalog_find(struct catalog *c, uint64_t lsn)
+{
+	uint32_t lo = 0, hi = c->count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (c->files[mid].name_lsn <= lsn + 1)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
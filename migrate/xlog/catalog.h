@@ -0,0 +1,90 @@
+#ifndef   _XLOG_CATALOG_H_
+#define   _XLOG_CATALOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Catalog of xlogs of a directory: lsn range of every file, read from
+ * row headers and checked against end of file marker.
+ *
+ * Files are listed with tnt_dir_scan() and sorted by lsn of their
+ * names. When the catalog is scanned again, only new files and files
+ * that changed since (by size and mtime) are read: a complete file is
+ * read by the first row header and the last one (found backwards from
+ * the end of file marker), a file that is still written is read by
+ * headers from where the previous scan stopped. Catalog may be saved to
+ * a file and loaded, so scanning of a directory is incremental across
+ * processes too. Compressed xlogs (see zstream.h) are read forward by
+ * headers, as they can't be mapped; if both plain and compressed files
+ * have the same lsn, the plain one is used.
+ */
+
+enum catalog_state {
+	/* rows are followed by end of file marker */
+	CATALOG_COMPLETE = 0,
+	/* no end of file marker (yet), rows are read up to 'end' */
+	CATALOG_OPEN,
+	/* file header can't be read or rows can't be found */
+	CATALOG_BROKEN
+};
+
+struct catalog_file {
+	/* file name, without directory */
+	char *name;
+	/* lsn in file name */
+	uint64_t name_lsn;
+	/* lsn of the first and the last row, 0 if there are no rows */
+	uint64_t lsn_first;
+	uint64_t lsn_last;
+	uint64_t size;
+	int64_t mtime;
+	/* offset after the last row read */
+	uint64_t end;
+	/* enum catalog_state */
+	uint32_t state;
+};
+
+struct catalog {
+	char *dir;
+	/* sorted by name_lsn */
+	struct catalog_file *files;
+	uint32_t count;
+	/* set if files were read since catalog was loaded */
+	int dirty;
+};
+
+struct catalog *
+catalog_new(const char *dir);
+
+void
+catalog_delete(struct catalog *c);
+
+/*
+ * Load entries saved by catalog_save(), they are checked by the next
+ * catalog_scan(). Missing or damaged catalog file is ignored.
+ */
+void
+catalog_load(struct catalog *c, const char *path);
+
+/* Returns -1 if catalog can't be written */
+int
+catalog_save(struct catalog *c, const char *path);
+
+/*
+ * List directory and read new or changed files, sets 'scanned' to the
+ * number of files read. Returns -1 and sets errbuf if directory can't
+ * be listed or memory can't be allocated.
+ */
+int
+catalog_scan(struct catalog *c, uint32_t *scanned, char *errbuf,
+	     size_t errlen);
+
+/*
+ * 1-based index of the file that has row 'lsn' + 1 by its name (the
+ * last file with name_lsn <= lsn + 1), 0 if there is none.
+ */
+uint32_t
+catalog_find(struct catalog *c, uint64_t lsn);
+
+#endif /* _XLOG_CATALOG_H_ */
@@ -0,0 +1,59 @@
+#ifndef   _XLOG_DAMAGE_LIST_H_
+#define   _XLOG_DAMAGE_LIST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <tarantool/tnt.h>
+#include <tarantool/tnt_log.h>
+
+/*
+ * Regions of file skipped by salvage (see tnt_log_set_salvage), they are
+ * collected in batches by decoder threads and handed over to iter_helper
+ * with rows of the batch.
+ */
+struct damage_list {
+	struct tnt_log_damage *items;
+	uint32_t count;
+	uint32_t capacity;
+};
+
+/* Returns -1 if memory can't be allocated */
+static inline int
+damage_list_add(struct damage_list *list, const struct tnt_log_damage *d)
+{
+	if (list->count == list->capacity) {
+		uint32_t capacity = list->capacity ? list->capacity * 2 : 8;
+		struct tnt_log_damage *items =
+			realloc(list->items, capacity * sizeof(*items));
+		if (items == NULL)
+			return -1;
+		list->items = items;
+		list->capacity = capacity;
+	}
+	list->items[list->count++] = *d;
+	return 0;
+}
+
+/* Append all regions of 'src' to 'dst', 'src' is emptied */
+static inline int
+damage_list_move(struct damage_list *dst, struct damage_list *src)
+{
+	for (uint32_t i = 0; i < src->count; ++i) {
+		if (damage_list_add(dst, &src->items[i]) != 0)
+			return -1;
+	}
+	src->count = 0;
+	return 0;
+}
+
+static inline void
+damage_list_destroy(struct damage_list *list)
+{
+	free(list->items);
+	list->items = NULL;
+	list->count = list->capacity = 0;
+}
+
+#endif /* _XLOG_DAMAGE_LIST_H_ */
@@ -0,0 +1,375 @@
+#include "decoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "row_filter.h"
+#include "xlog.h"
+
+#ifndef DECODER_BATCH_ROWS
+#define DECODER_BATCH_ROWS 1024
+#endif
+#define DECODER_BATCH_SIZE (1024 * 1024)
+/* number of decoded batches that may wait for consumer */
+#define DECODER_RING_SIZE 4
+
+static inline bool
+decoder_stopped(struct decoder *d)
+{
+	return __atomic_load_n(&d->stop, __ATOMIC_ACQUIRE);
+}
+
+struct decoder_budget *
+decoder_budget_new(size_t limit)
+{
+	struct decoder_budget *bg = calloc(1, sizeof(struct decoder_budget));
+	if (bg == NULL)
+		return NULL;
+	bg->limit = limit;
+	bg->refs = 1;
+	pthread_mutex_init(&bg->mutex, NULL);
+	pthread_cond_init(&bg->cond, NULL);
+	return bg;
+}
+
+void
+decoder_budget_ref(struct decoder_budget *bg)
+{
+	__atomic_add_fetch(&bg->refs, 1, __ATOMIC_SEQ_CST);
+}
+
+void
+decoder_budget_unref(struct decoder_budget *bg)
+{
+	if (bg == NULL || __atomic_sub_fetch(&bg->refs, 1, __ATOMIC_SEQ_CST) > 0)
+		return;
+	pthread_mutex_destroy(&bg->mutex);
+	pthread_cond_destroy(&bg->cond);
+	free(bg);
+}
+
+static inline bool
+decoder_is_head(struct decoder *d)
+{
+	return __atomic_load_n(&d->head, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Account batch in budget before it's passed to consumer, waits while
+ * budget is exhausted unless decoder becomes the head. A batch is let
+ * through if nothing is charged, so that it can be bigger than limit.
+ * Returns false if decoder was stopped while waiting.
+ */
+static bool
+decoder_charge(struct decoder *d, struct batch *b)
+{
+	struct decoder_budget *bg = d->budget;
+	b->charged = 0;
+	if (bg == NULL || decoder_is_head(d))
+		return true;
+	size_t size = batch_mem_size(b);
+	pthread_mutex_lock(&bg->mutex);
+	while (bg->used > 0 && bg->used + size > bg->limit &&
+	       !decoder_is_head(d) && !decoder_stopped(d))
+		pthread_cond_wait(&bg->cond, &bg->mutex);
+	bool stopped = decoder_stopped(d);
+	if (!stopped && !decoder_is_head(d)) {
+		bg->used += size;
+		b->charged = size;
+	}
+	pthread_mutex_unlock(&bg->mutex);
+	return !stopped;
+}
+
+/* Return memory of batch taken by consumer to budget */
+static void
+decoder_uncharge(struct decoder *d, struct batch *b)
+{
+	struct decoder_budget *bg = d->budget;
+	if (b->charged == 0)
+		return;
+	pthread_mutex_lock(&bg->mutex);
+	bg->used -= b->charged;
+	b->charged = 0;
+	pthread_cond_broadcast(&bg->cond);
+	pthread_mutex_unlock(&bg->mutex);
+}
+
+/* wake up producer waiting in decoder_charge() */
+static void
+decoder_budget_wakeup(struct decoder *d)
+{
+	if (d->budget == NULL)
+		return;
+	pthread_mutex_lock(&d->budget->mutex);
+	pthread_cond_broadcast(&d->budget->cond);
+	pthread_mutex_unlock(&d->budget->mutex);
+}
+
+/* called by consumer, it takes files in order */
+static inline void
+decoder_make_head(struct decoder *d)
+{
+	if (d->budget == NULL || d->head)
+		return;
+	__atomic_store_n(&d->head, true, __ATOMIC_RELEASE);
+	decoder_budget_wakeup(d);
+}
+
+/*
+ * Read rows into batch until it's full.
+ * Returns 0 if batch is full, 1 on end of file and -1 on error.
+ */
+static int
+decoder_fill(struct decoder *d, struct batch *b)
+{
+	struct tnt_log *l = &d->log;
+	while (b->count < DECODER_BATCH_ROWS && b->size < DECODER_BATCH_SIZE) {
+		if (decoder_stopped(d))
+			return 1;
+		int rc = 0;
+		if (l->type == TNT_LOG_SNAPSHOT) {
+			/* snapshot rows are converted right from the buffer */
+			char *buf = NULL;
+			uint32_t size = 0;
+			rc = l->read(l, &buf, &size);
+			if (rc == 1)
+				return 1;
+			if (rc != 0)
+				goto error;
+			rc = batch_add_snap_row(b, d->spaces,
+						l->current.hdr.lsn,
+						l->current.hdr.tm, buf, size);
+			if (l->io != TNT_LOG_IO_MMAP)
+				tnt_mem_free(buf);
+			b->offset = tnt_log_tell(l);
+		} else {
+			struct tnt_log_row *row = tnt_log_next_to(l, &d->value);
+			if (row == NULL) {
+				tnt_request_free(&d->value.r);
+				if (tnt_log_error(l) == TNT_LOG_EOK)
+					return 1;
+				goto error;
+			}
+			/* rows out of lsn range are skipped by filter */
+			rc = batch_add_request(b, d->spaces, row->hdr.lsn,
+					       row->hdr.tm, &d->value.r);
+			tnt_request_free(&d->value.r);
+			b->offset = tnt_log_tell(l);
+		}
+		if (rc != 0)
+			return -1;
+	}
+	return 0;
+error:
+	return batch_error(b, "parsing failed: %s", tnt_log_strerror(l));
+}
+
+/* decoder_fill() that parses rows in arena, rows are copied into batch */
+static int
+decoder_fill_arena(struct decoder *d, struct batch *b)
+{
+	if (d->arena != NULL)
+		row_arena_reset(d->arena);
+	struct row_arena *prev = row_arena_enter(d->arena);
+	int rc = decoder_fill(d, b);
+	row_arena_leave(prev);
+	return rc;
+}
+
+static enum tnt_log_filter_result
+decoder_filter(void *arg, const struct tnt_log_header_v11 *hdr, uint32_t space)
+{
+	struct decoder *d = arg;
+	return row_filter(d->log.type, d->spaces, d->lsn_from, d->lsn_to, hdr,
+			  space);
+}
+
+static void *
+decoder_f(void *arg)
+{
+	struct decoder *d = arg;
+	uint64_t seq = 0;
+	int seek_rc = lsn_index_seek(&d->log, d->path, d->lsn_from,
+				     d->lsn_index);
+	/* rows are parsed with malloc if arena can't be created */
+	if (d->alloc == ROW_ALLOC_ARENA)
+		d->arena = row_arena_new(d->hugepages);
+	while (!decoder_stopped(d)) {
+		struct batch *b = ring_pop(&d->free);
+		if (b == NULL)
+			b = batch_new();
+		if (b == NULL) {
+			__atomic_store_n(&d->failed, true, __ATOMIC_RELEASE);
+			break;
+		}
+		batch_reset(b);
+		b->seq = seq++;
+		b->wide_num = d->wide_num;
+		d->filling = b;
+		int rc = seek_rc == 0 ? decoder_fill_arena(d, b) :
+			 batch_error(b, "Cannot seek to lsn %llu",
+				     (unsigned long long)d->lsn_from);
+		/* damaged tail of file is reported by empty batch */
+		if (b->count == 0 && b->damaged.count == 0 && rc == 1) {
+			batch_delete(b);
+			break;
+		}
+		if (!decoder_charge(d, b)) {
+			batch_delete(b);
+			break;
+		}
+		while (!ring_push(&d->ready, b)) {
+			ring_wait_push(&d->ready);
+			if (decoder_stopped(d)) {
+				decoder_uncharge(d, b);
+				batch_delete(b);
+				goto out;
+			}
+		}
+		if (rc != 0)
+			break;
+	}
+out:
+	row_arena_delete(d->arena);
+	d->arena = NULL;
+	ring_close(&d->ready);
+	return NULL;
+}
+
+struct decoder *
+decoder_new(const char *path, enum tnt_log_type type, enum tnt_log_io io,
+	    enum tnt_log_verify verify, bool verify_skipped, bool salvage,
+	    const struct space_map *spaces, uint64_t lsn_from, uint64_t lsn_to,
+	    enum lsn_index_mode lsn_index, uint64_t offset,
+	    enum row_alloc alloc, bool hugepages,
+	    bool wide_num, struct decoder_budget *budget,
+	    char *errbuf, size_t errlen)
+{
+	struct decoder *d = calloc(1, sizeof(struct decoder));
+	if (d == NULL)
+		goto error_mem;
+	d->spaces = spaces;
+	d->lsn_from = lsn_from;
+	d->lsn_to = lsn_to;
+	d->lsn_index = type == TNT_LOG_XLOG ? lsn_index : LSN_INDEX_NONE;
+	d->alloc = alloc;
+	d->hugepages = hugepages;
+	d->wide_num = wide_num;
+	if (budget != NULL) {
+		decoder_budget_ref(budget);
+		d->budget = budget;
+	}
+	if (ring_create(&d->ready, DECODER_RING_SIZE) != 0 ||
+	    ring_create(&d->free, DECODER_RING_SIZE * 2) != 0)
+		goto error_mem;
+	d->path = strdup(path);
+	if (d->path == NULL)
+		goto error_mem;
+	if (tnt_log_open_io(&d->log, path, type, io) != 0) {
+		snprintf(errbuf, errlen, "Cannot open '%s': %s", path,
+			 tnt_log_strerror(&d->log));
+		goto error;
+	}
+	tnt_log_set_verify(&d->log, verify);
+	tnt_log_set_filter(&d->log, decoder_filter, d, verify_skipped);
+	if (salvage)
+		tnt_log_set_salvage(&d->log, batch_add_damage, &d->filling);
+	if (offset != 0) {
+		if (tnt_log_seek_row(&d->log, offset) != 0) {
+			snprintf(errbuf, errlen, "Cannot seek '%s' to offset "
+				 "%llu", path, (unsigned long long)offset);
+			goto error;
+		}
+		/* rows before lsn_from are still skipped by filter */
+		d->lsn_index = LSN_INDEX_NONE;
+	}
+	if (type == TNT_LOG_XLOG)
+		tnt_request_init(&d->value.r);
+	int rc = pthread_create(&d->thread, NULL, decoder_f, d);
+	if (rc != 0) {
+		snprintf(errbuf, errlen, "Failed to start decoder thread: %s",
+			 strerror(rc));
+		goto error;
+	}
+	d->started = true;
+	return d;
+error_mem:
+	snprintf(errbuf, errlen, "Failed to allocate memory for decoder");
+error:
+	decoder_delete(d);
+	return NULL;
+}
+
+void
+decoder_delete(struct decoder *d)
+{
+	if (d == NULL)
+		return;
+	if (d->started) {
+		__atomic_store_n(&d->stop, true, __ATOMIC_RELEASE);
+		/* wake up producer waiting for free slot or for budget */
+		ring_close(&d->ready);
+		decoder_budget_wakeup(d);
+		pthread_join(d->thread, NULL);
+	}
+	struct batch *b;
+	if (d->ready.slots != NULL) {
+		while ((b = ring_pop(&d->ready)) != NULL) {
+			decoder_uncharge(d, b);
+			batch_delete(b);
+		}
+	}
+	if (d->free.slots != NULL) {
+		while ((b = ring_pop(&d->free)) != NULL)
+			batch_delete(b);
+	}
+	ring_destroy(&d->ready);
+	ring_destroy(&d->free);
+	tnt_log_close(&d->log);
+	decoder_budget_unref(d->budget);
+	free(d->path);
+	free(d);
+}
+
+bool
+decoder_ready(struct decoder *d)
+{
+	decoder_make_head(d);
+	return !ring_empty(&d->ready) || ring_is_closed(&d->ready);
+}
+
+void
+decoder_wait(struct decoder *d)
+{
+	decoder_make_head(d);
+	ring_wait_pop(&d->ready);
+}
+
+struct batch *
+decoder_take(struct decoder *d)
+{
+	decoder_make_head(d);
+	for (;;) {
+		struct batch *b = ring_pop(&d->ready);
+		if (b == NULL && ring_is_closed(&d->ready)) {
+			/* batches pushed before close must be taken first */
+			b = ring_pop(&d->ready);
+			if (b == NULL)
+				return NULL;
+		}
+		if (b != NULL) {
+			decoder_uncharge(d, b);
+			return b;
+		}
+		ring_wait_pop(&d->ready);
+	}
+}
+
+void
+decoder_release(struct decoder *d, struct batch *b)
+{
+	if (!ring_push(&d->free, b))
+		batch_delete(b);
+}
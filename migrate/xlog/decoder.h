@@ -0,0 +1,124 @@
+#ifndef   _XLOG_DECODER_H_
+#define   _XLOG_DECODER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include <tarantool/tnt.h>
+#include <tarantool/tnt_log.h>
+
+#include "ring.h"
+#include "lsn_index.h"
+#include "row_arena.h"
+
+struct batch;
+struct space_map;
+
+/*
+ * Background decoder of one xlog or snapshot.
+ *
+ * Producer thread reads rows, checks them and converts them into
+ * msgpack batches ahead of the consumer. Decoded batches are passed
+ * to consumer through bounded ring, consumed batches are returned
+ * through another one and reused.
+ */
+
+/*
+ * Memory budget of batches that were decoded ahead of consumer by
+ * decoders of several files. Consumer takes files one after another,
+ * so decoder of the file that is being consumed (head) is limited only
+ * by its ring. Decoders of the next files wait while batches they have
+ * decoded but consumer hasn't taken yet exceed the limit, until their
+ * file becomes the head.
+ */
+struct decoder_budget {
+	size_t limit;
+	/* bytes of charged batches, see batch::charged */
+	size_t used;
+	int refs;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+struct decoder_budget *
+decoder_budget_new(size_t limit);
+
+void
+decoder_budget_ref(struct decoder_budget *bg);
+
+void
+decoder_budget_unref(struct decoder_budget *bg);
+
+struct decoder {
+	struct tnt_log log;
+	union tnt_log_value value;
+	const struct space_map *spaces;
+	uint64_t lsn_from;
+	uint64_t lsn_to;
+	/* xlog is sought to lsn_from in producer thread */
+	enum lsn_index_mode lsn_index;
+	/* xlog rows are parsed in arena, created by producer thread */
+	enum row_alloc alloc;
+	bool hugepages;
+	struct row_arena *arena;
+	/* batch being filled, gets regions skipped by salvage */
+	struct batch *filling;
+	char *path;
+	/* see batch::wide_num */
+	bool wide_num;
+	/* shared with decoders of other files, may be NULL */
+	struct decoder_budget *budget;
+	/* consumer started to take batches of this decoder */
+	bool head;
+	/* decoded batches, producer -> consumer */
+	struct ring ready;
+	/* consumed batches, consumer -> producer */
+	struct ring free;
+	pthread_t thread;
+	bool started;
+	bool stop;
+	/* set if producer failed to allocate batch */
+	bool failed;
+};
+
+/*
+ * Start decoding of file. If 'offset' isn't 0, rows are read from it
+ * (see tnt_log_seek_row) instead of seeking to 'lsn_from'. With
+ * 'salvage' damaged regions are skipped and passed in batch::damaged.
+ */
+struct decoder *
+decoder_new(const char *path, enum tnt_log_type type, enum tnt_log_io io,
+	    enum tnt_log_verify verify, bool verify_skipped, bool salvage,
+	    const struct space_map *spaces, uint64_t lsn_from, uint64_t lsn_to,
+	    enum lsn_index_mode lsn_index, uint64_t offset,
+	    enum row_alloc alloc, bool hugepages,
+	    bool wide_num, struct decoder_budget *budget,
+	    char *errbuf, size_t errlen);
+
+void
+decoder_delete(struct decoder *d);
+
+/* Check if decoder_take() won't block */
+bool
+decoder_ready(struct decoder *d);
+
+/* Block until decoder_take() won't block */
+void
+decoder_wait(struct decoder *d);
+
+/*
+ * Take next decoded batch, blocks if there is none yet. Returns NULL
+ * if whole file was consumed or if d->failed is set. If batch->error
+ * is set, rows before error are valid and it's the last batch.
+ */
+struct batch *
+decoder_take(struct decoder *d);
+
+/* Return consumed batch to decoder */
+void
+decoder_release(struct decoder *d, struct batch *b);
+
+#endif /* _XLOG_DECODER_H_ */
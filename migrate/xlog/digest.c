@@ -0,0 +1,434 @@
+#include "digest.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <msgpuck.h>
+
+#define DIGEST_CHUNK_SIZE (256 * 1024)
+
+static inline uint64_t
+digest_load64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static inline uint64_t
+digest_rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+digest_fmix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+/* MurmurHash3_x64_128 with zero seed */
+static void
+digest_murmur3(const char *key, size_t len, uint64_t h[2])
+{
+	const uint64_t c1 = 0x87c37b91114253d5ULL;
+	const uint64_t c2 = 0x4cf5ad432745937fULL;
+	const uint8_t *data = (const uint8_t *)key;
+	uint64_t h1 = 0, h2 = 0;
+	size_t nblocks = len / 16;
+	for (size_t i = 0; i < nblocks; ++i) {
+		uint64_t k1 = digest_load64(data + i * 16);
+		uint64_t k2 = digest_load64(data + i * 16 + 8);
+		k1 *= c1;
+		k1 = digest_rotl64(k1, 31);
+		k1 *= c2;
+		h1 ^= k1;
+		h1 = digest_rotl64(h1, 27);
+		h1 += h2;
+		h1 = h1 * 5 + 0x52dce729;
+		k2 *= c2;
+		k2 = digest_rotl64(k2, 33);
+		k2 *= c1;
+		h2 ^= k2;
+		h2 = digest_rotl64(h2, 31);
+		h2 += h1;
+		h2 = h2 * 5 + 0x38495ab5;
+	}
+	const uint8_t *tail = data + nblocks * 16;
+	uint64_t k1 = 0, k2 = 0;
+	switch (len & 15) {
+	case 15: k2 ^= (uint64_t)tail[14] << 48; /* fallthrough */
+	case 14: k2 ^= (uint64_t)tail[13] << 40; /* fallthrough */
+	case 13: k2 ^= (uint64_t)tail[12] << 32; /* fallthrough */
+	case 12: k2 ^= (uint64_t)tail[11] << 24; /* fallthrough */
+	case 11: k2 ^= (uint64_t)tail[10] << 16; /* fallthrough */
+	case 10: k2 ^= (uint64_t)tail[9] << 8;   /* fallthrough */
+	case 9:
+		k2 ^= (uint64_t)tail[8];
+		k2 *= c2;
+		k2 = digest_rotl64(k2, 33);
+		k2 *= c1;
+		h2 ^= k2;
+		/* fallthrough */
+	case 8: k1 ^= (uint64_t)tail[7] << 56; /* fallthrough */
+	case 7: k1 ^= (uint64_t)tail[6] << 48; /* fallthrough */
+	case 6: k1 ^= (uint64_t)tail[5] << 40; /* fallthrough */
+	case 5: k1 ^= (uint64_t)tail[4] << 32; /* fallthrough */
+	case 4: k1 ^= (uint64_t)tail[3] << 24; /* fallthrough */
+	case 3: k1 ^= (uint64_t)tail[2] << 16; /* fallthrough */
+	case 2: k1 ^= (uint64_t)tail[1] << 8;  /* fallthrough */
+	case 1:
+		k1 ^= (uint64_t)tail[0];
+		k1 *= c1;
+		k1 = digest_rotl64(k1, 31);
+		k1 *= c2;
+		h1 ^= k1;
+	}
+	h1 ^= len;
+	h2 ^= len;
+	h1 += h2;
+	h2 += h1;
+	h1 = digest_fmix64(h1);
+	h2 = digest_fmix64(h2);
+	h1 += h2;
+	h2 += h1;
+	h[0] = h1;
+	h[1] = h2;
+}
+
+static char *
+digest_normalize_double(char *pos, double v)
+{
+	if (v >= 0 && v < 18446744073709551616.0 && v == (double)(uint64_t)v)
+		return mp_encode_uint(pos, (uint64_t)v);
+	if (v < 0 && v >= -9223372036854775808.0 && v == (double)(int64_t)v)
+		return mp_encode_int(pos, (int64_t)v);
+	return mp_encode_double(pos, v);
+}
+
+/*
+ * Re-encode msgpack value so that equal values have equal encoding,
+ * the result is at most twice as long as the value (a float becomes
+ * a double).
+ */
+static char *
+digest_normalize(char *pos, const char **data)
+{
+	uint32_t len;
+	const char *str;
+	switch (mp_typeof(**data)) {
+	case MP_UINT:
+		return mp_encode_uint(pos, mp_decode_uint(data));
+	case MP_INT: {
+		int64_t v = mp_decode_int(data);
+		return v < 0 ? mp_encode_int(pos, v) :
+			       mp_encode_uint(pos, (uint64_t)v);
+	}
+	case MP_FLOAT:
+		return digest_normalize_double(pos, mp_decode_float(data));
+	case MP_DOUBLE:
+		return digest_normalize_double(pos, mp_decode_double(data));
+	case MP_STR:
+		str = mp_decode_str(data, &len);
+		return mp_encode_str(pos, str, len);
+	case MP_BIN:
+		str = mp_decode_bin(data, &len);
+		return mp_encode_bin(pos, str, len);
+	case MP_ARRAY:
+		len = mp_decode_array(data);
+		pos = mp_encode_array(pos, len);
+		for (uint32_t i = 0; i < len; ++i)
+			pos = digest_normalize(pos, data);
+		return pos;
+	case MP_MAP:
+		len = mp_decode_map(data);
+		pos = mp_encode_map(pos, len);
+		for (uint32_t i = 0; i < 2 * len; ++i)
+			pos = digest_normalize(pos, data);
+		return pos;
+	case MP_NIL:
+		mp_decode_nil(data);
+		return mp_encode_nil(pos);
+	case MP_BOOL:
+		return mp_encode_bool(pos, mp_decode_bool(data));
+	default:
+		/* extensions are compared as is */
+		str = *data;
+		mp_next(data);
+		memcpy(pos, str, *data - str);
+		return pos + (*data - str);
+	}
+}
+
+static int
+digest_state_account(struct digest_state *s, uint32_t slot, const char *data,
+		     size_t size)
+{
+	if (slot >= s->slot_count) {
+		uint32_t count = s->slot_count ? s->slot_count : 16;
+		while (count <= slot)
+			count *= 2;
+		struct digest_sum *sums = realloc(s->sums,
+						  count * sizeof(*sums));
+		if (sums == NULL)
+			return -1;
+		memset(sums + s->slot_count, 0,
+		       (count - s->slot_count) * sizeof(*sums));
+		s->sums = sums;
+		s->slot_count = count;
+	}
+	if (s->scratch_size < 2 * size + 16) {
+		size_t scratch_size = 2 * size + 16;
+		char *scratch = realloc(s->scratch, scratch_size);
+		if (scratch == NULL)
+			return -1;
+		s->scratch = scratch;
+		s->scratch_size = scratch_size;
+	}
+	const char *pos = data;
+	char *end = digest_normalize(s->scratch, &pos);
+	uint64_t h[2];
+	digest_murmur3(s->scratch, end - s->scratch, h);
+	struct digest_sum *sum = &s->sums[slot];
+	sum->lo += h[0];
+	sum->hi += h[1] + (sum->lo < h[0]);
+	sum->count++;
+	return 0;
+}
+
+static int
+digest_state_process(struct digest_state *s, const struct digest_chunk *c)
+{
+	const char *pos = c->data, *end = c->data + c->used;
+	while (pos < end) {
+		uint32_t hdr[2];
+		memcpy(hdr, pos, sizeof(hdr));
+		pos += sizeof(hdr);
+		if (digest_state_account(s, hdr[0], pos, hdr[1]) != 0)
+			return -1;
+		pos += hdr[1];
+	}
+	return 0;
+}
+
+static void
+digest_state_destroy(struct digest_state *s)
+{
+	free(s->sums);
+	free(s->scratch);
+}
+
+static void *
+digest_worker_f(void *arg)
+{
+	struct digest_worker *w = arg;
+	struct digest *d = w->d;
+	pthread_mutex_lock(&d->mutex);
+	for (;;) {
+		while (!d->stop && d->head == NULL)
+			pthread_cond_wait(&d->cond, &d->mutex);
+		if (d->stop)
+			break;
+		struct digest_chunk *c = d->head;
+		d->head = c->next;
+		if (d->head == NULL)
+			d->tail = &d->head;
+		d->queued--;
+		d->busy++;
+		pthread_mutex_unlock(&d->mutex);
+
+		int rc = digest_state_process(&w->state, c);
+		free(c);
+
+		pthread_mutex_lock(&d->mutex);
+		d->busy--;
+		if (rc != 0)
+			d->failed = true;
+		pthread_cond_broadcast(&d->done);
+	}
+	pthread_mutex_unlock(&d->mutex);
+	return NULL;
+}
+
+struct digest *
+digest_new(int threads, char *errbuf, size_t errlen)
+{
+	if (threads < 0)
+		threads = 0;
+	struct digest *d = calloc(1, sizeof(struct digest));
+	if (d == NULL)
+		goto error_mem;
+	d->tail = &d->head;
+	d->window = 2 * threads;
+	pthread_mutex_init(&d->mutex, NULL);
+	pthread_cond_init(&d->cond, NULL);
+	pthread_cond_init(&d->done, NULL);
+	if (threads == 0)
+		return d;
+	d->workers = calloc(threads, sizeof(struct digest_worker));
+	if (d->workers == NULL)
+		goto error_mem;
+	d->worker_count = threads;
+	for (int i = 0; i < threads; ++i) {
+		struct digest_worker *w = &d->workers[i];
+		w->d = d;
+		int rc = pthread_create(&w->thread, NULL, digest_worker_f, w);
+		if (rc != 0) {
+			snprintf(errbuf, errlen, "Failed to start worker "
+				 "thread: %s", strerror(rc));
+			goto error;
+		}
+		w->started = true;
+	}
+	return d;
+error_mem:
+	snprintf(errbuf, errlen, "Failed to allocate memory for digest");
+error:
+	digest_delete(d);
+	return NULL;
+}
+
+void
+digest_delete(struct digest *d)
+{
+	if (d == NULL)
+		return;
+	pthread_mutex_lock(&d->mutex);
+	d->stop = true;
+	pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->mutex);
+	for (int i = 0; i < d->worker_count; ++i) {
+		struct digest_worker *w = &d->workers[i];
+		if (w->started)
+			pthread_join(w->thread, NULL);
+		digest_state_destroy(&w->state);
+	}
+	while (d->head != NULL) {
+		struct digest_chunk *c = d->head;
+		d->head = c->next;
+		free(c);
+	}
+	free(d->filling);
+	digest_state_destroy(&d->state);
+	pthread_mutex_destroy(&d->mutex);
+	pthread_cond_destroy(&d->cond);
+	pthread_cond_destroy(&d->done);
+	free(d->workers);
+	free(d);
+}
+
+bool
+digest_ready(struct digest *d)
+{
+	if (d->worker_count == 0)
+		return true;
+	pthread_mutex_lock(&d->mutex);
+	bool ready = d->queued < d->window;
+	pthread_mutex_unlock(&d->mutex);
+	return ready;
+}
+
+void
+digest_wait(struct digest *d)
+{
+	pthread_mutex_lock(&d->mutex);
+	while (d->queued >= d->window && d->worker_count > 0)
+		pthread_cond_wait(&d->done, &d->mutex);
+	pthread_mutex_unlock(&d->mutex);
+}
+
+int
+digest_add(struct digest *d, uint32_t slot, const char *data, size_t size)
+{
+	if (d->worker_count == 0)
+		return digest_state_account(&d->state, slot, data, size);
+	uint32_t hdr[2] = {slot, (uint32_t)size};
+	size_t need = sizeof(hdr) + size;
+	struct digest_chunk *c = d->filling;
+	if (c != NULL && c->capacity - c->used < need) {
+		digest_flush(d);
+		c = NULL;
+	}
+	if (c == NULL) {
+		size_t capacity = need > DIGEST_CHUNK_SIZE ? need :
+							    DIGEST_CHUNK_SIZE;
+		c = malloc(sizeof(struct digest_chunk) + capacity);
+		if (c == NULL)
+			return -1;
+		c->next = NULL;
+		c->used = 0;
+		c->capacity = capacity;
+		d->filling = c;
+	}
+	memcpy(c->data + c->used, hdr, sizeof(hdr));
+	memcpy(c->data + c->used + sizeof(hdr), data, size);
+	c->used += need;
+	return 0;
+}
+
+void
+digest_flush(struct digest *d)
+{
+	struct digest_chunk *c = d->filling;
+	if (c == NULL)
+		return;
+	d->filling = NULL;
+	pthread_mutex_lock(&d->mutex);
+	*d->tail = c;
+	d->tail = &c->next;
+	d->queued++;
+	pthread_cond_signal(&d->cond);
+	pthread_mutex_unlock(&d->mutex);
+}
+
+bool
+digest_idle(struct digest *d)
+{
+	pthread_mutex_lock(&d->mutex);
+	bool idle = d->queued == 0 && d->busy == 0;
+	pthread_mutex_unlock(&d->mutex);
+	return idle;
+}
+
+void
+digest_wait_idle(struct digest *d)
+{
+	pthread_mutex_lock(&d->mutex);
+	while (d->queued != 0 || d->busy != 0)
+		pthread_cond_wait(&d->done, &d->mutex);
+	pthread_mutex_unlock(&d->mutex);
+}
+
+static void
+digest_sum_merge(struct digest_sum *dst, const struct digest_state *s,
+		 uint32_t slot)
+{
+	if (slot >= s->slot_count)
+		return;
+	const struct digest_sum *src = &s->sums[slot];
+	dst->lo += src->lo;
+	dst->hi += src->hi + (dst->lo < src->lo);
+	dst->count += src->count;
+}
+
+int
+digest_result(struct digest *d, uint32_t slot, struct digest_sum *sum)
+{
+	memset(sum, 0, sizeof(*sum));
+	pthread_mutex_lock(&d->mutex);
+	bool failed = d->failed;
+	digest_sum_merge(sum, &d->state, slot);
+	for (int i = 0; i < d->worker_count; ++i)
+		digest_sum_merge(sum, &d->workers[i].state, slot);
+	pthread_mutex_unlock(&d->mutex);
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,122 @@
+#ifndef   _XLOG_DIGEST_H_
+#define   _XLOG_DIGEST_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * Order-independent digest of sets of tuples (used by migrate.verify).
+ *
+ * Every tuple is normalized (numbers are encoded by value: integral
+ * doubles as integers, floats as doubles, integers in the smallest
+ * form) and hashed by 128-bit MurmurHash3, digest of a set is the sum
+ * of hashes modulo 2^128 and the number of tuples, so it doesn't
+ * depend on the order tuples are added in.
+ *
+ * Tuples are accounted to numbered slots (a space or a key range of
+ * it). They are copied into chunks, which are hashed by worker
+ * threads, the caller waits only if workers fall behind by more than
+ * two chunks each.
+ */
+
+struct digest_sum {
+	uint64_t lo;
+	uint64_t hi;
+	uint64_t count;
+};
+
+/* Entries are [slot u32][size u32][msgpack] */
+struct digest_chunk {
+	struct digest_chunk *next;
+	size_t used;
+	size_t capacity;
+	char data[];
+};
+
+/* Per-slot sums and scratch buffer of one hashing thread */
+struct digest_state {
+	struct digest_sum *sums;
+	uint32_t slot_count;
+	char *scratch;
+	size_t scratch_size;
+};
+
+struct digest_worker {
+	struct digest *d;
+	struct digest_state state;
+	pthread_t thread;
+	bool started;
+};
+
+struct digest {
+	int worker_count;
+	struct digest_worker *workers;
+	/* used if there are no workers */
+	struct digest_state state;
+	/* chunk being filled by digest_add() */
+	struct digest_chunk *filling;
+	/* queue of filled chunks */
+	struct digest_chunk *head;
+	struct digest_chunk **tail;
+	uint32_t queued;
+	/* digest_ready() is false if 'window' chunks are queued */
+	uint32_t window;
+	/* chunks being hashed */
+	uint32_t busy;
+	pthread_mutex_t mutex;
+	/* signaled when a chunk is queued */
+	pthread_cond_t cond;
+	/* signaled when a chunk is hashed */
+	pthread_cond_t done;
+	bool stop;
+	/* memory allocation failed in a worker */
+	bool failed;
+};
+
+/* threads = 0 hashes tuples in the calling thread */
+struct digest *
+digest_new(int threads, char *errbuf, size_t errlen);
+
+void
+digest_delete(struct digest *d);
+
+/*
+ * Check if workers keep up with digest_add(), it never blocks itself
+ * and the caller is expected to wait (digest_wait) if they don't.
+ */
+bool
+digest_ready(struct digest *d);
+
+/* Block until digest_ready() */
+void
+digest_wait(struct digest *d);
+
+/*
+ * Account tuple (a msgpack array, it must be valid) to 'slot',
+ * returns -1 if memory can't be allocated.
+ */
+int
+digest_add(struct digest *d, uint32_t slot, const char *data, size_t size);
+
+/* Hand over the chunk being filled to workers */
+void
+digest_flush(struct digest *d);
+
+/* Check if all added tuples are hashed */
+bool
+digest_idle(struct digest *d);
+
+/* Block until all added tuples are hashed */
+void
+digest_wait_idle(struct digest *d);
+
+/*
+ * Sum of tuples of 'slot', all added tuples must be hashed (see
+ * digest_idle). Returns -1 if hashing failed to allocate memory.
+ */
+int
+digest_result(struct digest *d, uint32_t slot, struct digest_sum *sum);
+
+#endif /* _XLOG_DIGEST_H_ */
@@ -1,6 +1,7 @@
 local ffi = require('ffi')
 local fun = require('fun')
 local json = require('json')
+local msgpack = require('msgpack')
 
 local utils = require('migrate.utils')
 local ct = require('migrate.utils.checktype')
@@ -35,9 +36,41 @@ enum field_t {
 enum ret_t {
     F_RET_TUPLE = 0,
     F_RET_TABLE,
+    F_RET_BATCH,
     F_RET_MAX
 };
 
+enum batch_op {
+    BATCH_OP_INSERT = 0,
+    BATCH_OP_DELETE,
+    BATCH_OP_UPDATE,
+    BATCH_OP_MAX
+};
+
+struct batch_row {
+    uint64_t lsn;
+    double tm;
+    uint32_t space;
+    uint32_t op;
+    uint32_t flags;
+    uint32_t data;
+    uint32_t ops;
+    uint32_t end;
+};
+
+enum field_layout {
+    F_LAYOUT_MIXED = 0,
+    F_LAYOUT_STR,
+    F_LAYOUT_NUM
+};
+
+struct field_plan {
+    uint8_t *ops;
+    uint32_t len;
+    uint8_t tail;
+    uint8_t layout;
+};
+
 struct space_def {
     int space_no;
     int *schema;
@@ -48,6 +81,27 @@ struct space_def {
     int throw;
     int convert;
     struct space_def *next;
+    struct field_plan tuple_plan;
+    struct field_plan key_plan;
+};
+
+struct space_map {
+    struct space_def **defs;
+    uint32_t size;
+    int filter;
+};
+
+struct tnt_log_damage {
+    int64_t from;
+    int64_t to;
+    uint64_t lsn_before;
+    uint64_t lsn_after;
+};
+
+struct damage_list {
+    struct tnt_log_damage *items;
+    uint32_t count;
+    uint32_t capacity;
 };
 
 struct iter_helper {
@@ -58,6 +112,15 @@ struct iter_helper {
     int return_type;
     uint64_t lsn_from;
     uint64_t lsn_to;
+    int lsn_index;
+    int verify_skipped;
+    int alloc;
+    int hugepages;
+    struct row_arena *arena;
+    struct space_map map;
+    uint64_t offset;
+    int salvage;
+    struct damage_list damaged;
 };
 
 enum tnt_log_error {
@@ -77,12 +140,45 @@ enum tnt_log_type {
     TNT_LOG_SNAPSHOT
 };
 
+enum tnt_log_io {
+    TNT_LOG_IO_STDIO,
+    TNT_LOG_IO_MMAP
+};
+
+enum tnt_log_verify {
+    TNT_LOG_VERIFY_FULL,
+    TNT_LOG_VERIFY_HEADER,
+    TNT_LOG_VERIFY_NONE
+};
+
+enum lsn_index_mode {
+    LSN_INDEX_NONE = 0,
+    LSN_INDEX_SCAN,
+    LSN_INDEX_FILE
+};
+
+enum row_alloc {
+    ROW_ALLOC_MALLOC = 0,
+    ROW_ALLOC_ARENA
+};
+
+struct row_arena;
+struct row_arena *row_arena_new(bool hugepages);
+void iter_helper_free_arena(struct iter_helper *hlp);
+void iter_helper_destroy(struct iter_helper *hlp);
+
 struct tnt_stream;
 
+size_t tnt_log_name_len(const char *file);
 enum tnt_log_type tnt_log_guess(const char *file);
+bool zstream_compressed(const char *path);
+bool zstream_supported(const char *path);
 
 struct tnt_stream *tnt_snapshot(struct tnt_stream *s);
 int tnt_snapshot_open(struct tnt_stream *s, const char *file);
+int tnt_snapshot_open_io(struct tnt_stream *s, const char *file,
+                         enum tnt_log_io io);
+void tnt_snapshot_set_verify(struct tnt_stream *s, enum tnt_log_verify verify);
 enum tnt_log_error tnt_snapshot_error(struct tnt_stream *s);
 char *tnt_snapshot_strerror(struct tnt_stream *s);
 int tnt_snapshot_errno(struct tnt_stream *s);
@@ -90,6 +186,18 @@ int tnt_snapshot_reset(struct tnt_stream *s);
 
 struct tnt_stream *tnt_xlog(struct tnt_stream *s);
 int tnt_xlog_open(struct tnt_stream *s, const char *file);
+int tnt_xlog_open_io(struct tnt_stream *s, const char *file,
+                     enum tnt_log_io io);
+void tnt_xlog_set_verify(struct tnt_stream *s, enum tnt_log_verify verify);
+int lsn_index_seek_xlog(struct tnt_stream *s, const char *path, uint64_t lsn,
+                        enum lsn_index_mode mode);
+void xlog_stream_set_filter(struct tnt_stream *s, struct iter_helper *hlp,
+                            int snapshot);
+int xlog_stream_seek(struct tnt_stream *s, struct iter_helper *hlp,
+                     int snapshot);
+int xlog_stream_open_fd(struct tnt_stream *s, int fd, int snapshot);
+void xlog_stream_follow(struct tnt_stream *s);
+int xlog_stream_complete(struct tnt_stream *s);
 enum tnt_log_error tnt_xlog_error(struct tnt_stream *s);
 char *tnt_xlog_strerror(struct tnt_stream *s);
 int tnt_xlog_errno(struct tnt_stream *s);
@@ -112,6 +220,11 @@ local internal = require('migrate.xlog.internal')
 local iter_helper_t = ffi.typeof('struct iter_helper [1]')
 local space_def_t = ffi.typeof('struct space_def [1]')
 local int_arr_t = ffi.typeof('int [?]')
+local uint8_arr_t = ffi.typeof('uint8_t [?]')
+local space_def_ptr_arr_t = ffi.typeof('struct space_def *[?]')
+
+-- space numbers are used as index in space map
+local SPACE_NO_MAX = 65535
 
 local function field_convert(fld)
     if fld == nil or fld == 'str' or fld == 'STR' then
@@ -129,16 +242,46 @@ end
 
 hold = {}
 
+-- Compile conversion of fields into plan (see struct field_plan): flat
+-- array of field types, type of the rest fields and layout for fast
+-- paths.
+local function plan_compile(plan, schema, len, default)
+    local has_str, has_num = default == ffi.C.F_FLD_STR,
+                             default == ffi.C.F_FLD_NUM
+    if len > 0 then
+        local ops = ffi.new(uint8_arr_t, len)
+        table.insert(hold, ops)
+        for i = 0, len - 1 do
+            ops[i] = schema[i]
+            has_str = has_str or schema[i] == ffi.C.F_FLD_STR
+            has_num = has_num or schema[i] == ffi.C.F_FLD_NUM
+        end
+        plan.ops = ops
+    end
+    plan.len = len
+    plan.tail = default
+    plan.layout = ffi.C.F_LAYOUT_MIXED
+    if not has_num then
+        plan.layout = ffi.C.F_LAYOUT_STR
+    elseif not has_str then
+        plan.layout = ffi.C.F_LAYOUT_NUM
+    end
+end
+
 local function checkt_spaces_table_xc(spaces, ext, convert, throw)
     local rv = {}
     for id, v in pairs(spaces) do
         local space_def = ffi.gc(ffi.new(space_def_t), man_gc)
         table.insert(hold, space_def)
         log.debug("AL'ed " .. tostring(space_def))
-        if not type(id) == 'number' then
+        if type(id) ~= 'number' then
             error("Bad 'space_id' type, expected 'number', got '%s' (%s)",
                   type(id), id)
         end
+        if id < 0 or id > SPACE_NO_MAX or id % 1 ~= 0 then
+            error("Bad 'space_id' value, expected integer in [0, %d], " ..
+                  "got %s", SPACE_NO_MAX, id)
+        end
         space_def[0].def = ffi.C.F_FLD_STR
         if convert then
             checkt_xc(v, 'table', 'bad space description')
@@ -171,6 +314,10 @@ local function checkt_spaces_table_xc(spaces, ext, convert, throw)
         end
         space_def[0].convert = convert
         space_def[0].space_no = id
+        plan_compile(space_def[0].tuple_plan, space_def[0].schema,
+                     space_def[0].schema_len, space_def[0].def)
+        plan_compile(space_def[0].key_plan, space_def[0].ischema,
+                     space_def[0].ischema_len, space_def[0].def)
         table.insert(rv, space_def)
     end
     return rv
@@ -194,15 +341,67 @@ config { -- table
     -- }
     -- for xlog/snap
     convert = true/false, -- (NYI) - convert tuple fields or not
-    return_type = 'tuple'/'table', -- (NYI) - retval of tuples/keys.
+    return_type = 'tuple'/'table'/'batch', -- (NYI) - retval of tuples/keys.
+                  -- 'batch' returns one object per decoded batch
     batch_count -- (NYI) - number of tuples to load at 1 batch
     throw = true/false/nil (NYI) - throw error if can't convert field
     -- for xlog
     lsn_from = (number)
     lsn_to   = (number)/
+    lsn_index = 'none'/'scan'/'file' -- how rows before lsn_from are skipped:
+                -- decoded and checked ('none'), only headers are read
+                -- ('scan', default) or headers are read starting from
+                -- the nearest entry of '<xlog>.lsnidx' sidecar index,
+                -- which is created or extended on the way ('file')
+    -- for xlog/snap
+    io = 'stdio'/'mmap' -- read rows with fread or straight from file mapping
+         -- (compressed files are always read with stdio)
+    verify = 'full'/'header'/'none' -- which row checksums to verify
+    verify_skipped = true/false -- verify data checksum of rows that are
+                     -- skipped by space or lsn before they are decoded
+                     -- (true by default, only with verify = 'full')
+    alloc = 'malloc'/'arena' -- allocate rows being parsed with malloc
+            -- (default) or in per-batch arena, released at once
+    hugepages = true/false -- back arena with transparent huge pages
+    prefetch = true/false -- read and decode rows in background thread
+    budget = xlog.decoder_budget(bytes) -- memory budget shared by files
+             -- decoded in background (prefetch), decoders of files that
+             -- aren't consumed yet wait while it's exhausted
+    -- for snap
+    threads = (number) -- decode snapshot in that many worker threads
+                       -- (always uses 'mmap', 0 - decode in tx thread,
+                       -- compressed snapshot is decoded as with prefetch)
+    -- for xlog/snap
+    offset = (number) -- start reading at offset returned by xlog.offset()
+             -- for the same file (rows before lsn_from are still skipped)
+    salvage = true/false -- skip damaged regions of file instead of
+              -- failing, they are returned by xlog.damaged() (rows with
+              -- bad data checksum are detected according to 'verify')
 }
 ]]--
 
+local function lsn_index_convert(lsn_index)
+    if lsn_index == nil or lsn_index == 'scan' or lsn_index == 'SCAN' then
+        return ffi.C.LSN_INDEX_SCAN
+    elseif lsn_index == 'none' or lsn_index == 'NONE' then
+        return ffi.C.LSN_INDEX_NONE
+    elseif lsn_index == 'file' or lsn_index == 'FILE' then
+        return ffi.C.LSN_INDEX_FILE
+    end
+    error("bad 'config.lsn_index' value, expected 'none'/'scan'/'file', " ..
+          "got '%s'", tostring(lsn_index))
+end
+
+local function alloc_convert(alloc)
+    if alloc == nil or alloc == 'malloc' or alloc == 'MALLOC' then
+        return ffi.C.ROW_ALLOC_MALLOC
+    elseif alloc == 'arena' or alloc == 'ARENA' then
+        return ffi.C.ROW_ALLOC_ARENA
+    end
+    error("bad 'config.alloc' value, expected 'malloc'/'arena', got '%s'",
+          tostring(alloc))
+end
+
 local function parse_cfg(cfg, ext, iter)
     cfg = cfg or {}
     checkt_xc(cfg, 'table', 'config')
@@ -216,6 +415,17 @@ local function parse_cfg(cfg, ext, iter)
     checkt_xc(cfg.throw, {'boolean', 'nil'}, 'config.throw')
     checkt_xc(cfg.lsn_from, {'number', 'nil'}, 'config.lsn_from')
     checkt_xc(cfg.lsn_to, {'number', 'nil'}, 'config.lsn_to')
+    checkt_xc(cfg.lsn_index, {'string', 'nil'}, 'config.lsn_index')
+    checkt_xc(cfg.io, {'string', 'nil'}, 'config.io')
+    checkt_xc(cfg.verify, {'string', 'nil'}, 'config.verify')
+    checkt_xc(cfg.verify_skipped, {'boolean', 'nil'}, 'config.verify_skipped')
+    checkt_xc(cfg.threads, {'number', 'nil'}, 'config.threads')
+    checkt_xc(cfg.prefetch, {'boolean', 'nil'}, 'config.prefetch')
+    checkt_xc(cfg.alloc, {'string', 'nil'}, 'config.alloc')
+    checkt_xc(cfg.hugepages, {'boolean', 'nil'}, 'config.hugepages')
+    checkt_xc(cfg.offset, {'number', 'nil'}, 'config.offset')
+    checkt_xc(cfg.salvage, {'boolean', 'nil'}, 'config.salvage')
+    checkt_xc(cfg.follow, {'boolean', 'nil'}, 'config.follow')
 
     local convert = cfg.convert or false
     local helper = iter_helper_t()
@@ -224,6 +434,12 @@ local function parse_cfg(cfg, ext, iter)
     helper[0].batch_count = cfg.batch_count or 1
     helper[0].lsn_from = cfg.lsn_from or 1
     helper[0].lsn_to = cfg.lsn_to or UINT64_MAX
+    helper[0].lsn_index = lsn_index_convert(cfg.lsn_index)
+    helper[0].verify_skipped = cfg.verify_skipped ~= false and 1 or 0
+    helper[0].alloc = alloc_convert(cfg.alloc)
+    helper[0].hugepages = cfg.hugepages and 1 or 0
+    helper[0].offset = cfg.offset or 0
+    helper[0].salvage = cfg.salvage and 1 or 0
     local return_type = cfg.return_type or 'table'
     if return_type == 'table' or return_type == 'TABLE' then
         helper[0].return_type = ffi.C.F_RET_TABLE
@@ -232,14 +448,17 @@ local function parse_cfg(cfg, ext, iter)
             error("Tuples are expected, but 'box.cfg' is not inited", 3)
         end
         helper[0].return_type = ffi.C.F_RET_TUPLE
+    elseif return_type == 'batch' or return_type == 'BATCH' then
+        helper[0].return_type = ffi.C.F_RET_BATCH
     else
-        error("bad 'config.return_type' value, expected 'table'/'tuple', got '%s'",
-              return_type)
+        error("bad 'config.return_type' value, expected " ..
+              "'table'/'tuple'/'batch', got '%s'", return_type)
     end
     local space_def_arr = nil
     local last = nil
     if cfg.spaces then
         space_def_arr = checkt_spaces_table_xc(cfg.spaces, ext, convert, cfg.throw)
+        local map_size = 0
         for _, v in ipairs(space_def_arr) do
             table.insert(hold, v[0])
             table.insert(hold, v[0].schema)
@@ -250,15 +469,35 @@ local function parse_cfg(cfg, ext, iter)
                 last[0].next = v
             end
             last = v
+            map_size = math.max(map_size, v[0].space_no + 1)
         end
+        -- dense array of definitions, indexed by space number
+        local defs = ffi.new(space_def_ptr_arr_t, map_size)
+        table.insert(hold, defs)
+        for _, v in ipairs(space_def_arr) do
+            defs[v[0].space_no] = v
+        end
+        helper[0].map.defs = defs
+        helper[0].map.size = map_size
+        helper[0].map.filter = map_size > 0 and 1 or 0
     end
     table.insert(hold, iter)
     local function gc_hold(obj)
         -- Temporary hack for gc (do not give GC to sweep space_def/iter)
         log.debug("hold object is destroyed")
+        -- iter is kept, but its last row mustn't point to freed arena
+        ffi.C.iter_helper_destroy(obj)
         return hold
     end
     ffi.gc(helper, gc_hold)
+    -- rows of iterator are parsed in tx thread, decoder threads create
+    -- arenas of their own
+    if iter ~= nil and helper[0].alloc == ffi.C.ROW_ALLOC_ARENA then
+        helper[0].arena = ffi.C.row_arena_new(cfg.hugepages or false)
+        if helper[0].arena == nil then
+            error("Failed to allocate memory for row arena")
+        end
+    end
     return helper
 end
 
@@ -268,53 +507,355 @@ local function iterate(func)
     end
 end
 
-local function reader_open(name, cfg)
+local function io_convert(io)
+    if io == nil or io == 'stdio' or io == 'STDIO' then
+        return ffi.C.TNT_LOG_IO_STDIO
+    elseif io == 'mmap' or io == 'MMAP' then
+        return ffi.C.TNT_LOG_IO_MMAP
+    end
+    error("bad 'config.io' value, expected 'stdio'/'mmap', got '%s'",
+          tostring(io))
+end
+
+local function verify_convert(verify)
+    if verify == nil or verify == 'full' or verify == 'FULL' then
+        return ffi.C.TNT_LOG_VERIFY_FULL
+    elseif verify == 'header' or verify == 'HEADER' then
+        return ffi.C.TNT_LOG_VERIFY_HEADER
+    elseif verify == 'none' or verify == 'NONE' then
+        return ffi.C.TNT_LOG_VERIFY_NONE
+    end
+    error("bad 'config.verify' value, expected 'full'/'header'/'none', got '%s'",
+          tostring(verify))
+end
+
+local function check_name(name)
     checkt_xc(name, 'string', 'name')
-    local ext = name:sub(-4, -1)
+    -- compressed file has extension before suffix of compression
+    local ext = name:sub(1, tonumber(ffi.C.tnt_log_name_len(name))):sub(-4, -1)
     if ext ~= 'xlog' and ext ~= 'snap' then
         error("bad extension name, expected 'snap'/'xlog', got '%s'", ext)
     end
+    if ffi.C.zstream_compressed(name) and not ffi.C.zstream_supported(name) then
+        error("Cannot open '%s': compression isn't supported by this build",
+              name)
+    end
+    return ext
+end
+
+-- Open file, rows of which are decoded in other threads, returns
+-- param for internal.batch_pairs/internal.batch_apply
+local function batches_open(name, cfg)
+    local ext = check_name(name)
+    local io = io_convert(type(cfg) == 'table' and cfg.io or nil)
+    local verify = verify_convert(type(cfg) == 'table' and cfg.verify or nil)
+    local threads = type(cfg) == 'table' and cfg.threads or 0
+    checkt_xc(threads, 'number', 'config.threads')
 
     local log_type = ffi.C.tnt_log_guess(name)
-    if log_type == ffi.C.TNT_LOG_SNAPSHOT then
-        local log = ffi.C.tnt_snapshot(nil)
-        if log == nil then
-            error("Failed to allocate memory for snapshot")
-        end
-        ffi.gc(log, ffi.C.tnt_stream_free)
-        if ffi.C.tnt_snapshot_open(log, name) == -1 then
-            local errstr = ffi.string(ffi.C.tnt_snapshot_strerror(log))
-            error("Cannot open snapshot '%s': %s", name, errstr)
-        end
-        local iter = ffi.C.tnt_iter_storage(nil, log)
-        if iter == nil then
-            error("failed to allocate memory for snap iterator")
+    -- compressed snapshot can't be mapped and split between threads, it's
+    -- decoded in one background thread
+    if log_type == ffi.C.TNT_LOG_SNAPSHOT and threads > 0 and
+       not ffi.C.zstream_compressed(name) then
+        local helper = parse_cfg(cfg, ext, nil)
+        local pipe = internal.snap_pipeline(name, helper, threads, verify)
+        return {pipe, helper}
+    elseif log_type == ffi.C.TNT_LOG_SNAPSHOT or
+           log_type == ffi.C.TNT_LOG_XLOG then
+        local helper = parse_cfg(cfg, ext, nil)
+        local budget = type(cfg) == 'table' and cfg.budget or nil
+        local decoder = internal.log_decoder(name, helper, log_type, io,
+                                             verify, budget)
+        return {decoder, helper}
+    end
+    error("can't detect filetype")
+end
+
+-- Open file 'source' (name or descriptor) read by rows in tx thread
+local function stream_open(log_type, source, ext, io, verify, cfg)
+    local snapshot = log_type == ffi.C.TNT_LOG_SNAPSHOT
+    local what = snapshot and 'snapshot' or 'xlog'
+    local name = type(source) == 'number' and 'fd ' .. source or source
+    local log = snapshot and ffi.C.tnt_snapshot(nil) or ffi.C.tnt_xlog(nil)
+    if log == nil then
+        error("Failed to allocate memory for %s", what)
+    end
+    ffi.gc(log, ffi.C.tnt_stream_free)
+    local rc
+    if type(source) == 'number' then
+        rc = ffi.C.xlog_stream_open_fd(log, source, snapshot and 1 or 0)
+    elseif snapshot then
+        rc = ffi.C.tnt_snapshot_open_io(log, source, io)
+    else
+        rc = ffi.C.tnt_xlog_open_io(log, source, io)
+    end
+    if rc == -1 then
+        local errstr = ffi.string(snapshot and
+                                  ffi.C.tnt_snapshot_strerror(log) or
+                                  ffi.C.tnt_xlog_strerror(log))
+        error("Cannot open %s '%s': %s", what, name, errstr)
+    end
+    local iter
+    if snapshot then
+        ffi.C.tnt_snapshot_set_verify(log, verify)
+        iter = ffi.C.tnt_iter_storage(nil, log)
+    else
+        ffi.C.tnt_xlog_set_verify(log, verify)
+        iter = ffi.C.tnt_iter_request(nil, log)
+    end
+    if iter == nil then
+        error("failed to allocate memory for %s iterator",
+              snapshot and 'snap' or 'xlog')
+    end
+    local helper = parse_cfg(cfg, ext, iter)
+    ffi.gc(iter, ffi.C.tnt_iter_free)
+    ffi.C.xlog_stream_set_filter(log, helper, snapshot and 1 or 0)
+    if not snapshot and type(cfg) == 'table' and cfg.follow then
+        ffi.C.xlog_stream_follow(log)
+    end
+    if helper[0].offset ~= 0 then
+        if ffi.C.xlog_stream_seek(log, helper, snapshot and 1 or 0) ~= 0 then
+            error("Cannot seek %s '%s' to offset %s", what, name,
+                  tostring(tonumber(helper[0].offset)))
         end
-        local helper = parse_cfg(cfg, ext, iter)
-        ffi.gc(iter, ffi.C.tnt_iter_free)
+    elseif not snapshot and
+           ffi.C.lsn_index_seek_xlog(log, type(source) == 'string' and
+                                     source or nil, helper[0].lsn_from,
+                                     helper[0].lsn_index) ~= 0 then
+        -- lsn index of a descriptor is never read or saved, it's scanned
+        error("Cannot seek xlog '%s' to lsn %s", name,
+              tostring(tonumber(helper[0].lsn_from)))
+    end
+    if snapshot then
         -- return internal.snap_pairs, {log, helper}, 0
         return fun.wrap(internal.snap_pairs, {log, helper}, 0)
-    elseif log_type == ffi.C.TNT_LOG_XLOG then
-        local log = ffi.C.tnt_xlog(nil)
-        if log == nil then
-            error("Failed to allocate memory for xlog")
-        end
-        ffi.gc(log, ffi.C.tnt_stream_free)
-        if ffi.C.tnt_xlog_open(log, name) == -1 then
-            local errstr = ffi.string(ffi.C.tnt_xlog_strerror(log))
-            error("Cannot open xlog '%s': %s", name, errstr)
+    end
+    return fun.wrap(internal.xlog_pairs, {log, helper}, 0)
+end
+
+local function reader_open(name, cfg)
+    local ext = check_name(name)
+    local io = io_convert(type(cfg) == 'table' and cfg.io or nil)
+    local verify = verify_convert(type(cfg) == 'table' and cfg.verify or nil)
+
+    local threads = type(cfg) == 'table' and cfg.threads or 0
+    checkt_xc(threads, 'number', 'config.threads')
+    local prefetch = type(cfg) == 'table' and cfg.prefetch or false
+    local return_type = type(cfg) == 'table' and cfg.return_type or nil
+
+    local log_type = ffi.C.tnt_log_guess(name)
+    if type(cfg) == 'table' and cfg.follow then
+        if log_type ~= ffi.C.TNT_LOG_XLOG or ffi.C.zstream_compressed(name) then
+            error("Cannot follow '%s': only plain xlogs can be followed",
+                  name)
         end
-        local iter = ffi.C.tnt_iter_request(nil, log)
-        if iter == nil then
-            error("failed to allocate memory for xlog iterator")
+        if prefetch or threads > 0 or return_type == 'batch' or
+           return_type == 'BATCH' then
+            error("'config.follow' can't be used with 'config.prefetch', " ..
+                  "'config.threads' and batches")
         end
-        local helper = parse_cfg(cfg, ext, iter)
-        ffi.gc(iter, ffi.C.tnt_iter_free)
-        return fun.wrap(internal.xlog_pairs, {log, helper}, 0)
+        -- mapping doesn't grow with file
+        io = ffi.C.TNT_LOG_IO_STDIO
+    end
+    if return_type == 'batch' or return_type == 'BATCH' then
+        return fun.wrap(internal.batch_next, batches_open(name, cfg), 0)
+    elseif prefetch or (log_type == ffi.C.TNT_LOG_SNAPSHOT and threads > 0) then
+        return fun.wrap(internal.batch_pairs, batches_open(name, cfg), 0)
+    elseif log_type == ffi.C.TNT_LOG_SNAPSHOT or
+           log_type == ffi.C.TNT_LOG_XLOG then
+        return stream_open(log_type, name, ext, io, verify, cfg)
     end
     error("can't detect filetype")
 end
 
+--[[
+Read file from descriptor 'fd' (e.g. 0 for stdin or a pipe), 'log_type'
+is 'snap' or 'xlog':
+
+    for _, row in xlog.open_fd(fd, 'xlog', cfg) do ... end
+
+Descriptor needn't be seekable: it's read ahead in 1 MB chunks by a
+background thread and offsets are counted by the reader, so 'offset'
+and 'lsn_from' skip rows forward ('lsn_index' is always 'scan').
+Descriptor is duplicated and stays open. Rows are read in tx thread, so
+'return_type' = 'batch', 'prefetch' and 'threads' aren't supported.
+]]--
+
+local function reader_open_fd(fd, log_type, cfg)
+    checkt_xc(fd, 'number', 'fd')
+    if type(cfg) == 'table' and cfg.follow then
+        error("'config.follow' isn't supported for fd")
+    end
+    checkt_xc(log_type, 'string', 'log_type')
+    if log_type ~= 'xlog' and log_type ~= 'snap' then
+        error("bad log type, expected 'snap'/'xlog', got '%s'", log_type)
+    end
+    local return_type = type(cfg) == 'table' and cfg.return_type or nil
+    if return_type == 'batch' or return_type == 'BATCH' then
+        error("'config.return_type' = 'batch' isn't supported for fd")
+    end
+    local verify = verify_convert(type(cfg) == 'table' and cfg.verify or nil)
+    return stream_open(log_type == 'snap' and ffi.C.TNT_LOG_SNAPSHOT or
+                       ffi.C.TNT_LOG_XLOG, fd, log_type,
+                       ffi.C.TNT_LOG_IO_STDIO, verify, cfg)
+end
+
+--[[
+With return_type = 'batch' every iteration returns one batch object:
+
+    #batch / batch:count() - number of rows
+    batch:row(i)           - i-th row (1-based) as a table, tuples and keys
+                             are box tuples
+    batch:rows()           - 'const struct batch_row *' (0-based)
+    batch:data()           - 'const char *', row body is msgpack at
+                             [data + row.data, data + row.ops), update
+                             operations are at [data + row.ops, data + row.end)
+
+Pointers are valid while batch object is referenced.
+]]--
+
+--[[
+Apply rows to spaces without creating Lua objects:
+
+    local plan = xlog.apply_plan({[space_no] = {space_id, index_id}, ...})
+    local param = xlog.batches_open(name, cfg)
+    local count, last_lsn = xlog.apply(param, plan, lsn, commit, throw)
+
+apply() applies up to 'cfg.batch_count' rows, xlog rows with lsn <= 'lsn'
+are skipped. It returns nothing at the end of file. If 'before_commit'
+is set, it's called as before_commit(count, last_lsn) in the transaction
+of the rows (it mustn't yield).
+]]--
+
+local function apply(param, plan, lsn, commit, throw, before_commit)
+    return internal.batch_apply(param, plan, lsn or 0, commit or false,
+                                throw or false, before_commit)
+end
+
+--[[
+Position of reading, that can be saved to restart reading of the same
+file later (e.g. by another process):
+
+    local offset = xlog.offset(iter) -- iterator returned by xlog.open()
+                                     -- or param of xlog.batches_open()
+    ...
+    iter = xlog.open(name, {offset = offset, ...})
+
+All rows before it were returned, rows after it were not (rows of
+batches that were returned only in part are returned again).
+]]--
+
+local function offset(obj)
+    local param = obj.param or obj
+    return tonumber(param[2][0].offset)
+end
+
+--[[
+Xlog that is being written is read with cfg.follow = true: iteration
+ends where written rows end, and when it's started again with the same
+iterator, rows appended since are returned. xlog.complete(iter) is true
+once end of file marker is read, the file won't grow after it.
+xlog.watch(dir) and xlog.watch_wait(watch, timeout) let fiber wait until
+files of directory are created or appended to (with inotify, where it's
+available) or timeout passes, watch_wait() returns true if they were.
+]]--
+
+local function complete(obj)
+    local param = obj.param or obj
+    return ffi.C.xlog_stream_complete(param[1]) ~= 0
+end
+
+--[[
+Regions skipped by 'salvage' before rows returned so far:
+
+    for _, d in ipairs(xlog.damaged(iter)) do
+        -- d.from, d.to - offsets of region in file
+        -- d.lsn_before - lsn of the last row before it (0 - none)
+        -- d.lsn_after - lsn of the first row after it (0 - end of file)
+    end
+
+Every region is returned once.
+]]--
+
+local function damaged(obj)
+    local param = obj.param or obj
+    return internal.damaged(param[2])
+end
+
+--[[
+Order-independent digests of tuples (see migrate.verify):
+
+    local d = xlog.digest(threads) -- hash in that many threads (0 - inline)
+    xlog.digest_add(d, slot, msgpack.encode(tuple))
+    local count, last_key = xlog.digest_scan(d, slot, space_id, index_id,
+                                             key, after, stop_key, parts,
+                                             limit)
+    xlog.digest_wait(d) -- if digest_scan() stopped early
+    local count, hash = xlog.digest_result(d, slot)
+
+digest_scan() adds up to 'limit' tuples of index from msgpack 'key'
+(excluding it if 'after' is set) up to 'stop_key' (excluding, nil - up to
+the end), returns last_key built from fields 'parts' to continue from, or
+nothing at the end. It doesn't yield.
+]]--
+
+--[[
+Workload profile of 1.5 files, read by headers without decoding rows
+(see migrate.analyze):
+
+    local res = xlog.analyze({path, ...}, {
+        spaces = {...}, -- schema/ischema of spaces to check NUM fields
+                        -- and convert hot keys, as for xlog.open()
+        threads = (number), -- files are read by that many threads
+        top = (number), -- hot keys reported per space
+        verify = 'full'/'header'/'none'
+    })
+
+Hot keys are decoded tables.
+]]--
+
+local function analyze(files, cfg)
+    cfg = cfg or {}
+    checkt_xc(files, 'table', 'files')
+    checkt_xc(cfg, 'table', 'config')
+    checkt_xc(cfg.threads, {'number', 'nil'}, 'config.threads')
+    checkt_xc(cfg.top, {'number', 'nil'}, 'config.top')
+    local helper = parse_cfg({spaces = cfg.spaces,
+                              convert = cfg.spaces ~= nil}, 'xlog', nil)
+    local res = internal.analyze(files, helper, cfg.threads or 1,
+                                 cfg.top or 0, verify_convert(cfg.verify))
+    for _, s in pairs(res.spaces) do
+        for _, h in ipairs(s.hot_keys) do
+            h.key = msgpack.decode(h.key)
+        end
+    end
+    return res
+end
+
+-- Change 'batch_count' of file that is being read, takes effect with
+-- the next batch
+local function set_batch_count(obj, count)
+    local param = obj.param or obj
+    param[2][0].batch_count = count
+end
+
 return {
-    open = reader_open
+    open = reader_open,
+    open_fd = reader_open_fd,
+    batches_open = batches_open,
+    decoder_budget = internal.decoder_budget,
+    apply_plan = internal.apply_plan,
+    apply = apply,
+    offset = offset,
+    complete = complete,
+    watch = internal.watch,
+    watch_wait = internal.watch_wait,
+    damaged = damaged,
+    digest = internal.digest,
+    digest_add = internal.digest_add,
+    digest_scan = internal.digest_scan,
+    digest_wait = internal.digest_wait,
+    digest_result = internal.digest_result,
+    analyze = analyze,
+    set_batch_count = set_batch_count
 }
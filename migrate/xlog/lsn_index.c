@@ -0,0 +1,203 @@
+#include "lsn_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include <third_party/crc32.h>
+
+#include <tarantool/tnt_xlog.h>
+
+#define LSN_INDEX_MAGIC "LSNIDX1\n"
+
+struct lsn_index_header {
+	char magic[8];
+	uint32_t count;
+	/* crc32c of entries */
+	uint32_t crc32;
+} __attribute__((packed));
+
+static int
+lsn_index_add(struct lsn_index *idx, uint64_t lsn, uint64_t offset)
+{
+	if (idx->count == idx->capacity) {
+		uint32_t capacity = idx->capacity ? idx->capacity * 2 : 64;
+		void *entries = realloc(idx->entries,
+					capacity * sizeof(*idx->entries));
+		if (entries == NULL)
+			return -1;
+		idx->entries = entries;
+		idx->capacity = capacity;
+	}
+	idx->entries[idx->count].lsn = lsn;
+	idx->entries[idx->count].offset = offset;
+	idx->count++;
+	idx->dirty = 1;
+	return 0;
+}
+
+/* last entry with lsn <= 'lsn' */
+static struct lsn_index_entry *
+lsn_index_find(struct lsn_index *idx, uint64_t lsn)
+{
+	uint32_t lo = 0, hi = idx->count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (idx->entries[mid].lsn <= lsn)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo > 0 ? &idx->entries[lo - 1] : NULL;
+}
+
+static void
+lsn_index_load(struct lsn_index *idx, const char *path)
+{
+	char name[PATH_MAX];
+	int len = snprintf(name, sizeof(name), "%s%s", path, LSN_INDEX_SUFFIX);
+	if (len < 0 || (size_t)len >= sizeof(name))
+		return;
+	FILE *f = fopen(name, "r");
+	if (f == NULL)
+		return;
+	struct lsn_index_header h;
+	struct stat st;
+	if (fread(&h, sizeof(h), 1, f) != 1 ||
+	    memcmp(h.magic, LSN_INDEX_MAGIC, sizeof(h.magic)) != 0 ||
+	    h.count == 0 || fstat(fileno(f), &st) == -1 ||
+	    (uint64_t)st.st_size != sizeof(h) +
+				    (uint64_t)h.count * sizeof(*idx->entries))
+		goto out;
+	idx->entries = malloc(h.count * sizeof(*idx->entries));
+	if (idx->entries == NULL)
+		goto out;
+	if (fread(idx->entries, sizeof(*idx->entries), h.count, f) != h.count ||
+	    crc32c(0, (unsigned char *)idx->entries,
+		   h.count * sizeof(*idx->entries)) != h.crc32) {
+		free(idx->entries);
+		idx->entries = NULL;
+		goto out;
+	}
+	idx->count = idx->capacity = h.count;
+out:
+	fclose(f);
+}
+
+/*
+ * Index is written to temporary file and renamed, errors are ignored,
+ * it isn't saved at all if names don't fit into PATH_MAX.
+ */
+static void
+lsn_index_save(struct lsn_index *idx, const char *path)
+{
+	char name[PATH_MAX], tmp[PATH_MAX];
+	int len = snprintf(name, sizeof(name), "%s%s", path, LSN_INDEX_SUFFIX);
+	if (len < 0 || (size_t)len >= sizeof(name))
+		return;
+	len = snprintf(tmp, sizeof(tmp), "%s.inprogress", name);
+	if (len < 0 || (size_t)len >= sizeof(tmp))
+		return;
+	FILE *f = fopen(tmp, "w");
+	if (f == NULL)
+		return;
+	struct lsn_index_header h;
+	memcpy(h.magic, LSN_INDEX_MAGIC, sizeof(h.magic));
+	h.count = idx->count;
+	h.crc32 = crc32c(0, (unsigned char *)idx->entries,
+			 idx->count * sizeof(*idx->entries));
+	int rc = (fwrite(&h, sizeof(h), 1, f) == 1 &&
+		  fwrite(idx->entries, sizeof(*idx->entries), idx->count,
+			 f) == idx->count) ? 0 : -1;
+	if (fclose(f) != 0 || rc != 0 || rename(tmp, name) != 0)
+		remove(tmp);
+}
+
+int
+lsn_index_read_hdr(struct tnt_log *l, uint64_t size, uint64_t offset,
+		   struct tnt_log_header_v11 *hdr)
+{
+	char buf[sizeof(tnt_log_marker_v11) + sizeof(*hdr)];
+	if (offset + sizeof(buf) > size)
+		return -1;
+	if (l->io == TNT_LOG_IO_MMAP) {
+		memcpy(buf, l->map + offset, sizeof(buf));
+	} else if (fseeko(l->fd, offset, SEEK_SET) != 0 ||
+		   fread(buf, sizeof(buf), 1, l->fd) != 1) {
+		return -1;
+	}
+	uint32_t marker;
+	memcpy(&marker, buf, sizeof(marker));
+	if (marker != tnt_log_marker_v11)
+		return -1;
+	memcpy(hdr, buf + sizeof(marker), sizeof(*hdr));
+	/* header crc is checked regardless of verification level, as
+	 * offset of the next row depends on it */
+	uint32_t crc32_hdr =
+		crc32c(0, (unsigned char *)hdr + sizeof(uint32_t),
+		       sizeof(*hdr) - sizeof(uint32_t));
+	if (crc32_hdr != hdr->crc32_hdr ||
+	    offset + sizeof(buf) + hdr->len > size)
+		return -1;
+	return 0;
+}
+
+int
+lsn_index_seek(struct tnt_log *l, const char *path, uint64_t lsn,
+	       enum lsn_index_mode mode)
+{
+	if (mode == LSN_INDEX_NONE || l->type != TNT_LOG_XLOG || lsn <= 1)
+		return 0;
+	uint64_t size = l->map_size;
+	if (l->io != TNT_LOG_IO_MMAP && fileno(l->fd) == -1) {
+		/* size of decompressed or piped stream isn't known and it
+		 * can't be read back if index doesn't match, so it's only
+		 * scanned */
+		size = UINT64_MAX;
+		mode = LSN_INDEX_SCAN;
+	} else if (l->io != TNT_LOG_IO_MMAP) {
+		struct stat st;
+		if (fstat(fileno(l->fd), &st) == -1)
+			return -1;
+		size = st.st_size;
+	}
+	struct lsn_index idx;
+	memset(&idx, 0, sizeof(idx));
+	struct tnt_log_header_v11 hdr;
+	uint64_t offset = l->begin_offset;
+	if (mode == LSN_INDEX_FILE) {
+		lsn_index_load(&idx, path);
+		struct lsn_index_entry *e = lsn_index_find(&idx, lsn);
+		if (e != NULL && lsn_index_read_hdr(l, size, e->offset,
+						    &hdr) == 0 &&
+		    hdr.lsn == e->lsn) {
+			offset = e->offset;
+		} else if (e != NULL) {
+			/* index doesn't match xlog, it's built again */
+			idx.count = 0;
+			idx.dirty = 1;
+		}
+	}
+	while (lsn_index_read_hdr(l, size, offset, &hdr) == 0 &&
+	       hdr.lsn < lsn) {
+		if (mode == LSN_INDEX_FILE &&
+		    (idx.count == 0 ||
+		     hdr.lsn >= idx.entries[idx.count - 1].lsn +
+				LSN_INDEX_STEP))
+			lsn_index_add(&idx, hdr.lsn, offset);
+		offset += sizeof(tnt_log_marker_v11) + sizeof(hdr) + hdr.len;
+	}
+	if (idx.dirty && idx.count > 0)
+		lsn_index_save(&idx, path);
+	free(idx.entries);
+	return tnt_log_seek(l, offset);
+}
+
+int
+lsn_index_seek_xlog(struct tnt_stream *s, const char *path, uint64_t lsn,
+		    enum lsn_index_mode mode)
+{
+	return lsn_index_seek(&TNT_SXLOG_CAST(s)->log, path, lsn, mode);
+}
@@ -0,0 +1,75 @@
+#ifndef   _XLOG_LSN_INDEX_H_
+#define   _XLOG_LSN_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <tarantool/tnt.h>
+#include <tarantool/tnt_log.h>
+
+/*
+ * Positioning of xlog at the first row with given lsn.
+ *
+ * Rows before it are skipped by reading only their headers: data is
+ * neither read nor checked. A sparse (lsn, offset) index with an entry
+ * every LSN_INDEX_STEP rows may be kept in a sidecar file next to the
+ * xlog ('<xlog>.lsnidx'), so that the next positioning starts from the
+ * nearest entry instead of the beginning of file. Index is extended
+ * when rows after its last entry are skipped, and entries are checked
+ * against the xlog before use.
+ */
+
+enum lsn_index_mode {
+	/* read and check all rows, skip them by lsn */
+	LSN_INDEX_NONE = 0,
+	/* skip rows by headers */
+	LSN_INDEX_SCAN,
+	/* skip rows by headers, starting from sidecar index entry */
+	LSN_INDEX_FILE
+};
+
+#ifndef LSN_INDEX_STEP
+#define LSN_INDEX_STEP 4096
+#endif
+
+#define LSN_INDEX_SUFFIX ".lsnidx"
+
+struct lsn_index_entry {
+	uint64_t lsn;
+	uint64_t offset;
+};
+
+struct lsn_index {
+	struct lsn_index_entry *entries;
+	uint32_t count;
+	uint32_t capacity;
+	/* set if entries were added since index was loaded */
+	int dirty;
+};
+
+/*
+ * Read header of row at 'offset' of opened log 'l' of 'size' bytes.
+ * Returns -1 if there is no valid header or row data doesn't fit into
+ * file.
+ */
+int
+lsn_index_read_hdr(struct tnt_log *l, uint64_t size, uint64_t offset,
+		   struct tnt_log_header_v11 *hdr);
+
+/*
+ * Seek opened xlog 'l' (file 'path') to the first row with lsn >= 'lsn'.
+ * Must be called before the first row is read. If a row header can't
+ * be parsed, log is positioned at it and the error is reported by the
+ * next read. Returns -1 if file can't be sought.
+ */
+int
+lsn_index_seek(struct tnt_log *l, const char *path, uint64_t lsn,
+	       enum lsn_index_mode mode);
+
+/* lsn_index_seek() for tnt_xlog() stream */
+int
+lsn_index_seek_xlog(struct tnt_stream *s, const char *path, uint64_t lsn,
+		    enum lsn_index_mode mode);
+
+#endif /* _XLOG_LSN_INDEX_H_ */
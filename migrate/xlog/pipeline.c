@@ -0,0 +1,335 @@
+#include "pipeline.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "row_filter.h"
+#include "xlog.h"
+
+#ifndef PIPELINE_CHUNK_SIZE
+#define PIPELINE_CHUNK_SIZE (4 * 1024 * 1024)
+#endif
+
+/* rows of other chunks and spaces that aren't read are skipped */
+static enum tnt_log_filter_result
+pipeline_filter(void *arg, const struct tnt_log_header_v11 *hdr,
+		uint32_t space)
+{
+	struct pipeline_worker *w = arg;
+	if (w->log.current_offset >= w->end) {
+		w->next_row = w->log.current_offset;
+		return TNT_LOG_FILTER_STOP;
+	}
+	return row_filter(w->p->type, w->p->spaces, 0, UINT64_MAX, hdr, space);
+}
+
+/*
+ * Decode all rows that start in chunk, reading starts at 'offset' or
+ * at the first row found in chunk if it's -1.
+ */
+static int
+pipeline_process_chunk(struct pipeline_worker *w, uint64_t chunk,
+		       struct batch *b, off_t offset)
+{
+	struct pipeline *p = w->p;
+	struct tnt_log *l = &w->log;
+	off_t start = p->begin + chunk * p->chunk_size;
+	off_t end = start + p->chunk_size;
+	if (end > p->size)
+		end = p->size;
+	w->end = end;
+	w->next_row = p->size;
+	if (offset == -1)
+		offset = chunk > 0 ? tnt_log_sync(l, start) : start;
+	if (offset == -1)
+		offset = p->size;
+	b->first_row = b->next_row = offset;
+	if (offset >= end)
+		return 0;
+	tnt_log_seek(l, offset);
+	for (;;) {
+		char *buf = NULL;
+		uint32_t size = 0;
+		int rc = l->read(l, &buf, &size);
+		if (rc == 1)
+			break;
+		if (rc != 0)
+			return batch_error(b, "parsing failed: %s",
+					   tnt_log_strerror(l));
+		/* row may be preceded by garbage, so it's start is
+		 * calculated from it's end */
+		off_t row_start = l->offset - size -
+				  sizeof(struct tnt_log_header_v11) -
+				  sizeof(tnt_log_marker_v11);
+		if (row_start >= end) {
+			w->next_row = row_start;
+			break;
+		}
+		if (batch_add_snap_row(b, p->spaces, l->current.hdr.lsn,
+				       l->current.hdr.tm, buf, size) != 0)
+			return -1;
+		b->offset = l->offset;
+	}
+	b->next_row = w->next_row;
+	return 0;
+}
+
+static void *
+pipeline_worker_f(void *arg)
+{
+	struct pipeline_worker *w = arg;
+	struct pipeline *p = w->p;
+	struct batch *b = NULL;
+	pthread_mutex_lock(&p->mutex);
+	for (;;) {
+		while (!p->stop && p->next_chunk < p->chunk_count &&
+		       p->next_chunk >= p->next_take + p->window)
+			pthread_cond_wait(&p->cond, &p->mutex);
+		if (p->stop || p->next_chunk >= p->chunk_count)
+			break;
+		if (b == NULL && p->free_count > 0)
+			b = p->free[--p->free_count];
+		if (b == NULL) {
+			pthread_mutex_unlock(&p->mutex);
+			b = batch_new();
+			pthread_mutex_lock(&p->mutex);
+			if (b == NULL) {
+				p->stop = true;
+				pthread_cond_broadcast(&p->cond);
+				break;
+			}
+			/* state could change while the lock was released */
+			continue;
+		}
+		uint64_t chunk = p->next_chunk++;
+		pthread_mutex_unlock(&p->mutex);
+
+		batch_reset(b);
+		b->seq = chunk;
+		b->wide_num = p->wide_num;
+		w->filling = b;
+		/*
+		 * failed chunk doesn't stop workers: it may be misplaced
+		 * and decoded again by consumer
+		 */
+		pipeline_process_chunk(w, chunk, b, -1);
+
+		pthread_mutex_lock(&p->mutex);
+		p->slots[chunk % p->window] = b;
+		b = NULL;
+		pthread_cond_broadcast(&p->cond);
+	}
+	pthread_mutex_unlock(&p->mutex);
+	batch_delete(b);
+	return NULL;
+}
+
+struct pipeline *
+pipeline_new(const char *path, enum tnt_log_type type,
+	     const struct space_map *spaces, int threads,
+	     enum tnt_log_verify verify, bool verify_skipped, bool salvage,
+	     bool wide_num, uint64_t offset, char *errbuf, size_t errlen)
+{
+	if (threads < 1)
+		threads = 1;
+	struct pipeline *p = calloc(1, sizeof(struct pipeline));
+	if (p == NULL)
+		goto error_mem;
+	p->type = type;
+	p->spaces = spaces;
+	p->wide_num = wide_num;
+	p->worker_count = threads;
+	p->window = 2 * threads;
+	p->chunk_size = PIPELINE_CHUNK_SIZE;
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->cond, NULL);
+	p->workers = calloc(threads, sizeof(struct pipeline_worker));
+	p->slots = calloc(p->window, sizeof(struct batch *));
+	p->free = calloc(p->window, sizeof(struct batch *));
+	if (p->workers == NULL || p->slots == NULL || p->free == NULL)
+		goto error_mem;
+	/* every worker has it's own mapping and cursor */
+	for (int i = 0; i <= threads; ++i) {
+		struct pipeline_worker *w = i < threads ? &p->workers[i] :
+					    &p->cursor;
+		w->p = p;
+		if (tnt_log_open_io(&w->log, path, type,
+				    TNT_LOG_IO_MMAP) != 0) {
+			snprintf(errbuf, errlen, "Cannot open '%s': %s", path,
+				 tnt_log_strerror(&w->log));
+			goto error;
+		}
+		/* compressed file is read as a stream, it can't be split */
+		if (w->log.io != TNT_LOG_IO_MMAP) {
+			snprintf(errbuf, errlen, "Cannot map '%s'", path);
+			goto error;
+		}
+		tnt_log_set_verify(&w->log, verify);
+		tnt_log_set_filter(&w->log, pipeline_filter, w, verify_skipped);
+		/* region crossing the end of chunk is reported by worker
+		 * of the chunk it starts in, the next one starts after it
+		 * (see tnt_log_sync) */
+		if (salvage)
+			tnt_log_set_salvage(&w->log, batch_add_damage,
+					    &w->filling);
+	}
+	p->begin = p->workers[0].log.begin_offset;
+	p->size = p->workers[0].log.map_size;
+	/* reading is restarted from the end of row read before */
+	if (offset != 0) {
+		if (tnt_log_seek_row(&p->workers[0].log, offset) != 0) {
+			snprintf(errbuf, errlen, "Cannot seek '%s' to offset "
+				 "%llu", path, (unsigned long long)offset);
+			goto error;
+		}
+		p->begin = offset;
+	}
+	p->next_row = p->begin;
+	p->chunk_count = (p->size - p->begin + p->chunk_size - 1) /
+			 p->chunk_size;
+	for (int i = 0; i < threads; ++i) {
+		struct pipeline_worker *w = &p->workers[i];
+		int rc = pthread_create(&w->thread, NULL, pipeline_worker_f, w);
+		if (rc != 0) {
+			snprintf(errbuf, errlen, "Failed to start worker "
+				 "thread: %s", strerror(rc));
+			goto error;
+		}
+		w->started = true;
+	}
+	return p;
+error_mem:
+	snprintf(errbuf, errlen, "Failed to allocate memory for pipeline");
+error:
+	pipeline_delete(p);
+	return NULL;
+}
+
+void
+pipeline_delete(struct pipeline *p)
+{
+	if (p == NULL)
+		return;
+	if (p->workers != NULL) {
+		pthread_mutex_lock(&p->mutex);
+		p->stop = true;
+		pthread_cond_broadcast(&p->cond);
+		pthread_mutex_unlock(&p->mutex);
+		for (int i = 0; i < p->worker_count; ++i) {
+			struct pipeline_worker *w = &p->workers[i];
+			if (w->started)
+				pthread_join(w->thread, NULL);
+			tnt_log_close(&w->log);
+		}
+	}
+	tnt_log_close(&p->cursor.log);
+	for (uint32_t i = 0; p->slots != NULL && i < p->window; ++i)
+		batch_delete(p->slots[i]);
+	for (uint32_t i = 0; p->free != NULL && i < p->free_count; ++i)
+		batch_delete(p->free[i]);
+	pthread_mutex_destroy(&p->mutex);
+	pthread_cond_destroy(&p->cond);
+	free(p->workers);
+	free(p->slots);
+	free(p->free);
+	free(p);
+}
+
+static inline bool
+pipeline_ready_locked(struct pipeline *p)
+{
+	if (p->next_take >= p->chunk_count)
+		return true;
+	struct batch *b = p->slots[p->next_take % p->window];
+	if (b != NULL && b->seq == p->next_take)
+		return true;
+	/* chunk will never be decoded */
+	return p->stop && p->next_take >= p->next_chunk;
+}
+
+/* next batch doesn't start at the row following the consumed ones */
+static inline struct batch *
+pipeline_misplaced_locked(struct pipeline *p)
+{
+	if (p->next_take >= p->chunk_count)
+		return NULL;
+	struct batch *b = p->slots[p->next_take % p->window];
+	if (b == NULL || b->seq != p->next_take ||
+	    b->first_row == (uint64_t)p->next_row)
+		return NULL;
+	return b;
+}
+
+/*
+ * Decode chunk again from the row following the previous one, the
+ * batch stays in it's slot, workers don't touch it until it's taken.
+ */
+static void
+pipeline_redo(struct pipeline *p, struct batch *b)
+{
+	uint64_t chunk = b->seq;
+	batch_reset(b);
+	b->seq = chunk;
+	b->wide_num = p->wide_num;
+	p->cursor.filling = b;
+	pipeline_process_chunk(&p->cursor, chunk, b, p->next_row);
+}
+
+bool
+pipeline_ready(struct pipeline *p)
+{
+	pthread_mutex_lock(&p->mutex);
+	bool ready = pipeline_ready_locked(p) &&
+		     pipeline_misplaced_locked(p) == NULL;
+	pthread_mutex_unlock(&p->mutex);
+	return ready;
+}
+
+void
+pipeline_wait(struct pipeline *p)
+{
+	pthread_mutex_lock(&p->mutex);
+	while (!pipeline_ready_locked(p))
+		pthread_cond_wait(&p->cond, &p->mutex);
+	struct batch *b = pipeline_misplaced_locked(p);
+	pthread_mutex_unlock(&p->mutex);
+	if (b != NULL)
+		pipeline_redo(p, b);
+}
+
+struct batch *
+pipeline_take(struct pipeline *p)
+{
+	pipeline_wait(p);
+	struct batch *b = NULL;
+	pthread_mutex_lock(&p->mutex);
+	if (p->next_take < p->chunk_count) {
+		uint32_t slot = p->next_take % p->window;
+		b = p->slots[slot];
+		if (b != NULL && b->seq == p->next_take) {
+			p->slots[slot] = NULL;
+			p->next_take++;
+			p->next_row = b->next_row;
+			pthread_cond_broadcast(&p->cond);
+		} else {
+			/* worker failed to allocate batch for chunk */
+			b = NULL;
+			p->failed = true;
+		}
+	}
+	pthread_mutex_unlock(&p->mutex);
+	return b;
+}
+
+void
+pipeline_release(struct pipeline *p, struct batch *b)
+{
+	pthread_mutex_lock(&p->mutex);
+	if (p->free_count < p->window) {
+		p->free[p->free_count++] = b;
+		b = NULL;
+	}
+	pthread_mutex_unlock(&p->mutex);
+	batch_delete(b);
+}
@@ -0,0 +1,112 @@
+#ifndef   _XLOG_PIPELINE_H_
+#define   _XLOG_PIPELINE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <tarantool/tnt.h>
+#include <tarantool/tnt_log.h>
+
+struct batch;
+struct space_map;
+struct pipeline;
+
+/*
+ * Parallel snapshot decoder.
+ *
+ * The file is split into chunks of equal size, every chunk is
+ * resynced to the first row that starts in it and decoded by one
+ * of the worker threads into a batch of msgpack rows. Batches are
+ * handed out to the consumer in file order, so the order of rows is
+ * the same as in sequential reading. At most 'window' chunks are
+ * decoded ahead of the consumer.
+ *
+ * Resync may be fooled by a copy of a row stored in tuple data, so
+ * the consumer checks that every chunk starts at the row following
+ * the previous one and decodes it again from there if it doesn't.
+ */
+
+struct pipeline_worker {
+	struct pipeline *p;
+	struct tnt_log log;
+	/* end of chunk being decoded */
+	off_t end;
+	/* first row after the chunk, set when it's reached */
+	off_t next_row;
+	/* batch being filled, gets regions skipped by salvage */
+	struct batch *filling;
+	pthread_t thread;
+	bool started;
+};
+
+struct pipeline {
+	enum tnt_log_type type;
+	const struct space_map *spaces;
+	/* see batch::wide_num */
+	bool wide_num;
+	/* first chunk starts here: at first row or at restart offset */
+	off_t begin;
+	off_t size;
+	size_t chunk_size;
+	uint64_t chunk_count;
+	int worker_count;
+	struct pipeline_worker *workers;
+	/* decoded batches, indexed by chunk number modulo window */
+	uint32_t window;
+	struct batch **slots;
+	/* used by consumer to decode again misplaced chunk */
+	struct pipeline_worker cursor;
+	/* offset of the row following the last consumed chunk */
+	off_t next_row;
+	/* batches returned by consumer, reused by workers */
+	struct batch **free;
+	uint32_t free_count;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/* next chunk to be decoded */
+	uint64_t next_chunk;
+	/* next chunk to be consumed */
+	uint64_t next_take;
+	bool stop;
+	/* set if pipeline_take() failed to allocate memory */
+	bool failed;
+};
+
+struct pipeline *
+pipeline_new(const char *path, enum tnt_log_type type,
+	     const struct space_map *spaces, int threads,
+	     enum tnt_log_verify verify, bool verify_skipped, bool salvage,
+	     bool wide_num, uint64_t offset, char *errbuf, size_t errlen);
+
+void
+pipeline_delete(struct pipeline *p);
+
+/* Check if pipeline_take() won't block */
+bool
+pipeline_ready(struct pipeline *p);
+
+/*
+ * Block until pipeline_take() won't block, misplaced chunk is decoded
+ * again here.
+ */
+void
+pipeline_wait(struct pipeline *p);
+
+/*
+ * Take next batch in file order, blocks if it isn't decoded yet.
+ * Returns NULL if whole file was consumed or if p->failed is set.
+ * If batch->error is set, rows before error are valid and reading
+ * must not be continued after it.
+ */
+struct batch *
+pipeline_take(struct pipeline *p);
+
+/* Return consumed batch to pipeline */
+void
+pipeline_release(struct pipeline *p, struct batch *b);
+
+#endif /* _XLOG_PIPELINE_H_ */
@@ -0,0 +1,152 @@
+#ifndef   _XLOG_RING_H_
+#define   _XLOG_RING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/*
+ * Bounded single-producer single-consumer queue of pointers.
+ *
+ * ring_push() and ring_pop() don't take locks. A side that has nothing
+ * to do may sleep in ring_wait_*(), the mutex is taken only then and
+ * by the other side if it sees that somebody sleeps.
+ */
+
+struct ring {
+	void **slots;
+	uint32_t mask;
+	/* next slot to pop, written by consumer only */
+	uint64_t head;
+	/* next slot to push, written by producer only */
+	uint64_t tail;
+	/* number of threads sleeping in ring_wait_*() */
+	int waiting;
+	/* no more pushes will be done, or nobody will pop */
+	bool closed;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+/* size is rounded up to the power of 2 */
+static inline int
+ring_create(struct ring *r, uint32_t size)
+{
+	uint32_t capacity = 1;
+	while (capacity < size)
+		capacity *= 2;
+	r->slots = calloc(capacity, sizeof(void *));
+	if (r->slots == NULL)
+		return -1;
+	r->mask = capacity - 1;
+	r->head = r->tail = 0;
+	r->waiting = 0;
+	r->closed = false;
+	pthread_mutex_init(&r->mutex, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	return 0;
+}
+
+static inline void
+ring_destroy(struct ring *r)
+{
+	if (r->slots == NULL)
+		return;
+	pthread_mutex_destroy(&r->mutex);
+	pthread_cond_destroy(&r->cond);
+	free(r->slots);
+	r->slots = NULL;
+}
+
+static inline bool
+ring_empty(struct ring *r)
+{
+	return __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) ==
+	       __atomic_load_n(&r->head, __ATOMIC_SEQ_CST);
+}
+
+static inline bool
+ring_full(struct ring *r)
+{
+	return __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) -
+	       __atomic_load_n(&r->head, __ATOMIC_SEQ_CST) > r->mask;
+}
+
+static inline bool
+ring_is_closed(struct ring *r)
+{
+	return __atomic_load_n(&r->closed, __ATOMIC_ACQUIRE);
+}
+
+/* wake up the other side if it sleeps */
+static inline void
+ring_wakeup(struct ring *r)
+{
+	if (__atomic_load_n(&r->waiting, __ATOMIC_SEQ_CST) == 0)
+		return;
+	pthread_mutex_lock(&r->mutex);
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->mutex);
+}
+
+/* returns false if ring is full */
+static inline bool
+ring_push(struct ring *r, void *ptr)
+{
+	uint64_t tail = r->tail;
+	if (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) > r->mask)
+		return false;
+	r->slots[tail & r->mask] = ptr;
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_SEQ_CST);
+	ring_wakeup(r);
+	return true;
+}
+
+/* returns NULL if ring is empty */
+static inline void *
+ring_pop(struct ring *r)
+{
+	uint64_t head = r->head;
+	if (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == head)
+		return NULL;
+	void *ptr = r->slots[head & r->mask];
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_SEQ_CST);
+	ring_wakeup(r);
+	return ptr;
+}
+
+static inline void
+ring_close(struct ring *r)
+{
+	pthread_mutex_lock(&r->mutex);
+	__atomic_store_n(&r->closed, true, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->mutex);
+}
+
+/* sleep until ring becomes non-empty or closed (consumer side) */
+static inline void
+ring_wait_pop(struct ring *r)
+{
+	pthread_mutex_lock(&r->mutex);
+	__atomic_add_fetch(&r->waiting, 1, __ATOMIC_SEQ_CST);
+	while (ring_empty(r) && !r->closed)
+		pthread_cond_wait(&r->cond, &r->mutex);
+	__atomic_sub_fetch(&r->waiting, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&r->mutex);
+}
+
+/* sleep until ring becomes non-full or closed (producer side) */
+static inline void
+ring_wait_push(struct ring *r)
+{
+	pthread_mutex_lock(&r->mutex);
+	__atomic_add_fetch(&r->waiting, 1, __ATOMIC_SEQ_CST);
+	while (ring_full(r) && !r->closed)
+		pthread_cond_wait(&r->cond, &r->mutex);
+	__atomic_sub_fetch(&r->waiting, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&r->mutex);
+}
+
+#endif /* _XLOG_RING_H_ */
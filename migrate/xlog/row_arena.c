@@ -0,0 +1,135 @@
+#include "row_arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <tarantool/tnt_mem.h>
+
+/*
+ * Every chunk is prefixed with header, so that chunk can be freed or
+ * reallocated regardless of arena the calling thread is in (e.g. when
+ * iterator is collected by Lua GC).
+ */
+struct row_arena_chunk {
+	/* size requested by caller */
+	size_t size;
+	/* 0 if chunk is malloc'ed */
+	size_t in_arena;
+};
+
+/* keeps chunk data aligned as well as malloc() does */
+#define ROW_ARENA_ALIGN 16
+
+static __thread struct row_arena *row_arena_current;
+
+void
+row_arena_init(void)
+{
+	tnt_mem_init(row_arena_realloc);
+}
+
+struct row_arena *
+row_arena_new(bool hugepages)
+{
+	struct row_arena *a = malloc(sizeof(*a));
+	if (a == NULL)
+		return NULL;
+	quota_init(&a->quota, QUOTA_MAX);
+	if (slab_arena_create(&a->arena, &a->quota, ROW_ARENA_PREALLOC,
+			      ROW_ARENA_SLAB_SIZE, MAP_PRIVATE) != 0) {
+		free(a);
+		return NULL;
+	}
+#ifdef MADV_HUGEPAGE
+	/* preallocated area is aligned by slab size */
+	if (hugepages && a->arena.arena != NULL)
+		madvise(a->arena.arena, a->arena.prealloc, MADV_HUGEPAGE);
+#else
+	(void)hugepages;
+#endif
+	slab_cache_create(&a->cache, &a->arena);
+	region_create(&a->region, &a->cache);
+	return a;
+}
+
+void
+row_arena_delete(struct row_arena *a)
+{
+	if (a == NULL)
+		return;
+	region_destroy(&a->region);
+	slab_cache_destroy(&a->cache);
+	slab_arena_destroy(&a->arena);
+	free(a);
+}
+
+void
+row_arena_reset(struct row_arena *a)
+{
+	/* slabs go back to the slab cache of arena, not to the system */
+	region_free(&a->region);
+}
+
+struct row_arena *
+row_arena_enter(struct row_arena *a)
+{
+	struct row_arena *prev = row_arena_current;
+	row_arena_current = a;
+	return prev;
+}
+
+void
+row_arena_leave(struct row_arena *prev)
+{
+	row_arena_current = prev;
+}
+
+static struct row_arena_chunk *
+row_arena_chunk_new(size_t size)
+{
+	struct row_arena *a = row_arena_current;
+	struct row_arena_chunk *c;
+	if (a != NULL)
+		c = region_aligned_alloc(&a->region, sizeof(*c) + size,
+					 ROW_ARENA_ALIGN);
+	else
+		c = malloc(sizeof(*c) + size);
+	if (c == NULL)
+		return NULL;
+	c->size = size;
+	c->in_arena = (a != NULL);
+	return c;
+}
+
+void *
+row_arena_realloc(void *ptr, size_t size)
+{
+	struct row_arena_chunk *c = ptr == NULL ? NULL :
+				    (struct row_arena_chunk *)ptr - 1;
+	if (size == 0) {
+		if (c != NULL && !c->in_arena)
+			free(c);
+		return NULL;
+	}
+	if (c == NULL) {
+		c = row_arena_chunk_new(size);
+		return c != NULL ? c + 1 : NULL;
+	}
+	if (!c->in_arena) {
+		c = realloc(c, sizeof(*c) + size);
+		if (c == NULL)
+			return NULL;
+		c->size = size;
+		return c + 1;
+	}
+	/* chunks of arena can't grow in place, old one is left in region */
+	if (size <= c->size)
+		return ptr;
+	struct row_arena_chunk *n = row_arena_chunk_new(size);
+	if (n == NULL)
+		return NULL;
+	memcpy(n + 1, ptr, c->size);
+	return n + 1;
+}
@@ -0,0 +1,83 @@
+#ifndef   _XLOG_ROW_ARENA_H_
+#define   _XLOG_ROW_ARENA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <small/quota.h>
+#include <small/slab_arena.h>
+#include <small/slab_cache.h>
+#include <small/region.h>
+
+/*
+ * Per-batch bump allocator for rows parsed by tarantool-c.
+ *
+ * row_arena_init() installs row_arena_realloc() as tnt_mem allocator.
+ * While a thread is inside row_arena_enter()/row_arena_leave(), every
+ * tnt_mem allocation of that thread (row buffer, request body, update
+ * operations, iovec vector, tuple copy) is taken from the region of the
+ * arena and freeing it does nothing. Whole region is released at once
+ * by row_arena_reset() before next batch is parsed, so parsing doesn't
+ * call malloc()/free() in steady state. Outside of arena memory is
+ * malloc'ed as before.
+ *
+ * Memory of a batch is valid until the next reset, nothing parsed in
+ * arena may be kept across it. An arena belongs to the thread that
+ * created it (slab cache of small isn't thread-safe).
+ */
+
+enum row_alloc {
+	ROW_ALLOC_MALLOC = 0,
+	ROW_ALLOC_ARENA
+};
+
+#ifndef ROW_ARENA_SLAB_SIZE
+#define ROW_ARENA_SLAB_SIZE (4 * 1024 * 1024)
+#endif
+/* mapped when arena is created, pages are backed on first touch */
+#ifndef ROW_ARENA_PREALLOC
+#define ROW_ARENA_PREALLOC (4 * ROW_ARENA_SLAB_SIZE)
+#endif
+
+struct row_arena {
+	struct quota quota;
+	struct slab_arena arena;
+	struct slab_cache cache;
+	struct region region;
+};
+
+/* Install row_arena_realloc() as tnt_mem allocator, idempotent */
+void
+row_arena_init(void);
+
+/*
+ * Create arena. With 'hugepages' preallocated slabs are advised to be
+ * backed by transparent huge pages (MADV_HUGEPAGE), which is ignored if
+ * kernel doesn't support it. Returns NULL on memory error.
+ */
+struct row_arena *
+row_arena_new(bool hugepages);
+
+void
+row_arena_delete(struct row_arena *a);
+
+/* Release memory of previous batch, slabs stay in the arena */
+void
+row_arena_reset(struct row_arena *a);
+
+/*
+ * Route tnt_mem allocations of current thread to arena 'a' (NULL means
+ * malloc). Returns arena that was used before, to be passed to
+ * row_arena_leave().
+ */
+struct row_arena *
+row_arena_enter(struct row_arena *a);
+
+void
+row_arena_leave(struct row_arena *prev);
+
+/* tnt_allocator_t */
+void *
+row_arena_realloc(void *ptr, size_t size);
+
+#endif /* _XLOG_ROW_ARENA_H_ */
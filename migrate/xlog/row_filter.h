@@ -0,0 +1,34 @@
+#ifndef   _XLOG_ROW_FILTER_H_
+#define   _XLOG_ROW_FILTER_H_
+
+#include <stdint.h>
+
+#include <tarantool/tnt.h>
+#include <tarantool/tnt_log.h>
+
+#include "xlog.h"
+
+/*
+ * Check row by its header and space before its data is checked and
+ * processed (see tnt_log_set_filter()). Rows of spaces that aren't read
+ * and xlog rows out of [lsn_from, lsn_to] are skipped, reading stops
+ * after lsn_to as lsn of xlog rows is increasing.
+ */
+static inline enum tnt_log_filter_result
+row_filter(enum tnt_log_type type, const struct space_map *spaces,
+	   uint64_t lsn_from, uint64_t lsn_to,
+	   const struct tnt_log_header_v11 *hdr, uint32_t space)
+{
+	if (type == TNT_LOG_XLOG) {
+		if (hdr->lsn > lsn_to)
+			return TNT_LOG_FILTER_STOP;
+		if (hdr->lsn < lsn_from)
+			return TNT_LOG_FILTER_SKIP;
+	}
+	struct space_def *def;
+	if (space != TNT_LOG_SPACE_NONE && space_map_find(spaces, space, &def))
+		return TNT_LOG_FILTER_SKIP;
+	return TNT_LOG_FILTER_PASS;
+}
+
+#endif /* _XLOG_ROW_FILTER_H_ */
@@ -5,6 +5,8 @@
 #include <stdint.h>
 #include <inttypes.h>
 
+#include <msgpuck.h>
+
 #include <tarantool/module.h>
 #include <tarantool/lua.h>
 #include <tarantool/lauxlib.h>
@@ -23,10 +25,15 @@ lua_field_encode(struct lua_State *L, const char *data, size_t size,
 	} else if (tp == F_FLD_NUM && size == 8) {
 		luaL_pushuint64(L, *((uint64_t*)data));
 	} else {
-		if (tp == F_FLD_NUM && throws)
-			luaL_error(L, "Cannot convert field '%.*s' to type NUM,"
-				      " exptected len 4 or 8, got '%zd'",
-				      size, data, size);
+		if (tp == F_FLD_NUM && throws) {
+			/* lua_pushfstring() has no '%.*s' */
+			lua_pushstring(L, "Cannot convert field '");
+			lua_pushlstring(L, data, size);
+			lua_pushfstring(L, "' to type NUM, exptected len 4 "
+					   "or 8, got '%d'", (int)size);
+			lua_concat(L, 3);
+			lua_error(L);
+		}
 		lua_pushlstring(L, data, size);
 	}
 }
@@ -42,13 +49,8 @@ luata_tuple_fields(struct lua_State *L, struct tnt_tuple *t,
 		int idx = TNT_IFIELD_IDX(&ifl);
 		char *data = TNT_IFIELD_DATA(&ifl);
 		uint32_t size = TNT_IFIELD_SIZE(&ifl);
-		enum field_t tp = F_FLD_STR;
+		enum field_t tp = space_def_field(def, idx, false);
 		int throws = true;
-		if (def) {
-			tp = def->defaults;
-			if (def->convert && idx < def->schema_len)
-				tp = def->schema[idx];
-		}
 		lua_pushinteger(L, idx + 1);
 		lua_field_encode(L, data, size, tp, throws);
 		lua_settable(L, -3); /* tuple field */
@@ -70,13 +72,8 @@ luata_key_fields(struct lua_State *L, struct tnt_tuple *t,
 		int idx = TNT_IFIELD_IDX(&ifl);
 		char *data = TNT_IFIELD_DATA(&ifl);
 		uint32_t size = TNT_IFIELD_SIZE(&ifl);
-		enum field_t tp = F_FLD_STR;
+		enum field_t tp = space_def_field(def, idx, true);
 		int throws = true;
-		if (def) {
-			tp = def->defaults;
-			if (def->convert && idx < def->ischema_len)
-				tp = def->ischema[idx];
-		}
 		lua_pushinteger(L, idx + 1);
 		lua_field_encode(L, data, size, tp, throws);
 		lua_settable(L, -3); /* tuple field */
@@ -143,23 +140,20 @@ luata_ops_fields(struct lua_State *L, struct tnt_request_update *req,
 		case TNT_UPDATE_INSERT:
 		case TNT_UPDATE_ASSIGN:
 			lua_pushnumber(L, 3);
-			enum field_t tp = F_FLD_STR;
+			enum field_t tp = space_def_field(def, op->field,
+							  false);
 			int throws = true;
-			if (def) {
-				tp = def->defaults;
-				if (def->convert && op->field < def->schema_len)
-					tp = def->schema[op->field];
-			}
 			lua_field_encode(L, data, size, tp, throws);
 			lua_settable(L, -3); /* value */
 			break;
 		case TNT_UPDATE_SPLICE: {
-			size_t pos = 1;
-			lua_settable_nn(L, 3, *(int32_t *)(data + pos), -1);
-			pos += 5;
-			lua_settable_nn(L, 4, *(int32_t *)(data + pos), -1);
-			pos += 4 + op->size_enc_len;
-			lua_settable_nsl(L, 5, data, size - pos, -1);
+			struct splice_args args = {0};
+			if (splice_args_parse(data, size, &args) != 0)
+				luaL_error(L, "failed to parse splice "
+					      "operation");
+			lua_settable_nn(L, 3, args.offset, -1);
+			lua_settable_nn(L, 4, args.length, -1);
+			lua_settable_nsl(L, 5, args.str, args.str_len, -1);
 			break;
 		}
 		case TNT_UPDATE_DELETE:
@@ -169,3 +163,47 @@ luata_ops_fields(struct lua_State *L, struct tnt_request_update *req,
 		lua_settable(L, -3); /* op */
 	}
 }
+
+static void
+luata_mp_value(struct lua_State *L, const char **data)
+{
+	switch (mp_typeof(**data)) {
+	case MP_UINT: {
+		/* 8 byte numbers are always stored as MP_UINT64 */
+		bool wide = (uint8_t)**data == 0xcf;
+		uint64_t num = mp_decode_uint(data);
+		if (wide)
+			luaL_pushuint64(L, num);
+		else
+			lua_pushnumber(L, num);
+		break;
+	}
+	case MP_INT:
+		lua_pushnumber(L, mp_decode_int(data));
+		break;
+	case MP_STR: {
+		uint32_t size = 0;
+		const char *str = mp_decode_str(data, &size);
+		lua_pushlstring(L, str, size);
+		break;
+	}
+	case MP_ARRAY: {
+		uint32_t count = mp_decode_array(data);
+		lua_newtable(L);
+		for (uint32_t idx = 0; idx < count; ++idx) {
+			lua_pushinteger(L, idx + 1);
+			luata_mp_value(L, data);
+			lua_settable(L, -3); /* field */
+		}
+		break;
+	}
+	default:
+		luaL_error(L, "unexpected msgpack type");
+	}
+}
+
+void
+luata_mp_decode(struct lua_State *L, const char *data)
+{
+	luata_mp_value(L, &data);
+}
@@ -18,4 +18,11 @@ void
 luata_ops_fields(struct lua_State *L, struct tnt_request_update *req,
 		 struct space_def *def);
 
+/*
+ * Decode tuple, key or update operations, encoded by batch.c with
+ * wide_num set, into table, the same way luata_*_fields() do.
+ */
+void
+luata_mp_decode(struct lua_State *L, const char *data);
+
 #endif /* _XLOG_TABLE_H_ */
@@ -0,0 +1,208 @@
+#include "transcode.h"
+
+#include <string.h>
+
+#include <msgpuck.h>
+
+#include "xlog.h"
+
+const struct field_plan field_plan_str = {
+	.ops = NULL,
+	.len = 0,
+	.tail = F_FLD_STR,
+	.layout = F_LAYOUT_STR
+};
+
+/* bounds-checked version of tnt_enc_read() */
+static int
+transcode_read_ber_slow(const char *data, const char *end, uint32_t *value)
+{
+	uint32_t v = 0;
+	for (int i = 0; i < 5 && data + i < end; ++i) {
+		v = v << 7 | (data[i] & 0x7f);
+		if (!(data[i] & 0x80)) {
+			*value = v;
+			return i + 1;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Read BER-encoded field size (7-bit groups, the most significant
+ * first, high bit is set in all bytes but the last one), returns
+ * number of bytes read or -1. Sizes of 128 bytes and more are
+ * decoded from one 8-byte load without a branch per byte.
+ */
+static inline int
+transcode_read_ber(const char *data, const char *end, uint32_t *value)
+{
+	if (__builtin_expect(data < end && !(*data & 0x80), 1)) {
+		*value = (uint8_t)*data;
+		return 1;
+	}
+	if (end - data < 8)
+		return transcode_read_ber_slow(data, end, value);
+	uint64_t word;
+	memcpy(&word, data, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	/* the first of 5 bytes without high bit is the last one */
+	uint64_t last = ~word & 0x8080808080ULL;
+	if (last == 0)
+		return -1;
+	int len = __builtin_ctzll(last) / 8 + 1;
+	/* byte i of size becomes byte len - 1 - i of v */
+	uint64_t v = __builtin_bswap64(word & 0x7f7f7f7f7fULL) >>
+		     (64 - 8 * len);
+	/* drop the gaps between 7-bit groups, overflow is truncated */
+	*value = (v & 0x7f) | (v >> 1 & 0x3f80) | (v >> 2 & 0x1fc000) |
+		 (v >> 3 & 0xfe00000) | (v >> 4 & 0xf0000000);
+	return len;
+}
+
+static inline enum field_t
+transcode_field_type(const struct field_plan *plan, int layout, uint32_t idx)
+{
+	if (layout == F_LAYOUT_STR)
+		return F_FLD_STR;
+	if (layout == F_LAYOUT_NUM)
+		return F_FLD_NUM;
+	return field_plan_op(plan, idx);
+}
+
+/* Returns 0 if field can't be converted to NUM */
+static inline uint32_t
+transcode_sizeof_num(const char *field, uint32_t size, bool wide_num)
+{
+	if (size == 4) {
+		uint32_t num;
+		memcpy(&num, field, sizeof(num));
+		return mp_sizeof_uint(num);
+	}
+	if (size != 8)
+		return 0;
+	if (wide_num)
+		return 9;
+	uint64_t num;
+	memcpy(&num, field, sizeof(num));
+	return mp_sizeof_uint(num);
+}
+
+static inline char *
+transcode_encode_num(char *pos, const char *field, uint32_t size,
+		     bool wide_num)
+{
+	if (size == 4) {
+		uint32_t num;
+		memcpy(&num, field, sizeof(num));
+		return mp_encode_uint(pos, num);
+	}
+	uint64_t num;
+	memcpy(&num, field, sizeof(num));
+	if (wide_num) {
+		pos = mp_store_u8(pos, 0xcf);
+		return mp_store_u64(pos, num);
+	}
+	return mp_encode_uint(pos, num);
+}
+
+/*
+ * Loops are inlined into transcode_size()/transcode_write() with
+ * constant 'layout', so that STR and NUM layouts don't look the field
+ * type up.
+ */
+static inline __attribute__((always_inline)) ssize_t
+transcode_size_layout(const char *data, const char *end,
+		      uint32_t cardinality, const struct field_plan *plan,
+		      int layout, bool wide_num, struct transcode_error *err)
+{
+	size_t total = mp_sizeof_array(cardinality);
+	uint32_t fsize = 0;
+	for (uint32_t idx = 0; idx < cardinality; ++idx) {
+		int esize = transcode_read_ber(data, end, &fsize);
+		if (esize < 0 || (size_t)(end - data) - esize < fsize)
+			goto malformed;
+		const char *field = data + esize;
+		data = field + fsize;
+		if (transcode_field_type(plan, layout, idx) == F_FLD_STR) {
+			total += mp_sizeof_str(fsize);
+			continue;
+		}
+		uint32_t nsize = transcode_sizeof_num(field, fsize, wide_num);
+		if (nsize == 0) {
+			err->field = field;
+			err->size = fsize;
+			return -1;
+		}
+		total += nsize;
+	}
+	return total;
+malformed:
+	err->field = NULL;
+	err->size = 0;
+	return -1;
+}
+
+ssize_t
+transcode_size(const char *data, size_t size, uint32_t cardinality,
+	       const struct field_plan *plan, bool wide_num,
+	       struct transcode_error *err)
+{
+	const char *end = data + size;
+	/* every field has at least one byte of BER-encoded size */
+	if (cardinality > size) {
+		err->field = NULL;
+		err->size = 0;
+		return -1;
+	}
+	switch (plan->layout) {
+	case F_LAYOUT_STR:
+		return transcode_size_layout(data, end, cardinality, plan,
+					     F_LAYOUT_STR, wide_num, err);
+	case F_LAYOUT_NUM:
+		return transcode_size_layout(data, end, cardinality, plan,
+					     F_LAYOUT_NUM, wide_num, err);
+	default:
+		return transcode_size_layout(data, end, cardinality, plan,
+					     F_LAYOUT_MIXED, wide_num, err);
+	}
+}
+
+static inline __attribute__((always_inline)) char *
+transcode_write_layout(char *pos, const char *data, const char *end,
+		       uint32_t cardinality, const struct field_plan *plan,
+		       int layout, bool wide_num)
+{
+	pos = mp_encode_array(pos, cardinality);
+	uint32_t fsize = 0;
+	for (uint32_t idx = 0; idx < cardinality; ++idx) {
+		const char *field = data + transcode_read_ber(data, end, &fsize);
+		data = field + fsize;
+		if (transcode_field_type(plan, layout, idx) == F_FLD_STR)
+			pos = mp_encode_str(pos, field, fsize);
+		else
+			pos = transcode_encode_num(pos, field, fsize, wide_num);
+	}
+	return pos;
+}
+
+char *
+transcode_write(char *pos, const char *data, size_t size,
+		uint32_t cardinality, const struct field_plan *plan,
+		bool wide_num)
+{
+	const char *end = data + size;
+	switch (plan->layout) {
+	case F_LAYOUT_STR:
+		return transcode_write_layout(pos, data, end, cardinality,
+					      plan, F_LAYOUT_STR, wide_num);
+	case F_LAYOUT_NUM:
+		return transcode_write_layout(pos, data, end, cardinality,
+					      plan, F_LAYOUT_NUM, wide_num);
+	default:
+		return transcode_write_layout(pos, data, end, cardinality,
+					      plan, F_LAYOUT_MIXED, wide_num);
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef   _XLOG_TRANSCODE_H_
+#define   _XLOG_TRANSCODE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct field_plan;
+
+/*
+ * Conversion of 1.5 tuple data (BER-encoded field sizes, followed by
+ * data) to msgpack array in two passes: transcode_size() checks the
+ * data and computes exact size of the array, transcode_write() encodes
+ * it into a buffer of that size without any more checks, so the
+ * caller reserves memory once per tuple.
+ *
+ * NUM fields are encoded as the smallest msgpack uint, or always as
+ * uint64 if 'wide_num' is set (see pipeline_new), other fields are
+ * encoded as strings.
+ */
+
+/* Field that failed conversion */
+struct transcode_error {
+	/* NULL if data is malformed */
+	const char *field;
+	/* size of NUM field that isn't 4 or 8 bytes long */
+	uint32_t size;
+};
+
+/*
+ * Returns size of msgpack array 'cardinality' fields of data are
+ * converted to with 'plan', or -1 and sets 'err' if they can't be
+ * converted.
+ */
+ssize_t
+transcode_size(const char *data, size_t size, uint32_t cardinality,
+	       const struct field_plan *plan, bool wide_num,
+	       struct transcode_error *err);
+
+/*
+ * Encode data checked by transcode_size() with the same arguments to
+ * pos, returns end of the array.
+ */
+char *
+transcode_write(char *pos, const char *data, size_t size,
+		uint32_t cardinality, const struct field_plan *plan,
+		bool wide_num);
+
+#endif /* _XLOG_TRANSCODE_H_ */
@@ -14,6 +14,7 @@
 #include <tarantool/tnt.h>
 
 #include "mpstream.h"
+#include "transcode.h"
 #include "xlog.h"
 
 extern struct ibuf xlog_ibuf;
@@ -44,10 +45,15 @@ lua_field_encode(struct lua_State *L, struct mpstream *stream, const char *data,
 //		say_info("encoding as uint");
 		mmpstream_encode_uint(stream, *((uint64_t *)data));
 	} else {
-		if (tp == F_FLD_NUM && throws)
-			luaL_error(L, "Cannot convert field '%.*s' to type NUM,"
-				      " exptected len 4 or 8, got '%zd'",
-				      size, data, size);
+		if (tp == F_FLD_NUM && throws) {
+			/* lua_pushfstring() has no '%.*s' */
+			lua_pushstring(L, "Cannot convert field '");
+			lua_pushlstring(L, data, size);
+			lua_pushfstring(L, "' to type NUM, exptected len 4 "
+					   "or 8, got '%d'", (int)size);
+			lua_concat(L, 3);
+			lua_error(L);
+		}
 		mmpstream_encode_str(stream, data, size);
 	}
 }
@@ -55,91 +61,61 @@ lua_field_encode(struct lua_State *L, struct mpstream *stream, const char *data,
 static const char *box_cfg_error = "Cannot get tuple_format (maybe box isn't "
 	"configured. box.cfg{} is needed)";
 
-void
-luatu_tuple_fields(struct lua_State *L, struct tnt_tuple *t,
-		   struct space_def *def)
+/*
+ * Push tuple of 1.5 tuple fields converted with 'plan': the size of
+ * msgpack is computed first, so it's encoded into one reservation.
+ */
+static void
+luatu_push_fields(struct lua_State *L, struct tnt_tuple *t,
+		  const struct field_plan *plan)
 {
 	struct ibuf *buf = &xlog_ibuf;
 	if (!tuple_format) tuple_format = box_tuple_format_default();
 	if (!tuple_format) luaL_error(L, box_cfg_error);
 
-	ibuf_reset(buf);
-	struct mpstream stream;
-	mmpstream_init(&stream, buf,
-		      ibuf_reserve_cb,
-		      ibuf_alloc_cb,
-		      mmpstream_tarantool_err, L);
-
-	mmpstream_encode_array(&stream, t->cardinality);
-	struct tnt_iter ifl;
-	tnt_iter(&ifl, t);
-	while (tnt_next(&ifl)) {
-		int idx = TNT_IFIELD_IDX(&ifl);
-		assert(idx < t->cardinality);
-		char *data = TNT_IFIELD_DATA(&ifl);
-		uint32_t size = TNT_IFIELD_SIZE(&ifl);
-		enum field_t tp = F_FLD_STR;
-		int throws = true;
-		if (def) {
-			tp = def->defaults;
-			if (idx < def->schema_len)
-				tp = def->schema[idx];
-		}
-		lua_field_encode(L, &stream, data, size, tp, throws);
-	}
-	if (ifl.status == TNT_ITER_FAIL)
+	/* tuple data starts with cardinality */
+	if (t->size < sizeof(uint32_t))
+		luaL_error(L, "failed to parse tuple");
+	const char *data = t->data + sizeof(uint32_t);
+	size_t size = t->size - sizeof(uint32_t);
+	struct transcode_error err;
+	ssize_t len = transcode_size(data, size, t->cardinality, plan, false,
+				     &err);
+	if (len < 0 && err.field == NULL)
 		luaL_error(L, "failed to parse tuple");
-	tnt_iter_free(&ifl);
+	if (len < 0) {
+		lua_pushstring(L, "Cannot convert field '");
+		lua_pushlstring(L, err.field, err.size);
+		lua_pushfstring(L, "' to type NUM, exptected len 4 or 8, "
+				   "got '%d'", (int)err.size);
+		lua_concat(L, 3);
+		lua_error(L);
+	}
 
-	box_tuple_t *tuple = box_tuple_new(tuple_format, stream.buf, stream.pos);
+	ibuf_reset(buf);
+	char *pos = ibuf_reserve(buf, len);
+	if (pos == NULL)
+		luaL_error(L, "%s: out of memory (ibuf_reserve)", __func__);
+	char *end = transcode_write(pos, data, size, t->cardinality, plan,
+				    false);
+	box_tuple_t *tuple = box_tuple_new(tuple_format, pos, end);
 	if (tuple == NULL)
 		luaL_error(L, "%s: out of memory (box_tuple_new)", __func__);
 	luaT_pushtuple(L, tuple);
-	return;
+}
+
+void
+luatu_tuple_fields(struct lua_State *L, struct tnt_tuple *t,
+		   struct space_def *def)
+{
+	luatu_push_fields(L, t, space_def_plan(def, false));
 }
 
 void
 luatu_key_fields(struct lua_State *L, struct tnt_tuple *t,
 		 struct space_def *def)
 {
-	struct ibuf *buf = &xlog_ibuf;
-	if (!tuple_format) tuple_format = box_tuple_format_default();
-	if (!tuple_format) luaL_error(L, box_cfg_error);
-
-	ibuf_reset(buf);
-	struct mpstream stream;
-	mmpstream_init(&stream, buf,
-		      ibuf_reserve_cb,
-		      ibuf_alloc_cb,
-		      mmpstream_tarantool_err, L);
-
-	mmpstream_encode_array(&stream, t->cardinality);
-	struct tnt_iter ifl;
-	tnt_iter(&ifl, t);
-	while (tnt_next(&ifl)) {
-		int idx = TNT_IFIELD_IDX(&ifl);
-		assert(idx < t->cardinality);
-		char *data = TNT_IFIELD_DATA(&ifl);
-		uint32_t size = TNT_IFIELD_SIZE(&ifl);
-		enum field_t tp = F_FLD_STR;
-		int throws = true;
-		if (def) {
-			tp = def->defaults;
-			if (idx < def->ischema_len)
-				tp = def->ischema[idx];
-		}
-		lua_field_encode(L, &stream, data, size, tp, throws);
-	}
-	if (ifl.status == TNT_ITER_FAIL)
-		luaL_error(L, "failed to parse tuple");
-	tnt_iter_free(&ifl);
-
-	box_tuple_t *tuple = box_tuple_new(tuple_format, stream.buf, stream.pos);
-
-	if (tuple == NULL)
-		luaL_error(L, "%s: out of memory (box_tuple_new)", __func__);
-	luaT_pushtuple(L, tuple);
-	return;
+	luatu_push_fields(L, t, space_def_plan(def, true));
 }
 
 void
@@ -179,23 +155,26 @@ luatu_ops_fields(struct lua_State *L, struct tnt_request_update *req,
 		}
 		case TNT_UPDATE_INSERT:
 		case TNT_UPDATE_ASSIGN: {
-			enum field_t tp = F_FLD_STR;
+			enum field_t tp = space_def_field(def, op->field,
+							  false);
 			int throws = true;
-			if (def) {
-				tp = def->defaults;
-				if (op->field < def->schema_len)
-					tp = def->schema[op->field];
-			}
 			lua_field_encode(L, &stream, data, size, tp, throws);
 			break;
 		}
 		case TNT_UPDATE_SPLICE: {
-			size_t pos = 1;
-			mmpstream_encode_uint(&stream, *(int32_t *)(data + pos));
-			pos += 5;
-			mmpstream_encode_uint(&stream, *(int32_t *)(data + pos));
-			pos += 4 + op->size_enc_len;
-			mmpstream_encode_str(&stream, data, size - pos);
+			struct splice_args args = {0};
+			if (splice_args_parse(data, size, &args) != 0)
+				luaL_error(L, "failed to parse splice "
+					      "operation");
+			if (args.offset < 0)
+				mmpstream_encode_int(&stream, args.offset);
+			else
+				mmpstream_encode_uint(&stream, args.offset);
+			if (args.length < 0)
+				mmpstream_encode_int(&stream, args.length);
+			else
+				mmpstream_encode_uint(&stream, args.length);
+			mmpstream_encode_str(&stream, args.str, args.str_len);
 			break;
 		}
 		case TNT_UPDATE_DELETE:
@@ -0,0 +1,67 @@
+#include "watch.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <limits.h>
+#include <sys/inotify.h>
+#endif
+
+struct watch *
+watch_new(const char *dir, char *errbuf, size_t errlen)
+{
+	struct watch *w = malloc(sizeof(struct watch));
+	if (w == NULL) {
+		snprintf(errbuf, errlen, "Failed to allocate memory for watch");
+		return NULL;
+	}
+	w->fd = -1;
+#ifdef __linux__
+	w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (w->fd == -1 ||
+	    inotify_add_watch(w->fd, dir, IN_CREATE | IN_MOVED_TO |
+			      IN_MODIFY | IN_CLOSE_WRITE) == -1) {
+		snprintf(errbuf, errlen, "Cannot watch '%s': %s", dir,
+			 strerror(errno));
+		watch_delete(w);
+		return NULL;
+	}
+#else
+	(void)dir;
+#endif
+	return w;
+}
+
+void
+watch_delete(struct watch *w)
+{
+	if (w->fd != -1)
+		close(w->fd);
+	free(w);
+}
+
+int
+watch_drain(struct watch *w)
+{
+	int count = 0;
+#ifdef __linux__
+	/* enough for at least one event with the longest name */
+	char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t n;
+	while (w->fd != -1 &&
+	       ((n = read(w->fd, buf, sizeof(buf))) > 0 ||
+		(n == -1 && errno == EINTR))) {
+		for (char *p = buf; p < buf + n; ++count) {
+			struct inotify_event *e = (struct inotify_event *)p;
+			p += sizeof(struct inotify_event) + e->len;
+		}
+	}
+#else
+	(void)w;
+#endif
+	return count;
+}
@@ -0,0 +1,29 @@
+#ifndef   _XLOG_WATCH_H_
+#define   _XLOG_WATCH_H_
+
+#include <stddef.h>
+
+/*
+ * Changes of directory of xlogs that is being written: files that are
+ * created, renamed into it or appended to. Directory is watched with
+ * inotify, where it isn't available watch has no descriptor and the
+ * caller polls the directory by timeout.
+ */
+
+struct watch {
+	/* readable when there are events to drain, -1 - no inotify */
+	int fd;
+};
+
+/* Returns NULL and sets errbuf on error */
+struct watch *
+watch_new(const char *dir, char *errbuf, size_t errlen);
+
+void
+watch_delete(struct watch *w);
+
+/* Read pending events without blocking, returns number of them */
+int
+watch_drain(struct watch *w);
+
+#endif /* _XLOG_WATCH_H_ */
@@ -1,8 +1,12 @@
 #include <assert.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <inttypes.h>
+#include <unistd.h>
 
 #include <tarantool/lua.h>
 #include <tarantool/lauxlib.h>
@@ -13,33 +17,55 @@
 #include <tarantool/module.h>
 
 #include <small/ibuf.h>
+#include <msgpuck.h>
 #include <tarantool/tnt.h>
 #include <tarantool/tnt_xlog.h>
 #include <tarantool/tnt_snapshot.h>
 
 #include "tuple.h"
 #include "table.h"
+#include "batch.h"
+#include "pipeline.h"
+#include "decoder.h"
+#include "row_filter.h"
+#include "row_arena.h"
+#include "digest.h"
+#include "analyze.h"
+#include "catalog.h"
+#include "zstream.h"
+#include "watch.h"
 
 struct ibuf xlog_ibuf;
 
+const struct update_op_record
+update_op_records [] = {
+	/* TNT_UPDATE_ASSIGN */	{"=", 3 },
+	/* TNT_UPDATE_ADD */	{"+", 3 },
+	/* TNT_UPDATE_AND */	{"&", 3 },
+	/* TNT_UPDATE_XOR */	{"^", 3 },
+	/* TNT_UPDATE_OR */	{"|", 3 },
+	/* TNT_UPDATE_SPLICE */	{":", 5 },
+	/* TNT_UPDATE_DELETE */	{"#", 3 },
+	/* TNT_UPDATE_INSERT */	{"!", 3 },
+	{ NULL, 0 }
+};
+
 static const char *parser_lib_name = "xlog.parser_v11";
+static const char *batch_reader_typename = "xlog.batch_reader";
+static const char *apply_plan_typename = "xlog.apply_plan";
+static const char *batch_typename = "xlog.batch";
+static const char *budget_typename = "xlog.decoder_budget";
+static const char *digest_typename = "xlog.digest";
+static const char *catalog_typename = "xlog.catalog";
+static const char *watch_typename = "xlog.watch";
 
 uint32_t CTID_STRUCT_ITER_HELPER_REF;
+uint32_t CTID_CONST_STRUCT_BATCH_ROW_PTR;
+uint32_t CTID_CONST_CHAR_PTR;
 box_tuple_format_t *tuple_format;
 
 /* Internal methods */
 
-struct space_def *
-search_space(struct iter_helper *hlp, int space_no) {
-	struct space_def *def = hlp->spaces;
-	while (def != NULL) {
-		if (space_no == def->space_no)
-			return def;
-		def = def->next;
-	}
-	return NULL;
-}
-
 static void
 lual_pushtuple(struct lua_State *L, struct tnt_tuple *t,
 	       struct space_def *def, int ret)
@@ -53,8 +79,8 @@ static void
 lual_pushkey(struct lua_State *L, struct tnt_tuple *t,
 	     struct space_def *def, int ret)
 {
-//	if (ret == F_RET_TUPLE)
-//		return luatu_key_fields(L, t, def);
+	if (ret == F_RET_TUPLE)
+		return luatu_key_fields(L, t, def);
 	return luata_key_fields(L, t, def);
 }
 
@@ -62,8 +88,8 @@ static void
 lual_pushops(struct lua_State *L, struct tnt_request_update *req,
 	     struct space_def *def, int ret)
 {
-//	if (ret == F_RET_TUPLE)
-//		return luatu_ops_fields(L, req, def);
+	if (ret == F_RET_TUPLE)
+		return luatu_ops_fields(L, req, def);
 	return luata_ops_fields(L, req, def);
 }
 
@@ -72,8 +98,8 @@ parser_xlog_iter_op_insert(struct lua_State *L, struct tnt_request *r,
 			   struct iter_helper *hlp)
 {
 	struct tnt_request_insert *req = &(r->r.insert);
-	struct space_def *def = search_space(hlp, req->h.ns);
-	if (!def && hlp->spaces)
+	struct space_def *def = NULL;
+	if (space_map_find(&hlp->map, req->h.ns, &def) != 0)
 		return 0;
 	lua_pushstring(L, "op");
 	lua_pushstring(L, "insert");
@@ -95,8 +121,8 @@ parser_xlog_iter_op_delete(struct lua_State *L, struct tnt_request *r,
 			   struct iter_helper *hlp)
 {
 	struct tnt_request_delete *req = &(r->r.del);
-	struct space_def *def = search_space(hlp, req->h.ns);
-	if (!def && hlp->spaces)
+	struct space_def *def = NULL;
+	if (space_map_find(&hlp->map, req->h.ns, &def) != 0)
 		return 0;
 	lua_pushstring(L, "op");
 	lua_pushstring(L, "delete");
@@ -115,8 +141,8 @@ parser_xlog_iter_op_update(struct lua_State *L, struct tnt_request *r,
 			   struct iter_helper *hlp)
 {
 	struct tnt_request_update *req = &(r->r.update);
-	struct space_def *def = search_space(hlp, req->h.ns);
-	if (!def && hlp->spaces)
+	struct space_def *def = NULL;
+	if (space_map_find(&hlp->map, req->h.ns, &def) != 0)
 		return 0;
 	lua_pushstring(L, "op");
 	lua_pushstring(L, "update");
@@ -133,6 +159,142 @@ parser_xlog_iter_op_update(struct lua_State *L, struct tnt_request *r,
 	return 1;
 }
 
+static enum tnt_log_filter_result
+iter_helper_filter_xlog(void *arg, const struct tnt_log_header_v11 *hdr,
+			uint32_t space)
+{
+	struct iter_helper *hlp = arg;
+	return row_filter(TNT_LOG_XLOG, &hlp->map, hlp->lsn_from, hlp->lsn_to,
+			  hdr, space);
+}
+
+static enum tnt_log_filter_result
+iter_helper_filter_snap(void *arg, const struct tnt_log_header_v11 *hdr,
+			uint32_t space)
+{
+	struct iter_helper *hlp = arg;
+	return row_filter(TNT_LOG_SNAPSHOT, &hlp->map, 0, UINT64_MAX, hdr,
+			  space);
+}
+
+static void
+iter_helper_salvage(void *arg, const struct tnt_log_damage *damage)
+{
+	struct iter_helper *hlp = arg;
+	if (damage_list_add(&hlp->damaged, damage) != 0)
+		say_error("failed to allocate memory for damaged region "
+			  "[%lld, %lld)", (long long)damage->from,
+			  (long long)damage->to);
+}
+
+/*
+ * Skip rows that won't be returned by xlog_pairs/snap_pairs before
+ * their data is processed, called through FFI after stream is opened.
+ * Damaged regions are skipped too if hlp->salvage is set.
+ */
+void
+xlog_stream_set_filter(struct tnt_stream *s, struct iter_helper *hlp,
+		       int snapshot)
+{
+	struct tnt_log *l = snapshot ? &TNT_SSNAPSHOT_CAST(s)->log :
+				       &TNT_SXLOG_CAST(s)->log;
+	tnt_log_set_filter(l, snapshot ? iter_helper_filter_snap :
+					 iter_helper_filter_xlog, hlp,
+			   hlp->verify_skipped);
+	if (hlp->salvage)
+		tnt_log_set_salvage(l, iter_helper_salvage, hlp);
+}
+
+/*
+ * Open stream on descriptor 'fd' that may be a pipe, called through FFI.
+ * Descriptor is duplicated, so the caller's one (e.g. stdin) stays open
+ * after stream is freed. Returns -1 on error (errno of stream is set).
+ */
+int
+xlog_stream_open_fd(struct tnt_stream *s, int fd, int snapshot)
+{
+	int dup_fd = dup(fd);
+	FILE *fp = dup_fd != -1 ? zstream_fdopen(dup_fd) : NULL;
+	return snapshot ? tnt_snapshot_open_fp(s, fp) :
+			  tnt_xlog_open_fp(s, fp);
+}
+
+/*
+ * Read xlog that is being written (see tnt_log_set_follow), called
+ * through FFI after stream is opened.
+ */
+void
+xlog_stream_follow(struct tnt_stream *s)
+{
+	tnt_log_set_follow(&TNT_SXLOG_CAST(s)->log, 1);
+}
+
+/* Whether end of file marker of xlog is read, called through FFI */
+int
+xlog_stream_complete(struct tnt_stream *s)
+{
+	return TNT_SXLOG_CAST(s)->log.complete;
+}
+
+/*
+ * Restart reading of stream at hlp->offset, called through FFI after
+ * stream is opened. Returns -1 if offset isn't a row of the file.
+ */
+int
+xlog_stream_seek(struct tnt_stream *s, struct iter_helper *hlp,
+		 int snapshot)
+{
+	struct tnt_log *l = snapshot ? &TNT_SSNAPSHOT_CAST(s)->log :
+				       &TNT_SXLOG_CAST(s)->log;
+	return tnt_log_seek_row(l, hlp->offset);
+}
+
+void
+iter_helper_free_arena(struct iter_helper *hlp)
+{
+	if (hlp->arena == NULL)
+		return;
+	/* current row of iterator points to the arena */
+	struct tnt_iter *i = hlp->iter;
+	if (i != NULL && i->type == TNT_ITER_REQUEST) {
+		tnt_request_free(TNT_IREQUEST_PTR(i));
+		tnt_request_init(TNT_IREQUEST_PTR(i));
+	} else if (i != NULL && i->type == TNT_ITER_STORAGE) {
+		tnt_tuple_free(TNT_ISTORAGE_TUPLE(i));
+		tnt_tuple_init(TNT_ISTORAGE_TUPLE(i));
+	}
+	row_arena_delete(hlp->arena);
+	hlp->arena = NULL;
+}
+
+void
+iter_helper_destroy(struct iter_helper *hlp)
+{
+	iter_helper_free_arena(hlp);
+	damage_list_destroy(&hlp->damaged);
+}
+
+/*
+ * Start batch of xlog_pairs/snap_pairs: rows of the previous one are
+ * already pushed to Lua, so memory they were parsed into is released.
+ */
+static inline void
+iter_helper_begin_batch(struct iter_helper *hlp)
+{
+	if (hlp->arena != NULL)
+		row_arena_reset(hlp->arena);
+}
+
+/* tnt_next() that parses row in arena of iterator, if there is one */
+static inline int
+iter_helper_next(struct iter_helper *hlp)
+{
+	struct row_arena *prev = row_arena_enter(hlp->arena);
+	int rc = tnt_next(hlp->iter);
+	row_arena_leave(prev);
+	return rc;
+}
+
 static int
 lua_xlog_pairs(struct lua_State *L)
 {
@@ -148,14 +310,20 @@ lua_xlog_pairs(struct lua_State *L)
 	struct tnt_iter *pi = hlp->iter;
 	int batch_count = 0;
 
+	struct tnt_log *l = &TNT_SXLOG_CAST(TNT_IREQUEST_STREAM(pi))->log;
+	iter_helper_begin_batch(hlp);
 	lua_newtable(L);
-	while (batch_count < hlp->batch_count && tnt_next(pi)) {
+	while (batch_count < hlp->batch_count && iter_helper_next(hlp)) {
 		lua_pushinteger(L, batch_count + 1);
 		struct tnt_request *r = TNT_IREQUEST_PTR(pi);
-		struct tnt_log_row *row =
-			&(TNT_SXLOG_CAST(TNT_IREQUEST_STREAM(pi))->log.current);
-		if (row->hdr.lsn < hlp->lsn_from ||
-		    row->hdr.lsn > hlp->lsn_to) {
+		struct tnt_log_row *row = &l->current;
+		/* lsn of xlog rows is increasing */
+		if (row->hdr.lsn > hlp->lsn_to) {
+			lua_pop(L, 1);
+			break;
+		}
+		hlp->offset = tnt_log_tell(l);
+		if (row->hdr.lsn < hlp->lsn_from) {
 			lua_pop(L, 1);
 			continue;
 		}
@@ -216,19 +384,20 @@ lua_snap_pairs(struct lua_State *L)
 
 	struct tnt_iter *pi = hlp->iter;
 	int batch_count = 0;
-	struct space_def *def = NULL;
 
+	struct tnt_log *l =
+		&TNT_SSNAPSHOT_CAST(TNT_ISTORAGE_STREAM(pi))->log;
+	iter_helper_begin_batch(hlp);
 	lua_newtable(L);
-	while (batch_count < hlp->batch_count && tnt_next(pi)) {
+	while (batch_count < hlp->batch_count && iter_helper_next(hlp)) {
 		lua_pushinteger(L, batch_count + 1);
 		lua_newtable(L);
 
-		struct tnt_log_row *row =
-			&(TNT_SSNAPSHOT_CAST(TNT_ISTORAGE_STREAM(pi))->log.current);
+		struct tnt_log_row *row = &l->current;
+		hlp->offset = tnt_log_tell(l);
 		uint32_t space = row->row_snap.space;
-		if (!def || space != def->space_no)
-			def = search_space(hlp, space);
-		if (!def && hlp->spaces) {
+		struct space_def *def = NULL;
+		if (space_map_find(&hlp->map, space, &def) != 0) {
 			lua_pop(L, 2);
 			continue;
 		}
@@ -254,10 +423,1231 @@ lua_snap_pairs(struct lua_State *L)
 	return 2;
 }
 
+/*
+ * Rows decoded by worker threads, either by parallel snapshot pipeline
+ * or by background decoder of single file.
+ */
+struct lua_batch_reader {
+	struct pipeline *pipeline;
+	struct decoder *decoder;
+	/* batch that is being consumed and position in it */
+	struct batch *cur;
+	uint32_t row;
+	bool eof;
+	bool xlog;
+	/* error of the batch that was already passed to Lua (batch_next) */
+	char *error;
+};
+
+static bool
+batch_reader_ready(struct lua_batch_reader *br)
+{
+	if (br->pipeline != NULL)
+		return pipeline_ready(br->pipeline);
+	return decoder_ready(br->decoder);
+}
+
+static ssize_t
+batch_reader_wait_cb(va_list ap)
+{
+	struct lua_batch_reader *br = va_arg(ap, struct lua_batch_reader *);
+	if (br->pipeline != NULL)
+		pipeline_wait(br->pipeline);
+	else
+		decoder_wait(br->decoder);
+	return 0;
+}
+
+static struct batch *
+batch_reader_take(struct lua_batch_reader *br)
+{
+	if (br->pipeline != NULL)
+		return pipeline_take(br->pipeline);
+	return decoder_take(br->decoder);
+}
+
+static void
+batch_reader_release(struct lua_batch_reader *br, struct batch *b)
+{
+	if (br->pipeline != NULL)
+		pipeline_release(br->pipeline, b);
+	else
+		decoder_release(br->decoder, b);
+}
+
+static bool
+batch_reader_failed(struct lua_batch_reader *br)
+{
+	if (br->pipeline != NULL)
+		return br->pipeline->failed;
+	return __atomic_load_n(&br->decoder->failed, __ATOMIC_ACQUIRE);
+}
+
+/* all rows of batch are passed on, reading may be restarted after it */
+static inline void
+batch_reader_done(struct iter_helper *hlp, struct batch *b)
+{
+	if (!b->error && b->offset > hlp->offset)
+		hlp->offset = b->offset;
+	if (damage_list_move(&hlp->damaged, &b->damaged) != 0)
+		say_error("failed to allocate memory for damaged regions");
+}
+
+static int
+lua_batch_reader_gc(struct lua_State *L)
+{
+	struct lua_batch_reader *br = luaL_checkudata(L, 1,
+						      batch_reader_typename);
+	batch_delete(br->cur);
+	br->cur = NULL;
+	pipeline_delete(br->pipeline);
+	br->pipeline = NULL;
+	decoder_delete(br->decoder);
+	br->decoder = NULL;
+	free(br->error);
+	br->error = NULL;
+	return 0;
+}
+
+static struct lua_batch_reader *
+lua_batch_reader_new(struct lua_State *L)
+{
+	struct lua_batch_reader *br = lua_newuserdata(L, sizeof(*br));
+	memset(br, 0, sizeof(*br));
+	luaL_getmetatable(L, batch_reader_typename);
+	lua_setmetatable(L, -2);
+	return br;
+}
+
+static void
+lual_pushmsgpack(struct lua_State *L, const char *begin, const char *end,
+		 int ret)
+{
+	if (ret == F_RET_TABLE)
+		return luata_mp_decode(L, begin);
+	if (!tuple_format) tuple_format = box_tuple_format_default();
+	if (!tuple_format)
+		luaL_error(L, "Cannot get tuple_format (maybe box isn't "
+			      "configured. box.cfg{} is needed)");
+	box_tuple_t *tuple = box_tuple_new(tuple_format, begin, end);
+	if (tuple == NULL)
+		luaL_error(L, "%s: out of memory (box_tuple_new)", __func__);
+	luaT_pushtuple(L, tuple);
+}
+
+static void
+lual_pushbatchrow(struct lua_State *L, bool xlog, struct batch *b,
+		  struct batch_row *r, int ret)
+{
+	static const char *op_names[] = {"insert", "delete", "update"};
+	const char *data = b->data + r->data;
+	const char *ops = b->data + r->ops;
+
+	lua_newtable(L);
+	if (xlog) {
+		lua_pushstring(L, "lsn");
+		lua_pushnumber(L, r->lsn);
+		lua_settable(L, -3); /* lsn */
+		lua_pushstring(L, "time");
+		lua_pushnumber(L, r->tm);
+		lua_settable(L, -3); /* time */
+		lua_pushstring(L, "op");
+		lua_pushstring(L, op_names[r->op]);
+		lua_settable(L, -3); /* op */
+	}
+	if (xlog && r->op == BATCH_OP_INSERT) {
+		lua_pushstring(L, "flags");
+		lua_pushnumber(L, r->flags);
+		lua_settable(L, -3); /* flags */
+	}
+	lua_pushstring(L, "space");
+	lua_pushinteger(L, r->space);
+	lua_settable(L, -3); /* space */
+	lua_pushstring(L, r->op == BATCH_OP_INSERT ? "tuple" : "key");
+	lual_pushmsgpack(L, data, ops, ret);
+	lua_settable(L, -3); /* tuple */
+	if (r->op == BATCH_OP_UPDATE) {
+		lua_pushstring(L, "ops");
+		lual_pushmsgpack(L, ops, b->data + r->end, ret);
+		lua_settable(L, -3); /* ops */
+	}
+}
+
+static int
+lua_snap_pipeline(struct lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+	uint32_t cdata;
+	struct iter_helper *hlp = luaL_checkcdata(L, 2, &cdata);
+	assert(cdata == CTID_STRUCT_ITER_HELPER_REF);
+	int threads = luaL_checkinteger(L, 3);
+	enum tnt_log_verify verify = luaL_checkinteger(L, 4);
+
+	struct lua_batch_reader *br = lua_batch_reader_new(L);
+	char errbuf[256];
+	br->pipeline = pipeline_new(path, TNT_LOG_SNAPSHOT, &hlp->map,
+				    threads, verify, hlp->verify_skipped,
+				    hlp->salvage,
+				    hlp->return_type == F_RET_TABLE,
+				    hlp->offset, errbuf, sizeof(errbuf));
+	if (br->pipeline == NULL)
+		luaL_error(L, "%s", errbuf);
+	return 1;
+}
+
+static int
+lua_log_decoder(struct lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+	uint32_t cdata;
+	struct iter_helper *hlp = luaL_checkcdata(L, 2, &cdata);
+	assert(cdata == CTID_STRUCT_ITER_HELPER_REF);
+	enum tnt_log_type type = luaL_checkinteger(L, 3);
+	enum tnt_log_io io = luaL_checkinteger(L, 4);
+	enum tnt_log_verify verify = luaL_checkinteger(L, 5);
+	struct decoder_budget *budget = NULL;
+	if (!lua_isnoneornil(L, 6))
+		budget = *(struct decoder_budget **)
+			luaL_checkudata(L, 6, budget_typename);
+
+	struct lua_batch_reader *br = lua_batch_reader_new(L);
+	br->xlog = (type == TNT_LOG_XLOG);
+	char errbuf[256];
+	br->decoder = decoder_new(path, type, io, verify, hlp->verify_skipped,
+				  hlp->salvage, &hlp->map,
+				  hlp->lsn_from, hlp->lsn_to, hlp->lsn_index,
+				  hlp->offset, hlp->alloc, hlp->hugepages,
+				  hlp->return_type == F_RET_TABLE, budget,
+				  errbuf, sizeof(errbuf));
+	if (br->decoder == NULL)
+		luaL_error(L, "%s", errbuf);
+	return 1;
+}
+
+/*
+ * Memory budget shared by decoders of xlogs that are decoded ahead of
+ * the one being applied (see struct decoder_budget).
+ */
+static int
+lua_decoder_budget(struct lua_State *L)
+{
+	double limit = luaL_checknumber(L, 1);
+	if (limit < 0)
+		luaL_error(L, "decoder budget must be non-negative");
+	struct decoder_budget **ptr = lua_newuserdata(L, sizeof(*ptr));
+	*ptr = decoder_budget_new((size_t)limit);
+	if (*ptr == NULL)
+		luaL_error(L, "Failed to allocate memory for decoder budget");
+	luaL_getmetatable(L, budget_typename);
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+static int
+lua_decoder_budget_gc(struct lua_State *L)
+{
+	struct decoder_budget **ptr = luaL_checkudata(L, 1, budget_typename);
+	decoder_budget_unref(*ptr);
+	*ptr = NULL;
+	return 0;
+}
+
+static int
+lua_batch_pairs(struct lua_State *L)
+{
+	lua_pushinteger(L, 1);
+	lua_gettable(L, 1);
+	struct lua_batch_reader *br = luaL_checkudata(L, -1,
+						      batch_reader_typename);
+	lua_pushinteger(L, 2);
+	lua_gettable(L, 1);
+	uint32_t cdata;
+	struct iter_helper *hlp = luaL_checkcdata(L, -1, &cdata);
+	assert(cdata == CTID_STRUCT_ITER_HELPER_REF);
+	if (br->pipeline == NULL && br->decoder == NULL)
+		luaL_error(L, "reader is closed");
+
+	int n = luaL_checkinteger(L, 2);
+	lua_pushinteger(L, n + 1);
+
+	int batch_count = 0;
+
+	lua_newtable(L);
+	while (batch_count < hlp->batch_count) {
+		struct batch *b = br->cur;
+		if (b != NULL && br->row < b->count) {
+			struct batch_row *r = &b->rows[br->row++];
+			lua_pushinteger(L, batch_count + 1);
+			lual_pushbatchrow(L, br->xlog, b, r,
+					  hlp->return_type);
+			lua_settable(L, -3);
+			batch_count += 1; /* operation */
+			if (br->row == b->count)
+				batch_reader_done(hlp, b);
+			continue;
+		}
+		/* rows before error are returned first */
+		if (b != NULL && b->error)
+			break;
+		if (b != NULL) {
+			batch_reader_done(hlp, b);
+			br->cur = NULL;
+			batch_reader_release(br, b);
+		}
+		if (br->eof)
+			break;
+		/* don't block tx thread while rows are decoded */
+		if (!batch_reader_ready(br))
+			coio_call(batch_reader_wait_cb, br);
+		br->cur = batch_reader_take(br);
+		br->row = 0;
+		if (br->cur == NULL)
+			br->eof = true;
+	}
+
+	if (batch_count == 0 && br->cur != NULL && br->cur->error)
+		luaL_error(L, "%s", br->cur->errmsg);
+	if (batch_count == 0 && batch_reader_failed(br))
+		luaL_error(L, "parsing failed: failed to allocate memory "
+			      "for batch");
+
+	if (batch_count == 0)
+		return 0;
+
+	return 2;
+}
+
+/*
+ * Batch of rows, returned to Lua as is (return_type = 'batch'). Rows
+ * are decoded lazily with batch:row(i), or may be accessed through
+ * FFI with batch:rows() and batch:data().
+ */
+struct lua_batch {
+	struct batch *batch;
+	bool xlog;
+};
+
+static struct lua_batch *
+lua_checkbatch(struct lua_State *L, int idx)
+{
+	struct lua_batch *lb = luaL_checkudata(L, idx, batch_typename);
+	if (lb->batch == NULL)
+		luaL_error(L, "batch is freed");
+	return lb;
+}
+
+static int
+lua_batch_gc(struct lua_State *L)
+{
+	struct lua_batch *lb = luaL_checkudata(L, 1, batch_typename);
+	batch_delete(lb->batch);
+	lb->batch = NULL;
+	return 0;
+}
+
+static int
+lua_batch_count(struct lua_State *L)
+{
+	struct lua_batch *lb = lua_checkbatch(L, 1);
+	lua_pushinteger(L, lb->batch->count);
+	return 1;
+}
+
+/* batch:row(i) -> row table, same as with return_type = 'tuple' */
+static int
+lua_batch_row(struct lua_State *L)
+{
+	struct lua_batch *lb = lua_checkbatch(L, 1);
+	int i = luaL_checkinteger(L, 2);
+	if (i < 1 || (uint32_t )i > lb->batch->count)
+		return 0;
+	struct batch *b = lb->batch;
+	lual_pushbatchrow(L, lb->xlog, b, &b->rows[i - 1], F_RET_TUPLE);
+	return 1;
+}
+
+/* batch:rows() -> 'const struct batch_row *', 0-based */
+static int
+lua_batch_rows(struct lua_State *L)
+{
+	struct lua_batch *lb = lua_checkbatch(L, 1);
+	const struct batch_row **ptr =
+		luaL_pushcdata(L, CTID_CONST_STRUCT_BATCH_ROW_PTR);
+	*ptr = lb->batch->rows;
+	return 1;
+}
+
+/* batch:data() -> 'const char *', base of batch_row offsets */
+static int
+lua_batch_data(struct lua_State *L)
+{
+	struct lua_batch *lb = lua_checkbatch(L, 1);
+	const char **ptr = luaL_pushcdata(L, CTID_CONST_CHAR_PTR);
+	*ptr = lb->batch->data;
+	return 1;
+}
+
+static const struct luaL_Reg
+batch_methods [] = {
+	{ "count",		lua_batch_count		 },
+	{ "row",		lua_batch_row		 },
+	{ "rows",		lua_batch_rows		 },
+	{ "data",		lua_batch_data		 },
+	{ NULL,			NULL			 }
+};
+
+/*
+ * Iterator, that returns decoded batches as they are, one userdata
+ * per batch. Batches that are left after filtering are returned,
+ * batch_count is not applied.
+ */
+static int
+lua_batch_next(struct lua_State *L)
+{
+	lua_pushinteger(L, 1);
+	lua_gettable(L, 1);
+	struct lua_batch_reader *br = luaL_checkudata(L, -1,
+						      batch_reader_typename);
+	lua_pushinteger(L, 2);
+	lua_gettable(L, 1);
+	uint32_t cdata;
+	struct iter_helper *hlp = luaL_checkcdata(L, -1, &cdata);
+	assert(cdata == CTID_STRUCT_ITER_HELPER_REF);
+	if (br->pipeline == NULL && br->decoder == NULL)
+		luaL_error(L, "reader is closed");
+	if (br->error != NULL)
+		luaL_error(L, "%s", br->error);
+
+	int n = luaL_checkinteger(L, 2);
+	struct batch *b = NULL;
+	while (!br->eof) {
+		/* don't block tx thread while rows are decoded */
+		if (!batch_reader_ready(br))
+			coio_call(batch_reader_wait_cb, br);
+		b = batch_reader_take(br);
+		if (b == NULL) {
+			br->eof = true;
+			break;
+		}
+		batch_reader_done(hlp, b);
+		if (b->count > 0)
+			break;
+		if (b->error) {
+			br->error = strdup(b->errmsg);
+			batch_reader_release(br, b);
+			luaL_error(L, "%s", br->error);
+		}
+		batch_reader_release(br, b);
+		b = NULL;
+	}
+	if (b == NULL) {
+		if (batch_reader_failed(br))
+			luaL_error(L, "parsing failed: failed to allocate "
+				      "memory for batch");
+		return 0;
+	}
+	/* rows before error are returned first */
+	if (b->error) {
+		br->eof = true;
+		br->error = strdup(b->errmsg);
+	}
+	lua_pushinteger(L, n + 1);
+	struct lua_batch *lb = lua_newuserdata(L, sizeof(*lb));
+	lb->batch = b;
+	lb->xlog = br->xlog;
+	luaL_getmetatable(L, batch_typename);
+	lua_setmetatable(L, -2);
+	return 2;
+}
+
+/* Where rows of old space are applied */
+struct apply_target {
+	uint32_t space_no;
+	uint32_t space_id;
+	uint32_t index_id;
+};
+
+struct apply_plan {
+	uint32_t count;
+	/* last target found */
+	uint32_t last;
+	struct apply_target targets[0];
+};
+
+static struct apply_target *
+apply_plan_search(struct apply_plan *plan, uint32_t space_no)
+{
+	if (plan->count > 0 && plan->targets[plan->last].space_no == space_no)
+		return &plan->targets[plan->last];
+	for (uint32_t i = 0; i < plan->count; ++i) {
+		if (plan->targets[i].space_no == space_no) {
+			plan->last = i;
+			return &plan->targets[i];
+		}
+	}
+	return NULL;
+}
+
+/* {[space_no] = {space_id, index_id}, ...} */
+static int
+lua_apply_plan(struct lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+	uint32_t count = 0;
+	lua_pushnil(L);
+	while (lua_next(L, 1) != 0) {
+		lua_pop(L, 1);
+		count++;
+	}
+	struct apply_plan *plan = lua_newuserdata(L, sizeof(*plan) +
+					count * sizeof(struct apply_target));
+	memset(plan, 0, sizeof(*plan));
+	luaL_getmetatable(L, apply_plan_typename);
+	lua_setmetatable(L, -2);
+	lua_pushnil(L);
+	while (lua_next(L, 1) != 0) {
+		struct apply_target *t = &plan->targets[plan->count++];
+		t->space_no = luaL_checkinteger(L, -2);
+		luaL_checktype(L, -1, LUA_TTABLE);
+		lua_rawgeti(L, -1, 1);
+		t->space_id = luaL_checkinteger(L, -1);
+		lua_rawgeti(L, -2, 2);
+		t->index_id = luaL_checkinteger(L, -1);
+		lua_pop(L, 3);
+	}
+	return 1;
+}
+
+static int
+batch_row_apply(struct batch *b, struct batch_row *r,
+		struct apply_target *t, const char **what)
+{
+	const char *data = b->data + r->data;
+	const char *ops = b->data + r->ops;
+	const char *end = b->data + r->end;
+	switch (r->op) {
+	case BATCH_OP_INSERT:
+		*what = "replacing";
+		return box_replace(t->space_id, data, ops, NULL);
+	case BATCH_OP_DELETE:
+		*what = "deleting";
+		return box_delete(t->space_id, t->index_id, data, ops, NULL);
+	case BATCH_OP_UPDATE:
+		*what = "updating";
+		/* field numbers in ops are 1-based */
+		return box_update(t->space_id, t->index_id, data, ops, ops,
+				  end, 1, NULL);
+	}
+	*what = "applying";
+	return -1;
+}
+
+/*
+ * Apply up to batch_count rows in one transaction without creating
+ * any Lua objects. Rows of xlog with lsn <= 'lsn' are skipped.
+ * Returns number of rows taken from file and lsn of the last one, or
+ * nothing at the end of file. Optional function is called before
+ * commit with the same values.
+ */
+static int
+lua_batch_apply(struct lua_State *L)
+{
+	lua_pushinteger(L, 1);
+	lua_gettable(L, 1);
+	struct lua_batch_reader *br = luaL_checkudata(L, -1,
+						      batch_reader_typename);
+	lua_pushinteger(L, 2);
+	lua_gettable(L, 1);
+	uint32_t cdata;
+	struct iter_helper *hlp = luaL_checkcdata(L, -1, &cdata);
+	assert(cdata == CTID_STRUCT_ITER_HELPER_REF);
+	struct apply_plan *plan = luaL_checkudata(L, 2, apply_plan_typename);
+	uint64_t skip_lsn = luaL_checkuint64(L, 3);
+	bool commit = lua_toboolean(L, 4);
+	bool throws = lua_toboolean(L, 5);
+	if (br->pipeline == NULL && br->decoder == NULL)
+		luaL_error(L, "reader is closed");
+
+	/* wait for rows before transaction is started, it can't yield */
+	while (br->cur == NULL || (br->row == br->cur->count &&
+				   !br->cur->error)) {
+		if (br->cur != NULL) {
+			batch_reader_done(hlp, br->cur);
+			batch_reader_release(br, br->cur);
+			br->cur = NULL;
+		}
+		if (br->eof)
+			break;
+		if (!batch_reader_ready(br))
+			coio_call(batch_reader_wait_cb, br);
+		br->cur = batch_reader_take(br);
+		br->row = 0;
+		if (br->cur == NULL)
+			br->eof = true;
+	}
+	if (br->cur == NULL) {
+		if (batch_reader_failed(br))
+			luaL_error(L, "parsing failed: failed to allocate memory "
+				      "for batch");
+		return 0;
+	}
+	if (br->row == br->cur->count)
+		luaL_error(L, "%s", br->cur->errmsg);
+
+	if (commit && box_txn_begin() != 0)
+		luaL_error(L, "%s", box_error_message(box_error_last()));
+	int count = 0;
+	uint64_t lsn = 0;
+	while (count < hlp->batch_count) {
+		struct batch *b = br->cur;
+		if (b != NULL && br->row < b->count) {
+			struct batch_row *r = &b->rows[br->row++];
+			count++;
+			lsn = r->lsn;
+			if (br->row == b->count)
+				batch_reader_done(hlp, b);
+			if (br->xlog && r->lsn <= skip_lsn)
+				continue;
+			struct apply_target *t = apply_plan_search(plan,
+								   r->space);
+			const char *what = NULL;
+			if (t != NULL && batch_row_apply(b, r, t, &what) == 0)
+				continue;
+			const char *err = t == NULL ? "no target space" :
+				box_error_message(box_error_last());
+			say_error("Error while %s space %u: %s", what,
+				  r->space, err);
+			if (!throws)
+				continue;
+			if (commit)
+				box_txn_rollback();
+			luaL_error(L, "Error while %s space %u: %s", what,
+				   r->space, err);
+		}
+		/* error is raised on the next call */
+		if (b == NULL || b->error)
+			break;
+		batch_reader_done(hlp, b);
+		br->cur = NULL;
+		batch_reader_release(br, b);
+		/* next batch is applied in this transaction only if it's
+		 * already decoded */
+		if (!batch_reader_ready(br))
+			break;
+		br->cur = batch_reader_take(br);
+		br->row = 0;
+		if (br->cur == NULL) {
+			br->eof = true;
+			break;
+		}
+	}
+	/* function(count, lsn) is called before commit, e.g. to save
+	 * progress in the same transaction */
+	if (!lua_isnoneornil(L, 6)) {
+		lua_pushvalue(L, 6);
+		lua_pushinteger(L, count);
+		lua_pushnumber(L, lsn);
+		if (lua_pcall(L, 2, 0, 0) != 0) {
+			if (commit)
+				box_txn_rollback();
+			lua_error(L);
+		}
+	}
+	if (commit && box_txn_commit() != 0)
+		luaL_error(L, "%s", box_error_message(box_error_last()));
+
+	lua_pushinteger(L, count);
+	lua_pushnumber(L, lsn);
+	return 2;
+}
+
+/*
+ * Regions skipped by salvage before rows returned so far, as array of
+ * {from = offset, to = offset, lsn_before = lsn, lsn_after = lsn}.
+ * They are returned once.
+ */
+static int
+lua_damaged(struct lua_State *L)
+{
+	uint32_t cdata;
+	struct iter_helper *hlp = luaL_checkcdata(L, 1, &cdata);
+	assert(cdata == CTID_STRUCT_ITER_HELPER_REF);
+	lua_createtable(L, hlp->damaged.count, 0);
+	for (uint32_t i = 0; i < hlp->damaged.count; ++i) {
+		struct tnt_log_damage *d = &hlp->damaged.items[i];
+		lua_createtable(L, 0, 4);
+		lua_pushnumber(L, d->from);
+		lua_setfield(L, -2, "from");
+		lua_pushnumber(L, d->to);
+		lua_setfield(L, -2, "to");
+		lua_pushnumber(L, d->lsn_before);
+		lua_setfield(L, -2, "lsn_before");
+		lua_pushnumber(L, d->lsn_after);
+		lua_setfield(L, -2, "lsn_after");
+		lua_rawseti(L, -2, i + 1);
+	}
+	hlp->damaged.count = 0;
+	return 1;
+}
+
+/* Digest of tuples hashed by 'threads' worker threads */
+static int
+lua_digest(struct lua_State *L)
+{
+	int threads = luaL_optinteger(L, 1, 0);
+	char errbuf[256];
+	struct digest **ptr = lua_newuserdata(L, sizeof(*ptr));
+	*ptr = NULL;
+	luaL_getmetatable(L, digest_typename);
+	lua_setmetatable(L, -2);
+	*ptr = digest_new(threads, errbuf, sizeof(errbuf));
+	if (*ptr == NULL)
+		luaL_error(L, "%s", errbuf);
+	return 1;
+}
+
+static struct digest *
+lua_checkdigest(struct lua_State *L, int idx)
+{
+	struct digest **ptr = luaL_checkudata(L, idx, digest_typename);
+	if (*ptr == NULL)
+		luaL_error(L, "digest is closed");
+	return *ptr;
+}
+
+static int
+lua_digest_gc(struct lua_State *L)
+{
+	struct digest **ptr = luaL_checkudata(L, 1, digest_typename);
+	digest_delete(*ptr);
+	*ptr = NULL;
+	return 0;
+}
+
+static ssize_t
+digest_wait_cb(va_list ap)
+{
+	struct digest *d = va_arg(ap, struct digest *);
+	digest_wait(d);
+	return 0;
+}
+
+static ssize_t
+digest_wait_idle_cb(va_list ap)
+{
+	struct digest *d = va_arg(ap, struct digest *);
+	digest_wait_idle(d);
+	return 0;
+}
+
+/* Account msgpack tuple (string) to slot */
+static int
+lua_digest_add(struct lua_State *L)
+{
+	struct digest *d = lua_checkdigest(L, 1);
+	uint32_t slot = luaL_checkinteger(L, 2);
+	size_t size;
+	const char *data = luaL_checklstring(L, 3, &size);
+	if (!digest_ready(d))
+		coio_call(digest_wait_cb, d);
+	if (digest_add(d, slot, data, size) != 0)
+		luaL_error(L, "Failed to allocate memory for digest");
+	return 0;
+}
+
+/*
+ * Account up to 'limit' tuples of space index to slot: tuples from
+ * 'key' (msgpack array, the one equal to it is skipped if 'after' is
+ * set) up to the first one not less than 'stop' key (or to the end
+ * of index if it's nil). The scan doesn't yield, so it stops early
+ * if workers fall behind. Returns number of tuples and key of the last
+ * one built from fields 'parts' (1-based), or nothing if index is
+ * scanned up to the end.
+ */
+static int
+lua_digest_scan(struct lua_State *L)
+{
+	struct digest *d = lua_checkdigest(L, 1);
+	uint32_t slot = luaL_checkinteger(L, 2);
+	uint32_t space_id = luaL_checkinteger(L, 3);
+	uint32_t index_id = luaL_checkinteger(L, 4);
+	size_t key_len;
+	const char *key = luaL_checklstring(L, 5, &key_len);
+	int type = lua_toboolean(L, 6) ? ITER_GT : ITER_GE;
+	size_t stop_len = 0;
+	const char *stop = NULL;
+	if (!lua_isnoneornil(L, 7))
+		stop = luaL_checklstring(L, 7, &stop_len);
+	luaL_checktype(L, 8, LUA_TTABLE);
+	int limit = luaL_checkinteger(L, 9);
+
+	box_tuple_t *stop_tuple = NULL;
+	if (stop != NULL) {
+		box_iterator_t *it = box_index_iterator(space_id, index_id,
+							ITER_GE, stop,
+							stop + stop_len);
+		if (it == NULL || box_iterator_next(it, &stop_tuple) != 0) {
+			if (it != NULL)
+				box_iterator_free(it);
+			luaL_error(L, "%s", box_error_message(box_error_last()));
+		}
+		box_iterator_free(it);
+	}
+	box_iterator_t *it = box_index_iterator(space_id, index_id, type, key,
+						key + key_len);
+	if (it == NULL)
+		luaL_error(L, "%s", box_error_message(box_error_last()));
+	int count = 0;
+	box_tuple_t *tuple = NULL, *last = NULL;
+	const char *err = NULL;
+	while (count < limit) {
+		if (box_iterator_next(it, &tuple) != 0) {
+			err = box_error_message(box_error_last());
+			break;
+		}
+		if (tuple == NULL || tuple == stop_tuple) {
+			last = NULL;
+			break;
+		}
+		ibuf_reset(&xlog_ibuf);
+		size_t size = box_tuple_bsize(tuple);
+		char *data = ibuf_reserve(&xlog_ibuf, size);
+		if (data == NULL || box_tuple_to_buf(tuple, data, size) < 0 ||
+		    digest_add(d, slot, data, size) != 0) {
+			err = "Failed to allocate memory for digest";
+			break;
+		}
+		count++;
+		last = tuple;
+		if (!digest_ready(d))
+			break;
+	}
+	if (err != NULL) {
+		box_iterator_free(it);
+		luaL_error(L, "%s", err);
+	}
+	lua_pushinteger(L, count);
+	if (last == NULL) {
+		box_iterator_free(it);
+		return 1;
+	}
+	/* tuple is valid until iterator is freed */
+	int part_count = lua_objlen(L, 8);
+	ibuf_reset(&xlog_ibuf);
+	char *pos = ibuf_alloc(&xlog_ibuf, mp_sizeof_array(part_count));
+	if (pos == NULL)
+		goto error_mem;
+	mp_encode_array(pos, part_count);
+	for (int i = 1; i <= part_count; ++i) {
+		lua_rawgeti(L, 8, i);
+		uint32_t fieldno = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		const char *field = fieldno > 0 ?
+				    box_tuple_field(last, fieldno - 1) : NULL;
+		const char *end = field;
+		if (field != NULL)
+			mp_next(&end);
+		pos = ibuf_alloc(&xlog_ibuf, field != NULL ? end - field :
+							     mp_sizeof_nil());
+		if (pos == NULL)
+			goto error_mem;
+		if (field != NULL)
+			memcpy(pos, field, end - field);
+		else
+			mp_encode_nil(pos);
+	}
+	box_iterator_free(it);
+	lua_pushlstring(L, xlog_ibuf.rpos, ibuf_used(&xlog_ibuf));
+	return 2;
+error_mem:
+	box_iterator_free(it);
+	return luaL_error(L, "%s: out of memory (ibuf_alloc)", __func__);
+}
+
+/* Wait until workers catch up with digest_add() */
+static int
+lua_digest_wait(struct lua_State *L)
+{
+	struct digest *d = lua_checkdigest(L, 1);
+	if (!digest_ready(d))
+		coio_call(digest_wait_cb, d);
+	return 0;
+}
+
+/* Returns number of tuples of slot and hex string of their digest */
+static int
+lua_digest_result(struct lua_State *L)
+{
+	struct digest *d = lua_checkdigest(L, 1);
+	uint32_t slot = luaL_checkinteger(L, 2);
+	digest_flush(d);
+	if (!digest_idle(d))
+		coio_call(digest_wait_idle_cb, d);
+	struct digest_sum sum;
+	if (digest_result(d, slot, &sum) != 0)
+		luaL_error(L, "Failed to allocate memory for digest");
+	char hex[33];
+	snprintf(hex, sizeof(hex), "%016" PRIx64 "%016" PRIx64, sum.hi,
+		 sum.lo);
+	lua_pushnumber(L, sum.count);
+	lua_pushstring(L, hex);
+	return 2;
+}
+
+static ssize_t
+analyze_wait_cb(va_list ap)
+{
+	struct analyze *a = va_arg(ap, struct analyze *);
+	analyze_wait(a);
+	return 0;
+}
+
+/* {{from = (number), to = (number), count = (number)}, ...} of non-empty
+ * log2 buckets */
+static void
+lual_pushhist(struct lua_State *L, const uint64_t *hist, uint32_t max)
+{
+	lua_createtable(L, 0, 2);
+	lua_pushnumber(L, max);
+	lua_setfield(L, -2, "max");
+	lua_newtable(L);
+	int n = 0;
+	for (int i = 0; i < ANALYZE_HIST_SIZE; ++i) {
+		if (hist[i] == 0)
+			continue;
+		lua_createtable(L, 0, 3);
+		lua_pushnumber(L, i == 0 ? 0 : (double)(1ULL << (i - 1)));
+		lua_setfield(L, -2, "from");
+		lua_pushnumber(L, i == 0 ? 0 : (double)((1ULL << i) - 1));
+		lua_setfield(L, -2, "to");
+		lua_pushnumber(L, hist[i]);
+		lua_setfield(L, -2, "count");
+		lua_rawseti(L, -2, ++n);
+	}
+	lua_setfield(L, -2, "hist");
+}
+
+static void
+lual_pushanalyze_space(struct lua_State *L, struct analyze_space *s)
+{
+	static const char *op_names[] = {"insert", "delete", "update"};
+	static const char *update_names[] = {"=", "+", "&", "^", "|", ":",
+					     "#", "!"};
+	lua_newtable(L);
+	lua_pushnumber(L, s->rows);
+	lua_setfield(L, -2, "rows");
+	lua_pushnumber(L, s->bytes);
+	lua_setfield(L, -2, "bytes");
+	lua_createtable(L, 0, ANALYZE_OP_MAX);
+	for (int i = 0; i < ANALYZE_OP_MAX; ++i) {
+		lua_pushnumber(L, s->ops[i]);
+		lua_setfield(L, -2, op_names[i]);
+	}
+	lua_setfield(L, -2, "ops");
+	lua_newtable(L);
+	for (int i = 0; i < TNT_UPDATE_MAX; ++i) {
+		if (s->update_ops[i] == 0)
+			continue;
+		lua_pushnumber(L, s->update_ops[i]);
+		lua_setfield(L, -2, update_names[i]);
+	}
+	lua_setfield(L, -2, "update_ops");
+	lua_pushnumber(L, s->tuples);
+	lua_setfield(L, -2, "tuples");
+	lual_pushhist(L, s->cardinality_hist, s->max_cardinality);
+	lua_setfield(L, -2, "cardinality");
+	lual_pushhist(L, s->size_hist, s->max_size);
+	lua_setfield(L, -2, "size");
+	lua_pushnumber(L, s->num_violations);
+	lua_setfield(L, -2, "num_violations");
+	lua_createtable(L, s->hot.count, 0);
+	for (uint32_t i = 0; i < s->hot.count; ++i) {
+		struct analyze_counter *c = &s->hot.heap[i];
+		lua_createtable(L, 0, 3);
+		lua_pushlstring(L, c->key, c->key_size);
+		lua_setfield(L, -2, "key");
+		lua_pushnumber(L, c->count);
+		lua_setfield(L, -2, "count");
+		lua_pushnumber(L, c->error);
+		lua_setfield(L, -2, "error");
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_setfield(L, -2, "hot_keys");
+}
+
+/*
+ * Workload profile of files (see analyze.h), returns
+ * {files = {...}, spaces = {[space_no] = {...}}}, hot keys are msgpack
+ * strings.
+ */
+static int
+lua_analyze(struct lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+	uint32_t cdata;
+	struct iter_helper *hlp = luaL_checkcdata(L, 2, &cdata);
+	assert(cdata == CTID_STRUCT_ITER_HELPER_REF);
+	int threads = luaL_checkinteger(L, 3);
+	uint32_t top = luaL_checkinteger(L, 4);
+	enum tnt_log_verify verify = luaL_checkinteger(L, 5);
+
+	uint32_t count = lua_objlen(L, 1);
+	ibuf_reset(&xlog_ibuf);
+	const char **paths = ibuf_alloc(&xlog_ibuf, (count + 1) *
+					sizeof(*paths));
+	if (paths == NULL)
+		luaL_error(L, "Failed to allocate memory for analysis");
+	for (uint32_t i = 0; i < count; ++i) {
+		lua_rawgeti(L, 1, i + 1);
+		/* strings stay referenced by the table */
+		paths[i] = luaL_checkstring(L, -1);
+		lua_pop(L, 1);
+	}
+
+	char errbuf[256];
+	struct analyze *a = analyze_new(paths, count, &hlp->map, verify, top,
+					threads, errbuf, sizeof(errbuf));
+	if (a == NULL)
+		luaL_error(L, "%s", errbuf);
+	coio_call(analyze_wait_cb, a);
+	struct analyze_space *spaces;
+	uint32_t space_count;
+	if (analyze_merge(a, &spaces, &space_count) != 0) {
+		for (uint32_t i = 0; i < space_count; ++i)
+			analyze_space_destroy(&spaces[i]);
+		free(spaces);
+		analyze_delete(a);
+		luaL_error(L, "Failed to allocate memory for analysis");
+	}
+
+	lua_createtable(L, 0, 2);
+	lua_createtable(L, a->file_count, 0);
+	for (uint32_t i = 0; i < a->file_count; ++i) {
+		struct analyze_file *f = &a->files[i];
+		lua_createtable(L, 0, 7);
+		lua_pushstring(L, f->path);
+		lua_setfield(L, -2, "path");
+		lua_pushnumber(L, f->rows);
+		lua_setfield(L, -2, "rows");
+		lua_pushnumber(L, f->bytes);
+		lua_setfield(L, -2, "bytes");
+		lua_pushnumber(L, f->lsn_first);
+		lua_setfield(L, -2, "lsn_first");
+		lua_pushnumber(L, f->lsn_last);
+		lua_setfield(L, -2, "lsn_last");
+		lua_pushnumber(L, f->malformed);
+		lua_setfield(L, -2, "malformed");
+		if (f->error != NULL) {
+			lua_pushstring(L, f->error);
+			lua_setfield(L, -2, "error");
+		}
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_setfield(L, -2, "files");
+	lua_newtable(L);
+	for (uint32_t i = 0; i < space_count; ++i) {
+		if (!spaces[i].used)
+			continue;
+		lual_pushanalyze_space(L, &spaces[i]);
+		lua_rawseti(L, -2, i);
+	}
+	lua_setfield(L, -2, "spaces");
+	for (uint32_t i = 0; i < space_count; ++i)
+		analyze_space_destroy(&spaces[i]);
+	free(spaces);
+	analyze_delete(a);
+	return 1;
+}
+
+/* Catalog of xlogs of directory 'dir' (see catalog.h) */
+static int
+lua_catalog(struct lua_State *L)
+{
+	const char *dir = luaL_checkstring(L, 1);
+	struct catalog **ptr = lua_newuserdata(L, sizeof(*ptr));
+	*ptr = NULL;
+	luaL_getmetatable(L, catalog_typename);
+	lua_setmetatable(L, -2);
+	*ptr = catalog_new(dir);
+	if (*ptr == NULL)
+		luaL_error(L, "Failed to allocate memory for catalog");
+	return 1;
+}
+
+static struct catalog *
+lua_checkcatalog(struct lua_State *L, int idx)
+{
+	struct catalog **ptr = luaL_checkudata(L, idx, catalog_typename);
+	if (*ptr == NULL)
+		luaL_error(L, "catalog is closed");
+	return *ptr;
+}
+
+static int
+lua_catalog_gc(struct lua_State *L)
+{
+	struct catalog **ptr = luaL_checkudata(L, 1, catalog_typename);
+	catalog_delete(*ptr);
+	*ptr = NULL;
+	return 0;
+}
+
+static int
+lua_catalog_load(struct lua_State *L)
+{
+	struct catalog *c = lua_checkcatalog(L, 1);
+	catalog_load(c, luaL_checkstring(L, 2));
+	return 0;
+}
+
+/* Save catalog if files were read since it was loaded or saved */
+static int
+lua_catalog_save(struct lua_State *L)
+{
+	struct catalog *c = lua_checkcatalog(L, 1);
+	const char *path = luaL_checkstring(L, 2);
+	lua_pushboolean(L, !c->dirty || catalog_save(c, path) == 0);
+	return 1;
+}
+
+static ssize_t
+catalog_scan_cb(va_list ap)
+{
+	struct catalog *c = va_arg(ap, struct catalog *);
+	uint32_t *scanned = va_arg(ap, uint32_t *);
+	char *errbuf = va_arg(ap, char *);
+	size_t errlen = va_arg(ap, size_t);
+	return catalog_scan(c, scanned, errbuf, errlen);
+}
+
+/* Read new and changed files, returns number of them */
+static int
+lua_catalog_scan(struct lua_State *L)
+{
+	struct catalog *c = lua_checkcatalog(L, 1);
+	uint32_t scanned;
+	char errbuf[1024];
+	if (coio_call(catalog_scan_cb, c, &scanned, errbuf,
+		      sizeof(errbuf)) != 0)
+		luaL_error(L, "%s", errbuf);
+	lua_pushnumber(L, scanned);
+	return 1;
+}
+
+static int
+lua_catalog_find(struct lua_State *L)
+{
+	struct catalog *c = lua_checkcatalog(L, 1);
+	lua_pushnumber(L, catalog_find(c, luaL_checknumber(L, 2)));
+	return 1;
+}
+
+/* Files of catalog starting from 1-based index 'from' */
+static int
+lua_catalog_files(struct lua_State *L)
+{
+	static const char *state_names[] = {"complete", "open", "broken"};
+	struct catalog *c = lua_checkcatalog(L, 1);
+	uint32_t from = luaL_optinteger(L, 2, 1);
+	if (from < 1)
+		from = 1;
+	lua_createtable(L, from <= c->count ? c->count - from + 1 : 0, 0);
+	for (uint32_t i = from; i <= c->count; ++i) {
+		struct catalog_file *f = &c->files[i - 1];
+		lua_createtable(L, 0, 6);
+		lua_pushstring(L, f->name);
+		lua_setfield(L, -2, "name");
+		lua_pushnumber(L, f->name_lsn);
+		lua_setfield(L, -2, "lsn");
+		lua_pushnumber(L, f->lsn_first);
+		lua_setfield(L, -2, "lsn_first");
+		lua_pushnumber(L, f->lsn_last);
+		lua_setfield(L, -2, "lsn_last");
+		lua_pushnumber(L, f->size);
+		lua_setfield(L, -2, "size");
+		lua_pushstring(L, state_names[f->state]);
+		lua_setfield(L, -2, "state");
+		lua_rawseti(L, -2, i - from + 1);
+	}
+	return 1;
+}
+
+/* Watch of directory 'dir' (see watch.h) */
+static int
+lua_watch(struct lua_State *L)
+{
+	const char *dir = luaL_checkstring(L, 1);
+	struct watch **ptr = lua_newuserdata(L, sizeof(*ptr));
+	*ptr = NULL;
+	luaL_getmetatable(L, watch_typename);
+	lua_setmetatable(L, -2);
+	char errbuf[1024];
+	*ptr = watch_new(dir, errbuf, sizeof(errbuf));
+	if (*ptr == NULL)
+		luaL_error(L, "%s", errbuf);
+	return 1;
+}
+
+static int
+lua_watch_gc(struct lua_State *L)
+{
+	struct watch **ptr = luaL_checkudata(L, 1, watch_typename);
+	if (*ptr != NULL)
+		watch_delete(*ptr);
+	*ptr = NULL;
+	return 0;
+}
+
+/*
+ * Yield until directory changes or 'timeout' passes, returns true if
+ * it has changed (without inotify it's just a sleep)
+ */
+static int
+lua_watch_wait(struct lua_State *L)
+{
+	struct watch **ptr = luaL_checkudata(L, 1, watch_typename);
+	double timeout = luaL_checknumber(L, 2);
+	if (*ptr == NULL)
+		luaL_error(L, "watch is closed");
+	struct watch *w = *ptr;
+	if (w->fd == -1) {
+		fiber_sleep(timeout);
+		lua_pushboolean(L, false);
+		return 1;
+	}
+	int count = watch_drain(w);
+	if (count == 0 && (coio_wait(w->fd, COIO_READ, timeout) & COIO_READ))
+		count = watch_drain(w);
+	lua_pushboolean(L, count > 0);
+	return 1;
+}
+
 static const struct luaL_Reg
 parser_lib_func [] = {
 	{ "snap_pairs",		lua_snap_pairs		 },
 	{ "xlog_pairs",		lua_xlog_pairs		 },
+	{ "snap_pipeline",	lua_snap_pipeline	 },
+	{ "log_decoder",	lua_log_decoder		 },
+	{ "decoder_budget",	lua_decoder_budget	 },
+	{ "batch_pairs",	lua_batch_pairs		 },
+	{ "batch_next",		lua_batch_next		 },
+	{ "apply_plan",		lua_apply_plan		 },
+	{ "batch_apply",	lua_batch_apply		 },
+	{ "damaged",		lua_damaged		 },
+	{ "digest",		lua_digest		 },
+	{ "digest_add",		lua_digest_add		 },
+	{ "digest_scan",	lua_digest_scan		 },
+	{ "digest_wait",	lua_digest_wait		 },
+	{ "digest_result",	lua_digest_result	 },
+	{ "analyze",		lua_analyze		 },
+	{ "catalog",		lua_catalog		 },
+	{ "catalog_load",	lua_catalog_load	 },
+	{ "catalog_save",	lua_catalog_save	 },
+	{ "catalog_scan",	lua_catalog_scan	 },
+	{ "catalog_find",	lua_catalog_find	 },
+	{ "catalog_files",	lua_catalog_files	 },
+	{ "watch",		lua_watch		 },
+	{ "watch_wait",		lua_watch_wait		 },
 	{ NULL,			NULL			 }
 };
 
@@ -265,7 +1655,44 @@ int
 luaopen_migrate_xlog_internal(struct lua_State *L)
 {
 	ibuf_create(&xlog_ibuf, cord_slab_cache(), 16000);;
+	row_arena_init();
+	/* compressed files are decompressed while they are read */
+	tnt_log_set_fopen(zstream_fopen);
 	CTID_STRUCT_ITER_HELPER_REF = luaL_ctypeid(L, "struct iter_helper [1]");
+	luaL_newmetatable(L, batch_reader_typename);
+	lua_pushcfunction(L, lua_batch_reader_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	luaL_newmetatable(L, apply_plan_typename);
+	lua_pop(L, 1);
+	luaL_newmetatable(L, budget_typename);
+	lua_pushcfunction(L, lua_decoder_budget_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	luaL_newmetatable(L, digest_typename);
+	lua_pushcfunction(L, lua_digest_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	luaL_newmetatable(L, catalog_typename);
+	lua_pushcfunction(L, lua_catalog_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	luaL_newmetatable(L, watch_typename);
+	lua_pushcfunction(L, lua_watch_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	CTID_CONST_STRUCT_BATCH_ROW_PTR = luaL_ctypeid(L,
+						       "const struct batch_row *");
+	CTID_CONST_CHAR_PTR = luaL_ctypeid(L, "const char *");
+	luaL_newmetatable(L, batch_typename);
+	lua_pushcfunction(L, lua_batch_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pushcfunction(L, lua_batch_count);
+	lua_setfield(L, -2, "__len");
+	lua_newtable(L);
+	luaL_register(L, NULL, batch_methods);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
 	luaL_register(L, parser_lib_name, parser_lib_func);
 	tuple_format = box_tuple_format_default();
 	/* assert(tuple_format); */
@@ -3,6 +3,9 @@
 
 #include <sys/queue.h>
 #include <stdint.h>
+#include <string.h>
+
+#include "damage_list.h"
 
 enum field_t {
 	F_FLD_STR = 0,
@@ -13,9 +16,32 @@ enum field_t {
 enum ret_t {
 	F_RET_TUPLE = 0,
 	F_RET_TABLE,
+	F_RET_BATCH,
 	F_RET_MAX
 };
 
+enum field_layout {
+	F_LAYOUT_MIXED = 0,
+	/* all fields are converted to strings */
+	F_LAYOUT_STR,
+	/* all fields are converted to numbers */
+	F_LAYOUT_NUM
+};
+
+/*
+ * Conversion of tuple (or key) fields of one space, compiled from
+ * schema (or ischema) and default type when reader is opened.
+ */
+struct field_plan {
+	/* enum field_t of fields [0, len) */
+	uint8_t *ops;
+	uint32_t len;
+	/* enum field_t of fields >= len */
+	uint8_t tail;
+	/* enum field_layout */
+	uint8_t layout;
+};
+
 struct space_def {
 	int space_no;
 	int *schema;
@@ -26,6 +52,17 @@ struct space_def {
 	int throws;
 	int convert;
 	struct space_def *next;
+	struct field_plan tuple_plan;
+	struct field_plan key_plan;
+};
+
+/* Spaces to read, indexed by space number */
+struct space_map {
+	/* NULL for spaces without definition */
+	struct space_def **defs;
+	uint32_t size;
+	/* skip rows of spaces without definition */
+	int filter;
 };
 
 struct iter_helper {
@@ -36,26 +73,143 @@ struct iter_helper {
 	int return_type;
 	uint64_t lsn_from;
 	uint64_t lsn_to;
+	/* enum lsn_index_mode */
+	int lsn_index;
+	/* check data crc of rows that are skipped without processing */
+	int verify_skipped;
+	/* enum row_alloc, rows are parsed in arena (see row_arena.h) */
+	int alloc;
+	int hugepages;
+	/* arena of iteration in tx thread, decoders create their own */
+	struct row_arena *arena;
+	struct space_map map;
+	/*
+	 * File offset where reading starts (0 - from the beginning), then
+	 * offset that all rows returned so far end before: reading may be
+	 * restarted from it by another reader (see tnt_log_seek_row).
+	 */
+	uint64_t offset;
+	/* skip damaged regions of file (see tnt_log_set_salvage) */
+	int salvage;
+	/* regions skipped before rows returned so far */
+	struct damage_list damaged;
 };
 
+/*
+ * Find definition of space. Returns 1 if rows of space must be skipped,
+ * *def is NULL if fields of space aren't converted.
+ */
+static inline int
+space_map_find(const struct space_map *map, uint32_t space_no,
+	       struct space_def **def)
+{
+	*def = space_no < map->size ? map->defs[space_no] : NULL;
+	return (*def == NULL && map->filter) ? 1 : 0;
+}
+
+static inline enum field_t
+field_plan_op(const struct field_plan *plan, uint32_t idx)
+{
+	return idx < plan->len ? plan->ops[idx] : plan->tail;
+}
+
+/* plan of spaces without definition, all fields are STR */
+extern const struct field_plan field_plan_str;
+
+/* plan of conversion of tuple (or key) of space */
+static inline const struct field_plan *
+space_def_plan(const struct space_def *def, int is_key)
+{
+	if (def == NULL)
+		return &field_plan_str;
+	return is_key ? &def->key_plan : &def->tuple_plan;
+}
+
+/* type of field 'idx' of tuple (or key) of space */
+static inline enum field_t
+space_def_field(const struct space_def *def, uint32_t idx, int is_key)
+{
+	if (def == NULL)
+		return F_FLD_STR;
+	return field_plan_op(is_key ? &def->key_plan : &def->tuple_plan, idx);
+}
+
+struct lua_State;
+struct tnt_stream;
+
 int luaopen_xlog(struct lua_State *L);
 
+void
+xlog_stream_set_filter(struct tnt_stream *s, struct iter_helper *hlp,
+		       int snapshot);
+
+int
+xlog_stream_seek(struct tnt_stream *s, struct iter_helper *hlp,
+		 int snapshot);
+
+int
+xlog_stream_open_fd(struct tnt_stream *s, int fd, int snapshot);
+
+void
+xlog_stream_follow(struct tnt_stream *s);
+
+int
+xlog_stream_complete(struct tnt_stream *s);
+
+/* Drop current row of hlp->iter and delete hlp->arena */
+void
+iter_helper_free_arena(struct iter_helper *hlp);
+
+/* Free memory of helper, that isn't managed by Lua */
+void
+iter_helper_destroy(struct iter_helper *hlp);
+
 struct update_op_record {
 	const char *operation;
 	uint8_t args_count;
 };
 
-static struct update_op_record
-update_op_records [] = {
-	/* TNT_UPDATE_ASSIGN */	{"=", 3 },
-	/* TNT_UPDATE_ADD */	{"+", 3 },
-	/* TNT_UPDATE_AND */	{"&", 3 },
-	/* TNT_UPDATE_XOR */	{"^", 3 },
-	/* TNT_UPDATE_OR */	{"|", 3 },
-	/* TNT_UPDATE_SPLICE */	{":", 5 },
-	/* TNT_UPDATE_DELETE */	{"#", 3 },
-	/* TNT_UPDATE_INSERT */	{"!", 3 },
-	{ NULL, 0 }
+/* indexed by operation code, terminated by NULL operation */
+extern const struct update_op_record update_op_records[];
+
+/* Arguments of splice operation */
+struct splice_args {
+	int32_t offset;
+	int32_t length;
+	const char *str;
+	uint32_t str_len;
 };
 
+/*
+ * Parse data of 1.5 splice operation: BER-prefixed int32 offset and
+ * length, followed by BER-prefixed string. Offset is converted to 1.10
+ * rules: non-negative offsets are 1-based there and negative ones count
+ * from the position after the last character.
+ * Returns -1 if data is malformed.
+ */
+static inline int
+splice_args_parse(const char *data, uint32_t size, struct splice_args *args)
+{
+	const uint32_t head = 2 * (1 + sizeof(int32_t));
+	if (size <= head || data[0] != sizeof(int32_t) ||
+	    data[1 + sizeof(int32_t)] != sizeof(int32_t))
+		return -1;
+	memcpy(&args->offset, data + 1, sizeof(int32_t));
+	memcpy(&args->length, data + 2 + sizeof(int32_t), sizeof(int32_t));
+	args->offset += args->offset < 0 ? -1 : 1;
+	/* BER-encoded length of string */
+	const char *pos = data + head, *end = data + size;
+	uint32_t len = 0;
+	do {
+		if (pos == end || pos - (data + head) == 5)
+			return -1;
+		len = len << 7 | (*pos & 0x7f);
+	} while (*pos++ & 0x80);
+	if ((size_t)(end - pos) != len)
+		return -1;
+	args->str = pos;
+	args->str_len = len;
+	return 0;
+}
+
 #endif /* __LUA_XLOG_H__ */
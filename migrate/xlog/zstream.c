@@ -0,0 +1,556 @@
+/* fopencookie() */
+#define _GNU_SOURCE
+
+#include "zstream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "ring.h"
+
+/* decompressed data is passed to reader in chunks of this size */
+#define ZSTREAM_CHUNK_SIZE (1024 * 1024)
+/* chunks decompressed ahead of reader, at most */
+#define ZSTREAM_CHUNKS 4
+/* compressed file is read in blocks of this size */
+#define ZSTREAM_READ_SIZE (256 * 1024)
+/* stdio buffer, must be smaller than chunk to seek back within it */
+#define ZSTREAM_BUF_SIZE (64 * 1024)
+
+struct zstream_codec {
+	const char *suffix;
+	/* returns NULL if state can't be allocated */
+	void *(*create)(void);
+	/*
+	 * Decompress data from [*in, in_end) to [*out, out_end), pointers
+	 * are moved past data consumed and produced. Returns -1 if data is
+	 * corrupted.
+	 */
+	int (*decode)(void *state, const char **in, const char *in_end,
+		      char **out, char *out_end);
+	/* true if data decoded so far ends with a complete frame */
+	bool (*done)(void *state);
+	void (*destroy)(void *state);
+};
+
+#ifdef HAVE_ZLIB
+struct zstream_gz {
+	z_stream z;
+	bool end;
+};
+
+static void *
+zstream_gz_create(void)
+{
+	struct zstream_gz *g = calloc(1, sizeof(struct zstream_gz));
+	if (g == NULL)
+		return NULL;
+	/* 32 - gzip or zlib header is detected */
+	if (inflateInit2(&g->z, 15 + 32) != Z_OK) {
+		free(g);
+		return NULL;
+	}
+	return g;
+}
+
+static int
+zstream_gz_decode(void *state, const char **in, const char *in_end,
+		  char **out, char *out_end)
+{
+	struct zstream_gz *g = state;
+	/* concatenated gzip members are decoded one after another */
+	if (g->end) {
+		if (*in == in_end)
+			return 0;
+		if (inflateReset(&g->z) != Z_OK)
+			return -1;
+		g->end = false;
+	}
+	g->z.next_in = (Bytef *)*in;
+	g->z.avail_in = in_end - *in;
+	g->z.next_out = (Bytef *)*out;
+	g->z.avail_out = out_end - *out;
+	int rc = inflate(&g->z, Z_NO_FLUSH);
+	*in = (const char *)g->z.next_in;
+	*out = (char *)g->z.next_out;
+	if (rc == Z_STREAM_END)
+		g->end = true;
+	return (rc == Z_OK || rc == Z_STREAM_END || rc == Z_BUF_ERROR) ? 0 : -1;
+}
+
+static bool
+zstream_gz_done(void *state)
+{
+	return ((struct zstream_gz *)state)->end;
+}
+
+static void
+zstream_gz_destroy(void *state)
+{
+	struct zstream_gz *g = state;
+	inflateEnd(&g->z);
+	free(g);
+}
+#endif /* HAVE_ZLIB */
+
+#ifdef HAVE_ZSTD
+struct zstream_zstd {
+	ZSTD_DStream *ds;
+	/* 0 if the last frame is complete */
+	size_t hint;
+};
+
+static void *
+zstream_zstd_create(void)
+{
+	struct zstream_zstd *s = calloc(1, sizeof(struct zstream_zstd));
+	if (s == NULL)
+		return NULL;
+	s->ds = ZSTD_createDStream();
+	if (s->ds == NULL || ZSTD_isError(ZSTD_initDStream(s->ds))) {
+		ZSTD_freeDStream(s->ds);
+		free(s);
+		return NULL;
+	}
+	s->hint = 1;
+	return s;
+}
+
+static int
+zstream_zstd_decode(void *state, const char **in, const char *in_end,
+		    char **out, char *out_end)
+{
+	struct zstream_zstd *s = state;
+	ZSTD_inBuffer ib = { *in, in_end - *in, 0 };
+	ZSTD_outBuffer ob = { *out, out_end - *out, 0 };
+	size_t rc = ZSTD_decompressStream(s->ds, &ob, &ib);
+	if (ZSTD_isError(rc))
+		return -1;
+	*in += ib.pos;
+	*out += ob.pos;
+	s->hint = rc;
+	return 0;
+}
+
+static bool
+zstream_zstd_done(void *state)
+{
+	return ((struct zstream_zstd *)state)->hint == 0;
+}
+
+static void
+zstream_zstd_destroy(void *state)
+{
+	struct zstream_zstd *s = state;
+	ZSTD_freeDStream(s->ds);
+	free(s);
+}
+#endif /* HAVE_ZSTD */
+
+#ifdef HAVE_LZ4
+struct zstream_lz4 {
+	LZ4F_dctx *ctx;
+	/* 0 if the last frame is complete */
+	size_t hint;
+};
+
+static void *
+zstream_lz4_create(void)
+{
+	struct zstream_lz4 *s = calloc(1, sizeof(struct zstream_lz4));
+	if (s == NULL)
+		return NULL;
+	if (LZ4F_isError(LZ4F_createDecompressionContext(&s->ctx,
+							 LZ4F_VERSION))) {
+		free(s);
+		return NULL;
+	}
+	s->hint = 1;
+	return s;
+}
+
+static int
+zstream_lz4_decode(void *state, const char **in, const char *in_end,
+		   char **out, char *out_end)
+{
+	struct zstream_lz4 *s = state;
+	size_t in_size = in_end - *in;
+	size_t out_size = out_end - *out;
+	size_t rc = LZ4F_decompress(s->ctx, *out, &out_size, *in, &in_size,
+				    NULL);
+	if (LZ4F_isError(rc))
+		return -1;
+	*in += in_size;
+	*out += out_size;
+	s->hint = rc;
+	return 0;
+}
+
+static bool
+zstream_lz4_done(void *state)
+{
+	return ((struct zstream_lz4 *)state)->hint == 0;
+}
+
+static void
+zstream_lz4_destroy(void *state)
+{
+	struct zstream_lz4 *s = state;
+	LZ4F_freeDecompressionContext(s->ctx);
+	free(s);
+}
+#endif /* HAVE_LZ4 */
+
+/* suffixes match tnt_log_name_len(), codecs that aren't built are NULL */
+static const struct zstream_codec zstream_codecs[] = {
+#ifdef HAVE_ZLIB
+	{ ".gz", zstream_gz_create, zstream_gz_decode, zstream_gz_done,
+	  zstream_gz_destroy },
+#else
+	{ ".gz", NULL, NULL, NULL, NULL },
+#endif
+#ifdef HAVE_ZSTD
+	{ ".zst", zstream_zstd_create, zstream_zstd_decode, zstream_zstd_done,
+	  zstream_zstd_destroy },
+#else
+	{ ".zst", NULL, NULL, NULL, NULL },
+#endif
+#ifdef HAVE_LZ4
+	{ ".lz4", zstream_lz4_create, zstream_lz4_decode, zstream_lz4_done,
+	  zstream_lz4_destroy },
+#else
+	{ ".lz4", NULL, NULL, NULL, NULL },
+#endif
+	{ NULL, NULL, NULL, NULL, NULL }
+};
+
+static const struct zstream_codec *
+zstream_codec(const char *path)
+{
+	const char *ext = strrchr(path, '.');
+	if (ext == NULL)
+		return NULL;
+	for (const struct zstream_codec *c = zstream_codecs; c->suffix; ++c) {
+		if (strcasecmp(ext, c->suffix) == 0)
+			return c;
+	}
+	return NULL;
+}
+
+bool
+zstream_compressed(const char *path)
+{
+	return zstream_codec(path) != NULL;
+}
+
+bool
+zstream_supported(const char *path)
+{
+	const struct zstream_codec *c = zstream_codec(path);
+	return c != NULL && c->create != NULL;
+}
+
+struct zstream_chunk {
+	char *data;
+	size_t size;
+	/* offset of data in decompressed file */
+	uint64_t offset;
+};
+
+struct zstream {
+	const struct zstream_codec *codec;
+	void *state;
+	int fd;
+	pthread_t thread;
+	bool started;
+	/* chunks decompressed by thread and chunks given back by reader */
+	struct ring ready;
+	struct ring free;
+	struct zstream_chunk chunks[ZSTREAM_CHUNKS];
+	/* errno of failed decompression, set before 'ready' is closed */
+	int error;
+	/* chunk being read and the one before it, kept to seek back */
+	struct zstream_chunk *cur;
+	struct zstream_chunk *prev;
+	/* reader offset in decompressed file */
+	uint64_t pos;
+	/* all chunks were taken */
+	bool eof;
+};
+
+static void *
+zstream_f(void *arg)
+{
+	struct zstream *z = arg;
+	char *buf = z->codec != NULL ? malloc(ZSTREAM_READ_SIZE) : NULL;
+	const char *in = buf, *in_end = buf;
+	uint64_t offset = 0;
+	bool eof = false;
+	int error = z->codec != NULL && buf == NULL ? ENOMEM : 0;
+	while (error == 0 && !eof && !ring_is_closed(&z->free)) {
+		struct zstream_chunk *c = ring_pop(&z->free);
+		if (c == NULL) {
+			ring_wait_pop(&z->free);
+			continue;
+		}
+		char *out = c->data, *out_end = c->data + ZSTREAM_CHUNK_SIZE;
+		while (out < out_end) {
+			if (z->codec == NULL) {
+				/* plain data is read right into chunk */
+				ssize_t n = read(z->fd, out, out_end - out);
+				if (n == -1 && errno == EINTR)
+					continue;
+				if (n == -1)
+					error = errno;
+				if (n <= 0) {
+					eof = true;
+					break;
+				}
+				out += n;
+				continue;
+			}
+			if (in == in_end) {
+				ssize_t n = read(z->fd, buf, ZSTREAM_READ_SIZE);
+				if (n == -1 && errno == EINTR)
+					continue;
+				if (n == -1) {
+					error = errno;
+					break;
+				}
+				if (n == 0) {
+					/* file ends in the middle of frame */
+					if (!z->codec->done(z->state))
+						error = EIO;
+					eof = true;
+					break;
+				}
+				in = buf;
+				in_end = buf + n;
+			}
+			const char *in_was = in;
+			char *out_was = out;
+			if (z->codec->decode(z->state, &in, in_end, &out,
+					     out_end) != 0 ||
+			    (in == in_was && out == out_was)) {
+				error = EIO;
+				break;
+			}
+		}
+		c->offset = offset;
+		c->size = out - c->data;
+		offset += c->size;
+		/* 'ready' has room for all chunks */
+		ring_push(&z->ready, c);
+	}
+	free(buf);
+	__atomic_store_n(&z->error, error, __ATOMIC_RELEASE);
+	ring_close(&z->ready);
+	return NULL;
+}
+
+/*
+ * Chunk that has data at reader offset, NULL at the end of file. Chunks
+ * before it are given back to thread, except the previous one.
+ */
+static struct zstream_chunk *
+zstream_chunk_at(struct zstream *z)
+{
+	if (z->prev != NULL && z->pos < z->cur->offset)
+		return z->prev;
+	while (z->cur == NULL || z->pos >= z->cur->offset + z->cur->size) {
+		if (z->eof)
+			return NULL;
+		struct zstream_chunk *c;
+		while ((c = ring_pop(&z->ready)) == NULL) {
+			if (ring_is_closed(&z->ready)) {
+				/* chunks pushed before close are taken first */
+				c = ring_pop(&z->ready);
+				break;
+			}
+			ring_wait_pop(&z->ready);
+		}
+		if (c == NULL) {
+			z->eof = true;
+			return NULL;
+		}
+		if (z->prev != NULL)
+			ring_push(&z->free, z->prev);
+		z->prev = z->cur;
+		z->cur = c;
+	}
+	return z->cur;
+}
+
+static ssize_t
+zstream_read(void *cookie, char *buf, size_t size)
+{
+	struct zstream *z = cookie;
+	struct zstream_chunk *c = zstream_chunk_at(z);
+	if (c == NULL) {
+		int error = __atomic_load_n(&z->error, __ATOMIC_ACQUIRE);
+		if (error != 0) {
+			errno = error;
+			return -1;
+		}
+		return 0;
+	}
+	size_t skip = z->pos - c->offset;
+	size_t n = c->size - skip;
+	if (n > size)
+		n = size;
+	memcpy(buf, c->data + skip, n);
+	z->pos += n;
+	return n;
+}
+
+static int
+zstream_seek(void *cookie, off64_t *offset, int whence)
+{
+	struct zstream *z = cookie;
+	int64_t pos;
+	switch (whence) {
+	case SEEK_SET:
+		pos = *offset;
+		break;
+	case SEEK_CUR:
+		pos = z->pos + *offset;
+		break;
+	case SEEK_END:
+		/* the rest of file is decompressed to know its size */
+		do {
+			if (z->cur != NULL)
+				z->pos = z->cur->offset + z->cur->size;
+		} while (zstream_chunk_at(z) != NULL);
+		pos = z->pos + *offset;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+	/* data before the previous chunk is dropped */
+	uint64_t first = z->prev != NULL ? z->prev->offset :
+			 z->cur != NULL ? z->cur->offset : 0;
+	if (pos < 0 || (uint64_t)pos < first) {
+		errno = EINVAL;
+		return -1;
+	}
+	z->pos = pos;
+	*offset = pos;
+	return 0;
+}
+
+static void
+zstream_delete(struct zstream *z)
+{
+	if (z->started) {
+		/* wake up thread waiting for free chunk */
+		ring_close(&z->free);
+		pthread_join(z->thread, NULL);
+	}
+	ring_destroy(&z->ready);
+	ring_destroy(&z->free);
+	for (int i = 0; i < ZSTREAM_CHUNKS; ++i)
+		free(z->chunks[i].data);
+	if (z->state != NULL)
+		z->codec->destroy(z->state);
+	if (z->fd != -1)
+		close(z->fd);
+	free(z);
+}
+
+static int
+zstream_close(void *cookie)
+{
+	zstream_delete(cookie);
+	return 0;
+}
+
+/* stream of file 'fd' decoded with 'codec' (NULL - plain data) */
+static FILE *
+zstream_open(int fd, const struct zstream_codec *codec)
+{
+	struct zstream *z = calloc(1, sizeof(struct zstream));
+	if (z == NULL) {
+		close(fd);
+		return NULL;
+	}
+	z->codec = codec;
+	z->fd = fd;
+	posix_fadvise(z->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	if (ring_create(&z->ready, ZSTREAM_CHUNKS) != 0 ||
+	    ring_create(&z->free, ZSTREAM_CHUNKS) != 0)
+		goto error_mem;
+	for (int i = 0; i < ZSTREAM_CHUNKS; ++i) {
+		z->chunks[i].data = malloc(ZSTREAM_CHUNK_SIZE);
+		if (z->chunks[i].data == NULL)
+			goto error_mem;
+		ring_push(&z->free, &z->chunks[i]);
+	}
+	if (codec != NULL) {
+		z->state = codec->create();
+		if (z->state == NULL)
+			goto error_mem;
+	}
+	int rc = pthread_create(&z->thread, NULL, zstream_f, z);
+	if (rc != 0) {
+		errno = rc;
+		goto error;
+	}
+	z->started = true;
+	cookie_io_functions_t io = {
+		.read = zstream_read,
+		.write = NULL,
+		.seek = zstream_seek,
+		.close = zstream_close
+	};
+	FILE *f = fopencookie(z, "r", io);
+	if (f == NULL)
+		goto error_mem;
+	setvbuf(f, NULL, _IOFBF, ZSTREAM_BUF_SIZE);
+	return f;
+error_mem:
+	errno = ENOMEM;
+error:;
+	int error = errno;
+	zstream_delete(z);
+	errno = error;
+	return NULL;
+}
+
+FILE *
+zstream_fopen(const char *path)
+{
+	const struct zstream_codec *codec = zstream_codec(path);
+	if (codec == NULL)
+		return fopen(path, "r");
+	if (codec->create == NULL) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+	return zstream_open(fd, codec);
+}
+
+FILE *
+zstream_fdopen(int fd)
+{
+	return zstream_open(fd, NULL);
+}
@@ -0,0 +1,45 @@
+#ifndef   _XLOG_ZSTREAM_H_
+#define   _XLOG_ZSTREAM_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/*
+ * Compressed 1.5 files (.gz, .zst, .lz4), read without unpacking them to
+ * disk, and files read from pipes.
+ *
+ * zstream_fopen() is the tnt_log_set_fopen() hook: compressed file is
+ * returned as read-only stdio stream (fopencookie), which is filled by a
+ * thread decompressing file in chunks ahead of the reader, so inflating
+ * overlaps with parsing of rows. Stream can be positioned forward
+ * anywhere and back within the last two chunks (tnt_log seeks back only
+ * within stdio buffer). Codecs are available if module is built with
+ * them (HAVE_ZLIB, HAVE_ZSTD, HAVE_LZ4).
+ */
+
+/* true if file has suffix of compression, supported or not */
+bool
+zstream_compressed(const char *path);
+
+/* true if codec of compressed file is built in */
+bool
+zstream_supported(const char *path);
+
+/*
+ * Opens compressed file as decompressed stream, other files with
+ * fopen(). Returns NULL and sets errno on error (ENOTSUP if codec isn't
+ * built in).
+ */
+FILE *
+zstream_fopen(const char *path);
+
+/*
+ * Stream of plain data read from descriptor 'fd' (e.g. a pipe, which
+ * can't be seeked), it's read ahead in chunks by thread the same way and
+ * offsets are counted by the stream. Descriptor is closed with stream,
+ * or on error. Returns NULL and sets errno on error.
+ */
+FILE *
+zstream_fdopen(int fd);
+
+#endif /* _XLOG_ZSTREAM_H_ */
@@ -0,0 +1,87 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local xdir = require('migrate.xdir')
+local xlog = require('migrate.xlog')
+local migrate = require('migrate')
+
+local spaces = {
+    [0] = {fields = {'str', 'num', 'num'}, index = {parts = {1}},
+           default = 'str'},
+    [1] = {fields = {'num', 'str', 'num', 'num'}, index = {parts = {1}},
+           default = 'str'},
+    [2] = {fields = {'num', 'str', 'num'}, index = {parts = {1}},
+           default = 'str'}
+}
+
+-- rows per space and op, read by xlog.open()
+local function count_rows(dir)
+    local counts, total = {}, 0
+    local _, files = xdir.xdir(dir, dir)
+    for _, file in ipairs(files) do
+        for _, batch in xlog.open(file) do
+            for _, row in pairs(batch) do
+                local c = counts[row.space] or {insert = 0, delete = 0,
+                                                update = 0}
+                counts[row.space] = c
+                c[row.op or 'insert'] = c[row.op or 'insert'] + 1
+                total = total + 1
+            end
+        end
+    end
+    return counts, total
+end
+
+local test = tap.test("analysis of 1.5 files")
+test:plan(3)
+
+test:test("rows are counted", function(test)
+    local counts, total = count_rows('insert_test')
+    local modes = {{threads = 1}, {threads = 3}, {spaces = spaces}}
+    test:plan(#modes * 4)
+    for _, mode in ipairs(modes) do
+        local res = migrate.analyze('insert_test', mode)
+        local rows = 0
+        for _, f in ipairs(res.files) do
+            rows = rows + f.rows
+        end
+        local same = true
+        for no, c in pairs(counts) do
+            local s = res.spaces[no]
+            same = same and s ~= nil and s.ops.insert == c.insert and
+                   s.rows == c.insert and s.tuples == c.insert
+        end
+        test:ok(same, "rows of spaces match")
+        test:is(rows, total, "rows of files")
+        test:ok(res.bytes > 0 and res.time >= 0, "bytes and time")
+        test:is(res.spaces[1].num_violations, 0, "no NUM violations")
+    end
+end)
+
+test:test("op mix and hot keys", function(test)
+    test:plan(6)
+    local counts = count_rows('update_test')
+    local res = migrate.analyze('update_test', {spaces = spaces, top = 1})
+    test:is_deeply(res.spaces[1].ops, counts[1], "ops of space 1")
+    test:is_deeply(res.spaces[0].ops, counts[0], "ops of space 0")
+    test:is_deeply(res.spaces[1].update_ops, {[':'] = 3, ['#'] = 1,
+                                              ['!'] = 1},
+                   "update ops of space 1")
+    test:is(#res.spaces[1].hot_keys, 1, "top keys")
+    test:is_deeply(res.spaces[1].hot_keys[1].key, {1}, "the most updated key")
+    test:is(res.spaces[1].hot_keys[1].count, 3, "its count")
+end)
+
+test:test("NUM fields of wrong width", function(test)
+    test:plan(2)
+    -- the first field of space 0 is a string
+    local wrong = {[0] = {fields = {'num', 'num', 'num'},
+                          index = {parts = {1}}, default = 'str'}}
+    local res = migrate.analyze('insert_test', {spaces = wrong})
+    test:ok(res.spaces[0].num_violations > 0, "violations are found")
+    test:is(migrate.analyze('insert_test').spaces[0].num_violations, 0,
+            "nothing is checked without spaces")
+end)
+
+os.exit(test:check() == true and 0 or -1)
@@ -0,0 +1,123 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local migrate = require('migrate')
+local xlog = require('migrate.xlog')
+
+local common = require('common')
+
+box.cfg{
+    wal_mode = 'none',
+    logger_nonblock = false
+}
+
+local UPDATE_XLOG = 'update_test/00000000000000000001.xlog'
+local UPDATE_LSN = common.read_lsn(xlog.open(UPDATE_XLOG, {
+    spaces = common.space_schema,
+    convert = true,
+    return_type = 'table'
+}))
+
+-- Load directory with reader, returns contents of spaces and last lsn
+local function load(dir, opts)
+    local spaces = common.targets('apply_' .. opts.apply)
+    opts.batch_count = 4
+    local reader = migrate.reader(common.reader_cfg(dir, spaces, opts))
+    reader:resume()
+    return common.select_targets(spaces), reader.lsn
+end
+
+-- Apply rows of xlog with lsn > 'lsn' from Lua, errors are ignored
+local function apply_lua(name, spaces, lsn)
+    for _, rv in xlog.open(name, {spaces = common.space_schema,
+                                  convert = true, return_type = 'tuple'}) do
+        for _, v in ipairs(rv) do
+            local s = spaces[v.space]
+            if v.lsn > lsn then
+                if v.op == 'insert' then
+                    pcall(s.replace, s, v.tuple)
+                elseif v.op == 'delete' then
+                    pcall(s.delete, s, v.key)
+                elseif v.op == 'update' then
+                    pcall(s.update, s, v.key, v.ops)
+                end
+            end
+        end
+    end
+end
+
+-- Apply rows of xlog with lsn > 'lsn' from C, returns number of rows
+-- taken from file and lsn of the last one
+local function apply_native(name, spaces, lsn, throw)
+    local plan = {}
+    for no, s in pairs(spaces) do
+        plan[no] = {s.id, s.index.primary.id}
+    end
+    plan = xlog.apply_plan(plan)
+    local param = xlog.batches_open(name, {spaces = common.space_schema,
+                                           convert = true, batch_count = 4})
+    local count, last = 0, 0
+    while true do
+        local n, l = xlog.apply(param, plan, lsn, true, throw)
+        if n == nil then
+            break
+        end
+        count, last = count + n, l
+    end
+    return count, last
+end
+
+local test = tap.test("native apply")
+test:plan(3)
+
+test:test("reader", function(test)
+    local dirs = {'insert_test', 'update_test'}
+    test:plan(#dirs * 2 + 2)
+    for _, dir in ipairs(dirs) do
+        local expected, lsn = load(dir, {apply = 'lua'})
+        local got, got_lsn = load(dir, {apply = 'native'})
+        local s = "'" .. dir .. "', "
+        test:is_deeply(got, expected, s .. "same spaces as with lua apply")
+        test:is(got_lsn, lsn, s .. "same lsn")
+    end
+    local expected = load('insert_test', {apply = 'lua'})
+    test:ok(#expected[0] > 0 and #expected[1] > 0 and #expected[2] > 0,
+            "rows are loaded")
+    test:is_deeply(load('insert_test', {apply = 'native', threads = 2}),
+                   expected, "snapshot is decoded by threads")
+end)
+
+test:test("rows up to lsn are skipped", function(test)
+    test:plan(9)
+    local last_lsn = UPDATE_LSN[#UPDATE_LSN]
+    for _, lsn in ipairs({0, 6, last_lsn}) do
+        local expected = common.targets('skip_lua')
+        apply_lua(UPDATE_XLOG, expected, lsn)
+        local got = common.targets('skip_native')
+        local count, last = apply_native(UPDATE_XLOG, got, lsn, true)
+        local s = "lsn " .. lsn .. ", "
+        test:is_deeply(common.select_targets(got),
+                       common.select_targets(expected), s .. "same spaces")
+        test:is(count, #UPDATE_LSN, s .. "skipped rows are counted")
+        test:is(last, last_lsn, s .. "lsn of the last row")
+    end
+end)
+
+test:test("errors", function(test)
+    test:plan(3)
+    -- keys of space 0 are strings, they don't fit into the target
+    local spaces = common.targets('error', {[0] = 'unsigned'})
+    local ok, err = pcall(apply_native, UPDATE_XLOG, spaces, 0, true)
+    test:ok(not ok and tostring(err):match("Error while"),
+            "failed row is raised with throw = true")
+    common.targets('error', {[0] = 'unsigned'})
+    local count = apply_native(UPDATE_XLOG, spaces, 0, false)
+    test:is(count, #UPDATE_LSN, "failed rows are skipped with throw = false")
+    local expected = common.targets('error_lua', {[0] = 'unsigned'})
+    apply_lua(UPDATE_XLOG, expected, 0)
+    test:is_deeply(common.select_targets(spaces),
+                   common.select_targets(expected), "other rows are applied")
+end)
+
+os.exit(test:check() == true and 0 or -1)
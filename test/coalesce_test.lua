@@ -0,0 +1,210 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local migrate = require('migrate')
+local coalesce = require('migrate.coalesce')
+
+local common = require('common')
+
+box.cfg{
+    wal_mode = 'none',
+    logger_nonblock = false
+}
+
+local seq = common.space_create('coalesce_seq', 'unsigned')
+local out = common.space_create('coalesce_out', 'unsigned')
+
+local function random_op()
+    local r = math.random(10)
+    local n = math.random(0, 1000)
+    if r == 1 then return {'=', 2, n} end
+    if r == 2 then return {'+', 2, math.random(5)} end
+    if r == 3 then return {'&', 2, n} end
+    if r == 4 then return {'|', 2, n} end
+    if r == 5 then return {'^', 2, n} end
+    if r == 6 then return {'=', 3, 'str' .. n} end
+    if r == 7 then return {':', 3, 2, 1, 'xy'} end
+    if r == 8 then return {'!', 4, n} end
+    if r == 9 then return {'#', 4, 1} end
+    return {'+', 4, 1}
+end
+
+-- Random rows of space 0, that are applied to 'seq' one by one, rows
+-- that fail are not returned, as they wouldn't be in xlog
+local function random_rows(count, keys, as_tuples)
+    local rows = {}
+    local wrap = as_tuples and box.tuple.new or function (t) return t end
+    seq:truncate()
+    for lsn = 1, count do
+        local key = math.random(keys)
+        local r = math.random(10)
+        local v = {lsn = lsn, space = 0, flags = 0}
+        local ok
+        if r <= 2 then
+            v.op = 'insert'
+            v.tuple = wrap({key, math.random(0, 1000), 'str'})
+            ok = pcall(seq.replace, seq, v.tuple)
+        elseif r == 3 then
+            v.op = 'delete'
+            v.key = wrap({key})
+            ok = pcall(seq.delete, seq, v.key)
+        else
+            v.op = 'update'
+            v.key = wrap({key})
+            local ops = {}
+            for i = 1, math.random(3) do
+                ops[i] = random_op()
+            end
+            v.ops = wrap(ops)
+            ok = pcall(seq.update, seq, v.key, v.ops)
+        end
+        if ok then
+            table.insert(rows, v)
+        end
+    end
+    return rows
+end
+
+local function replay(rows)
+    out:truncate()
+    for _, v in ipairs(rows) do
+        if v.op == 'insert' then
+            out:replace(v.tuple)
+        elseif v.op == 'delete' then
+            out:delete(v.key)
+        else
+            out:update(v.key, v.ops)
+        end
+    end
+end
+
+local function coalesced(rows, size)
+    local window = coalesce.new({[0] = {parts = {1}}})
+    local result = {}
+    for _, v in ipairs(rows) do
+        window:push(v)
+        if window.count >= size then
+            for _, r in ipairs(window:drain()) do
+                table.insert(result, r)
+            end
+        end
+    end
+    for _, r in ipairs(window:drain()) do
+        table.insert(result, r)
+    end
+    return result
+end
+
+local test = tap.test("coalescing of xlog rows")
+test:plan(3)
+
+test:test("same result as sequential replay", function(test)
+    local windows = {1, 2, 7, 50, 100000}
+    test:plan(#windows * 2 * 2)
+    math.randomseed(15)
+    for _, as_tuples in ipairs({false, true}) do
+        local rows = random_rows(3000, 20, as_tuples)
+        local expected = common.select_all(seq)
+        for _, size in ipairs(windows) do
+            local result = coalesced(rows, size)
+            local s = string.format("%s, window %d, ",
+                                    as_tuples and 'tuples' or 'tables', size)
+            local ok, err = pcall(replay, result)
+            test:ok(ok and #result <= #rows, s .. "replayed " .. #rows ..
+                    " rows as " .. #result .. (ok and '' or
+                    ' (' .. tostring(err) .. ')'))
+            test:is_deeply(common.select_all(out), expected,
+                           s .. "same tuples")
+        end
+    end
+end)
+
+test:test("rows are folded", function(test)
+    test:plan(9)
+    local function fold(rows)
+        for lsn, v in ipairs(rows) do
+            v.lsn, v.space = lsn, 0
+        end
+        return coalesced(rows, #rows)
+    end
+    local rv = fold({
+        {op = 'insert', tuple = {1, 10, 'a'}},
+        {op = 'update', key = {1}, ops = {{'+', 2, 5}}},
+        {op = 'update', key = {1}, ops = {{'=', 3, 'b'}}}
+    })
+    test:is_deeply({#rv, rv[1].op, rv[1].tuple, rv[1].lsn},
+                   {1, 'insert', {1, 15, 'b'}, 3}, "insert and updates")
+    rv = fold({
+        {op = 'insert', tuple = {1, 10, 'a'}},
+        {op = 'update', key = {1}, ops = {{'+', 2, 5}}},
+        {op = 'delete', key = {1}}
+    })
+    test:is_deeply({#rv, rv[1].op}, {1, 'delete'}, "insert and delete")
+    rv = fold({
+        {op = 'update', key = {1}, ops = {{'+', 2, 1}}},
+        {op = 'update', key = {1}, ops = {{'+', 2, 2}, {'=', 3, 'x'}}},
+        {op = 'update', key = {1}, ops = {{'+', 2, 3}, {'=', 3, 'y'}}}
+    })
+    test:is_deeply(rv[1].ops, {{'+', 2, 6}, {'=', 3, 'y'}},
+                   "additions are summed, assignments collapse")
+    rv = fold({
+        {op = 'update', key = {1}, ops = {{'=', 2, 7}}},
+        {op = 'update', key = {1}, ops = {{'+', 2, 3}, {'|', 4, 1}}},
+        {op = 'update', key = {1}, ops = {{'|', 4, 2}}}
+    })
+    test:is_deeply(rv[1].ops, {{'=', 2, 10}, {'|', 4, 3}},
+                   "arithmetic after assignment")
+    rv = fold({
+        {op = 'update', key = {1}, ops = {{'!', 2, 7}}},
+        {op = 'update', key = {1}, ops = {{'=', 2, 3}}}
+    })
+    test:is_deeply(rv[1].ops, {{'!', 2, 7}, {'=', 2, 3}},
+                   "fields aren't merged after insertion")
+    rv = fold({
+        {op = 'delete', key = {1}},
+        {op = 'update', key = {1}, ops = {{'=', 2, 3}}}
+    })
+    test:is_deeply({#rv, rv[1].op}, {1, 'delete'}, "update after delete")
+    rv = fold({
+        {op = 'insert', tuple = {1, 10, 'a'}},
+        {op = 'update', key = {1}, ops = {{'=', 1, 2}}}
+    })
+    test:is(#rv, 2, "update of primary key isn't folded")
+    rv = fold({
+        {op = 'insert', tuple = {1, 10, 'a'}},
+        {op = 'update', key = {1}, ops = {{'+', 3, 1}}}
+    })
+    test:is(#rv, 2, "failing update isn't folded")
+    rv = fold({
+        {op = 'update', key = {1}, ops = {{'+', 2, 1}}},
+        {op = 'update', key = {2}, ops = {{'+', 2, 1}}},
+        {op = 'update', key = {1}, ops = {{'+', 2, 1}}}
+    })
+    test:is_deeply({#rv, rv[1].key[1], rv[2].key[1]}, {2, 2, 1},
+                   "keys are ordered by their last row")
+end)
+
+test:test("reader", function(test)
+    local dirs = {'insert_test', 'update_test'}
+    test:plan(#dirs * 3 + 1)
+    local function load(dir, window)
+        local targets = common.targets('coalesce_' .. window)
+        migrate.reader(common.reader_cfg(dir, targets,
+                                         {coalesce = window})):resume()
+        return targets
+    end
+    for _, dir in ipairs(dirs) do
+        local expected = load(dir, 0)
+        local got = load(dir, 10)
+        for no, s in pairs(expected) do
+            test:is_deeply(common.select_all(got[no]), common.select_all(s),
+                           "'" .. dir .. "', space " .. no)
+        end
+    end
+    test:ok(not pcall(migrate.reader, {dir = 'insert_test', spaces = {},
+                                       coalesce = 10, apply = 'native'}),
+            "not with native apply")
+end)
+
+os.exit(test:check() == true and 0 or -1)
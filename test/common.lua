@@ -1,6 +1,29 @@
+local fio = require('fio')
 local fun = require('fun')
 local pickle = require('pickle')
 
+-- Schema of spaces in files of insert_test and update_test
+local space_schema = {
+    [0] = {
+        space_no = 0,
+        schema = {'str', 'num', 'num'},
+        ischema = {'str'},
+        default = 'str'
+    },
+    [1] = {
+        space_no = 1,
+        schema = {'num', 'str', 'num', 'num'},
+        ischema = {'num'},
+        default = 'str'
+    },
+    [2] = {
+        space_no = 2,
+        schema = {'num', 'str', 'num'},
+        ischema = {'num'},
+        default = 'str'
+    }
+}
+
 -- Decode field
 -- If convert == true, then do nothing
 local function field_decode(field, t, convert)
@@ -36,8 +59,111 @@ local function tuple_cmp(got, expected, tt, def, convert)
     ):reduce(fun.operator.land, true)
 end
 
+-- Create space with TREE primary index on the first field
+local function space_create(name, pk_type)
+    local s = box.schema.create_space(name)
+    s:create_index('primary', {type = 'TREE', parts = {1, pk_type}})
+    return s
+end
+
+-- Tuples of space as tables, in primary key order
+local function select_all(space)
+    local rv = {}
+    for _, t in space:pairs() do
+        table.insert(rv, t:totable())
+    end
+    return rv
+end
+
+-- Empty target spaces '<prefix>_<space_no>' for spaces of space_schema,
+-- created by space_create() on first use, 'pk_types' overrides type of
+-- primary key of some of them
+local function targets(prefix, pk_types)
+    local rv = {}
+    for no, def in pairs(space_schema) do
+        local name = prefix .. '_' .. no
+        local pk_type = (pk_types or {})[no] or
+                        (def.schema[1] == 'str' and 'string' or 'unsigned')
+        local s = box.space[name] or space_create(name, pk_type)
+        s:truncate()
+        rv[no] = s
+    end
+    return rv
+end
+
+-- Config of reader that loads spaces of space_schema from 'dir' into
+-- 'targets', fields of 'opts' are added to it
+local function reader_cfg(dir, targets, opts)
+    local cfg = {dir = dir, spaces = {}}
+    for no, def in pairs(space_schema) do
+        cfg.spaces[no] = {
+            new_id = targets[no].name,
+            index = {new_id = 'primary', parts = {1}},
+            fields = def.schema,
+            default = def.default
+        }
+    end
+    for k, v in pairs(opts or {}) do
+        cfg[k] = v
+    end
+    return cfg
+end
+
+-- Tuples of target spaces, see select_all()
+local function select_targets(targets)
+    local rv = {}
+    for no, s in pairs(targets) do
+        rv[no] = select_all(s)
+    end
+    return rv
+end
+
+-- Whole content of small file
+local function file_read(name)
+    local f = fio.open(name, {'O_RDONLY'})
+    local data = f:read(1024 * 1024)
+    f:close()
+    return data
+end
+
+local function file_write(name, data)
+    local f = fio.open(name, {'O_WRONLY', 'O_CREAT', 'O_TRUNC'},
+                       tonumber('644', 8))
+    f:write(data)
+    f:close()
+end
+
+-- Lsns of rows returned by xlog reader
+local function read_lsn(iter)
+    local rows = {}
+    for _, rv in iter do
+        for _, v in ipairs(rv) do
+            table.insert(rows, v.lsn)
+        end
+    end
+    return rows
+end
+
+-- Remove directory with files in it
+local function rmtree(dir)
+    for _, name in ipairs(fio.glob(fio.pathjoin(dir, '*'))) do
+        fio.unlink(name)
+    end
+    fio.rmdir(dir)
+end
+
 return {
+    space_schema = space_schema,
     field_decode = field_decode,
     tuple_decode = tuple_decode,
-    tuple_cmp = tuple_cmp
+    tuple_cmp = tuple_cmp,
+    space_create = space_create,
+    select_all = select_all,
+    targets = targets,
+    reader_cfg = reader_cfg,
+    select_targets = select_targets,
+    file_read = file_read,
+    file_write = file_write,
+    read_lsn = read_lsn,
+    rmtree = rmtree
 }
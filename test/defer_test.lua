@@ -0,0 +1,114 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local migrate = require('migrate')
+local xlog = require('migrate.xlog')
+
+local common = require('common')
+
+box.cfg{
+    wal_mode = 'none',
+    logger_nonblock = false
+}
+
+local SNAP = 'insert_test/00000000000000000032.snap'
+local SNAP_ROWS = #common.read_lsn(xlog.open(SNAP, {
+    spaces = common.space_schema,
+    convert = true,
+    return_type = 'table'
+}))
+
+local targets = common.targets('defer')
+targets[1]:create_index('secondary', {type = 'TREE', unique = false,
+                                      parts = {3, 'unsigned'}})
+targets[2]:create_index('secondary', {type = 'TREE', unique = false,
+                                      parts = {2, 'string'}})
+
+-- Definitions of secondary indexes of target spaces
+local function secondary()
+    local rv = {}
+    for no, s in pairs(targets) do
+        rv[no] = {}
+        for _, t in box.space._index:pairs({s.id}) do
+            local index = s.index[t[3]]
+            if t[2] ~= 0 then
+                table.insert(rv[no], {t[2], t[3], index.type, index.unique,
+                                      index.parts})
+            end
+        end
+    end
+    return rv
+end
+
+-- Load insert_test with secondary indexes dropped, 'crash_at' is number
+-- of row that fails. Returns result of resume() and whether secondary
+-- indexes existed when every row was applied.
+local function load(crash_at)
+    -- empty the targets
+    common.targets('defer')
+    local cfg = common.reader_cfg('insert_test', targets,
+                                  {batch_count = 4, defer_secondary = true})
+    local indexed = {}
+    for no, space in pairs(cfg.spaces) do
+        local s = targets[no]
+        space.insert = function (tuple)
+            if #indexed + 1 == crash_at then
+                error('crash')
+            end
+            table.insert(indexed, targets[1].index.secondary ~= nil)
+            s:replace(tuple)
+        end
+    end
+    local reader = migrate.reader(cfg)
+    local ok, err = pcall(reader.resume, reader)
+    return ok, err, indexed
+end
+
+local test = tap.test("deferred secondary indexes")
+test:plan(3)
+
+test:test("indexes are built after snapshot", function(test)
+    test:plan(5)
+    local expected = secondary()
+    local ok, _, indexed = load()
+    test:ok(ok, "loaded")
+    local dropped = true
+    for i = 1, SNAP_ROWS do
+        dropped = dropped and not indexed[i]
+    end
+    test:ok(dropped, "indexes are dropped while snapshot is loaded")
+    test:ok(indexed[#indexed], "they exist while xlogs are replayed")
+    test:is_deeply(secondary(), expected, "same definitions")
+    test:is(targets[1].index.secondary:count(), targets[1]:len(),
+            "all tuples are indexed")
+end)
+
+test:test("indexes are restored if loading fails", function(test)
+    test:plan(2)
+    local expected = secondary()
+    local ok, err = load(10)
+    test:ok(not ok and tostring(err):match('crash'), "error of loading")
+    test:is_deeply(secondary(), expected, "indexes are restored")
+end)
+
+test:test("index can't be restored", function(test)
+    test:plan(5)
+    -- values of the 3rd field repeat in snapshot
+    targets[1]:create_index('unique', {type = 'TREE', unique = true,
+                                       parts = {3, 'unsigned'}})
+    local ok, err = load()
+    test:ok(not ok and tostring(err):match('Failed to restore'),
+            "error of restore")
+    test:ok(targets[1].index.unique == nil, "index isn't restored")
+    test:ok(targets[1].index.secondary ~= nil, "other indexes are restored")
+    targets[1]:create_index('unique', {type = 'TREE', unique = true,
+                                       parts = {3, 'unsigned'}})
+    -- all duplicates are loaded when the first xlog row fails
+    ok, err = load(SNAP_ROWS + 1)
+    err = tostring(err)
+    test:ok(not ok and err:match('crash'), "error of loading is raised")
+    test:ok(err:match('Failed to restore'), "restore error is attached")
+end)
+
+os.exit(test:check() == true and 0 or -1)
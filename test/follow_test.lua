@@ -0,0 +1,169 @@
+#!/usr/bin/env tarantool
+
+local fio = require('fio')
+local fun = require('fun')
+local tap = require('tap')
+local fiber = require('fiber')
+
+local migrate = require('migrate')
+local xlog = require('migrate.xlog')
+
+local common = require('common')
+local space_schema = common.space_schema
+
+box.cfg{
+    wal_mode = 'none',
+    logger_nonblock = false
+}
+
+-- "XLOG\n0.11\n\n"
+local HEADER_SIZE = 11
+-- end of file marker
+local EOF_SIZE = 4
+
+-- Write 'data' to 'name' the way 1.5 does: file appears with its header
+-- and grows by 'step' bytes
+local function file_grow(name, data, step)
+    local tmp = name .. '.inprogress'
+    local f = fio.open(tmp, {'O_WRONLY', 'O_CREAT', 'O_TRUNC'},
+                       tonumber('644', 8))
+    f:write(data:sub(1, HEADER_SIZE))
+    fio.rename(tmp, name)
+    for pos = HEADER_SIZE + 1, #data, step do
+        fiber.sleep(0.001)
+        f:write(data:sub(pos, pos + step - 1))
+    end
+    f:close()
+end
+
+local test = tap.test("follow mode")
+test:plan(3)
+
+test:test("growing xlog", function(test)
+    test:plan(5)
+    local name = 'insert_test/00000000000000000050.xlog'
+    local data = common.file_read(name)
+    local cfg = {spaces = space_schema, convert = true,
+                 return_type = 'table', batch_count = 4}
+    local expected = common.read_lsn(xlog.open(name, cfg))
+    local dir = fio.tempdir()
+    local path = fio.pathjoin(dir, fio.basename(name))
+    local f = fio.open(path, {'O_WRONLY', 'O_CREAT'}, tonumber('644', 8))
+    -- half of a row is written
+    local half = math.floor(#data / 2)
+    f:write(data:sub(1, half))
+    cfg.follow = true
+    local iter = xlog.open(path, cfg)
+    local rows = common.read_lsn(iter)
+    test:ok(#rows > 0 and #rows < #expected, "written rows are read")
+    test:ok(not xlog.complete(iter), "file isn't complete")
+    f:write(data:sub(half + 1, #data - EOF_SIZE))
+    for _, lsn in ipairs(common.read_lsn(iter)) do
+        table.insert(rows, lsn)
+    end
+    test:is_deeply(rows, expected, "appended rows are read")
+    f:write(data:sub(#data - EOF_SIZE + 1))
+    test:is(#common.read_lsn(iter), 0, "no rows after end of file marker")
+    test:ok(xlog.complete(iter), "file is complete")
+    f:close()
+    common.rmtree(dir)
+end)
+
+local targets = common.targets('follow')
+
+local function select_all()
+    local rv = common.select_targets(targets)
+    common.targets('follow')
+    return rv
+end
+
+-- Follow xlogs of insert_test written to empty directory, 'cut' -
+-- function that changes data of file before it's written
+local function follow(cut)
+    local dir = fio.tempdir()
+    local files = fio.glob('insert_test/*.xlog')
+    table.sort(files)
+    local snap = 'insert_test/00000000000000000032.snap'
+    common.file_write(fio.pathjoin(dir, fio.basename(snap)),
+                      common.file_read(snap))
+    local reader = migrate.reader(common.reader_cfg(dir, targets,
+                                                    {batch_count = 4}))
+    local done = fiber.channel(1)
+    fiber.create(function ()
+        done:put({pcall(reader.follow, reader, {poll_interval = 0.05})})
+    end)
+    -- lag is polled while rows are applied, the first call waits for
+    -- resume() that scans the same catalog
+    local lags, polling = {}, true
+    fiber.create(function ()
+        while polling do
+            local ok, lag = pcall(reader.lag, reader)
+            table.insert(lags, ok and lag.lsn >= 0 or tostring(lag))
+            fiber.sleep(0.001)
+        end
+    end)
+    local last = 0
+    for _, name in ipairs(files) do
+        local data = common.file_read(name)
+        file_grow(fio.pathjoin(dir, fio.basename(name)), cut(name, data), 53)
+        local rows = common.read_lsn(xlog.open(name, {
+            spaces = space_schema,
+            convert = true,
+            return_type = 'table'
+        }))
+        last = rows[#rows]
+    end
+    local deadline = fiber.time() + 10
+    while reader.lsn < last and fiber.time() < deadline do
+        fiber.sleep(0.01)
+    end
+    local lag = reader:lag()
+    polling = false
+    reader:stop()
+    local rv = done:get(1)
+    common.rmtree(dir)
+    return reader, rv, lag, last, lags
+end
+
+test:test("reader", function(test)
+    test:plan(7)
+    migrate.reader(common.reader_cfg('insert_test', targets)):resume()
+    local expected = select_all()
+    local reader, rv, lag, last, lags = follow(function (_, data)
+        return data
+    end)
+    test:ok(rv ~= nil and rv[1], "follow() returns after stop()")
+    local failed = fun.iter(lags):filter(function (v)
+        return v ~= true
+    end):totable()
+    test:is_deeply({#lags > 0, failed}, {true, {}},
+                   "lag() is called while following")
+    test:is(reader.lsn, last, "all rows are applied")
+    test:is_deeply(select_all(), expected, "same spaces")
+    test:is_deeply(lag, {lsn = 0, seconds = 0}, "no lag")
+    test:ok(not reader.following, "reader isn't following")
+    -- 1.5 crashed and started the next xlog
+    local cut = '00000000000000000050.xlog'
+    reader = follow(function (name, data)
+        if fio.basename(name) == cut then
+            return data:sub(1, #data - EOF_SIZE)
+        end
+        return data
+    end)
+    test:is_deeply({reader.lsn, select_all()}, {last, expected},
+                   "xlog without end of file marker is followed by the next")
+end)
+
+test:test("options", function(test)
+    test:plan(3)
+    test:ok(not pcall(xlog.open, 'insert_test/00000000000000000032.snap',
+                      {follow = true}), "snapshot isn't followed")
+    test:ok(not pcall(xlog.open, 'insert_test/00000000000000000050.xlog',
+                      {follow = true, prefetch = true}),
+            "followed xlog isn't prefetched")
+    local reader = migrate.reader(common.reader_cfg('insert_test', targets))
+    test:ok(not pcall(reader.follow, reader, {poll_interval = 'x'}),
+            "poll_interval is a number")
+end)
+
+os.exit(test:check() == true and 0 or -1)
@@ -0,0 +1,167 @@
+#!/usr/bin/env tarantool
+
+local fio = require('fio')
+local tap = require('tap')
+local msgpack = require('msgpack')
+-- reader of 1.10 snapshots
+local xlog110 = require('xlog')
+
+local migrate = require('migrate')
+local xdir = require('migrate.xdir')
+local offline = require('migrate.offline')
+
+local common = require('common')
+
+local memtx_dir = fio.tempdir()
+
+box.cfg{
+    memtx_dir = memtx_dir,
+    wal_mode = 'none',
+    logger_nonblock = false
+}
+
+local targets = common.targets('offline')
+local spaces = common.reader_cfg(nil, targets).spaces
+
+local function last_snap(dir)
+    local snaps = fio.glob(fio.pathjoin(dir, '*.snap'))
+    table.sort(snaps)
+    return snaps[#snaps]
+end
+
+-- schema with empty target spaces
+box.snapshot()
+local base = last_snap(memtx_dir)
+
+local function snap_rows(path)
+    local rows = {}
+    for _, row in xlog110.pairs(path) do
+        table.insert(rows, row)
+    end
+    return rows
+end
+
+-- tuples of space by encoded primary key
+local function snap_tuples(rows, space_id)
+    local tuples = {}
+    for _, row in ipairs(rows) do
+        if row.BODY.space_id == space_id then
+            tuples[msgpack.encode(row.BODY.tuple[1])] = row.BODY.tuple
+        end
+    end
+    return tuples
+end
+
+local function box_tuples(space)
+    local tuples = {}
+    for _, t in space:pairs() do
+        tuples[msgpack.encode(t[1])] = t:totable()
+    end
+    return tuples
+end
+
+local function convert(dir, memory)
+    local output = fio.tempdir()
+    local res = offline.convert({
+        dir = dir,
+        spaces = spaces,
+        base = base,
+        output = output,
+        memory = memory,
+        batch_count = 7
+    })
+    local rows = snap_rows(res.path)
+    return res, rows, output
+end
+
+-- load the same files with reader and compare spaces with snapshot
+local function check_converted(test, dir, rows)
+    common.targets('offline')
+    migrate.reader(common.reader_cfg(dir, targets)):resume()
+    for no, s in pairs(targets) do
+        test:is_deeply(snap_tuples(rows, s.id), box_tuples(s),
+                       "'" .. dir .. "', space " .. no .. " is the same " ..
+                       "as loaded by reader")
+    end
+end
+
+local test = tap.test("offline converter")
+test:plan(4)
+
+test:test("snapshot is written", function(test)
+    test:plan(8)
+    local res, rows, output = convert('insert_test')
+    test:is(res.lsn, 114, "last lsn")
+    test:is(fio.basename(res.path),
+            xdir.filename_from_lsn(xdir.lsn_from_filename(base) + 1, 'snap'),
+            "snapshot is named by vclock")
+    local base_rows = snap_rows(base)
+    test:is(#rows, #base_rows + res.rows, "base rows and tuples are written")
+    local numbered = true
+    for i, row in ipairs(rows) do
+        numbered = numbered and row.HEADER.lsn == i and
+                   row.HEADER.type == 'INSERT'
+    end
+    test:ok(numbered, "rows are numbered from 1")
+    test:is_deeply(rows[1].BODY, base_rows[1].BODY, "base rows go first")
+    check_converted(test, 'insert_test', rows)
+    common.rmtree(output)
+end)
+
+test:test("updates and deletes", function(test)
+    test:plan(4)
+    local res, rows, output = convert('update_test')
+    test:is(res.lsn, 13, "last lsn")
+    check_converted(test, 'update_test', rows)
+    common.rmtree(output)
+end)
+
+test:test("state is spilled to disk", function(test)
+    test:plan(4)
+    for _, dir in ipairs({'insert_test', 'update_test'}) do
+        local _, rows, output = convert(dir)
+        local _, spilled, spilled_output = convert(dir, 1)
+        local same = #rows == #spilled
+        for i = 1, #rows do
+            same = same and msgpack.encode(rows[i].BODY) ==
+                            msgpack.encode(spilled[i].BODY)
+        end
+        test:ok(same, "'" .. dir .. "', same snapshot with spilled state")
+        test:is(#fio.glob(fio.pathjoin(spilled_output, '*.run')), 0,
+                "'" .. dir .. "', runs are removed")
+        common.rmtree(output)
+        common.rmtree(spilled_output)
+    end
+end)
+
+test:test("errors", function(test)
+    test:plan(4)
+    local output = fio.tempdir()
+    local cfg = {dir = 'insert_test', spaces = spaces, base = base,
+                 output = output}
+    offline.convert(cfg)
+    local ok, err = pcall(offline.convert, cfg)
+    test:ok(not ok and err:match('already exists'), "snapshot isn't overwritten")
+
+    cfg.spaces = {[0] = table.copy(spaces[0])}
+    cfg.spaces[0].new_id = 'missing'
+    ok, err = pcall(offline.convert, cfg)
+    test:ok(not ok and err:match('is not found'), "unknown space")
+
+    cfg.spaces[0] = table.copy(spaces[0])
+    cfg.spaces[0].insert = function () end
+    ok, err = pcall(offline.convert, cfg)
+    test:ok(not ok and err:match('callback'), "custom callbacks")
+
+    -- target spaces are filled by reader in previous tests
+    box.snapshot()
+    cfg.spaces = spaces
+    cfg.base = last_snap(memtx_dir)
+    ok, err = pcall(offline.convert, cfg)
+    test:ok(not ok and err:match("isn't empty"), "base has data")
+    common.rmtree(output)
+end)
+
+common.rmtree(memtx_dir)
+
+os.exit(test:check() == true and 0 or -1)
@@ -0,0 +1,211 @@
+#!/usr/bin/env tarantool
+
+local fio = require('fio')
+local tap = require('tap')
+local json = require('json')
+
+local migrate = require('migrate')
+local xlog = require('migrate.xlog')
+
+local common = require('common')
+local space_schema = common.space_schema
+
+box.cfg{
+    wal_mode = 'none',
+    logger_nonblock = false
+}
+
+local targets = common.targets('progress')
+targets[1]:create_index('secondary', {type = 'TREE', unique = false,
+                                      parts = {3, 'unsigned'}})
+
+-- Read file by batches, returns rows and offset after every batch
+local function read(file, cfg)
+    local rows, offsets = {}, {}
+    local iter = xlog.open(file, cfg)
+    for _, rv in iter do
+        for _, v in ipairs(rv) do
+            table.insert(rows, v)
+        end
+        table.insert(offsets, {#rows, xlog.offset(iter)})
+    end
+    return rows, offsets
+end
+
+local function equals(a, b)
+    if type(a) ~= 'table' or type(b) ~= 'table' then
+        return a == b
+    end
+    for k, v in pairs(a) do
+        if not equals(v, b[k]) then
+            return false
+        end
+    end
+    for k in pairs(b) do
+        if a[k] == nil then
+            return false
+        end
+    end
+    return true
+end
+
+local function is_tail(rows, tail)
+    for i = 1, #tail do
+        if not equals(rows[#rows - #tail + i], tail[i]) then
+            return false
+        end
+    end
+    return true
+end
+
+local test = tap.test("progress checkpoints")
+test:plan(3)
+
+test:test("reading is restarted at offset", function(test)
+    local files = fio.glob('insert_test/*.xlog')
+    table.insert(files, 'insert_test/00000000000000000032.snap')
+    table.insert(files, 'update_test/00000000000000000001.xlog')
+    table.sort(files)
+    local modes = {
+        {io = 'stdio'},
+        {io = 'mmap'},
+        {prefetch = true},
+        {threads = 2}
+    }
+    test:plan(#files * #modes + 2)
+    for _, file in ipairs(files) do
+        for _, mode in ipairs(modes) do
+            local cfg = {
+                spaces = space_schema,
+                convert = true,
+                return_type = 'table',
+                batch_count = 4
+            }
+            for k, v in pairs(mode) do
+                cfg[k] = v
+            end
+            local rows, offsets = read(file, cfg)
+            local ok = #rows > 0
+            for _, pos in ipairs(offsets) do
+                cfg.offset = pos[2]
+                local tail = read(file, cfg)
+                -- rows of batch decoded in background are returned
+                -- again if they were returned only in part
+                ok = ok and #tail >= #rows - pos[1] and is_tail(rows, tail)
+                if mode.io ~= nil then
+                    ok = ok and #tail == #rows - pos[1]
+                end
+            end
+            test:ok(ok, string.format("'%s', %s", file, json.encode(mode)))
+        end
+    end
+    local cfg = {spaces = space_schema, convert = true, return_type = 'table',
+                 offset = 1}
+    test:ok(not pcall(xlog.open, 'insert_test/00000000000000000025.xlog',
+                      cfg), "offset before rows")
+    cfg.offset = 100000000
+    test:ok(not pcall(xlog.open, 'insert_test/00000000000000000032.snap',
+                      cfg), "offset after end of file")
+end)
+
+-- Callbacks of reader config 'cfg' that fail on the 'crash_at' row
+local function crash_cfg(cfg, crash_at)
+    local calls = 0
+    local function crash()
+        calls = calls + 1
+        if calls == crash_at then
+            error('crash')
+        end
+    end
+    for no, space in pairs(cfg.spaces) do
+        local s = targets[no]
+        space.insert = function (tuple)
+            crash()
+            s:replace(tuple)
+        end
+        space.delete = function (key)
+            crash()
+            s:delete(key)
+        end
+        space.update = function (key, ops)
+            crash()
+            s:update(key, ops)
+        end
+    end
+end
+
+local function load(dir, opts, crash_at)
+    local cfg = common.reader_cfg(dir, targets, opts)
+    cfg.batch_count = cfg.batch_count or 4
+    if crash_at ~= nil then
+        crash_cfg(cfg, crash_at)
+        -- callbacks can't be used with native apply
+        cfg.apply = nil
+    end
+    return migrate.reader(cfg)
+end
+
+local function truncate()
+    for _, s in pairs(targets) do
+        s:truncate()
+    end
+    if box.space.progress_state ~= nil then
+        box.space.progress_state:drop()
+    end
+end
+
+test:test("reader continues after crash", function(test)
+    local cases = {
+        {'insert_test', 10}, {'insert_test', 50}, {'insert_test', 115},
+        {'update_test', 7}
+    }
+    local variants = {
+        {},
+        {progress_every = 3},
+        {apply = 'native'},
+        {coalesce = 10},
+        {prefetch = true, xlog_threads = 2},
+        {defer_secondary = true}
+    }
+    test:plan(#cases * #variants * 2)
+    for _, case in ipairs(cases) do
+        local dir, crash_at = case[1], case[2]
+        truncate()
+        load(dir, {}):resume()
+        local expected = common.select_targets(targets)
+        for _, opts in ipairs(variants) do
+            local name = string.format("'%s', crash at %d, %s", dir,
+                                       crash_at, json.encode(opts))
+            truncate()
+            opts.progress = 'progress_state'
+            local crashing = load(dir, opts, crash_at)
+            local crashed = not pcall(crashing.resume, crashing)
+            box.rollback()
+            local reader = load(dir, opts)
+            reader:resume()
+            local same = true
+            for no, s in pairs(targets) do
+                same = same and equals(common.select_all(s), expected[no])
+            end
+            test:ok(crashed and same, name .. ", same spaces")
+            local state = box.space.progress_state:get(1)
+            test:ok(state[2] == '' and state[4] == reader.lsn and
+                    targets[1].index.secondary ~= nil,
+                    name .. ", progress is saved")
+            opts.progress = nil
+        end
+    end
+end)
+
+test:test("options", function(test)
+    test:plan(2)
+    test:ok(not pcall(migrate.reader, {dir = 'insert_test', spaces = {},
+                                       progress = 1}),
+            "progress is a space name")
+    test:ok(not pcall(migrate.reader, {dir = 'insert_test', spaces = {},
+                                       progress = 'progress_state',
+                                       progress_every = 0}),
+            "progress_every is positive")
+end)
+
+os.exit(test:check() == true and 0 or -1)
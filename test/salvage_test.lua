@@ -0,0 +1,128 @@
+#!/usr/bin/env tarantool
+
+local fio = require('fio')
+local tap = require('tap')
+local json = require('json')
+
+local migrate = require('migrate')
+local xlog = require('migrate.xlog')
+
+local common = require('common')
+local space_schema = common.space_schema
+
+box.cfg{
+    wal_mode = 'none',
+    logger_nonblock = false
+}
+
+local MARKER = '\237\171\011\186'
+
+-- Offset of n-th row (1-based) of file
+local function row_offset(data, n)
+    local pos = 0
+    for _ = 1, n do
+        pos = data:find(MARKER, pos + 1, true)
+    end
+    return pos - 1
+end
+
+-- Copy 'name' into 'dir' with a byte of data of n-th row flipped, returns
+-- path of the copy and offsets of the damaged row
+local function damage(name, dir, n)
+    local data = common.file_read(name)
+    local from, to = row_offset(data, n), row_offset(data, n + 1)
+    -- marker, 28 bytes of header, then data
+    local pos = from + 4 + 28 + 3 + 1
+    data = data:sub(1, pos - 1) ..
+           string.char(bit.bxor(data:byte(pos), 0xff)) .. data:sub(pos + 1)
+    local path = fio.pathjoin(dir, fio.basename(name))
+    common.file_write(path, data)
+    return path, from, to
+end
+
+local function read(file, cfg)
+    local iter = xlog.open(file, cfg)
+    return common.read_lsn(iter), xlog.damaged(iter)
+end
+
+local test = tap.test("salvage of damaged files")
+test:plan(3)
+
+test:test("damaged row is skipped", function(test)
+    local dir = fio.tempdir()
+    local cases = {
+        -- the 4th row of xlog has lsn 53
+        {'insert_test/00000000000000000050.xlog', 4, 52, 54,
+         {{io = 'stdio'}, {io = 'mmap'}, {prefetch = true}}},
+        -- snapshot rows have no lsn
+        {'insert_test/00000000000000000032.snap', 6, 0, 0,
+         {{io = 'stdio'}, {io = 'mmap'}, {prefetch = true}, {threads = 2}}}
+    }
+    local count = 0
+    for _, case in ipairs(cases) do
+        count = count + #case[5] * 2 + 1
+    end
+    test:plan(count)
+    for _, case in ipairs(cases) do
+        local name, n, lsn_before, lsn_after, modes = unpack(case)
+        local cfg = {spaces = space_schema, convert = true,
+                     return_type = 'table', batch_count = 4}
+        local expected = read(name, cfg)
+        local path, from, to = damage(name, dir, n)
+        test:ok(not pcall(read, path, cfg),
+                string.format("'%s' fails without salvage", name))
+        table.remove(expected, n)
+        for _, mode in ipairs(modes) do
+            local opts = table.deepcopy(cfg)
+            opts.salvage = true
+            for k, v in pairs(mode) do
+                opts[k] = v
+            end
+            local what = string.format("'%s', %s", name, json.encode(mode))
+            local rows, damaged = read(path, opts)
+            test:is_deeply(rows, expected, what .. ", other rows are read")
+            test:is_deeply(damaged, {{from = from, to = to,
+                                      lsn_before = lsn_before,
+                                      lsn_after = lsn_after}},
+                           what .. ", damaged region is reported")
+        end
+    end
+    common.rmtree(dir)
+end)
+
+test:test("reader", function(test)
+    test:plan(4)
+    local dir = fio.tempdir()
+    for _, name in ipairs(fio.glob('insert_test/*')) do
+        common.file_write(fio.pathjoin(dir, fio.basename(name)),
+                          common.file_read(name))
+    end
+    local path, from, to = damage('insert_test/00000000000000000050.xlog',
+                                  dir, 4)
+    local targets = common.targets('salvage')
+    local clean = migrate.reader(common.reader_cfg('insert_test', targets))
+    local processed = clean:resume()
+    local reader = migrate.reader(common.reader_cfg(dir, targets))
+    test:ok(not pcall(reader.resume, reader), "it fails without salvage")
+    box.rollback()
+    reader = migrate.reader(common.reader_cfg(dir, targets,
+                                              {salvage = true}))
+    test:is(reader:resume(), processed - 1, "damaged row isn't applied")
+    test:is(reader.lsn, clean.lsn, "the last lsn is the same")
+    test:is_deeply(reader.damaged, {{file = path, from = from, to = to,
+                                     lsn_before = 52, lsn_after = 54}},
+                   "damaged region is saved")
+    common.rmtree(dir)
+end)
+
+test:test("options", function(test)
+    test:plan(2)
+    test:ok(not pcall(migrate.reader, {dir = 'insert_test', spaces = {},
+                                       salvage = 1}),
+            "salvage is a boolean")
+    test:ok(not pcall(xlog.open, 'insert_test/00000000000000000050.xlog',
+                      {salvage = 'yes'}),
+            "xlog salvage is a boolean")
+end)
+
+os.exit(test:check() == true and 0 or -1)
@@ -1,5 +1,6 @@
 #!/usr/bin/env tarantool
 
+local fio = require('fio')
 local fun = require('fun')
 local tap = require('tap')
 local xlog = require('migrate.xlog')
@@ -157,7 +158,7 @@ box.cfg{
 }
 
 local test = tap.test("snapshot reader/converter")
-test:plan(20)
+test:plan(27)
 
 for _, rtype in pairs({'table', 'tuple'}) do
     for _, ctype in pairs({false, true}) do
@@ -202,4 +203,233 @@ for _, rtype in pairs({'table', 'tuple'}) do
     end
 end
 
+local function snap_read_all(verify, threads, return_type, spaces, prefetch)
+    local rows = {}
+    for _, batch in xlog.open("insert_test/00000000000000000032.snap", {
+        spaces = spaces or {[0] = true, [1] = true, [2] = true},
+        convert = spaces ~= nil,
+        return_type = return_type or 'table',
+        batch_count = 10,
+        verify = verify,
+        threads = threads,
+        prefetch = prefetch
+    }) do
+        for _, t in pairs(batch) do
+            if return_type == 'tuple' then
+                t.tuple = t.tuple:totable()
+            end
+            table.insert(rows, t)
+        end
+    end
+    return rows
+end
+
+test:test("snapshot, verify levels", function(test)
+    test:plan(4)
+    local full = snap_read_all('full')
+    test:is(#full, 31, "all tuples are read")
+    test:is_deeply(snap_read_all('header'), full, "verify 'header'")
+    test:is_deeply(snap_read_all('none'), full, "verify 'none'")
+    test:ok(not pcall(snap_read_all, 'data'), "bad verify level")
+end)
+
+test:test("snapshot, threads", function(test)
+    test:plan(6)
+    local spaces = {}
+    for _, v in ipairs({snap_space0, snap_space1, snap_space2}) do
+        spaces[v.space_no] = {schema = v.schema, default = 'str'}
+    end
+    local seq = snap_read_all('full')
+    test:is(#seq, 31, "all tuples are read")
+    test:is_deeply(snap_read_all('full', 1), seq, "1 thread")
+    test:is_deeply(snap_read_all('full', 4), seq, "4 threads")
+    test:is_deeply(snap_read_all('full', 2, 'table', spaces),
+                   snap_read_all('full', 0, 'table', spaces),
+                   "2 threads, converted tables")
+    test:is_deeply(snap_read_all('full', 2, 'tuple', spaces),
+                   snap_read_all('full', 0, 'tuple', spaces),
+                   "2 threads, converted tuples")
+    test:ok(not pcall(snap_read_all, 'full', 'two'), "bad threads value")
+end)
+
+test:test("snapshot, prefetch", function(test)
+    test:plan(3)
+    local spaces = {}
+    for _, v in ipairs({snap_space0, snap_space1, snap_space2}) do
+        spaces[v.space_no] = {schema = v.schema, default = 'str'}
+    end
+    test:is_deeply(snap_read_all('full', 0, 'table', nil, true),
+                   snap_read_all('full'), "not converted")
+    test:is_deeply(snap_read_all('full', 0, 'table', spaces, true),
+                   snap_read_all('full', 0, 'table', spaces),
+                   "converted tables")
+    test:is_deeply(snap_read_all('full', 0, 'tuple', spaces, true),
+                   snap_read_all('full', 0, 'tuple', spaces),
+                   "converted tuples")
+end)
+
+test:test("snapshot, batch objects", function(test)
+    test:plan(5)
+    local spaces = {}
+    for _, v in ipairs({snap_space0, snap_space1, snap_space2}) do
+        spaces[v.space_no] = {schema = v.schema, default = 'str'}
+    end
+    local rows, ffi_ok = {}, true
+    for _, batch in xlog.open("insert_test/00000000000000000032.snap", {
+        spaces = spaces,
+        convert = true,
+        return_type = 'batch'
+    }) do
+        local raw = batch:rows()
+        for i = 1, #batch do
+            local t = batch:row(i)
+            ffi_ok = ffi_ok and raw[i - 1].space == t.space and
+                     raw[i - 1].op == 0
+            t.tuple = t.tuple:totable()
+            table.insert(rows, t)
+        end
+        test:is(batch:row(#batch + 1), nil, "row out of range")
+    end
+    test:is(#rows, 31, "all tuples are read")
+    test:is_deeply(rows, snap_read_all('full', 0, 'tuple', spaces),
+                   "rows are the same as tuples")
+    test:ok(ffi_ok, "rows are accessible through ffi")
+    test:ok(not pcall(snap_read_all, 'full', 0, 'batches'),
+            "bad return_type")
+end)
+
+test:test("snapshot, rows are skipped before decoding", function(test)
+    test:plan(6)
+    local function read(name, cfg)
+        local rows = {}
+        cfg.return_type = 'table'
+        cfg.batch_count = 10
+        for _, batch in xlog.open(name, cfg) do
+            for _, t in pairs(batch) do
+                table.insert(rows, t)
+            end
+        end
+        return rows
+    end
+    local function of_spaces(rows, spaces)
+        return fun.iter(rows):filter(function(t)
+            return spaces[t.space] ~= nil
+        end):totable()
+    end
+    local name = "insert_test/00000000000000000032.snap"
+    local spaces = {[1] = true, [2] = true}
+    local expected = of_spaces(snap_read_all('full'), spaces)
+    test:is_deeply(read(name, {spaces = spaces}), expected, "stdio")
+    test:is_deeply(read(name, {spaces = spaces, io = 'mmap'}), expected,
+                   "mmap")
+    test:is_deeply(read(name, {spaces = spaces, threads = 2}), expected,
+                   "2 threads")
+    test:is_deeply(read(name, {spaces = spaces, prefetch = true}), expected,
+                   "prefetch")
+
+    -- corrupt the last byte of data of the first row (space 0): file
+    -- header is 11 bytes, row header is 32 bytes, data is 47 bytes
+    local f = fio.open(name, {'O_RDONLY'})
+    local data = f:read(1024 * 1024)
+    f:close()
+    local pos = 11 + 32 + 47
+    data = data:sub(1, pos - 1) ..
+           string.char(bit.bxor(data:byte(pos), 0xff)) .. data:sub(pos + 1)
+    local dir = fio.tempdir()
+    local corrupted = fio.pathjoin(dir, "00000000000000000032.snap")
+    f = fio.open(corrupted, {'O_WRONLY', 'O_CREAT'}, tonumber('644', 8))
+    f:write(data)
+    f:close()
+    test:is_deeply(read(corrupted, {spaces = spaces, verify_skipped = false}),
+                   expected, "crc of skipped rows isn't checked")
+    test:ok(not pcall(read, corrupted, {spaces = spaces}),
+            "crc of skipped rows is checked by default")
+    fio.unlink(corrupted)
+    fio.rmdir(dir)
+end)
+
+test:test("snapshot, rows parsed in arena", function(test)
+    test:plan(4)
+    local spaces = {}
+    for _, v in ipairs({snap_space0, snap_space1, snap_space2}) do
+        spaces[v.space_no] = {schema = v.schema, default = 'str'}
+    end
+    local function read(cfg)
+        local rows = {}
+        cfg.spaces = spaces
+        cfg.convert = true
+        cfg.return_type = 'tuple'
+        cfg.batch_count = 10
+        cfg.alloc = cfg.alloc or 'arena'
+        for _, batch in xlog.open("insert_test/00000000000000000032.snap",
+                                  cfg) do
+            for _, t in pairs(batch) do
+                t.tuple = t.tuple:totable()
+                table.insert(rows, t)
+            end
+        end
+        return rows
+    end
+    local expected = snap_read_all('full', 0, 'tuple', spaces)
+    test:is_deeply(read({}), expected, "stdio")
+    test:is_deeply(read({io = 'mmap', hugepages = true}), expected,
+                   "mmap, hugepages")
+    test:is_deeply(read({prefetch = true}), expected, "prefetch")
+    test:ok(not pcall(read, {alloc = 'slab'}), "bad alloc value")
+end)
+
+test:test("snapshot, transcoded fields", function(test)
+    test:plan(9)
+    local spaces = {}
+    for _, v in ipairs({snap_space0, snap_space1, snap_space2}) do
+        spaces[v.space_no] = {schema = v.schema, default = 'str'}
+    end
+    -- tables are converted field by field, others are transcoded
+    local tables = snap_read_all('full', 0, 'table', spaces)
+    test:is_deeply(snap_read_all('full', 0, 'tuple', spaces), tables,
+                   "tuples are the same as tables")
+    test:is_deeply(snap_read_all('full', 0, 'table', spaces, true), tables,
+                   "prefetched tables with wide NUM fields")
+    test:is_deeply(snap_read_all('full', 2, 'table', spaces), tables,
+                   "tables decoded by threads with wide NUM fields")
+    test:is_deeply(snap_read_all('full', 0, 'tuple'), snap_read_all('full'),
+                   "not converted tuples are the same as tables")
+
+    -- the first field of space 0 is a 10 bytes long string
+    local bad_num = {[0] = {schema = {'num', 'num', 'num'}}}
+    for _, v in ipairs({{'table', false}, {'tuple', false},
+                        {'table', true}}) do
+        local ok, err = pcall(snap_read_all, 'full', 0, v[1], bad_num, v[2])
+        test:ok(not ok and tostring(err):match("len 4 or 8, got '10'"),
+                v[1] .. (v[2] and ", prefetch" or "") ..
+                ", NUM field of wrong size")
+    end
+
+    -- BER-encoded size of the first field of the first row is broken:
+    -- file header is 11 bytes, row header is 32 bytes, tuple data starts
+    -- after 22 bytes of row data
+    local name = "insert_test/00000000000000000032.snap"
+    local data = common.file_read(name)
+    local pos = 11 + 32 + 22 + 1
+    data = data:sub(1, pos - 1) .. '\xff' .. data:sub(pos + 1)
+    local dir = fio.tempdir()
+    local corrupted = fio.pathjoin(dir, fio.basename(name))
+    common.file_write(corrupted, data)
+    -- table path reads fields without bounds checks, so it isn't tried
+    for _, prefetch in ipairs({false, true}) do
+        local ok, err = pcall(function ()
+            for _ in xlog.open(corrupted, {spaces = spaces, convert = true,
+                                           return_type = prefetch and
+                                                         'table' or 'tuple',
+                                           verify = 'header',
+                                           prefetch = prefetch}) do
+            end
+        end)
+        test:ok(not ok and tostring(err):match("failed to parse tuple"),
+                (prefetch and "prefetch" or "tuple") ..
+                ", malformed field size")
+    end
+    common.rmtree(dir)
+end)
+
 os.exit(test:check() == true and 0 or -1)
@@ -0,0 +1,116 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+local clock = require('clock')
+local fiber = require('fiber')
+
+local migrate = require('migrate')
+local throttle = require('migrate.throttle')
+
+local common = require('common')
+
+box.cfg{
+    wal_mode = 'none',
+    logger_nonblock = false
+}
+
+-- throttle with fake clock, sleep advances it
+local function fake(cfg)
+    local t = throttle.new(cfg)
+    local now = 0
+    t.slept = 0
+    t.ready = 0
+    t.window_start = 0
+    t.clock = function () return now end
+    t.sleep = function (s)
+        t.slept = t.slept + s
+        now = now + s
+    end
+    t.advance = function (s) now = now + s end
+    return t
+end
+
+local function load(opts)
+    local targets = common.targets('throttle')
+    opts.batch_count = opts.batch_count or 10
+    local reader = migrate.reader(common.reader_cfg('insert_test', targets,
+                                                    opts))
+    reader:resume()
+    return common.select_targets(targets), reader
+end
+
+local test = tap.test("throttling of batches")
+test:plan(3)
+
+test:test("scheduler", function(test)
+    test:plan(7)
+    local t = fake({batch_count = 500, max_tx_time = 0.01})
+    t:batch(500, 0, 0.1)
+    test:is(t.batch_count, 50, "batch shrinks to fit tx time")
+    t:batch(50, 0, 0.0001)
+    test:is(t.batch_count, 99, "batch grows at most twice")
+    for _ = 1, 20 do
+        t:batch(t.batch_count, 0, 0)
+    end
+    test:is(t.batch_count, 500, "batch doesn't grow over batch_count")
+    test:is(t.slept, 0, "it only yields without rate limits")
+
+    t = fake({batch_count = 100, max_rows_per_sec = 1000})
+    for _ = 1, 20 do
+        t:batch(100, 0, 0)
+    end
+    test:ok(math.abs(t.slept - 2) < 1e-9, "rows per second are limited")
+    test:ok(math.abs(t:rate().rows_per_sec - 1000) < 100,
+            "rate is measured")
+
+    t = fake({batch_count = 100, max_bytes_per_sec = 1000})
+    t:batch(1, 500, 0)
+    t.advance(0.2)
+    t:batch(1, 500, 0)
+    test:ok(math.abs(t.slept - 1) < 1e-9,
+            "bytes per second are limited, idle time isn't saved up")
+end)
+
+test:test("reader", function(test)
+    local modes = {{}, {apply = 'native'}}
+    test:plan(#modes * 4)
+    local expected = load({})
+    for _, mode in ipairs(modes) do
+        local opts = table.deepcopy(mode)
+        opts.max_rows_per_sec = 500
+        local ticks = 0
+        local ticker = fiber.create(function ()
+            while true do
+                ticks = ticks + 1
+                fiber.sleep(0.001)
+            end
+        end)
+        local start = clock.monotonic()
+        local got, reader = load(opts)
+        local elapsed = clock.monotonic() - start
+        ticker:cancel()
+        local name = mode.apply or 'lua'
+        test:is_deeply(got, expected, name .. ", same tuples")
+        -- 121 rows
+        test:ok(elapsed >= 0.2, name .. ", rows per second are limited")
+        test:ok(ticks > 10, name .. ", other fibers run")
+
+        opts = table.deepcopy(mode)
+        opts.max_tx_time_ms = 0.000001
+        _, reader = load(opts)
+        test:is(reader:rate().batch_count, 1,
+                name .. ", batch is shrunk to fit tx time")
+    end
+end)
+
+test:test("options", function(test)
+    test:plan(3)
+    for _, name in ipairs({'max_tx_time_ms', 'max_rows_per_sec',
+                           'max_mb_per_sec'}) do
+        test:ok(not pcall(migrate.reader, {dir = 'insert_test', spaces = {},
+                                           [name] = 0}),
+                name .. " is positive")
+    end
+end)
+
+os.exit(test:check() == true and 0 or -1)
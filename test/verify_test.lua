@@ -0,0 +1,89 @@
+#!/usr/bin/env tarantool
+
+local ffi = require('ffi')
+local fio = require('fio')
+local tap = require('tap')
+local json = require('json')
+
+local migrate = require('migrate')
+
+local common = require('common')
+
+box.cfg{
+    wal_mode = 'none',
+    logger_nonblock = false
+}
+
+local targets = common.targets('verify')
+
+migrate.reader(common.reader_cfg('insert_test', targets)):resume()
+
+local tmpdir = fio.tempdir()
+
+local function verify(opts)
+    local cfg = common.reader_cfg('insert_test', targets, opts)
+    cfg.tmpdir = cfg.tmpdir or tmpdir
+    return migrate.verify(cfg)
+end
+
+local test = tap.test("verification of migrated spaces")
+test:plan(4)
+
+test:test("migrated spaces match", function(test)
+    local modes = {{threads = 0}, {threads = 2}, {memory = 4096},
+                   {prefetch = true}}
+    test:plan(#modes * 3)
+    for _, mode in ipairs(modes) do
+        local res = verify(mode)
+        local what = json.encode(mode)
+        test:ok(res.ok, what .. ", ok")
+        test:is(res.spaces.verify_1.source.count, box.space.verify_1:len(),
+                what .. ", tuples are counted")
+        test:is(res.spaces.verify_1.source.hash,
+                res.spaces.verify_1.target.hash, what .. ", hashes match")
+    end
+end)
+
+test:test("changed tuple", function(test)
+    test:plan(6)
+    local tuple = box.space.verify_1:select({}, {limit = 10})[7]
+    box.space.verify_1:update(tuple[1], {{'=', 2, 'changed'}})
+    local res = verify({bisect = 8})
+    test:ok(not res.ok, "mismatch is found")
+    test:ok(res.spaces.verify_0.ok and res.spaces.verify_2.ok,
+            "other spaces match")
+    local space = res.spaces.verify_1
+    test:is(space.source.count, space.target.count, "counts are the same")
+    test:is(#space.ranges, 1, "one range is reported")
+    local r = space.ranges[1]
+    test:ok((r.from == nil or r.from[1] <= tuple[1]) and
+            (r.to == nil or tuple[1] < r.to[1]), "range has the key")
+    test:ok(r.from ~= nil or r.to ~= nil, "range is narrowed")
+    box.space.verify_1:replace(tuple)
+end)
+
+test:test("deleted tuple", function(test)
+    test:plan(3)
+    local tuple = box.space.verify_2:select({}, {limit = 1})[1]
+    box.space.verify_2:delete(tuple[1])
+    local res = verify()
+    local space = res.spaces.verify_2
+    test:ok(not space.ok, "mismatch is found")
+    test:is(space.source.count - space.target.count, 1, "count differs")
+    test:is_deeply(space.ranges, {{source_count = space.source.count,
+                                   target_count = space.target.count}},
+                   "whole space is reported without bisect")
+    box.space.verify_2:replace(tuple)
+end)
+
+test:test("numbers are compared by value", function(test)
+    test:plan(1)
+    local tuple = box.space.verify_1:select({}, {limit = 1})[1]:totable()
+    tuple[3] = ffi.new('double', tonumber(tuple[3]))
+    box.space.verify_1:replace(tuple)
+    test:ok(verify().ok, "double field with integral value matches")
+end)
+
+fio.rmdir(tmpdir)
+
+os.exit(test:check() == true and 0 or -1)
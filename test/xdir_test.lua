@@ -1,11 +1,12 @@
 #!/usr/bin/env tarantool
 
+local fio = require('fio')
 local fun = require('fun')
 local tap = require('tap')
 local yaml = require('yaml')
 
 local test = tap.test("xlog reader/converter")
-test:plan(4)
+test:plan(5)
 
 local xdir = require('migrate.xdir')
 
@@ -218,4 +219,70 @@ test:test("xdir_load", function(test)
     )
 end)
 
+local function copy_xlogs(from, to)
+    for _, path in ipairs(fio.glob(fio.pathjoin(from, '*.xlog'))) do
+        fio.copyfile(path, fio.pathjoin(to, fio.basename(path)))
+    end
+end
+
+local function truncate(path, size)
+    local f = fio.open(path, {'O_RDWR'})
+    f:truncate(size)
+    f:close()
+end
+
+test:test("catalog", function(test)
+    test:plan(13)
+    local dir = fio.tempdir()
+    copy_xlogs('insert_test', dir)
+    local file = fio.pathjoin(dir, 'xlog.catalog')
+    local catalog = xdir.catalog(dir, file)
+    for _, lsn in ipairs({32, 60, 99}) do
+        local files, issues = catalog:after(lsn)
+        test:is_deeply(files, xdir.xdir_xlogs_after_lsn(dir, lsn),
+                       "files after " .. lsn .. " are the same as by names")
+        test:is(#issues, 0, "no issues after " .. lsn)
+    end
+    local ranges = fun.iter(catalog:files()):map(function (f)
+        return {f.lsn_first, f.lsn_last, f.state}
+    end):totable()
+    test:is_deeply(ranges, {{25, 49, 'complete'}, {50, 74, 'complete'},
+                            {75, 99, 'complete'}, {100, 114, 'complete'}},
+                   "lsn ranges of files")
+
+    -- a file is being written and the one before it is lost
+    local last = fio.pathjoin(dir, '00000000000000000100.xlog')
+    truncate(last, 700)
+    fio.unlink(fio.pathjoin(dir, '00000000000000000075.xlog'))
+    local reloaded = xdir.catalog(dir, file)
+    local _, issues = reloaded:after(60)
+    test:is_deeply(issues, {{kind = 'gap', from = 75, to = 99}},
+                   "missing file is a gap")
+    local f = reloaded:files()[3]
+    test:is(f.state, 'open', "file without end marker is open")
+    test:ok(f.lsn_last > 100 and f.lsn_last < 114, "rows read so far")
+    fio.copyfile('insert_test/00000000000000000100.xlog', last)
+    fio.copyfile('insert_test/00000000000000000075.xlog',
+                 fio.pathjoin(dir, '00000000000000000075.xlog'))
+    fio.copyfile('insert_test/00000000000000000050.xlog',
+                 fio.pathjoin(dir, '00000000000000000060.xlog'))
+    _, issues = reloaded:after(32)
+    test:is_deeply(issues, {{kind = 'overlap',
+                             file = '00000000000000000060.xlog',
+                             from = 50, to = 74}},
+                   "overlap is found")
+    test:is(reloaded:files()[5].lsn_last, 114, "appended rows are read")
+    fio.unlink(fio.pathjoin(dir, '00000000000000000060.xlog'))
+    truncate(fio.pathjoin(dir, '00000000000000000025.xlog'), 50)
+    _, issues = reloaded:after(32)
+    test:is_deeply(issues, {{kind = 'incomplete',
+                             file = '00000000000000000025.xlog'},
+                            {kind = 'gap', from = 33, to = 49}},
+                   "truncated file in the middle")
+    for _, path in ipairs(fio.glob(fio.pathjoin(dir, '*'))) do
+        fio.unlink(path)
+    end
+    fio.rmdir(dir)
+end)
+
 os.exit(test:check() == true and 0 or -1)
@@ -1,6 +1,7 @@
 #!/usr/bin/env tarantool
 
 local fun  = require('fun')
+local ffi  = require('ffi')
 local fio  = require('fio')
 local tap  = require('tap')
 local yaml = require('yaml')
@@ -10,26 +11,7 @@ local xlog = require('migrate.xlog')
 
 local common = require('common')
 
-local space_schema = {
-    [0] = {
-        space_no = 0,
-        schema = {'str', 'num', 'num'},
-        ischema = {'str'},
-        default = 'str'
-    },
-    [1] = {
-        space_no = 1,
-        schema = {'num', 'str', 'num', 'num'},
-        ischema = {'num'},
-        default = 'str'
-    },
-    [2] = {
-        space_no = 2,
-        schema = {'num', 'str', 'num'},
-        ischema = {'num'},
-        default = 'str'
-    }
-}
+local space_schema = common.space_schema
 
 local xlog_list = {
     [25] = {
@@ -563,7 +545,7 @@ for k, v in pairs(xlog_list) do
     xcount = xcount + 1
 end
 
-test:plan(xcount * 2 * 2 * 2 * 5)
+test:plan(xcount * 2 * 2 * 2 * 5 + xcount * 2 + 6)
 
 local function construct_name(xlog_name, spaces, bcount, convert, return_type, cut)
     local spacenos = {}
@@ -628,4 +610,360 @@ for lsn, xlog_inst in pairs(xlog_list) do
     end
 end
 
+local function xlog_read_all(name, io, prefetch)
+    local rows = {}
+    for _, batch in xlog.open(name, {
+        spaces = {[0] = true, [1] = true, [2] = true},
+        return_type = 'table',
+        batch_count = 7,
+        io = io,
+        prefetch = prefetch
+    }) do
+        for _, t in pairs(batch) do
+            table.insert(rows, t)
+        end
+    end
+    return rows
+end
+
+for lsn, xlog_inst in pairs(xlog_list) do
+    test:test("xlog '" .. xlog_inst.name .. "', io 'mmap'", function(test)
+        test:plan(2)
+        local lsn_path = fio.pathjoin('insert_test', xlog_inst.name)
+        local stdio = xlog_read_all(lsn_path, 'stdio')
+        local mmap = xlog_read_all(lsn_path, 'mmap')
+        test:is(#mmap, xlog_inst.lsn[2] - xlog_inst.lsn[1] + 1,
+                "all rows are read with mmap")
+        test:is_deeply(mmap, stdio, "mmap and stdio rows are the same")
+    end)
+    test:test("xlog '" .. xlog_inst.name .. "', prefetch", function(test)
+        test:plan(2)
+        local lsn_path = fio.pathjoin('insert_test', xlog_inst.name)
+        local rows = xlog_read_all(lsn_path, 'stdio')
+        test:is_deeply(xlog_read_all(lsn_path, 'stdio', true), rows,
+                       "rows decoded in background with stdio")
+        test:is_deeply(xlog_read_all(lsn_path, 'mmap', true), rows,
+                       "rows decoded in background with mmap")
+    end)
+end
+
+-- read rows with converted fields, tuples are turned into tables
+local function xlog_read_converted(name, return_type, prefetch)
+    local rows = {}
+    for _, batch in xlog.open(name, {
+        spaces = space_schema,
+        convert = true,
+        return_type = return_type,
+        batch_count = 5,
+        prefetch = prefetch
+    }) do
+        for _, t in pairs(batch) do
+            if return_type == 'tuple' then
+                for _, k in pairs({'tuple', 'key', 'ops'}) do
+                    if t[k] ~= nil then
+                        t[k] = t[k]:totable()
+                    end
+                end
+            end
+            table.insert(rows, t)
+        end
+    end
+    return rows
+end
+
+test:test("xlog, tuple keys and update operations", function(test)
+    local files = {}
+    for _, v in pairs(xlog_list) do
+        table.insert(files, fio.pathjoin('insert_test', v.name))
+    end
+    local update_xlog = fio.pathjoin('update_test', '00000000000000000001.xlog')
+    table.insert(files, update_xlog)
+    test:plan(#files * 3 + 9)
+
+    for _, name in ipairs(files) do
+        local rows = xlog_read_converted(name, 'table')
+        test:is_deeply(xlog_read_converted(name, 'tuple'), rows,
+                       "'" .. name .. "', tuples are the same as tables")
+        test:is_deeply(xlog_read_converted(name, 'tuple', true), rows,
+                       "'" .. name .. "', prefetched tuples are the same")
+        test:is_deeply(xlog_read_converted(name, 'table', true), rows,
+                       "'" .. name .. "', prefetched tables are the same")
+    end
+
+    local rows = {}
+    for _, batch in xlog.open(update_xlog, {
+        spaces = space_schema,
+        convert = true,
+        return_type = 'tuple',
+        batch_count = 50
+    }) do
+        for _, t in pairs(batch) do
+            rows[t.lsn] = t
+        end
+    end
+    test:iscdata(rows[12].key, "const box_tuple_t&", "delete key is tuple")
+    test:iscdata(rows[5].ops, "const box_tuple_t&", "update ops are tuple")
+    test:is_deeply(rows[5].ops:totable(), {{'=', 2, 100},
+                                           {'=', 1, 'key_000001'}},
+                   "assign")
+    test:is_deeply(rows[6].ops:totable(), {{'+', 3, 5}, {'&', 2, 15},
+                                           {'^', 3, 3}, {'|', 2, 48}},
+                   "arithmetic operations")
+    test:is_deeply(rows[7].ops:totable(), {{':', 2, 1, 5, 'HELLO'}},
+                   "splice, offsets are 1-based")
+    test:is_deeply(rows[8].ops:totable(), {{':', 2, -6, -2, 'XY'}},
+                   "splice, negative offset and length")
+    test:is_deeply(rows[9].ops:totable(),
+                   {{':', 2, 11, 3, string.rep('r', 120)}},
+                   "splice, long string")
+    test:is_deeply(rows[10].ops:totable(), {{'#', 4, 1}}, "delete field")
+    test:is_deeply(rows[11].ops:totable(), {{'!', 3, 77}}, "insert field")
+end)
+
+local function xlog_read_range(name, cfg)
+    local rows = {}
+    cfg.spaces = {[0] = true, [1] = true, [2] = true}
+    cfg.return_type = 'table'
+    cfg.batch_count = 4
+    for _, batch in xlog.open(name, cfg) do
+        for _, t in pairs(batch) do
+            table.insert(rows, t)
+        end
+    end
+    return rows
+end
+
+test:test("xlog, seek to lsn_from", function(test)
+    test:plan(xcount * 8)
+    local dir = fio.tempdir()
+    for _, xlog_inst in pairs(xlog_list) do
+        -- sidecar index is created next to xlog, so it's copied
+        local name = fio.pathjoin(dir, xlog_inst.name)
+        common.file_write(name, common.file_read(
+            fio.pathjoin('insert_test', xlog_inst.name)))
+
+        local range = {
+            lsn_from = xlog_inst.lsn[1] + 10,
+            lsn_to = xlog_inst.lsn[2] - 5
+        }
+        local function read(lsn_index, io, prefetch)
+            return xlog_read_range(name, {
+                lsn_from = range.lsn_from,
+                lsn_to = range.lsn_to,
+                lsn_index = lsn_index,
+                io = io,
+                prefetch = prefetch
+            })
+        end
+        local s = "'" .. xlog_inst.name .. "', "
+        local rows = read('none')
+        test:is(#rows, range.lsn_to - range.lsn_from + 1, s .. "row count")
+        test:is(rows[1].lsn, range.lsn_from, s .. "first row")
+        test:is_deeply(read('scan'), rows, s .. "headers are scanned")
+        test:is_deeply(read('scan', 'mmap', true), rows,
+                       s .. "headers are scanned in background")
+        test:is_deeply(read('file'), rows, s .. "index is built")
+        test:ok(fio.stat(name .. '.lsnidx') ~= nil, s .. "index is saved")
+        test:is_deeply(read('file', 'mmap'), rows, s .. "index is used")
+        common.file_write(name .. '.lsnidx',
+                          'LSNIDX1\n' .. string.rep('x', 40))
+        test:is_deeply(read('file'), rows, s .. "broken index is ignored")
+    end
+    for _, name in ipairs(fio.glob(fio.pathjoin(dir, '*'))) do
+        fio.unlink(name)
+    end
+    fio.rmdir(dir)
+end)
+
+test:test("xlog, rows parsed in arena", function(test)
+    test:plan(xcount * 4)
+    for _, xlog_inst in pairs(xlog_list) do
+        local name = fio.pathjoin('insert_test', xlog_inst.name)
+        local function read(io, prefetch, hugepages)
+            return xlog_read_range(name, {
+                alloc = 'arena',
+                hugepages = hugepages,
+                io = io,
+                prefetch = prefetch
+            })
+        end
+        local s = "'" .. xlog_inst.name .. "', "
+        local rows = xlog_read_range(name, {alloc = 'malloc'})
+        test:is_deeply(read('stdio'), rows, s .. "stdio")
+        test:is_deeply(read('mmap'), rows, s .. "mmap")
+        test:is_deeply(read('stdio', true), rows, s .. "in background")
+        test:is_deeply(read('stdio', false, true), rows, s .. "hugepages")
+    end
+end)
+
+test:test("xlog, files decoded ahead share memory budget", function(test)
+    local names = {}
+    for _, xlog_inst in pairs(xlog_list) do
+        table.insert(names, xlog_inst.name)
+    end
+    table.sort(names)
+    test:plan(#names * 2 + 1)
+    local cfg = {
+        spaces = {[0] = true, [1] = true, [2] = true},
+        return_type = 'table',
+        batch_count = 3
+    }
+    local function read(iter)
+        local rows = {}
+        for _, batch in iter do
+            for _, t in pairs(batch) do
+                table.insert(rows, t)
+            end
+        end
+        return rows
+    end
+    -- budget of 1 byte lets files ahead decode only one batch, the
+    -- first file isn't limited
+    for _, limit in ipairs({1, 64 * 1024 * 1024}) do
+        local budget = xlog.decoder_budget(limit)
+        local iters = {}
+        for i, name in ipairs(names) do
+            iters[i] = xlog.open(fio.pathjoin('insert_test', name), {
+                spaces = cfg.spaces,
+                return_type = cfg.return_type,
+                batch_count = cfg.batch_count,
+                prefetch = true,
+                budget = budget
+            })
+        end
+        for i, name in ipairs(names) do
+            local expected = read(xlog.open(fio.pathjoin('insert_test', name),
+                                            cfg))
+            test:is_deeply(read(iters[i]), expected,
+                           "'" .. name .. "', budget " .. limit)
+        end
+    end
+    test:ok(not pcall(xlog.decoder_budget, -1), "negative budget")
+end)
+
+test:test("compressed files", function(test)
+    local names = {'00000000000000000032.snap'}
+    for _, xlog_inst in pairs(xlog_list) do
+        table.insert(names, xlog_inst.name)
+    end
+    table.sort(names)
+    test:plan(#names * 2 + 7)
+    local function read(name, cfg, limit)
+        local rows = {}
+        cfg = cfg or {}
+        cfg.spaces = {[0] = true, [1] = true, [2] = true}
+        cfg.return_type = 'table'
+        cfg.batch_count = 3
+        local iter = xlog.open(name, cfg)
+        for _, batch in iter do
+            for _, t in pairs(batch) do
+                table.insert(rows, t)
+            end
+            if limit ~= nil and #rows >= limit then
+                return rows, xlog.offset(iter)
+            end
+        end
+        return rows
+    end
+    for _, name in ipairs(names) do
+        local expected = read(fio.pathjoin('insert_test', name))
+        local gz = fio.pathjoin('compressed_test', name .. '.gz')
+        test:is_deeply(read(gz), expected, "'" .. name .. ".gz'")
+        test:is_deeply(read(gz, {prefetch = true, io = 'mmap'}), expected,
+                       "'" .. name .. ".gz', prefetch")
+    end
+    local snap = '00000000000000000032.snap'
+    test:is_deeply(read(fio.pathjoin('compressed_test', snap .. '.gz'),
+                        {threads = 2}),
+                   read(fio.pathjoin('insert_test', snap)),
+                   "snapshot with threads is decoded in background")
+
+    local gz = fio.pathjoin('compressed_test', '00000000000000000050.xlog.gz')
+    local head, offset = read(gz, nil, 6)
+    local tail = read(gz, {offset = offset})
+    test:is_deeply(fun.chain(head, tail):totable(), read(gz),
+                   "reading is continued from offset")
+
+    local lsn, files = xdir.xdir('compressed_test')
+    test:is(lsn, 32, "snapshot lsn by name before suffix")
+    test:is_deeply(files, {
+        'compressed_test/00000000000000000032.snap.gz',
+        'compressed_test/00000000000000000025.xlog.gz',
+        'compressed_test/00000000000000000050.xlog.gz',
+        'compressed_test/00000000000000000075.xlog.gz',
+        'compressed_test/00000000000000000100.xlog.gz'
+    }, "compressed files are listed")
+    local after = xdir.catalog('compressed_test'):after(32)
+    test:is_deeply(after, xdir.xdir_xlogs_after_lsn('compressed_test', 32),
+                   "catalog reads compressed xlogs")
+    test:is(xdir.lsn_from_filename('dir/00000000000000000050.xlog.zst'), 50,
+            "lsn of zstd file")
+    test:ok(not pcall(xlog.open, 'compressed_test/00000000000000000050.gz'),
+            "name without extension before suffix")
+end)
+
+ffi.cdef[[
+void *popen(const char *command, const char *type);
+int pclose(void *stream);
+int fileno(void *stream);
+]]
+
+test:test("file descriptors", function(test)
+    local names = {'00000000000000000032.snap'}
+    for _, xlog_inst in pairs(xlog_list) do
+        table.insert(names, xlog_inst.name)
+    end
+    table.sort(names)
+    test:plan(#names * 2 + 2)
+    local function read(iter, limit)
+        local rows = {}
+        for _, batch in iter do
+            for _, t in pairs(batch) do
+                table.insert(rows, t)
+            end
+            if limit ~= nil and #rows >= limit then
+                return rows, xlog.offset(iter)
+            end
+        end
+        return rows
+    end
+    local function config(cfg)
+        cfg = cfg or {}
+        cfg.spaces = {[0] = true, [1] = true, [2] = true}
+        cfg.batch_count = 3
+        return cfg
+    end
+    -- rows of file written to pipe by 'cat'
+    local function read_pipe(path, cfg, limit)
+        local p = ffi.C.popen('cat ' .. path, 'r')
+        local ok, rows, offset = pcall(function()
+            return read(xlog.open_fd(ffi.C.fileno(p), path:sub(-4),
+                                     config(cfg)), limit)
+        end)
+        ffi.C.pclose(p)
+        if not ok then
+            error(rows)
+        end
+        return rows, offset
+    end
+    for _, name in ipairs(names) do
+        local path = fio.pathjoin('insert_test', name)
+        local expected = read(xlog.open(path, config()))
+        local f = fio.open(path, {'O_RDONLY'})
+        test:is_deeply(read(xlog.open_fd(f.fh, name:sub(-4), config())),
+                       expected, "'" .. name .. "' by fd")
+        f:close()
+        test:is_deeply(read_pipe(path), expected,
+                       "'" .. name .. "' from pipe")
+    end
+
+    local path = fio.pathjoin('insert_test', '00000000000000000050.xlog')
+    local head, offset = read_pipe(path, nil, 6)
+    local tail = read_pipe(path, {offset = offset})
+    test:is_deeply(fun.chain(head, tail):totable(), read_pipe(path),
+                   "pipe is read from offset")
+    test:ok(not pcall(xlog.open_fd, 0, 'xlog', {return_type = 'batch'}),
+            "batches aren't read from fd")
+end)
+
 os.exit(test:check() == true and 0 or -1)
@@ -92,7 +92,7 @@ uint32_t crc32_table[] = {
 };
 
 uint32_t
-crc32(const void *buf, size_t size)
+bsd_crc32(const void *buf, size_t size)
 {
 	const uint8_t *p = buf;
 	uint32_t crc;
@@ -734,8 +734,8 @@ multitable_crc32c(uint32_t crc32c,
 	return (crc32c_sb8_64_bit(crc32c, buffer, length, to_even_word));
 }
 
-uint32_t
-crc32c(uint32_t crc32c,
+static uint32_t
+crc32c_sw(uint32_t crc32c,
     const unsigned char *buffer,
     unsigned int length)
 {
@@ -745,3 +745,177 @@ crc32c(uint32_t crc32c,
 		return (multitable_crc32c(crc32c, buffer, length));
 	}
 }
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CRC32C_HW 1
+#endif
+
+#ifdef CRC32C_HW
+
+#include <string.h>
+#include <cpuid.h>
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+
+/*
+ * Hardware CRC32C using SSE4.2 crc32 instruction.
+ *
+ * Large buffers are split into three equal blocks that are processed
+ * in parallel (crc32 has latency 3 and throughput 1), and the three
+ * partial CRCs are then combined using carry-less multiplication
+ * (PCLMULQDQ) by x^(8 * block - 33) mod P.
+ */
+
+#define CRC32C_POLY 0x82f63b78
+#define CRC32C_LONG 8192
+#define CRC32C_SHORT 256
+
+static uint32_t crc32c_long_k;
+static uint32_t crc32c_short_k;
+
+/* a * b mod P, both are reflected polynomials */
+static uint32_t
+crc32c_multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = (uint32_t)1 << 31, p = 0;
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+	return p;
+}
+
+/* x^n mod P */
+static uint32_t
+crc32c_xpow(uint32_t n)
+{
+	uint32_t p = (uint32_t)1 << 31;	/* x^0 */
+	uint32_t x2k = (uint32_t)1 << 30;	/* x^1 */
+	while (n) {
+		if (n & 1)
+			p = crc32c_multmodp(x2k, p);
+		x2k = crc32c_multmodp(x2k, x2k);
+		n >>= 1;
+	}
+	return p;
+}
+
+static inline uint64_t
+crc32c_load64(const unsigned char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t __attribute__((target("sse4.2")))
+crc32c_sse42_serial(uint32_t crc, const unsigned char *p, size_t length)
+{
+	uint64_t crc0 = crc;
+	for (; length > 0 && ((uintptr_t)p & 7); length--)
+		crc0 = _mm_crc32_u8(crc0, *p++);
+	for (; length >= 8; length -= 8, p += 8)
+		crc0 = _mm_crc32_u64(crc0, crc32c_load64(p));
+	for (; length > 0; length--)
+		crc0 = _mm_crc32_u8(crc0, *p++);
+	return crc0;
+}
+
+static uint32_t
+crc32c_sse42(uint32_t crc, const unsigned char *p, unsigned int length)
+{
+	return crc32c_sse42_serial(crc, p, length);
+}
+
+/* crc * x^(8 * block) mod P, k is x^(8 * block - 33) mod P */
+static inline uint32_t __attribute__((target("sse4.2,pclmul")))
+crc32c_shift(uint32_t k, uint32_t crc)
+{
+	__m128i r = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc),
+					 _mm_cvtsi32_si128(k), 0);
+	return _mm_crc32_u64(0, _mm_cvtsi128_si64(r));
+}
+
+/* consume as many 3 * block chunks as possible */
+static inline uint32_t __attribute__((target("sse4.2,pclmul")))
+crc32c_3way(uint32_t crc, const unsigned char **buf, size_t *length,
+	    size_t block, uint32_t k)
+{
+	const unsigned char *p = *buf;
+	for (; *length >= 3 * block; *length -= 3 * block) {
+		uint64_t crc0 = crc, crc1 = 0, crc2 = 0;
+		const unsigned char *end = p + block;
+		for (; p < end; p += 8) {
+			crc0 = _mm_crc32_u64(crc0, crc32c_load64(p));
+			crc1 = _mm_crc32_u64(crc1, crc32c_load64(p + block));
+			crc2 = _mm_crc32_u64(crc2, crc32c_load64(p + 2 * block));
+		}
+		crc = crc32c_shift(k, crc0) ^ crc1;
+		crc = crc32c_shift(k, crc) ^ crc2;
+		p += 2 * block;
+	}
+	*buf = p;
+	return crc;
+}
+
+static uint32_t __attribute__((target("sse4.2,pclmul")))
+crc32c_pclmul(uint32_t crc, const unsigned char *p, unsigned int length)
+{
+	size_t len = length;
+	if (len >= 3 * CRC32C_SHORT) {
+		crc = crc32c_3way(crc, &p, &len, CRC32C_LONG, crc32c_long_k);
+		crc = crc32c_3way(crc, &p, &len, CRC32C_SHORT, crc32c_short_k);
+	}
+	return crc32c_sse42_serial(crc, p, len);
+}
+
+static uint32_t
+crc32c_resolve(uint32_t crc, const unsigned char *buffer, unsigned int length);
+
+static uint32_t (*crc32c_impl)(uint32_t, const unsigned char *,
+			       unsigned int) = crc32c_resolve;
+
+static uint32_t
+crc32c_resolve(uint32_t crc, const unsigned char *buffer, unsigned int length)
+{
+	unsigned int eax, ebx, ecx = 0, edx;
+	uint32_t (*impl)(uint32_t, const unsigned char *, unsigned int) =
+		crc32c_sw;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2)) {
+		impl = crc32c_sse42;
+		if (ecx & bit_PCLMUL) {
+			crc32c_long_k = crc32c_xpow(8 * CRC32C_LONG - 33);
+			crc32c_short_k = crc32c_xpow(8 * CRC32C_SHORT - 33);
+			impl = crc32c_pclmul;
+		}
+	}
+	/* racing threads resolve to the same value */
+	__atomic_store_n(&crc32c_impl, impl, __ATOMIC_RELEASE);
+	return impl(crc, buffer, length);
+}
+
+uint32_t
+crc32c(uint32_t crc32c,
+    const unsigned char *buffer,
+    unsigned int length)
+{
+	return __atomic_load_n(&crc32c_impl, __ATOMIC_ACQUIRE)(crc32c, buffer,
+							       length);
+}
+
+#else /* CRC32C_HW */
+
+uint32_t
+crc32c(uint32_t crc32c,
+    const unsigned char *buffer,
+    unsigned int length)
+{
+	return crc32c_sw(crc32c, buffer, length);
+}
+
+#endif /* CRC32C_HW */
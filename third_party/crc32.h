@@ -3,7 +3,8 @@
 
 #include <stdint.h>
 
-uint32_t crc32(const void *buf, size_t size);
+/* named so that it doesn't interpose crc32() of zlib */
+uint32_t bsd_crc32(const void *buf, size_t size);
 uint32_t crc32c(uint32_t crc32c, const unsigned char *buffer, unsigned int length);
 
 #endif
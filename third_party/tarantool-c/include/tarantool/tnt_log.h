@@ -73,6 +73,52 @@ enum tnt_log_type {
 	TNT_LOG_SNAPSHOT
 };
 
+enum tnt_log_io {
+	TNT_LOG_IO_STDIO,
+	TNT_LOG_IO_MMAP
+};
+
+enum tnt_log_verify {
+	TNT_LOG_VERIFY_FULL,	/* header and data crc */
+	TNT_LOG_VERIFY_HEADER,	/* header crc only */
+	TNT_LOG_VERIFY_NONE
+};
+
+enum tnt_log_filter_result {
+	TNT_LOG_FILTER_PASS,	/* row is processed */
+	TNT_LOG_FILTER_SKIP,	/* row is skipped */
+	TNT_LOG_FILTER_STOP	/* row and the rest of file are skipped */
+};
+
+/* space of row is unknown (not a space request or row is too short) */
+#define TNT_LOG_SPACE_NONE UINT32_MAX
+
+/*
+ * Row filter, called with header and space number of every row before
+ * its data is checked and processed.
+ */
+typedef enum tnt_log_filter_result
+(*tnt_log_filter_t)(void *arg, const struct tnt_log_header_v11 *hdr,
+		    uint32_t space);
+
+/*
+ * Region of file skipped in salvage mode (see tnt_log_set_salvage):
+ * bytes [from, to) with rows that failed checksums or garbage between
+ * rows. Adjacent regions are merged.
+ */
+struct tnt_log_damage {
+	off_t from;
+	off_t to;
+	/* lsn of the last good row before the region, 0 if none */
+	uint64_t lsn_before;
+	/* lsn of the first good row after the region, 0 if none */
+	uint64_t lsn_after;
+};
+
+/* Called with every skipped region once the next good row is found */
+typedef void
+(*tnt_log_salvage_t)(void *arg, const struct tnt_log_damage *damage);
+
 union tnt_log_value {
 	struct tnt_request r;
 	struct tnt_tuple t;
@@ -87,13 +133,35 @@ struct tnt_log_row {
 
 struct tnt_log {
 	enum tnt_log_type type;
+	enum tnt_log_io io;
+	enum tnt_log_verify verify;
 	FILE *fd;
+	/* file mapping, used only with TNT_LOG_IO_MMAP */
+	char *map;
+	size_t map_size;
+	off_t map_dropped;
 	off_t begin_offset;
 	off_t current_offset;
 	off_t offset;
 	int (*read)(struct tnt_log *l, char **buf, uint32_t *size);
 	int (*process)(struct tnt_log *l, char *buf, uint32_t size,
 		       union tnt_log_value *value);
+	tnt_log_filter_t filter;
+	void *filter_arg;
+	/* check data crc of skipped rows (with TNT_LOG_VERIFY_FULL) */
+	int filter_verify;
+	/* skip damaged regions instead of failing, NULL - not salvaged */
+	tnt_log_salvage_t salvage;
+	void *salvage_arg;
+	/* region being skipped, reported when a good row follows */
+	struct tnt_log_damage damage;
+	int damaged;
+	/* lsn of the last good row */
+	uint64_t last_lsn;
+	/* file is being written, see tnt_log_set_follow() */
+	int follow;
+	/* end of file marker is read */
+	int complete;
 	struct tnt_log_row current;
 	union tnt_log_value current_value;
 	enum tnt_log_error error;
@@ -103,11 +171,62 @@ struct tnt_log {
 extern const uint32_t tnt_log_marker_v11;
 extern const uint32_t tnt_log_marker_eof_v11;
 
+/*
+ * Length of file name without suffix of compression (.gz, .zst, .lz4),
+ * such files are guessed by the name before it.
+ */
+size_t tnt_log_name_len(const char *file);
 enum tnt_log_type tnt_log_guess(const char *file);
 
+/*
+ * Opens files for tnt_log_open() instead of fopen(), e.g. to decompress
+ * them on the fly. Returns NULL and sets errno on error. Streams that
+ * aren't files (fileno() is -1) are always read with TNT_LOG_IO_STDIO,
+ * they must support seeking forward and back within the last buffer.
+ */
+typedef FILE *(*tnt_log_fopen_t)(const char *file);
+void tnt_log_set_fopen(tnt_log_fopen_t hook);
+
 enum tnt_log_error
 tnt_log_open(struct tnt_log *l, const char *file, enum tnt_log_type type);
+enum tnt_log_error
+tnt_log_open_io(struct tnt_log *l, const char *file, enum tnt_log_type type,
+		enum tnt_log_io io);
+/*
+ * Open log on stream 'fp' (e.g. a pipe wrapped to track offsets), it's
+ * read with TNT_LOG_IO_STDIO and closed with the log.
+ */
+enum tnt_log_error
+tnt_log_open_fp(struct tnt_log *l, FILE *fp, enum tnt_log_type type);
 int tnt_log_seek(struct tnt_log *l, off_t offset);
+/* offset right after the last row read */
+off_t tnt_log_tell(struct tnt_log *l);
+/*
+ * Seek to offset returned by tnt_log_tell() on the same file, checks
+ * that it's within rows and points to a row or to end of file.
+ */
+int tnt_log_seek_row(struct tnt_log *l, off_t offset);
+off_t tnt_log_sync(struct tnt_log *l, off_t offset);
+/* First row marker in [p, end), NULL if there is none */
+const char *tnt_log_find_marker(const char *p, const char *end);
+void tnt_log_set_verify(struct tnt_log *l, enum tnt_log_verify verify);
+void tnt_log_set_filter(struct tnt_log *l, tnt_log_filter_t filter, void *arg,
+			int verify);
+/*
+ * Salvage mode: rows with bad header or data crc (depending on verify
+ * level) and garbage between rows are skipped, reading is resumed from
+ * the next marker followed by a header with valid crc. Every skipped
+ * region is passed to 'salvage'.
+ */
+void tnt_log_set_salvage(struct tnt_log *l, tnt_log_salvage_t salvage,
+			 void *arg);
+/*
+ * Follow mode (TNT_LOG_IO_STDIO only): file that ends without end of
+ * file marker is still being written, so reading stops before the row
+ * that isn't written completely, and the next read continues from it.
+ * l->complete is set once end of file marker is read.
+ */
+void tnt_log_set_follow(struct tnt_log *l, int follow);
 void tnt_log_close(struct tnt_log *l);
 
 struct tnt_log_row *tnt_log_next(struct tnt_log *l);
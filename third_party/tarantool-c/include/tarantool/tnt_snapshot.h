@@ -41,6 +41,10 @@ struct tnt_stream_snapshot {
 struct tnt_stream *tnt_snapshot(struct tnt_stream *s);
 
 int tnt_snapshot_open(struct tnt_stream *s, const char *file);
+int tnt_snapshot_open_io(struct tnt_stream *s, const char *file,
+		   enum tnt_log_io io);
+int tnt_snapshot_open_fp(struct tnt_stream *s, FILE *fp);
+void tnt_snapshot_set_verify(struct tnt_stream *s, enum tnt_log_verify verify);
 void tnt_snapshot_close(struct tnt_stream *s);
 
 enum tnt_log_error tnt_snapshot_error(struct tnt_stream *s);
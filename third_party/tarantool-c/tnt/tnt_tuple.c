@@ -103,7 +103,7 @@ tnt_tuple_add(struct tnt_tuple *t, const void *data, uint32_t size)
 	int esize = tnt_enc_size(size);
 	size_t nsize = t->size + esize + size;
 	/* reallocating tuple data */
-	char *ndata = realloc(t->data, nsize);
+	char *ndata = tnt_mem_realloc(t->data, nsize);
 	if (ndata == NULL) {
 		if (allocated)
 			tnt_mem_free(t);
@@ -392,9 +392,10 @@ struct tnt_tuple *tnt_list_at(struct tnt_list *l, struct tnt_tuple *t) {
 			return NULL;
 	}
 	/* reallocating tuple data */
-	char *ndata = realloc(l->list, sizeof(struct tnt_list_ptr) * (l->count + 1));
+	char *ndata = tnt_mem_realloc(l->list,
+				      sizeof(struct tnt_list_ptr) * (l->count + 1));
 	if (ndata == NULL) {
-		free(l->list);
+		tnt_mem_free(l->list);
 		if (allocated)
 			tnt_tuple_free(t);
 		return NULL;
@@ -41,6 +41,7 @@
 
 #include <tarantool/tnt.h>
 #include <tarantool/tnt_dir.h>
+#include <tarantool/tnt_log.h>
 
 void tnt_dir_init(struct tnt_dir *d, enum tnt_dir_type type) {
 	d->type = type;
@@ -87,8 +88,9 @@ static int tnt_dir_put(struct tnt_dir *d,
 static int tnt_dir_cmp(const void *_a, const void *_b) {
 	const struct tnt_dir_file *a = _a;
 	const struct tnt_dir_file *b = _b;
+	/* plain file goes before its compressed copy */
 	if (a->lsn == b->lsn)
-		return 0;
+		return strcmp(a->name, b->name);
 	return (a->lsn > b->lsn) ? 1: -1;
 }
 
@@ -114,13 +116,16 @@ int tnt_dir_scan(struct tnt_dir *d, char *path) {
 		if (ext == NULL)
 			continue;
 
+		/* compressed files are listed too (see tnt_log_name_len) */
+		if (tnt_log_name_len(de.d_name) != (size_t)(ext - de.d_name) + 5)
+			continue;
 		switch (d->type) {
 		case TNT_DIR_XLOG:
-			if (strcmp(ext, ".xlog") != 0)
+			if (strncmp(ext, ".xlog", 5) != 0)
 				continue;
 			break;
 		case TNT_DIR_SNAPSHOT:
-			if (strcmp(ext, ".snap") != 0)
+			if (strncmp(ext, ".snap", 5) != 0)
 				continue;
 			break;
 		}
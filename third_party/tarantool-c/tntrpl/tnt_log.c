@@ -36,25 +36,49 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <third_party/crc32.h>
 
 #include <tarantool/tnt.h>
 #include <tarantool/tnt_log.h>
 
+/* suffixes of compressed files, read with tnt_log_set_fopen() hook */
+static const char *tnt_log_compressed_ext[] = { ".gz", ".zst", ".lz4", NULL };
+
+size_t tnt_log_name_len(const char *file) {
+	size_t len = strlen(file);
+	const char *ext = strrchr(file, '.');
+	if (ext == NULL)
+		return len;
+	for (const char **c = tnt_log_compressed_ext; *c != NULL; ++c) {
+		if (strcasecmp(ext, *c) == 0)
+			return ext - file;
+	}
+	return len;
+}
+
 enum tnt_log_type tnt_log_guess(const char *file) {
 	if (file == NULL)
 		return TNT_LOG_XLOG;
-	char *ext = strrchr(file, '.');
-	if (ext == NULL)
+	size_t len = tnt_log_name_len(file);
+	if (len < 5)
 		return TNT_LOG_NONE;
-	if (strcasecmp(ext, ".snap") == 0)
+	const char *ext = file + len - 5;
+	if (strncasecmp(ext, ".snap", 5) == 0)
 		return TNT_LOG_SNAPSHOT;
-	if (strcasecmp(ext, ".xlog") == 0)
+	if (strncasecmp(ext, ".xlog", 5) == 0)
 		return TNT_LOG_XLOG;
 	return TNT_LOG_NONE;
 }
 
+static tnt_log_fopen_t tnt_log_fopen_hook = NULL;
+
+void tnt_log_set_fopen(tnt_log_fopen_t hook) {
+	tnt_log_fopen_hook = hook;
+}
+
 inline static int
 tnt_log_seterr(struct tnt_log *l, enum tnt_log_error e) {
 	l->error = e;
@@ -66,11 +90,289 @@ tnt_log_seterr(struct tnt_log *l, enum tnt_log_error e) {
 const uint32_t tnt_log_marker_v11 = 0xba0babed;
 const uint32_t tnt_log_marker_eof_v11 = 0x10adab1e;
 
+static const char *
+tnt_log_find_marker_sw(const char *p, const char *end)
+{
+	const unsigned char first = tnt_log_marker_v11 & 0xff;
+	while ((size_t)(end - p) >= sizeof(tnt_log_marker_v11)) {
+		p = memchr(p, first, end - p - sizeof(tnt_log_marker_v11) + 1);
+		if (p == NULL)
+			return NULL;
+		uint32_t marker;
+		memcpy(&marker, p, sizeof(marker));
+		if (marker == tnt_log_marker_v11)
+			return p;
+		p++;
+	}
+	return NULL;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define TNT_LOG_FIND_SIMD 1
+#endif
+
+#ifdef TNT_LOG_FIND_SIMD
+
+#include <immintrin.h>
+
+/*
+ * Vectorized marker search: every byte of the marker is compared with
+ * a block loaded at the corresponding shift, so that bit i of the
+ * combined mask is set only if the whole marker starts at p + i.
+ */
+
+#define TNT_LOG_MARKER_BYTE(i) ((char)(tnt_log_marker_v11 >> (8 * (i))))
+
+static const char * __attribute__((target("sse2")))
+tnt_log_find_marker_sse2(const char *p, const char *end)
+{
+	const __m128i b0 = _mm_set1_epi8(TNT_LOG_MARKER_BYTE(0));
+	const __m128i b1 = _mm_set1_epi8(TNT_LOG_MARKER_BYTE(1));
+	const __m128i b2 = _mm_set1_epi8(TNT_LOG_MARKER_BYTE(2));
+	const __m128i b3 = _mm_set1_epi8(TNT_LOG_MARKER_BYTE(3));
+	const size_t block = sizeof(__m128i);
+	while ((size_t)(end - p) >= block + sizeof(tnt_log_marker_v11) - 1) {
+		__m128i m0 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)p), b0);
+		__m128i m1 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(p + 1)), b1);
+		__m128i m2 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(p + 2)), b2);
+		__m128i m3 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(p + 3)), b3);
+		int mask = _mm_movemask_epi8(_mm_and_si128(
+			_mm_and_si128(m0, m1), _mm_and_si128(m2, m3)));
+		if (mask != 0)
+			return p + __builtin_ctz(mask);
+		p += block;
+	}
+	return tnt_log_find_marker_sw(p, end);
+}
+
+static const char * __attribute__((target("avx2")))
+tnt_log_find_marker_avx2(const char *p, const char *end)
+{
+	const __m256i b0 = _mm256_set1_epi8(TNT_LOG_MARKER_BYTE(0));
+	const __m256i b1 = _mm256_set1_epi8(TNT_LOG_MARKER_BYTE(1));
+	const __m256i b2 = _mm256_set1_epi8(TNT_LOG_MARKER_BYTE(2));
+	const __m256i b3 = _mm256_set1_epi8(TNT_LOG_MARKER_BYTE(3));
+	const size_t block = sizeof(__m256i);
+	while ((size_t)(end - p) >= block + sizeof(tnt_log_marker_v11) - 1) {
+		__m256i m0 = _mm256_cmpeq_epi8(
+			_mm256_loadu_si256((const __m256i *)p), b0);
+		__m256i m1 = _mm256_cmpeq_epi8(
+			_mm256_loadu_si256((const __m256i *)(p + 1)), b1);
+		__m256i m2 = _mm256_cmpeq_epi8(
+			_mm256_loadu_si256((const __m256i *)(p + 2)), b2);
+		__m256i m3 = _mm256_cmpeq_epi8(
+			_mm256_loadu_si256((const __m256i *)(p + 3)), b3);
+		unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(
+			_mm256_and_si256(m0, m1), _mm256_and_si256(m2, m3)));
+		if (mask != 0)
+			return p + __builtin_ctz(mask);
+		p += block;
+	}
+	return tnt_log_find_marker_sse2(p, end);
+}
+
+static const char *
+tnt_log_find_marker_resolve(const char *p, const char *end);
+
+static const char *(*tnt_log_find_marker_impl)(const char *, const char *) =
+	tnt_log_find_marker_resolve;
+
+static const char *
+tnt_log_find_marker_resolve(const char *p, const char *end)
+{
+	const char *(*impl)(const char *, const char *) =
+		tnt_log_find_marker_sse2;
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		impl = tnt_log_find_marker_avx2;
+	/* racing threads resolve to the same value */
+	__atomic_store_n(&tnt_log_find_marker_impl, impl, __ATOMIC_RELEASE);
+	return impl(p, end);
+}
+
+const char *
+tnt_log_find_marker(const char *p, const char *end)
+{
+	return __atomic_load_n(&tnt_log_find_marker_impl,
+			       __ATOMIC_ACQUIRE)(p, end);
+}
+
+#else /* TNT_LOG_FIND_SIMD */
+
+const char *
+tnt_log_find_marker(const char *p, const char *end)
+{
+	return tnt_log_find_marker_sw(p, end);
+}
+
+#endif /* TNT_LOG_FIND_SIMD */
+
+/* header of row at 'offset' has valid crc and row ends within 'size' */
+static int
+tnt_log_hdr_valid(const struct tnt_log_header_v11 *hdr, off_t offset,
+		  uint64_t size)
+{
+	uint32_t crc32_hdr =
+		crc32c(0, (const unsigned char *)hdr + sizeof(uint32_t),
+		       sizeof(*hdr) - sizeof(uint32_t));
+	return crc32_hdr == hdr->crc32_hdr &&
+	       offset + sizeof(tnt_log_marker_v11) + sizeof(*hdr) +
+	       hdr->len <= size;
+}
+
+/* file size, used by resync of stdio files */
+static int
+tnt_log_size(struct tnt_log *l, uint64_t *size)
+{
+	if (l->io == TNT_LOG_IO_MMAP) {
+		*size = l->map_size;
+		return 0;
+	}
+	/* size of stream that isn't a file (see tnt_log_set_fopen) isn't
+	 * known, rows are checked by header crc only */
+	if (fileno(l->fd) == -1) {
+		*size = UINT64_MAX;
+		return 0;
+	}
+	struct stat st;
+	if (fstat(fileno(l->fd), &st) == -1)
+		return -1;
+	*size = st.st_size;
+	return 0;
+}
+
+/*
+ * Offset of the first row marker at 'from' or after it, -1 if there is
+ * none. With 'check' the marker must be followed by a header with valid
+ * crc (regardless of verification level, as marker may occur inside of
+ * row data) of a row that ends within the file. Stdio files are read in
+ * chunks, file position is undefined after the call.
+ */
+static off_t
+tnt_log_resync(struct tnt_log *l, off_t from, int check)
+{
+	struct tnt_log_header_v11 hdr;
+	uint64_t size = 0;
+	if (check && tnt_log_size(l, &size) == -1)
+		return -1;
+	if (l->io == TNT_LOG_IO_MMAP) {
+		const char *end = l->map + l->map_size;
+		const char *p = l->map + from;
+		while (p < end && (p = tnt_log_find_marker(p, end)) != NULL) {
+			if (!check)
+				return p - l->map;
+			if ((size_t)(end - p) >= sizeof(tnt_log_marker_v11) +
+						 sizeof(hdr)) {
+				memcpy(&hdr, p + sizeof(tnt_log_marker_v11),
+				       sizeof(hdr));
+				if (tnt_log_hdr_valid(&hdr, p - l->map, size))
+					return p - l->map;
+			}
+			p++;
+		}
+		return -1;
+	}
+	char chunk[16384];
+	off_t pos = from;
+	for (;;) {
+		if (fseeko(l->fd, pos, SEEK_SET) == -1)
+			return -1;
+		size_t n = fread(chunk, 1, sizeof(chunk), l->fd);
+		const char *end = chunk + n;
+		const char *p = chunk;
+		while ((p = tnt_log_find_marker(p, end)) != NULL) {
+			off_t offset = pos + (p - chunk);
+			if (!check)
+				return offset;
+			/* header may continue in the next chunk */
+			if (fseeko(l->fd, offset + sizeof(tnt_log_marker_v11),
+				   SEEK_SET) == 0 &&
+			    fread(&hdr, sizeof(hdr), 1, l->fd) == 1 &&
+			    tnt_log_hdr_valid(&hdr, offset, size))
+				return offset;
+			p++;
+		}
+		if (n < sizeof(chunk))
+			return -1;
+		/* marker may cross the end of chunk */
+		pos += n - (sizeof(tnt_log_marker_v11) - 1);
+	}
+}
+
+/*
+ * Position stdio file at the next row marker after the current row
+ * (see tnt_log_resync), returns 1 if there is none: the file is
+ * positioned at its end then.
+ */
+static int
+tnt_log_skip_to_row(struct tnt_log *l, int check)
+{
+	off_t found = tnt_log_resync(l, l->current_offset + 1, check);
+	if (found == -1) {
+		if (fseeko(l->fd, 0, SEEK_END) == -1)
+			return tnt_log_seterr(l, TNT_LOG_ESYSTEM);
+		l->current_offset = ftello(l->fd);
+		return 1;
+	}
+	if (fseeko(l->fd, found, SEEK_SET) == -1)
+		return tnt_log_seterr(l, TNT_LOG_ESYSTEM);
+	return 0;
+}
+
+/* region starting at 'from' is skipped, it's merged with pending one */
+static void
+tnt_log_damaged(struct tnt_log *l, off_t from)
+{
+	if (l->damaged)
+		return;
+	l->damaged = 1;
+	l->damage.from = from;
+	l->damage.to = from;
+	l->damage.lsn_before = l->last_lsn;
+	l->damage.lsn_after = 0;
+}
+
+/* report pending region, that ends at 'to' */
+static void
+tnt_log_damage_flush(struct tnt_log *l, off_t to, uint64_t lsn_after)
+{
+	if (!l->damaged)
+		return;
+	l->damaged = 0;
+	l->damage.to = to;
+	l->damage.lsn_after = lsn_after;
+	l->salvage(l->salvage_arg, &l->damage);
+}
+
+/* current row is good, it ends region that was skipped before it */
+static inline void
+tnt_log_accept(struct tnt_log *l)
+{
+	tnt_log_damage_flush(l, l->current_offset, l->current.hdr.lsn);
+	l->last_lsn = l->current.hdr.lsn;
+}
+
 inline static int
 tnt_log_eof(struct tnt_log *l, char *data) {
 	uint32_t marker = 0;
 	if (data)
 		tnt_mem_free(data);
+	/* failed read (e.g. of corrupted compressed file) isn't eof */
+	if (ferror(l->fd))
+		return tnt_log_seterr(l, TNT_LOG_ESYSTEM);
+	if (l->follow && !l->complete) {
+		/* the rest of file isn't written yet, the last row is read
+		 * again by the next call */
+		clearerr(l->fd);
+		if (fseeko(l->fd, l->current_offset, SEEK_SET) != 0)
+			return tnt_log_seterr(l, TNT_LOG_ESYSTEM);
+		return 1;
+	}
+	tnt_log_damage_flush(l, l->current_offset, 0);
 	/* checking eof condition */
 	if (ftello(l->fd) == l->offset + sizeof(tnt_log_marker_eof_v11)) {
 		fseeko(l->fd, l->offset, SEEK_SET);
@@ -85,8 +387,97 @@ tnt_log_eof(struct tnt_log *l, char *data) {
 	return 1;
 }
 
+static inline int
+tnt_log_verify_hdr(struct tnt_log *l)
+{
+	/* salvage relies on header crc to find rows */
+	if (l->verify == TNT_LOG_VERIFY_NONE && l->salvage == NULL)
+		return 1;
+	uint32_t crc32_hdr =
+		crc32c(0, (unsigned char*)&l->current.hdr + sizeof(uint32_t),
+		       sizeof(struct tnt_log_header_v11) -
+		       sizeof(uint32_t));
+	return crc32_hdr == l->current.hdr.crc32_hdr;
+}
+
+static inline int
+tnt_log_verify_data(struct tnt_log *l, const char *data)
+{
+	if (l->verify != TNT_LOG_VERIFY_FULL)
+		return 1;
+	uint32_t crc32_data =
+		crc32c(0, (const unsigned char*)data, l->current.hdr.len);
+	return crc32_data == l->current.hdr.crc32_data;
+}
+
+/* space number of row, 'data' is the beginning of row data */
+static uint32_t
+tnt_log_row_space(struct tnt_log *l, const char *data, uint32_t size)
+{
+	uint32_t space = TNT_LOG_SPACE_NONE;
+	if (l->type == TNT_LOG_SNAPSHOT) {
+		struct tnt_log_row_snap_v11 row;
+		if (size >= sizeof(row)) {
+			memcpy(&row, data, sizeof(row));
+			space = row.space;
+		}
+		return space;
+	}
+	struct tnt_log_row_v11 row;
+	if (size < sizeof(row) + sizeof(space))
+		return space;
+	memcpy(&row, data, sizeof(row));
+	/* all space requests start with space number */
+	switch (row.op) {
+	case TNT_OP_INSERT:
+	case TNT_OP_UPDATE:
+	case TNT_OP_DELETE_1_3:
+	case TNT_OP_DELETE:
+		memcpy(&space, data + sizeof(row), sizeof(space));
+		break;
+	}
+	return space;
+}
+
+/* enough of row data to find its space */
+#define TNT_LOG_ROW_PREFIX sizeof(struct tnt_log_row_snap_v11)
+
+/*
+ * Skip data of filtered out row, first 'done' bytes of which were
+ * already read into 'prefix'. Data crc is checked only if it's required
+ * for skipped rows, data is read in chunks then.
+ * Returns 1 if file ends before the end of row.
+ */
+static int
+tnt_log_skip(struct tnt_log *l, const char *prefix, uint32_t done)
+{
+	uint32_t len = l->current.hdr.len;
+	if (!l->filter_verify || l->verify != TNT_LOG_VERIFY_FULL) {
+		if (fseeko(l->fd, len - done, SEEK_CUR) == -1)
+			return tnt_log_seterr(l, TNT_LOG_ESYSTEM);
+		return 0;
+	}
+	uint32_t crc32_data = crc32c(0, (const unsigned char *)prefix, done);
+	char chunk[4096];
+	while (done < len) {
+		uint32_t n = len - done;
+		if (n > sizeof(chunk))
+			n = sizeof(chunk);
+		if (fread(chunk, n, 1, l->fd) != 1)
+			return 1;
+		crc32_data = crc32c(crc32_data, (const unsigned char *)chunk, n);
+		done += n;
+	}
+	if (crc32_data != l->current.hdr.crc32_data)
+		return tnt_log_seterr(l, TNT_LOG_ECORRUPT);
+	return 0;
+}
+
 static int tnt_log_read(struct tnt_log *l, char **buf, uint32_t *size)
 {
+	char prefix[TNT_LOG_ROW_PREFIX];
+	uint32_t prefix_size = 0;
+next:
 	/* current record offset (before marker) */
 	l->current_offset = ftello(l->fd);
 
@@ -97,12 +488,17 @@ static int tnt_log_read(struct tnt_log *l, char **buf, uint32_t *size)
 		return tnt_log_eof(l, data);
 
 	/* seeking for marker if necessary */
-	while (marker != tnt_log_marker_v11) {
-		int c = fgetc(l->fd);
-		if (c == EOF)
+	if (marker != tnt_log_marker_v11) {
+		if (marker == tnt_log_marker_eof_v11 && fgetc(l->fd) == EOF) {
+			l->complete = 1;
 			return tnt_log_eof(l, data);
-		marker = marker >> 8 | ((uint32_t) c & 0xff) <<
-			 (sizeof(marker) * 8 - 8);
+		}
+		if (l->salvage != NULL)
+			tnt_log_damaged(l, l->current_offset);
+		int rc = tnt_log_skip_to_row(l, l->salvage != NULL);
+		if (rc != 0)
+			return rc == 1 ? tnt_log_eof(l, data) : rc;
+		goto next;
 	}
 
 	/* reading header */
@@ -113,32 +509,226 @@ static int tnt_log_read(struct tnt_log *l, char **buf, uint32_t *size)
 	l->offset = ftello(l->fd);
 
 	/* checking header crc, starting from lsn */
-	uint32_t crc32_hdr =
-		crc32c(0, (unsigned char*)&l->current.hdr + sizeof(uint32_t),
-		       sizeof(struct tnt_log_header_v11) -
-		       sizeof(uint32_t));
-	if (crc32_hdr != l->current.hdr.crc32_hdr)
-		return tnt_log_seterr(l, TNT_LOG_ECORRUPT);
+	if (!tnt_log_verify_hdr(l)) {
+		if (l->salvage == NULL)
+			return tnt_log_seterr(l, TNT_LOG_ECORRUPT);
+		/* length can't be trusted, row is skipped up to the next
+		 * marker */
+		tnt_log_damaged(l, l->current_offset);
+		int rc = tnt_log_skip_to_row(l, 1);
+		if (rc != 0)
+			return rc == 1 ? tnt_log_eof(l, data) : rc;
+		goto next;
+	}
+
+	/* filtering row by the beginning of its data */
+	if (l->filter != NULL) {
+		prefix_size = l->current.hdr.len;
+		if (prefix_size > sizeof(prefix))
+			prefix_size = sizeof(prefix);
+		if (prefix_size > 0 &&
+		    fread(prefix, prefix_size, 1, l->fd) != 1)
+			return tnt_log_eof(l, data);
+		switch (l->filter(l->filter_arg, &l->current.hdr,
+				  tnt_log_row_space(l, prefix, prefix_size))) {
+		case TNT_LOG_FILTER_PASS:
+			break;
+		case TNT_LOG_FILTER_SKIP: {
+			int rc = tnt_log_skip(l, prefix, prefix_size);
+			if (rc == 1)
+				return tnt_log_eof(l, data);
+			if (rc != 0 && (l->salvage == NULL ||
+					l->error != TNT_LOG_ECORRUPT))
+				return rc;
+			if (rc != 0) {
+				l->error = TNT_LOG_EOK;
+				tnt_log_damaged(l, l->current_offset);
+			} else {
+				tnt_log_accept(l);
+			}
+			goto next;
+		}
+		case TNT_LOG_FILTER_STOP:
+			tnt_log_accept(l);
+			return 1;
+		}
+	}
 
 	/* allocating memory and reading data */
 	data = tnt_mem_alloc(l->current.hdr.len);
 	if (data == NULL)
 		return tnt_log_seterr(l, TNT_LOG_EMEMORY);
-	if (fread(data, l->current.hdr.len, 1, l->fd) != 1)
+	memcpy(data, prefix, prefix_size);
+	if (l->current.hdr.len > prefix_size &&
+	    fread(data + prefix_size, l->current.hdr.len - prefix_size, 1,
+		  l->fd) != 1)
 		return tnt_log_eof(l, data);
 
 	/* checking data crc */
-	uint32_t crc32_data = crc32c(0, (unsigned char*)data, l->current.hdr.len);
-	if (crc32_data != l->current.hdr.crc32_data) {
+	if (!tnt_log_verify_data(l, data)) {
 		tnt_mem_free(data);
-		return tnt_log_seterr(l, TNT_LOG_ECORRUPT);
+		if (l->salvage == NULL)
+			return tnt_log_seterr(l, TNT_LOG_ECORRUPT);
+		/* header is good, so the next row follows this one */
+		tnt_log_damaged(l, l->current_offset);
+		goto next;
 	}
+	tnt_log_accept(l);
 
 	*buf = data;
 	*size = l->current.hdr.len;
 	return 0;
 }
 
+/* mapped pages are dropped behind the reader in steps of this size */
+#define TNT_LOG_MMAP_DROP_STEP (8 * 1024 * 1024)
+
+static void
+tnt_log_mmap_drop(struct tnt_log *l)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	off_t upto = l->current_offset & ~((off_t)page - 1);
+	if (upto - l->map_dropped < TNT_LOG_MMAP_DROP_STEP)
+		return;
+	/* pages behind the current row will never be read again */
+	madvise(l->map + l->map_dropped, upto - l->map_dropped,
+		MADV_DONTNEED);
+	posix_fadvise(fileno(l->fd), l->map_dropped,
+		      upto - l->map_dropped, POSIX_FADV_DONTNEED);
+	l->map_dropped = upto;
+}
+
+/* end of mapped file, region that was skipped before it is reported */
+static inline int
+tnt_log_mmap_end(struct tnt_log *l)
+{
+	tnt_log_damage_flush(l, l->current_offset, 0);
+	return 1;
+}
+
+/*
+ * Move to the next row marker after the current row (see
+ * tnt_log_resync), returns 1 if there is none.
+ */
+static int
+tnt_log_mmap_skip_to_row(struct tnt_log *l, int check)
+{
+	off_t found = tnt_log_resync(l, l->current_offset + 1, check);
+	if (found == -1) {
+		/* the rest of file is skipped in salvage mode */
+		if (l->salvage != NULL)
+			l->offset = l->current_offset = l->map_size;
+		return 1;
+	}
+	l->offset = found;
+	return 0;
+}
+
+static int tnt_log_read_mmap(struct tnt_log *l, char **buf, uint32_t *size)
+{
+	const char *end = l->map + l->map_size;
+	const char *p;
+next:
+	p = l->map + l->offset;
+
+	/* current record offset (before marker) */
+	l->current_offset = l->offset;
+	tnt_log_mmap_drop(l);
+
+	uint32_t marker = 0;
+	if ((size_t)(end - p) < sizeof(marker))
+		return tnt_log_mmap_end(l);
+	/* checking eof condition */
+	if (end - p == sizeof(marker)) {
+		memcpy(&marker, p, sizeof(marker));
+		if (marker != tnt_log_marker_eof_v11) {
+			if (l->salvage == NULL)
+				return tnt_log_seterr(l, TNT_LOG_ECORRUPT);
+			tnt_log_damaged(l, l->current_offset);
+			l->current_offset = l->map_size;
+		} else {
+			l->complete = 1;
+		}
+		l->offset += sizeof(marker);
+		return tnt_log_mmap_end(l);
+	}
+
+	/* seeking for marker if necessary */
+	memcpy(&marker, p, sizeof(marker));
+	p += sizeof(marker);
+	if (marker != tnt_log_marker_v11) {
+		if (l->salvage != NULL)
+			tnt_log_damaged(l, l->current_offset);
+		if (tnt_log_mmap_skip_to_row(l, l->salvage != NULL) != 0)
+			return tnt_log_mmap_end(l);
+		goto next;
+	}
+
+	/* reading header */
+	if ((size_t)(end - p) < sizeof(l->current.hdr))
+		return tnt_log_mmap_end(l);
+	memcpy(&l->current.hdr, p, sizeof(l->current.hdr));
+	p += sizeof(l->current.hdr);
+
+	/* updating offset */
+	l->offset = p - l->map;
+
+	/* checking header crc, starting from lsn */
+	if (!tnt_log_verify_hdr(l)) {
+		if (l->salvage == NULL)
+			return tnt_log_seterr(l, TNT_LOG_ECORRUPT);
+		/* length can't be trusted, row is skipped up to the next
+		 * marker */
+		tnt_log_damaged(l, l->current_offset);
+		if (tnt_log_mmap_skip_to_row(l, 1) != 0)
+			return tnt_log_mmap_end(l);
+		goto next;
+	}
+
+	/* data is used right from the mapping */
+	if ((size_t)(end - p) < l->current.hdr.len)
+		return tnt_log_mmap_end(l);
+
+	if (l->filter != NULL) {
+		switch (l->filter(l->filter_arg, &l->current.hdr,
+				  tnt_log_row_space(l, p,
+						    l->current.hdr.len))) {
+		case TNT_LOG_FILTER_PASS:
+			break;
+		case TNT_LOG_FILTER_SKIP:
+			if (l->filter_verify && !tnt_log_verify_data(l, p)) {
+				if (l->salvage == NULL)
+					return tnt_log_seterr(l,
+							TNT_LOG_ECORRUPT);
+				tnt_log_damaged(l, l->current_offset);
+			} else {
+				tnt_log_accept(l);
+			}
+			l->offset += l->current.hdr.len;
+			goto next;
+		case TNT_LOG_FILTER_STOP:
+			tnt_log_accept(l);
+			return 1;
+		}
+	}
+
+	/* checking data crc */
+	if (!tnt_log_verify_data(l, p)) {
+		if (l->salvage == NULL)
+			return tnt_log_seterr(l, TNT_LOG_ECORRUPT);
+		/* header is good, so the next row follows this one */
+		tnt_log_damaged(l, l->current_offset);
+		l->offset += l->current.hdr.len;
+		goto next;
+	}
+	tnt_log_accept(l);
+	l->offset += l->current.hdr.len;
+
+	*buf = (char *)p;
+	*size = l->current.hdr.len;
+	return 0;
+}
+
 static int
 tnt_log_process_xlog(struct tnt_log *l, char *buf, uint32_t size,
 		     union tnt_log_value *value)
@@ -199,6 +789,9 @@ tnt_log_next_to(struct tnt_log *l, union tnt_log_value *value) {
 	if (rc != 0)
 		return NULL;
 	rc = l->process(l, buf, size, value);
+	/* mapped rows are owned by the mapping */
+	if (l->io == TNT_LOG_IO_MMAP)
+		return (rc == 0) ? &l->current : NULL;
 	if (rc != 0) {
 		tnt_mem_free(buf);
 		return NULL;
@@ -222,21 +815,60 @@ tnt_log_open_err(struct tnt_log *l, enum tnt_log_error e) {
 	return -1;
 }
 
+static int
+tnt_log_map(struct tnt_log *l)
+{
+	struct stat st;
+	if (fstat(fileno(l->fd), &st) == -1)
+		return -1;
+	l->map_size = st.st_size;
+	l->map_dropped = 0;
+	if (l->map_size == 0)
+		return 0;
+	l->map = mmap(NULL, l->map_size, PROT_READ, MAP_PRIVATE,
+		      fileno(l->fd), 0);
+	if (l->map == MAP_FAILED) {
+		l->map = NULL;
+		return -1;
+	}
+	madvise(l->map, l->map_size, MADV_SEQUENTIAL);
+	return 0;
+}
+
 enum tnt_log_error
 tnt_log_open(struct tnt_log *l, const char *file, enum tnt_log_type type)
+{
+	return tnt_log_open_io(l, file, type, TNT_LOG_IO_STDIO);
+}
+
+static void
+tnt_log_init(struct tnt_log *l, enum tnt_log_type type, enum tnt_log_io io)
+{
+	l->type = type;
+	l->io = io;
+	l->fd = NULL;
+	l->map = NULL;
+	l->map_size = 0;
+	l->verify = TNT_LOG_VERIFY_FULL;
+	l->error = TNT_LOG_EOK;
+	l->filter = NULL;
+	l->filter_arg = NULL;
+	l->filter_verify = 1;
+	l->salvage = NULL;
+	l->salvage_arg = NULL;
+	l->damaged = 0;
+	l->last_lsn = 0;
+	l->follow = 0;
+	l->complete = 0;
+}
+
+/* reading file header from l->fd */
+static enum tnt_log_error
+tnt_log_open_header(struct tnt_log *l, enum tnt_log_type type)
 {
 	char filetype[32];
 	char version[32];
 	char *rc, *magic = "\0";
-	l->type = type;
-	/* trying to open file */
-	if (file) {
-		l->fd = fopen(file, "r");
-		if (l->fd == NULL)
-			return tnt_log_open_err(l, TNT_LOG_ESYSTEM);
-	} else {
-		l->fd = stdin;
-	}
 	/* reading xlog filetype */
 	rc = fgets(filetype, sizeof(filetype), l->fd);
 	if (rc == NULL)
@@ -247,7 +879,7 @@ tnt_log_open(struct tnt_log *l, const char *file, enum tnt_log_type type)
 		return tnt_log_open_err(l, TNT_LOG_ESYSTEM);
 	/* checking file type and setting read/process
 	 * interfaces */
-	l->read = tnt_log_read;
+	l->read = (l->io == TNT_LOG_IO_MMAP) ? tnt_log_read_mmap : tnt_log_read;
 	switch (type) {
 	case TNT_LOG_XLOG:
 		magic = TNT_LOG_MAGIC_XLOG;
@@ -276,11 +908,47 @@ tnt_log_open(struct tnt_log *l, const char *file, enum tnt_log_type type)
 	/* getting current offset */
 	l->begin_offset = l->offset = ftello(l->fd);
 	l->current_offset = 0;
+	if (l->io == TNT_LOG_IO_MMAP && tnt_log_map(l) == -1)
+		return tnt_log_open_err(l, TNT_LOG_ESYSTEM);
 	memset(&l->current_value, 0, sizeof(l->current_value));
 	return 0;
 }
 
+enum tnt_log_error
+tnt_log_open_io(struct tnt_log *l, const char *file, enum tnt_log_type type,
+		enum tnt_log_io io)
+{
+	/* stdin can't be mapped */
+	tnt_log_init(l, type, file ? io : TNT_LOG_IO_STDIO);
+	/* trying to open file */
+	if (file) {
+		l->fd = tnt_log_fopen_hook != NULL ? tnt_log_fopen_hook(file) :
+						     fopen(file, "r");
+		if (l->fd == NULL)
+			return tnt_log_open_err(l, TNT_LOG_ESYSTEM);
+		/* streams that aren't files can't be mapped */
+		if (fileno(l->fd) == -1)
+			l->io = TNT_LOG_IO_STDIO;
+	} else {
+		l->fd = stdin;
+	}
+	return tnt_log_open_header(l, type);
+}
+
+enum tnt_log_error
+tnt_log_open_fp(struct tnt_log *l, FILE *fp, enum tnt_log_type type)
+{
+	tnt_log_init(l, type, TNT_LOG_IO_STDIO);
+	l->fd = fp;
+	if (fp == NULL)
+		return tnt_log_open_err(l, TNT_LOG_ESYSTEM);
+	return tnt_log_open_header(l, type);
+}
+
 void tnt_log_close(struct tnt_log *l) {
+	if (l->map)
+		munmap(l->map, l->map_size);
+	l->map = NULL;
 	if (l->fd && l->fd != stdin)
 		fclose(l->fd);
 	l->fd = NULL;
@@ -289,9 +957,83 @@ void tnt_log_close(struct tnt_log *l) {
 int tnt_log_seek(struct tnt_log *l, off_t offset)
 {
 	l->offset = offset;
+	/* skipped region doesn't continue at another place */
+	l->damaged = 0;
+	l->last_lsn = 0;
+	if (l->io == TNT_LOG_IO_MMAP) {
+		l->map_dropped = offset & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+		return ((size_t)offset <= l->map_size) ? 0 : -1;
+	}
 	return fseeko(l->fd, offset, SEEK_SET);
 }
 
+off_t tnt_log_tell(struct tnt_log *l)
+{
+	/* stdio offset points to data of the last row, not past it */
+	if (l->io == TNT_LOG_IO_MMAP)
+		return l->offset;
+	return ftello(l->fd);
+}
+
+int tnt_log_seek_row(struct tnt_log *l, off_t offset)
+{
+	uint64_t size = 0;
+	if (tnt_log_size(l, &size) == -1)
+		return tnt_log_seterr(l, TNT_LOG_ESYSTEM);
+	if (offset < l->begin_offset || (uint64_t)offset > size)
+		return tnt_log_seterr(l, TNT_LOG_EFAIL);
+	/* offset must point to a row or to the end of file */
+	uint32_t marker = tnt_log_marker_eof_v11;
+	if ((uint64_t)offset + sizeof(marker) <= size) {
+		if (l->io == TNT_LOG_IO_MMAP) {
+			memcpy(&marker, l->map + offset, sizeof(marker));
+		} else if (fseeko(l->fd, offset, SEEK_SET) != 0 ||
+			   fread(&marker, sizeof(marker), 1, l->fd) != 1) {
+			return tnt_log_seterr(l, TNT_LOG_ESYSTEM);
+		}
+	}
+	if (marker != tnt_log_marker_v11 && marker != tnt_log_marker_eof_v11)
+		return tnt_log_seterr(l, TNT_LOG_ECORRUPT);
+	return tnt_log_seek(l, offset);
+}
+
+off_t tnt_log_sync(struct tnt_log *l, off_t offset)
+{
+	/* only mapped files can be scanned randomly */
+	if (l->io != TNT_LOG_IO_MMAP) {
+		tnt_log_seterr(l, TNT_LOG_EFAIL);
+		return -1;
+	}
+	if (offset < l->begin_offset)
+		offset = l->begin_offset;
+	return tnt_log_resync(l, offset, 1);
+}
+
+void tnt_log_set_verify(struct tnt_log *l, enum tnt_log_verify verify)
+{
+	l->verify = verify;
+}
+
+void tnt_log_set_salvage(struct tnt_log *l, tnt_log_salvage_t salvage,
+			 void *arg)
+{
+	l->salvage = salvage;
+	l->salvage_arg = arg;
+}
+
+void tnt_log_set_follow(struct tnt_log *l, int follow)
+{
+	l->follow = follow;
+}
+
+void tnt_log_set_filter(struct tnt_log *l, tnt_log_filter_t filter, void *arg,
+			int verify)
+{
+	l->filter = filter;
+	l->filter_arg = arg;
+	l->filter_verify = verify;
+}
+
 enum tnt_log_error tnt_log_error(struct tnt_log *l) {
 	return l->error;
 }
@@ -115,6 +115,51 @@ int tnt_snapshot_open(struct tnt_stream *s, const char *file) {
 	return tnt_log_open(&ss->log, file, TNT_LOG_SNAPSHOT);
 }
 
+/*
+ * tnt_snapshot_open_io()
+ *
+ * open snapshot file using specified io backend and associate
+ * it with stream;
+ *
+ * s - snapshot stream pointer
+ * io - TNT_LOG_IO_STDIO or TNT_LOG_IO_MMAP
+ *
+ * returns 0 on success, or -1 on error.
+*/
+int tnt_snapshot_open_io(struct tnt_stream *s, const char *file,
+		   enum tnt_log_io io) {
+	struct tnt_stream_snapshot *ss = TNT_SSNAPSHOT_CAST(s);
+	return tnt_log_open_io(&ss->log, file, TNT_LOG_SNAPSHOT, io);
+}
+
+/*
+ * tnt_snapshot_open_fp()
+ *
+ * read snapshot from stdio stream and associate it with stream;
+ *
+ * s - snapshot stream pointer
+ * fp - stream, it's closed with snapshot stream
+ *
+ * returns 0 on success, or -1 on error.
+*/
+int tnt_snapshot_open_fp(struct tnt_stream *s, FILE *fp) {
+	struct tnt_stream_snapshot *ss = TNT_SSNAPSHOT_CAST(s);
+	return tnt_log_open_fp(&ss->log, fp, TNT_LOG_SNAPSHOT);
+}
+
+/*
+ * tnt_snapshot_set_verify()
+ *
+ * set crc verification level for rows read from stream;
+ *
+ * s - snapshot stream pointer
+ * verify - TNT_LOG_VERIFY_FULL, TNT_LOG_VERIFY_HEADER or
+ *          TNT_LOG_VERIFY_NONE
+*/
+void tnt_snapshot_set_verify(struct tnt_stream *s, enum tnt_log_verify verify) {
+	tnt_log_set_verify(&TNT_SSNAPSHOT_CAST(s)->log, verify);
+}
+
 /*
  * tnt_snapshot_close()
  *
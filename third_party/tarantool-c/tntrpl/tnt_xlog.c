@@ -115,6 +115,51 @@ int tnt_xlog_open(struct tnt_stream *s, const char *file) {
 	return tnt_log_open(&sx->log, file, TNT_LOG_XLOG);
 }
 
+/*
+ * tnt_xlog_open_io()
+ *
+ * open xlog file using specified io backend and associate
+ * it with stream;
+ *
+ * s - xlog stream pointer
+ * io - TNT_LOG_IO_STDIO or TNT_LOG_IO_MMAP
+ *
+ * returns 0 on success, or -1 on error.
+*/
+int tnt_xlog_open_io(struct tnt_stream *s, const char *file,
+		   enum tnt_log_io io) {
+	struct tnt_stream_xlog *sx = TNT_SXLOG_CAST(s);
+	return tnt_log_open_io(&sx->log, file, TNT_LOG_XLOG, io);
+}
+
+/*
+ * tnt_xlog_open_fp()
+ *
+ * read xlog from stdio stream and associate it with stream;
+ *
+ * s - xlog stream pointer
+ * fp - stream, it's closed with xlog stream
+ *
+ * returns 0 on success, or -1 on error.
+*/
+int tnt_xlog_open_fp(struct tnt_stream *s, FILE *fp) {
+	struct tnt_stream_xlog *sx = TNT_SXLOG_CAST(s);
+	return tnt_log_open_fp(&sx->log, fp, TNT_LOG_XLOG);
+}
+
+/*
+ * tnt_xlog_set_verify()
+ *
+ * set crc verification level for rows read from stream;
+ *
+ * s - xlog stream pointer
+ * verify - TNT_LOG_VERIFY_FULL, TNT_LOG_VERIFY_HEADER or
+ *          TNT_LOG_VERIFY_NONE
+*/
+void tnt_xlog_set_verify(struct tnt_stream *s, enum tnt_log_verify verify) {
+	tnt_log_set_verify(&TNT_SXLOG_CAST(s)->log, verify);
+}
+
 /*
  * tnt_xlog_close()
  *